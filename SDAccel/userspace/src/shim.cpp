@@ -710,16 +710,24 @@ namespace awsbwhal {
         }
         }
 
-        while (length >= 4) {
 #ifdef INTERNAL_TESTING
+        while (length >= 4) {
             *(unsigned *)qBuf = *(unsigned *)(mem + offset);
-#else
-            fpga_pci_peek(ocl_kernel_bar, (uint64_t)offset,(uint32_t*)qBuf);
-#endif
             offset += 4;
             qBuf += 4;
             length -= 4;
         }
+#else
+        if (length >= 4) {
+            unsigned long long dwords = length / 4;
+            if (fpga_pci_read_burst(ocl_kernel_bar, (uint64_t)offset, (uint32_t*)qBuf, dwords)) {
+                return -1;
+            }
+            offset += dwords * 4;
+            qBuf += dwords * 4;
+            length -= dwords * 4;
+        }
+#endif
         while (length) {
 #ifdef INTERNAL_TESTING
             *qBuf = *(mem + offset);
@@ -763,16 +771,24 @@ namespace awsbwhal {
             }
             }
 
-            while (length >= 4) {
 #ifdef INTERNAL_TESTING
+            while (length >= 4) {
                 *(unsigned *)(mem + offset) = *(unsigned *)qBuf;
-#else
-                fpga_pci_poke(ocl_kernel_bar, uint64_t (offset), *((uint32_t*) qBuf));
-#endif
                 offset += 4;
                 qBuf += 4;
                 length -= 4;
             }
+#else
+            if (length >= 4) {
+                unsigned long long dwords = length / 4;
+                if (fpga_pci_write_burst(ocl_kernel_bar, uint64_t (offset), (uint32_t*) qBuf, dwords)) {
+                    return -1;
+                }
+                offset += dwords * 4;
+                qBuf += dwords * 4;
+                length -= dwords * 4;
+            }
+#endif
             while (length) {
 #ifdef INTERNEL_TESTING
                 *(mem + offset) = *qBuf;
@@ -15,20 +15,70 @@
  * limitations under the License.
  */
 
+#ifndef _DMA_OS_H
+#define _DMA_OS_H
+
 #include <stdint.h>
+#include <stdbool.h>
 #include <sys/types.h>
 
+struct piton_aws;
+
+/*
+ * Readback verification modes
+ */
+enum dma_verify_mode {
+    /* no readback */
+    DMA_VERIFY_NONE,
+    /* read back one DMA_VERIFY_SAMPLE_SIZE window per transfer */
+    DMA_VERIFY_SAMPLE,
+    /* hash while streaming, read back and compare hashes after the load */
+    DMA_VERIFY_DEFERRED,
+    /* read back and compare every byte */
+    DMA_VERIFY_FULL,
+};
+
 uint64_t buffer_compare(uint8_t *bufa, uint8_t *bufb,
     size_t buffer_size);
+uint64_t buffer_hash(const uint8_t *buf, size_t len, uint64_t seed);
+int parse_verify_mode(const char *str, enum dma_verify_mode *mode);
+size_t verify_sample_offset(size_t addr, size_t len);
 
-int check_slot_config(int slot_id);
-void usage(const char* program_name);
-int get_fds(int slot_id, int* read_fd, int* write_fd);
-int dma_os(int read_df, int write_fd, const char* os_img_filename, size_t begin);
-int fill_mem(int read_fd, int write_fd, size_t begin, size_t end, uint8_t byte, size_t buffer_size);
+/*
+ * OS image loader tunables
+ */
+struct dma_os_opts {
+    /* number of XDMA channels the image chunks are spread across */
+    int n_channels;
+    /* number of chunk buffers in flight, at least n_channels */
+    int n_buffers;
+    /* bytes per chunk */
+    size_t chunk_size;
+    /*
+     * DRAM is known to be zeroed (e.g. right after the AFI load), so file
+     * holes and all-zero blocks of the image are not transferred
+     */
+    bool skip_zero;
+    /* how the written image is checked */
+    enum dma_verify_mode verify;
+    /* read raw images into the chunk buffers instead of mapping them */
+    bool copy;
+};
+
+int dma_os(struct piton_aws *ctx, int slot_id, const char* os_img_filename,
+    size_t begin, const struct dma_os_opts *opts);
+int fill_mem(int slot_id, int read_fd, int write_fd, size_t begin, size_t end,
+    uint8_t byte, size_t buffer_size, enum dma_verify_mode verify);
 int fill_ariane_mem_region(int read_fd, int write_fd);
 
 #define MEM_1MB              (1ULL << 20)
 #define MEM_1GB              (1ULL << 30)
 #define	MEM_16GB              (1ULL << 34)
 #define OS_OFFSET            (2 * MEM_16GB)
+
+#define DMA_OS_CHANNELS_MAX  4
+#define DMA_OS_BUFFER_ALIGN  4096
+#define DMA_OS_ZERO_BLOCK    (64 * 1024)
+#define DMA_VERIFY_SAMPLE_SIZE 4096
+
+#endif /* _DMA_OS_H */
@@ -0,0 +1,56 @@
+#ifndef _ETH_H
+#define _ETH_H
+
+/*
+ * Host side of piton_aws_eth: an AXI Ethernet Lite MAC whose MII is
+ * cross-connected to Piton's. Offsets are relative to the MAC's base in
+ * the BAR.
+ */
+
+#define ETH_TX_PING_DATA    UINT32_C(0x0000)
+#define ETH_TX_PING_LEN     UINT32_C(0x07f4)
+#define ETH_GIE             UINT32_C(0x07f8)
+#define ETH_TX_PING_CTRL    UINT32_C(0x07fc)
+#define ETH_TX_PONG_DATA    UINT32_C(0x0800)
+#define ETH_TX_PONG_LEN     UINT32_C(0x0ff4)
+#define ETH_TX_PONG_CTRL    UINT32_C(0x0ffc)
+#define ETH_RX_PING_DATA    UINT32_C(0x1000)
+#define ETH_RX_PING_CTRL    UINT32_C(0x17fc)
+#define ETH_RX_PONG_DATA    UINT32_C(0x1800)
+#define ETH_RX_PONG_CTRL    UINT32_C(0x1ffc)
+
+#define ETH_REGS_SIZE       UINT32_C(0x2000)
+
+/*
+ * Some control register bits
+ */
+
+/* TX: set by software to send, cleared by the MAC when done */
+#define ETH_TX_CTRL_BUSY    UINT32_C(0x1)
+/* TX: with BUSY, load the MAC address from the buffer instead of sending */
+#define ETH_TX_CTRL_PROGRAM UINT32_C(0x2)
+/* RX: set by the MAC when a frame is ready, cleared by software */
+#define ETH_RX_CTRL_READY   UINT32_C(0x1)
+#define ETH_CTRL_IE         UINT32_C(0x8)
+
+/*
+ * The MAC adds and strips the FCS, so buffers hold at most a 1514 byte
+ * frame. There is no RX length register, the length comes from the
+ * EtherType and the IP headers, so the header is fetched first.
+ */
+
+#define ETH_FRAME_MAX       1514
+#define ETH_FRAME_MIN       60
+#define ETH_RX_HEADER_SIZE  20
+
+/*
+ * Bridge settings
+ */
+
+#define ETH_TAP_DEFAULT     "piton0"
+#define ETH_POLL_MIN_US     10
+#define ETH_POLL_MAX_US     1000
+/* frames moved per direction before the other direction gets a turn */
+#define ETH_BATCH           16
+
+#endif /* _ETH_H */
@@ -0,0 +1,114 @@
+/*
+ * Amazon FPGA Hardware Development Kit
+ *
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Amazon Software License (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *    http://aws.amazon.com/asl/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on
+ * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _PITON_AWS_H
+#define _PITON_AWS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include <fpga_pci.h>
+#include <fpga_mgmt.h>
+
+#include "dma_os.h"
+
+/*
+ * libpiton_aws keeps what the host tools discover about the slots for the
+ * lifetime of the process: the AFI check (a mailbox round trip), the
+ * resource maps (a sysfs scan), the open DMA queues and the attached BARs.
+ * The piton_aws commands share one context, so a chain of commands pays for
+ * the discovery once.
+ */
+
+#define PITON_AWS_PCI_VENDOR_ID  0x1D0F /* Amazon PCI Vendor ID */
+#define PITON_AWS_PCI_DEVICE_ID  0xF001
+
+/* marker for the command separator of a piton_aws command chain */
+#define PITON_AWS_CHAIN          "+"
+
+enum piton_aws_slot_state {
+    PITON_AWS_SLOT_UNKNOWN,
+    PITON_AWS_SLOT_READY,
+    PITON_AWS_SLOT_NOT_READY,
+};
+
+struct piton_aws_slot {
+    enum piton_aws_slot_state state;
+    /* resource map of the slot, valid once it is ready */
+    struct fpga_slot_spec spec;
+    /* DMA queues, opened on first use */
+    int read_fds[DMA_OS_CHANNELS_MAX];
+    int write_fds[DMA_OS_CHANNELS_MAX];
+    pci_bar_handle_t bars[FPGA_BAR_PER_PF_MAX];
+};
+
+struct piton_aws {
+    /* slot given on the command line, -1 if none */
+    int slot_id;
+    /* slots with an AFI loaded, from fpga_pci_get_all_slot_specs */
+    bool have_specs;
+    uint32_t loaded_slots;
+    struct piton_aws_slot slots[FPGA_SLOT_MAX];
+};
+
+int piton_aws_open(struct piton_aws *ctx);
+void piton_aws_close(struct piton_aws *ctx);
+
+/**
+ * Check once that the expected AFI is loaded in slot_id, rescanning the app
+ * PF if the IDs do not match yet (e.g. right after a load).
+ *
+ * @returns 0 if the slot is ready, 1 otherwise
+ */
+int piton_aws_slot_ready(struct piton_aws *ctx, int slot_id);
+
+/**
+ * Bitmask of the slots which have an AFI loaded.
+ */
+int piton_aws_loaded_slots(struct piton_aws *ctx, uint32_t *slots);
+
+/**
+ * DMA queue of a ready slot. The context owns the fd, callers must not close
+ * it, and no two threads may use the same queue at once.
+ *
+ * @returns the fd, or -1 on error
+ */
+int piton_aws_dma_fd(struct piton_aws *ctx, int slot_id, int channel, bool is_read);
+
+/**
+ * App PF BAR of a ready slot. The context owns the handle.
+ */
+int piton_aws_bar(struct piton_aws *ctx, int slot_id, int bar_id,
+    pci_bar_handle_t *handle);
+
+/* the slot a command works on: --slot of the command, of the chain, or 0 */
+int piton_aws_default_slot(const struct piton_aws *ctx);
+
+/* parse a byte count or address with an optional K/M/G suffix */
+int parse_size(const char *str, size_t *size);
+
+/*
+ * piton_aws commands, argv[0] is the command or tool name
+ */
+
+int piton_aws_load(struct piton_aws *ctx, int argc, char **argv);
+int piton_aws_dump(struct piton_aws *ctx, int argc, char **argv);
+int piton_aws_fill(struct piton_aws *ctx, int argc, char **argv);
+int piton_aws_console(struct piton_aws *ctx, int argc, char **argv);
+
+#endif /* _PITON_AWS_H */
@@ -0,0 +1,81 @@
+/*
+ * Amazon FPGA Hardware Development Kit
+ *
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Amazon Software License (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *    http://aws.amazon.com/asl/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on
+ * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _SNAPSHOT_H
+#define _SNAPSHOT_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+struct piton_aws;
+
+/*
+ * A snapshot of a DRAM range is a raw image file holding the range at
+ * offset (address - begin), which dma_os can load as is, plus a manifest
+ * <image>.manifest with one XXH64 hash per chunk:
+ *
+ *   struct snapshot_header
+ *   uint64_t hash[n_chunks]
+ *
+ * All fields are little endian.
+ */
+
+#define SNAPSHOT_MAGIC          UINT64_C(0x504e534e4f544950) /* "PITONSNP" */
+#define SNAPSHOT_VERSION        1
+#define SNAPSHOT_MANIFEST_EXT   ".manifest"
+
+struct snapshot_header {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t reserved;
+    /* first DRAM address covered by the snapshot */
+    uint64_t begin;
+    /* bytes covered by the snapshot */
+    uint64_t size;
+    /* bytes per hashed chunk, the last chunk may be shorter */
+    uint64_t chunk_size;
+    uint64_t n_chunks;
+};
+
+struct snapshot_opts {
+    /* number of XDMA channels used in parallel */
+    int n_channels;
+    /* bytes per hashed chunk of a new snapshot */
+    size_t chunk_size;
+};
+
+/**
+ * Snapshot [begin, end) into image_filename. If a matching manifest from an
+ * earlier snapshot of the same range exists, only chunks whose hash changed
+ * are written to the image. Only a snapshot removes the manifest: it does so
+ * before the image is written and rewrites it once the image is flushed, so
+ * an interrupted snapshot cannot be restored and the next snapshot of it is
+ * a full one.
+ */
+int snapshot_save(struct piton_aws *ctx, int slot_id, size_t begin, size_t end,
+    const char *image_filename, const struct snapshot_opts *opts);
+
+/**
+ * Restore the range recorded in image_filename's manifest. DRAM is read and
+ * hashed, and only chunks which differ from the snapshot are written back.
+ * The image and its manifest are only read, so a snapshot can be restored
+ * any number of times.
+ */
+int snapshot_restore(struct piton_aws *ctx, int slot_id, const char *image_filename,
+    const struct snapshot_opts *opts);
+
+#endif /* _SNAPSHOT_H */
@@ -1,6 +1,11 @@
 #ifndef _UART_H
 #define _UART_H
 
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <fpga_pci.h>
+
 /*
  * Hypervisor UART console definitions
  */
@@ -27,6 +32,12 @@
 #define LSR_THRE UINT32_C(0x20)
 #define LSR_TEMT UINT32_C(0x40)
 
+/*
+ * Some Interrupt Enable Register (IER) bits
+ */
+
+#define IER_ERBFI UINT32_C(0x1)
+
 /*
  * Some FIFO Control Register (FCR) bits
  */
@@ -52,4 +63,101 @@
 #define DLL_115200 UINT32_C(0x01)
 #define DLM_115200 UINT32_C(0x0)
 
+/*
+ * The divisor latch divides the UART clock, shell_clk, by 16 * divisor.
+ * shell_clk is 125 MHz with clock recipe A0 and 250 MHz with A1. The
+ * default divisor gives the 115200 baud (+2.8%) Piton's UART boots with.
+ */
+
+#define UART_CLOCK_HZ           UINT32_C(125000000)
+#define UART_DIVISOR_DEFAULT    66
+/* largest baud rate error against the requested rate which still works */
+#define UART_BAUD_TOLERANCE_PCT 3
+
+struct uart_speed {
+    /* UART input clock */
+    uint32_t clock_hz;
+    /* requested baud rate, 0 to use divisor as is */
+    uint32_t baud;
+    /* divisor latch value, derived from baud when that is set */
+    uint32_t divisor;
+};
+
+/*
+ * Console bridge settings
+ */
+
+/* depth of the 16550 receive and transmit FIFOs */
+#define UART_FIFO_DEPTH     16
+/* bytes moved between the pty and the UART per burst */
+#define UART_BURST_SIZE     4096
+/* idle polling backs off from UART_POLL_MIN_US up to the --poll-max-us limit */
+#define UART_POLL_MIN_US    10
+#define UART_POLL_MAX_US    500
+/* bound of the backoff while waiting for the transmit FIFO to drain */
+#define UART_TX_POLL_MAX_US 80
+/* fallback poll interval when waiting on the XDMA events device */
+#define UART_EVENTS_TIMEOUT_MS 10
+/* retry interval while no terminal is attached to the pty */
+#define UART_HANGUP_WAIT_MS 10
+
+/*
+ * Console daemon settings
+ */
+
+/* UARTs per slot, behind APP_PF_BAR0 and APP_PF_BAR1 */
+#define UARTD_UARTS_PER_SLOT    2
+#define UARTD_CONSOLES_MAX      (FPGA_SLOT_MAX * UARTD_UARTS_PER_SLOT)
+#define UARTD_THREADS_DEFAULT   2
+#define UARTD_THREADS_MAX       16
+/* socket clients attached to one console at the same time */
+#define UARTD_CLIENTS_MAX       4
+#define UARTD_EVENTS_MAX        32
+/* default scrollback per console, in KiB */
+#define UARTD_SCROLLBACK_KB     64
+
+/*
+ * Console helpers shared by uart and uartd
+ */
+
+/* reset the FIFOs and program 8N1 and the divisor, ier is written to IER */
+int init_uart(pci_bar_handle_t pci_bar_handle, uint32_t ier, uint32_t divisor);
+
+/*
+ * Derive speed->divisor from speed->baud, fails if no divisor gets within
+ * UART_BAUD_TOLERANCE_PCT of it. Then set speed->baud to the actual rate.
+ */
+int uart_resolve_speed(struct uart_speed *speed);
+
+/* time the receive FIFO takes to fill at speed->baud, the idle polling limit */
+unsigned int uart_fifo_fill_us(const struct uart_speed *speed);
+
+/*
+ * An attached UART BAR as polled by uart_read_fifo/uart_write_fifo: through
+ * its view without per access checks, or through its handle when the BAR is
+ * emulated and has no view.
+ */
+struct uart_bar {
+    pci_bar_handle_t handle;
+    fpga_pci_bar_view_t view;
+    bool mapped;
+};
+
+/* set up bar for an attached UART BAR */
+int uart_bar_view(pci_bar_handle_t pci_bar_handle, struct uart_bar *bar);
+
+/* drain the receive FIFO while LSR_DRDY is set, *n is the number of bytes read */
+int uart_read_fifo(const struct uart_bar *bar, uint8_t *buf, size_t size, size_t *n);
+
+/*
+ * If the transmit FIFO is empty, fill it with up to UART_FIFO_DEPTH bytes of
+ * buf. *n is the number of bytes sent, 0 while the FIFO is still draining.
+ */
+int uart_write_fifo(const struct uart_bar *bar, const uint8_t *buf, size_t len, size_t *n);
+
+int open_pty_pair(int *amaster, char** slave_name);
+
+/* open /dev/xdmaN_events_<irq> of the slot, returns the fd or -1 */
+int open_events(int slot_id, int irq);
+
 #endif /* _UART_H */               
@@ -24,7 +24,19 @@
 #include <poll.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/mman.h>
 #include <stdint.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+#include <limits.h>
+#include <zlib.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(DMA_OS_ZSTD)
+#include <zstd.h>
+#endif
 
 #include <fpga_pci.h>
 #include <fpga_mgmt.h>
@@ -33,224 +45,911 @@
 #include <utils/sh_dpi_tasks.h>
 
 #include "dma_os.h"
+#include "piton_aws.h"
+
+static void dma_os_usage(const char* program_name) {
+    printf("usage: %s [--slot <slot-id>] [--channels <1-%d>] [--buffers <n>]\n"
+           "       [--chunk-size <MB>] [--dram-cleared] [--copy]\n"
+           "       [--verify=none|sample|deferred|full] <os_img_file>\n"
+           "os_img_file may be raw, gzip or zstd compressed; raw images are\n"
+           "DMAed straight from the page cache unless --copy is given\n",
+           program_name, DMA_OS_CHANNELS_MAX);
+}
 
-/* use the standard out logger */
-static const struct logger *logger = &logger_stdout;
-
-int main(int argc, char **argv) {
+int piton_aws_load(struct piton_aws *ctx, int argc, char **argv) {
     int rc;
-    int slot_id = 0;
+    int opt;
+    int slot_id = piton_aws_default_slot(ctx);
     char os_img_filename[1024] = {0};
+    struct dma_os_opts opts = {
+        .n_channels = DMA_OS_CHANNELS_MAX,
+        .n_buffers = 3 * DMA_OS_CHANNELS_MAX,
+        .chunk_size = 4 * MEM_1MB,
+        .skip_zero = false,
+        .verify = DMA_VERIFY_FULL,
+    };
+
+    static struct option long_options[] = {
+        {"slot",       required_argument, 0, 'S'},
+        {"channels",   required_argument, 0, 'c'},
+        {"buffers",    required_argument, 0, 'b'},
+        {"chunk-size", required_argument, 0, 's'},
+        {"dram-cleared", no_argument,     0, 'z'},
+        {"verify",     required_argument, 0, 'v'},
+        {"copy",       no_argument,       0, 'C'},
+        {0, 0, 0, 0}
+    };
+
+    optind = 0;
+    while ((opt = getopt_long(argc, argv, "S:c:b:s:zv:C", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'S':
+            slot_id = atoi(optarg);
+            break;
+        case 'c':
+            opts.n_channels = atoi(optarg);
+            break;
+        case 'b':
+            opts.n_buffers = atoi(optarg);
+            break;
+        case 's':
+            opts.chunk_size = strtoull(optarg, NULL, 0) * MEM_1MB;
+            break;
+        case 'z':
+            opts.skip_zero = true;
+            break;
+        case 'v':
+            if (parse_verify_mode(optarg, &opts.verify)) {
+                dma_os_usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'C':
+            opts.copy = true;
+            break;
+        default:
+            dma_os_usage(argv[0]);
+            return 1;
+        }
+    }
 
-    switch (argc) {
-    case 2:
-        sscanf(argv[1], "%s", os_img_filename);
-        break;
-    default:
-        usage(argv[0]);
+    if (optind != argc - 1) {
+        dma_os_usage(argv[0]);
         return 1;
     }
-
-    /* setup logging to print to stdout */
-    rc = log_init("test_dram_dma");
-    fail_on(rc, out, "Unable to initialize the log.");
-    rc = log_attach(logger, NULL, 0);
-    fail_on(rc, out, "%s", "Unable to attach to the log.");
-
-    /* initialize the fpga_plat library */
-    rc = fpga_mgmt_init();
-    fail_on(rc, out, "Unable to initialize the fpga_mgmt library");
+    snprintf(os_img_filename, sizeof(os_img_filename), "%s", argv[optind]);
 
     /* check that the AFI is loaded */
-    log_info("Checking to see if the right AFI is loaded...");
-    rc = check_slot_config(slot_id);
+    rc = piton_aws_slot_ready(ctx, slot_id);
     fail_on(rc, out, "slot config is not correct");
 
-    /* get fds */
-    int read_fd = -1;
-    int write_fd = -1;
-    rc = get_fds(slot_id, &read_fd, &write_fd);
-    fail_on(rc, out, "Couldn't get file descriptors for DMA");
-
     /* load os */
-    rc = dma_os(read_fd, write_fd, os_img_filename, 8 * MEM_1GB);
+    rc = dma_os(ctx, slot_id, os_img_filename, 8 * MEM_1GB, &opts);
     fail_on(rc, out, "OS DMA failed!");
 
 out:
-    if (write_fd >= 0) {
-        close(write_fd);
+    log_info("Memory initialization %s", (rc == 0) ? "PASSED" : "FAILED");
+    return (rc != 0 ? 1 : 0);
+}
+
+/*
+ * The OS image loader is a three stage pipeline:
+ *   file read (main thread) -> H2C write -> C2H readback + compare
+ * The main thread fills free chunk buffers from the image file and hands
+ * them to one worker per XDMA channel. Each worker writes its chunk on its
+ * own h2c queue, reads it back on its own c2h queue and returns the buffer
+ * to the free list, so file I/O and DMA on all channels overlap.
+ * A raw image is mapped instead, and its chunks point into the mapping: the
+ * driver then pins the page cache pages and the file data is never copied.
+ */
+
+struct dma_os_chunk {
+    /* the chunk buffer, or the image mapping */
+    uint8_t *data;
+    size_t len;
+    size_t addr;
+    /* slice of the chunk buffers, NULL for a mapped image */
+    uint8_t *buffer;
+};
+
+/* bounded FIFO of chunk pointers, a NULL entry tells a worker to exit */
+struct dma_os_fifo {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct dma_os_chunk **items;
+    size_t head;
+    size_t count;
+    size_t size;
+};
+
+struct dma_os_stage {
+    uint64_t bytes;
+    uint64_t busy_ns;
+};
+
+/* written range and source hash kept for DMA_VERIFY_DEFERRED */
+struct dma_os_record {
+    size_t addr;
+    size_t len;
+    uint64_t hash;
+};
+
+struct dma_os_worker {
+    pthread_t thread;
+    int channel;
+    int read_fd;
+    int write_fd;
+    uint8_t *read_buffer;
+    struct dma_os_fifo *full;
+    struct dma_os_fifo *free;
+    volatile bool *failed;
+    bool skip_zero;
+    enum dma_verify_mode verify_mode;
+    struct dma_os_record *records;
+    size_t n_records;
+    size_t max_records;
+    struct dma_os_stage h2c;
+    struct dma_os_stage verify;
+    uint64_t skipped;
+};
+
+/*
+ * Image source: a raw (possibly sparse) file or a gzip/zstd stream that is
+ * decompressed straight into the chunk buffers.
+ */
+enum dma_os_image_format {
+    DMA_OS_IMAGE_RAW,
+    DMA_OS_IMAGE_GZIP,
+    DMA_OS_IMAGE_ZSTD,
+};
+
+struct dma_os_image {
+    enum dma_os_image_format format;
+    int fd;
+    /* file size for raw images */
+    uint64_t size;
+    /* uncompressed offset of the next byte to read */
+    uint64_t offset;
+    /* bytes of file holes that were never read */
+    uint64_t holes;
+    /* mapping of a raw image, NULL if it is read into the chunk buffers */
+    uint8_t *map;
+    gzFile gz;
+#if defined(DMA_OS_ZSTD)
+    ZSTD_DStream *zds;
+    ZSTD_inBuffer zin;
+    uint8_t *zbuf;
+    size_t zbuf_size;
+    bool zeof;
+#endif
+};
+
+static uint64_t dma_os_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NS_PER_SECOND + ts.tv_nsec;
+}
+
+/* returns true if every byte of the buffer is zero */
+static bool buffer_is_zero(const uint8_t *buf, size_t len) {
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 64 <= len; i += 64) {
+        __m128i v = _mm_or_si128(
+            _mm_or_si128(_mm_loadu_si128((const __m128i *)(buf + i)),
+                         _mm_loadu_si128((const __m128i *)(buf + i + 16))),
+            _mm_or_si128(_mm_loadu_si128((const __m128i *)(buf + i + 32)),
+                         _mm_loadu_si128((const __m128i *)(buf + i + 48))));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)) != 0xffff) {
+            return false;
+        }
     }
-    if (read_fd >= 0) {
-        close(read_fd);
+#endif
+    for (; i < len; i++) {
+        if (buf[i] != 0) {
+            return false;
+        }
     }
-    
-    log_info("Memory initialization %s", (rc == 0) ? "PASSED" : "FAILED");
+    return true;
+}
+
+static int dma_os_image_open(struct dma_os_image *image, const char *filename) {
+    int rc;
+    struct stat st;
+    uint8_t magic[4] = {0};
+
+    memset(image, 0, sizeof(*image));
+    image->fd = open(filename, O_RDONLY);
+    fail_on((rc = (image->fd < 0) ? -ENOENT : 0), out, "Unable to open %s", filename);
+
+    rc = fstat(image->fd, &st);
+    fail_on((rc = rc ? -errno : 0), out, "Unable to stat %s", filename);
+    image->size = st.st_size;
+    posix_fadvise(image->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    if (pread(image->fd, magic, sizeof(magic), 0) < 0) {
+        rc = -errno;
+        fail_on(rc, out, "Unable to read %s", filename);
+    }
+
+    if (magic[0] == 0x1f && magic[1] == 0x8b) {
+        image->format = DMA_OS_IMAGE_GZIP;
+        image->gz = gzdopen(dup(image->fd), "rb");
+        fail_on((rc = (image->gz == NULL) ? -ENOMEM : 0), out, "gzdopen failed");
+        gzbuffer(image->gz, MEM_1MB);
+    } else if (magic[0] == 0x28 && magic[1] == 0xb5 &&
+               magic[2] == 0x2f && magic[3] == 0xfd) {
+        image->format = DMA_OS_IMAGE_ZSTD;
+#if defined(DMA_OS_ZSTD)
+        image->zds = ZSTD_createDStream();
+        image->zbuf_size = ZSTD_DStreamInSize();
+        image->zbuf = malloc(image->zbuf_size);
+        fail_on((rc = (image->zds == NULL || image->zbuf == NULL) ? -ENOMEM : 0),
+            out, "Unable to set up the zstd stream");
+        ZSTD_initDStream(image->zds);
+#else
+        rc = -ENOTSUP;
+        fail_on(rc, out, "%s is zstd compressed but zstd support is not built in",
+            filename);
+#endif
+    } else {
+        image->format = DMA_OS_IMAGE_RAW;
+    }
+
+out:
     return rc;
 }
 
+/*
+ * Map a raw image for zero copy loading. The mapping is shared and read only,
+ * so the driver pins the page cache pages themselves and the load never
+ * copies or dirties the image.
+ */
+static void dma_os_image_map(struct dma_os_image *image) {
+    void *map;
+
+    if (image->format != DMA_OS_IMAGE_RAW || image->size == 0) {
+        return;
+    }
+    map = mmap(NULL, image->size, PROT_READ, MAP_SHARED, image->fd, 0);
+    if (map == MAP_FAILED) {
+        log_info("Unable to map the image, reading it instead");
+        errno = 0;
+        return;
+    }
+    madvise(map, image->size, MADV_SEQUENTIAL);
+    image->map = map;
+}
+
+static void dma_os_image_unmap(struct dma_os_image *image) {
+    if (image->map != NULL) {
+        munmap(image->map, image->size);
+        image->map = NULL;
+    }
+}
+
+/*
+ * Drivers without read-only pinning pin every DMA buffer writable, which
+ * fails for a read-only mapping. Probe with the first page of the image,
+ * written where it belongs anyway, and copy the image if the driver
+ * refuses it.
+ */
+static void dma_os_image_probe(struct dma_os_image *image, int write_fd, size_t begin) {
+    int rc;
+
+    if (image->map == NULL) {
+        return;
+    }
+    rc = fpga_dma_burst_write(write_fd, image->map,
+        min(image->size, (uint64_t)sysconf(_SC_PAGESIZE)), begin);
+    if (rc) {
+        log_info("The DMA driver cannot pin read only pages, copying the image");
+        errno = 0;
+        dma_os_image_unmap(image);
+    }
+}
+
+/*
+ * Drop the pages of a transferred chunk from the mapping, so that the
+ * process does not keep the whole image mapped while the load runs. The page
+ * cache keeps them; pages of neighbouring chunks just fault in again.
+ */
+static void dma_os_chunk_unmap(const struct dma_os_chunk *chunk) {
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)chunk->data & ~(page_size - 1);
+    uintptr_t end = (uintptr_t)chunk->data + chunk->len;
+
+    madvise((void *)start, end - start, MADV_DONTNEED);
+}
+
+static void dma_os_image_close(struct dma_os_image *image) {
+    dma_os_image_unmap(image);
+    if (image->gz != NULL) {
+        gzclose(image->gz);
+    }
+#if defined(DMA_OS_ZSTD)
+    if (image->zds != NULL) {
+        ZSTD_freeDStream(image->zds);
+    }
+    free(image->zbuf);
+#endif
+    if (image->fd >= 0) {
+        close(image->fd);
+    }
+    memset(image, 0, sizeof(*image));
+    image->fd = -1;
+}
+
+/*
+ * Skip the file hole at the current offset of a raw image and clamp len to
+ * the data extent that follows. Returns 1 when only holes are left.
+ */
+static int dma_os_image_next_data(struct dma_os_image *image, size_t *len) {
+    off_t data, hole;
+
+    if (image->format != DMA_OS_IMAGE_RAW) {
+        return 0;
+    }
+
+    data = lseek(image->fd, image->offset, SEEK_DATA);
+    if (data < 0) {
+        int err = errno;
+        errno = 0;
+        if (err != ENXIO) {
+            /* no SEEK_DATA support, rely on the zero scan instead */
+            return 0;
+        }
+        image->holes += image->size - image->offset;
+        image->offset = image->size;
+        return 1;
+    }
+
+    hole = lseek(image->fd, data, SEEK_HOLE);
+    if (hole < 0) {
+        hole = image->size;
+    }
 
-static const uint16_t AMZ_PCI_VENDOR_ID = 0x1D0F; /* Amazon PCI Vendor ID */
-static const uint16_t PCI_DEVICE_ID = 0xF001;
+    image->holes += data - image->offset;
+    image->offset = data;
+    *len = min(*len, (size_t)(hole - data));
+    return 0;
+}
+
+#if defined(DMA_OS_ZSTD)
+static ssize_t dma_os_zstd_read(struct dma_os_image *image, uint8_t *buf, size_t len) {
+    ZSTD_outBuffer zout = { buf, len, 0 };
+
+    while (zout.pos == 0) {
+        if (!image->zeof && image->zin.pos == image->zin.size) {
+            ssize_t n = read(image->fd, image->zbuf, image->zbuf_size);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return -1;
+            }
+            image->zeof = (n == 0);
+            image->zin.src = image->zbuf;
+            image->zin.size = n;
+            image->zin.pos = 0;
+        }
 
-uint64_t buffer_compare(uint8_t *bufa, uint8_t *bufb,
-    size_t buffer_size)
-{
-    size_t i;
-    uint64_t differ = 0;
-    for (i = 0; i < buffer_size; ++i) {
-        if (bufa[i] != bufb[i]) {
-            differ += 1;
+        size_t ret = ZSTD_decompressStream(image->zds, &zout, &image->zin);
+        if (ZSTD_isError(ret)) {
+            log_error("zstd decompression failed: %s", ZSTD_getErrorName(ret));
+            return -1;
+        }
+        if (image->zeof && zout.pos == 0) {
+            break;
         }
     }
 
-    return differ;
+    return zout.pos;
 }
+#endif
 
-int check_slot_config(int slot_id)
-{
-    int rc;
-    struct fpga_mgmt_image_info info = {0};
+/* fill buf with up to len bytes, returns fewer only at the end of the image */
+static ssize_t dma_os_image_read(struct dma_os_image *image, uint8_t *buf, size_t len) {
+    size_t done = 0;
 
-    /* get local image description, contains status, vendor id, and device id */
-    rc = fpga_mgmt_describe_local_image(slot_id, &info, 0);
-    fail_on(rc, out, "Unable to get local image information. Are you running "
-        "as root?");
+    while (done < len) {
+        ssize_t n = -1;
 
-    /* check to see if the slot is ready */
-    if (info.status != FPGA_STATUS_LOADED) {
-        rc = 1;
-        fail_on(rc, out, "Slot %d is not ready", slot_id);
+        switch (image->format) {
+        case DMA_OS_IMAGE_RAW:
+            n = pread(image->fd, buf + done, len - done, image->offset);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            break;
+        case DMA_OS_IMAGE_GZIP:
+            n = gzread(image->gz, buf + done, min(len - done, (size_t)INT_MAX));
+            break;
+        case DMA_OS_IMAGE_ZSTD:
+#if defined(DMA_OS_ZSTD)
+            n = dma_os_zstd_read(image, buf + done, len - done);
+#endif
+            break;
+        }
+
+        if (n < 0) {
+            return -1;
+        }
+        if (n == 0) {
+            break;
+        }
+        done += n;
+        image->offset += n;
+    }
+
+    return done;
+}
+
+static int dma_os_fifo_init(struct dma_os_fifo *fifo, size_t size) {
+    memset(fifo, 0, sizeof(*fifo));
+    fifo->items = calloc(size, sizeof(struct dma_os_chunk *));
+    if (fifo->items == NULL) {
+        return -ENOMEM;
+    }
+    fifo->size = size;
+    pthread_mutex_init(&fifo->lock, NULL);
+    pthread_cond_init(&fifo->cond, NULL);
+    return 0;
+}
+
+static void dma_os_fifo_destroy(struct dma_os_fifo *fifo) {
+    if (fifo->items == NULL) {
+        return;
+    }
+    pthread_mutex_destroy(&fifo->lock);
+    pthread_cond_destroy(&fifo->cond);
+    free(fifo->items);
+    fifo->items = NULL;
+}
+
+static void dma_os_fifo_push(struct dma_os_fifo *fifo, struct dma_os_chunk *chunk) {
+    pthread_mutex_lock(&fifo->lock);
+    while (fifo->count == fifo->size) {
+        pthread_cond_wait(&fifo->cond, &fifo->lock);
+    }
+    fifo->items[(fifo->head + fifo->count) % fifo->size] = chunk;
+    fifo->count++;
+    pthread_cond_broadcast(&fifo->cond);
+    pthread_mutex_unlock(&fifo->lock);
+}
+
+static struct dma_os_chunk *dma_os_fifo_pop(struct dma_os_fifo *fifo) {
+    struct dma_os_chunk *chunk;
+
+    pthread_mutex_lock(&fifo->lock);
+    while (fifo->count == 0) {
+        pthread_cond_wait(&fifo->cond, &fifo->lock);
+    }
+    chunk = fifo->items[fifo->head];
+    fifo->head = (fifo->head + 1) % fifo->size;
+    fifo->count--;
+    pthread_cond_broadcast(&fifo->cond);
+    pthread_mutex_unlock(&fifo->lock);
+
+    return chunk;
+}
+
+/* remember a written range and its hash for the deferred verify pass */
+static int dma_os_record(struct dma_os_worker *worker, size_t addr, size_t len,
+    uint64_t hash) {
+    if (worker->n_records == worker->max_records) {
+        size_t max_records = worker->max_records ? 2 * worker->max_records : 1024;
+        struct dma_os_record *records = realloc(worker->records,
+            max_records * sizeof(*records));
+        if (records == NULL) {
+            log_error("Unable to allocate verify records");
+            return -ENOMEM;
+        }
+        worker->records = records;
+        worker->max_records = max_records;
     }
 
-    /* confirm that the AFI that we expect is in fact loaded */
-    if (info.spec.map[FPGA_APP_PF].vendor_id != AMZ_PCI_VENDOR_ID ||
-        info.spec.map[FPGA_APP_PF].device_id != PCI_DEVICE_ID)
-    {
+    worker->records[worker->n_records++] = (struct dma_os_record) {
+        .addr = addr,
+        .len = len,
+        .hash = hash,
+    };
+    return 0;
+}
+
+/* check a transfer that was just written according to the verify mode */
+static int dma_os_verify(struct dma_os_worker *worker, uint8_t *data,
+    size_t len, size_t addr) {
+    int rc = 0;
+    size_t off = 0;
+
+    switch (worker->verify_mode) {
+    case DMA_VERIFY_NONE:
+        return 0;
+    case DMA_VERIFY_DEFERRED:
+        return dma_os_record(worker, addr, len, buffer_hash(data, len, 0));
+    case DMA_VERIFY_SAMPLE:
+        off = verify_sample_offset(addr, len);
+        len = min(len - off, (size_t)DMA_VERIFY_SAMPLE_SIZE);
+        break;
+    case DMA_VERIFY_FULL:
+        break;
+    }
+
+    rc = fpga_dma_burst_read(worker->read_fd, worker->read_buffer + off, len, addr + off);
+    fail_on(rc, out, "DMA read failed on channel %d at 0x%zx", worker->channel, addr);
+    worker->verify.bytes += len;
+
+    uint64_t differ = buffer_compare(worker->read_buffer + off, data + off, len);
+    if (differ != 0) {
+        log_error("OS image write failed with %lu bytes which differ at 0x%zx",
+            differ, addr + off);
         rc = 1;
-        char sdk_path_buf[512];
-        char *sdk_env_var;
-        sdk_env_var = getenv("SDK_DIR");
-        snprintf(sdk_path_buf, sizeof(sdk_path_buf), "%s",
-            (sdk_env_var != NULL) ? sdk_env_var : "<aws-fpga>");
-        log_error(
-            "...\n"
-            "  The slot appears loaded, but the pci vendor or device ID doesn't match the\n"
-            "  expected values. You may need to rescan the fpga with \n"
-            "    fpga-describe-local-image -S %i -R\n"
-            "  Note that rescanning can change which device file in /dev/ a FPGA will map to.\n",
-            slot_id);
-        log_error(
-            "...\n"
-            "  To remove and re-add your xdma driver and reset the device file mappings, run\n"
-            "    sudo rmmod xdma && sudo insmod \"%s/sdk/linux_kernel_drivers/xdma/xdma.ko\"\n",
-            sdk_path_buf);
-        fail_on(rc, out, "The PCI vendor id and device of the loaded image are "
-                         "not the expected values.");
-    }
-
-    char dbdf[16];
-    snprintf(dbdf,
-                  sizeof(dbdf),
-                  PCI_DEV_FMT,
-                  info.spec.map[FPGA_APP_PF].domain,
-                  info.spec.map[FPGA_APP_PF].bus,
-                  info.spec.map[FPGA_APP_PF].dev,
-                  info.spec.map[FPGA_APP_PF].func);
-    log_info("Operating on slot %d with id: %s", slot_id, dbdf);
+    }
 
 out:
     return rc;
 }
 
+/*
+ * Second pass of DMA_VERIFY_DEFERRED: read back everything this worker wrote
+ * on its own channel and compare against the hashes taken while streaming.
+ */
+static void *dma_os_deferred_verify(void *arg) {
+    int rc;
+    struct dma_os_worker *worker = arg;
+
+    for (size_t i = 0; i < worker->n_records && !*worker->failed; i++) {
+        struct dma_os_record *record = &worker->records[i];
+
+        uint64_t t0 = dma_os_now_ns();
+        rc = fpga_dma_burst_read(worker->read_fd, worker->read_buffer,
+            record->len, record->addr);
+        if (rc) {
+            log_error("DMA read failed on channel %d at 0x%zx", worker->channel,
+                record->addr);
+            *worker->failed = true;
+            break;
+        }
+        uint64_t hash = buffer_hash(worker->read_buffer, record->len, 0);
+        worker->verify.bytes += record->len;
+        worker->verify.busy_ns += dma_os_now_ns() - t0;
+
+        if (hash != record->hash) {
+            log_error("OS image write failed, hash mismatch for %zu bytes at 0x%zx",
+                record->len, record->addr);
+            *worker->failed = true;
+        }
+    }
 
-void usage(const char* program_name) {
-    printf("usage: %s <os_img_file>\n", program_name);
+    return NULL;
 }
 
-int get_fds(int slot_id, int* read_fd, int* write_fd) {
+/* write one run of a chunk and verify it */
+static int dma_os_transfer(struct dma_os_worker *worker, uint8_t *data,
+    size_t len, size_t addr) {
     int rc;
-    
-    *read_fd = fpga_dma_open_queue(FPGA_DMA_XDMA, slot_id, /*channel*/ 0, /*is_read*/ true);
-    fail_on((rc = (read_fd < 0) ? -1 : 0), out, "unable to open read dma queue");
 
-    *write_fd = fpga_dma_open_queue(FPGA_DMA_XDMA, slot_id, /*channel*/ 0, /*is_read*/ false);
-    fail_on((rc = (write_fd < 0) ? -1 : 0), out, "unable to open write dma queue");
+    uint64_t t0 = dma_os_now_ns();
+    rc = fpga_dma_burst_write(worker->write_fd, data, len, addr);
+    uint64_t t1 = dma_os_now_ns();
+    fail_on(rc, out, "DMA write failed on channel %d at 0x%zx", worker->channel, addr);
+    worker->h2c.bytes += len;
+    worker->h2c.busy_ns += t1 - t0;
+
+    rc = dma_os_verify(worker, data, len, addr);
+    worker->verify.busy_ns += dma_os_now_ns() - t1;
 
 out:
-    /* if there is an error code, exit with status 1 */
-    return (rc != 0 ? 1 : 0);
+    return rc;
+}
+
+/*
+ * Transfer only the non-zero blocks of a chunk, coalesced into runs. This is
+ * only valid when the DRAM behind the image is known to be zeroed already.
+ */
+static int dma_os_transfer_nonzero(struct dma_os_worker *worker,
+    struct dma_os_chunk *chunk) {
+    int rc = 0;
+    size_t run = 0;
+
+    for (size_t off = 0; off < chunk->len && rc == 0; off += DMA_OS_ZERO_BLOCK) {
+        size_t block = min((size_t)DMA_OS_ZERO_BLOCK, chunk->len - off);
+        if (!buffer_is_zero(chunk->data + off, block)) {
+            continue;
+        }
+        if (off > run) {
+            rc = dma_os_transfer(worker, chunk->data + run, off - run, chunk->addr + run);
+        }
+        worker->skipped += block;
+        run = off + block;
+    }
+    if (rc == 0 && chunk->len > run) {
+        rc = dma_os_transfer(worker, chunk->data + run, chunk->len - run, chunk->addr + run);
+    }
+
+    return rc;
+}
+
+static void *dma_os_worker(void *arg) {
+    int rc;
+    struct dma_os_worker *worker = arg;
+
+    while (1) {
+        struct dma_os_chunk *chunk = dma_os_fifo_pop(worker->full);
+        if (chunk == NULL) {
+            break;
+        }
+
+        /* keep draining after a failure so the reader never blocks */
+        if (*worker->failed) {
+            dma_os_fifo_push(worker->free, chunk);
+            continue;
+        }
+
+        if (worker->skip_zero) {
+            rc = dma_os_transfer_nonzero(worker, chunk);
+        } else {
+            rc = dma_os_transfer(worker, chunk->data, chunk->len, chunk->addr);
+        }
+        if (rc) {
+            *worker->failed = true;
+        }
+        if (chunk->buffer == NULL) {
+            dma_os_chunk_unmap(chunk);
+        }
+
+        dma_os_fifo_push(worker->free, chunk);
+    }
+
+    return NULL;
 }
 
+static void dma_os_report_stage(const char *name, const struct dma_os_stage *stage) {
+    double secs = (double)stage->busy_ns / NS_PER_SECOND;
+    log_info("  %-8s %8.3f GB/s (%zu bytes, %.3f s busy)", name,
+        (secs > 0) ? (double)stage->bytes / secs / 1e9 : 0.0,
+        (size_t)stage->bytes, secs);
+}
 
 /**
  * Write OS into dimm3
  */
-int dma_os(int read_fd, int write_fd, const char* os_img_filename, size_t begin) {
+int dma_os(struct piton_aws *ctx, int slot_id, const char* os_img_filename,
+    size_t begin, const struct dma_os_opts *opts) {
     int rc;
-    
-    FILE* os_img_file = fopen(os_img_filename, "r");
-    if (os_img_file == NULL) {
-        rc = -ENOENT;
-        goto out;
+    int n_channels = opts->n_channels;
+    int n_buffers = opts->n_buffers;
+    size_t buffer_size = opts->chunk_size;
+    int read_fds[DMA_OS_CHANNELS_MAX];
+    int write_fds[DMA_OS_CHANNELS_MAX];
+    struct dma_os_chunk *chunks = NULL;
+    struct dma_os_worker *workers = NULL;
+    struct dma_os_fifo full_fifo = {0}, free_fifo = {0};
+    struct dma_os_stage file_stage = {0};
+    volatile bool failed = false;
+    int n_started = 0;
+    uint64_t start_ns = 0;
+    uint64_t skipped = 0;
+    struct dma_os_image image = { .fd = -1 };
+    /* chunk and readback buffers, on the NUMA node of the slot */
+    struct fpga_dma_buffer chunk_mem = { 0 };
+    struct fpga_dma_buffer read_mem = { 0 };
+    size_t stride = (buffer_size + DMA_OS_BUFFER_ALIGN - 1) &
+        ~(size_t)(DMA_OS_BUFFER_ALIGN - 1);
+
+    for (int i = 0; i < DMA_OS_CHANNELS_MAX; i++) {
+        read_fds[i] = -1;
+        write_fds[i] = -1;
     }
 
-    size_t buffer_size = MEM_1MB;
+    fail_on((rc = (n_channels < 1 || n_channels > DMA_OS_CHANNELS_MAX ||
+        n_buffers < n_channels || buffer_size == 0) ? -EINVAL : 0), out,
+        "Invalid loader parameters");
+
+    rc = dma_os_image_open(&image, os_img_filename);
+    fail_on(rc, out, "Unable to open OS image");
+    if (!opts->copy) {
+        dma_os_image_map(&image);
+    }
 
-    uint8_t *write_buffer = calloc(buffer_size, sizeof(uint8_t));
-    uint8_t *read_buffer = calloc(buffer_size, sizeof(uint8_t));
-    if (write_buffer == NULL || read_buffer == NULL) {
+    for (int i = 0; i < n_channels; i++) {
+        write_fds[i] = piton_aws_dma_fd(ctx, slot_id, i, /*is_read*/ false);
+        fail_on((rc = (write_fds[i] < 0) ? 1 : 0), out,
+            "Couldn't get file descriptors for DMA");
+        if (opts->verify != DMA_VERIFY_NONE) {
+            read_fds[i] = piton_aws_dma_fd(ctx, slot_id, i, /*is_read*/ true);
+            fail_on((rc = (read_fds[i] < 0) ? 1 : 0), out,
+                "Couldn't get file descriptors for DMA");
+        }
+    }
+    dma_os_image_probe(&image, write_fds[0], begin);
+
+    chunks = calloc(n_buffers, sizeof(*chunks));
+    workers = calloc(n_channels, sizeof(*workers));
+    if (chunks == NULL || workers == NULL) {
         rc = -ENOMEM;
         goto out;
     }
 
-    size_t pos = begin;
-    bool passed = true;
-    while(1) {
-        size_t bytes_read = fread(write_buffer, 1, buffer_size, os_img_file);
+    /* the full fifo also carries one exit marker per worker */
+    rc = dma_os_fifo_init(&full_fifo, n_buffers + n_channels);
+    fail_on(rc, out, "Unable to allocate chunk queue");
+    rc = dma_os_fifo_init(&free_fifo, n_buffers);
+    fail_on(rc, out, "Unable to allocate chunk queue");
+
+    if (image.map == NULL) {
+        rc = fpga_dma_buffer_alloc(slot_id, stride * n_buffers, &chunk_mem);
+        fail_on(rc, out, "Unable to allocate chunk buffers");
+    }
+    if (opts->verify != DMA_VERIFY_NONE) {
+        rc = fpga_dma_buffer_alloc(slot_id, stride * n_channels, &read_mem);
+        fail_on(rc, out, "Unable to allocate readback buffers");
+    }
+
+    for (int i = 0; i < n_buffers; i++) {
+        if (image.map == NULL) {
+            chunks[i].buffer = chunk_mem.data + stride * i;
+        }
+        dma_os_fifo_push(&free_fifo, &chunks[i]);
+    }
+
+    for (int i = 0; i < n_channels; i++) {
+        struct dma_os_worker *worker = &workers[i];
+        worker->channel = i;
+        worker->read_fd = read_fds[i];
+        worker->write_fd = write_fds[i];
+        worker->full = &full_fifo;
+        worker->free = &free_fifo;
+        worker->failed = &failed;
+        worker->skip_zero = opts->skip_zero;
+        worker->verify_mode = opts->verify;
+        if (read_mem.data != NULL) {
+            worker->read_buffer = read_mem.data + stride * i;
+        }
+    }
+
+    log_info("Loading %s%s at 0x%zx on %d channel(s), %d x %zu byte buffers",
+        os_img_filename,
+        (image.format == DMA_OS_IMAGE_GZIP) ? " (gzip)" :
+        (image.format == DMA_OS_IMAGE_ZSTD) ? " (zstd)" :
+        (image.map != NULL) ? " (mapped)" : "",
+        begin, n_channels, n_buffers, buffer_size);
+    if (chunk_mem.data != NULL) {
+        if (chunk_mem.numa_node >= 0) {
+            log_info("Chunk buffers use %zu KiB pages on NUMA node %d",
+                chunk_mem.page_size >> 10, chunk_mem.numa_node);
+        } else {
+            log_info("Chunk buffers use %zu KiB pages", chunk_mem.page_size >> 10);
+        }
+    }
+    if (opts->skip_zero) {
+        log_info("DRAM is assumed cleared, zero blocks are skipped");
+    }
 
-        rc = fpga_dma_burst_write(write_fd, write_buffer, bytes_read, pos);
-        fail_on(rc, out, "DMA write failed");
+    for (int i = 0; i < n_channels; i++) {
+        rc = pthread_create(&workers[i].thread, NULL, dma_os_worker, &workers[i]);
+        fail_on((rc = rc ? -rc : 0), stop, "Unable to start DMA worker %d", i);
+        n_started++;
+    }
 
-        rc = fpga_dma_burst_read(read_fd, read_buffer, bytes_read, pos);
-        fail_on(rc, out, "DMA read failed");
+    start_ns = dma_os_now_ns();
+    while (!failed) {
+        size_t want = buffer_size;
+        struct dma_os_chunk *chunk = dma_os_fifo_pop(&free_fifo);
 
-        uint64_t differ = buffer_compare(read_buffer, write_buffer, bytes_read);
-    
-        if (differ != 0) {
-            log_error("OS image write failed with %lu bytes which differ", differ);
-            passed = false;
+        uint64_t t0 = dma_os_now_ns();
+        if (opts->skip_zero && dma_os_image_next_data(&image, &want)) {
+            dma_os_fifo_push(&free_fifo, chunk);
             break;
         }
+        chunk->addr = begin + image.offset;
+        ssize_t bytes_read;
+        if (image.map != NULL) {
+            chunk->data = image.map + image.offset;
+            bytes_read = min(want, (size_t)(image.size - image.offset));
+            image.offset += bytes_read;
+        } else {
+            chunk->data = chunk->buffer;
+            bytes_read = dma_os_image_read(&image, chunk->data, want);
+        }
+        file_stage.busy_ns += dma_os_now_ns() - t0;
+
+        if (bytes_read <= 0) {
+            if (bytes_read < 0) {
+                log_error("Error reading %s", os_img_filename);
+                failed = true;
+            }
+            dma_os_fifo_push(&free_fifo, chunk);
+            break;
+        }
+        file_stage.bytes += bytes_read;
+
+        chunk->len = bytes_read;
+        dma_os_fifo_push(&full_fifo, chunk);
 
-        if (bytes_read != buffer_size) {
+        if ((size_t)bytes_read != want) {
             break;
         }
-        pos += bytes_read;
     }
 
-    printf("written %zu bytes\n", pos - begin);
-    if (passed) {
+stop:
+    for (int i = 0; i < n_started; i++) {
+        dma_os_fifo_push(&full_fifo, NULL);
+    }
+    for (int i = 0; i < n_started; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+    if (rc) {
+        goto out;
+    }
+
+    if (opts->verify == DMA_VERIFY_DEFERRED && !failed) {
+        n_started = 0;
+        for (int i = 0; i < n_channels; i++) {
+            rc = pthread_create(&workers[i].thread, NULL, dma_os_deferred_verify,
+                &workers[i]);
+            if (rc) {
+                log_error("Unable to start verify worker %d", i);
+                failed = true;
+                rc = 0;
+                break;
+            }
+            n_started++;
+        }
+        for (int i = 0; i < n_started; i++) {
+            pthread_join(workers[i].thread, NULL);
+        }
+    }
+
+    uint64_t wall_ns = dma_os_now_ns() - start_ns;
+    struct dma_os_stage h2c = {0}, verify = {0};
+    for (int i = 0; i < n_channels; i++) {
+        h2c.bytes += workers[i].h2c.bytes;
+        h2c.busy_ns += workers[i].h2c.busy_ns;
+        verify.bytes += workers[i].verify.bytes;
+        verify.busy_ns += workers[i].verify.busy_ns;
+        skipped += workers[i].skipped;
+    }
+    /* channels run concurrently, report their aggregate rate */
+    h2c.busy_ns /= n_channels;
+    verify.busy_ns /= n_channels;
+
+    skipped += image.holes;
+    printf("written %zu bytes\n", (size_t)image.offset);
+    if (opts->skip_zero) {
+        printf("skipped %zu zero bytes (%.1f%%)\n", (size_t)skipped,
+            image.offset ? 100.0 * skipped / image.offset : 0.0);
+    }
+    log_info("Stage throughput:");
+    dma_os_report_stage("file", &file_stage);
+    dma_os_report_stage("h2c", &h2c);
+    dma_os_report_stage("verify", &verify);
+    dma_os_report_stage("total", &(struct dma_os_stage){ image.offset, wall_ns });
+
+    if (!failed) {
         log_info("OS image written!");
     } else { 
         log_info("OS image write failed!");
     }
 
-    
-    rc = (passed) ? 0 : 1;
+    rc = (!failed) ? 0 : 1;
 
 out:
-    if (write_buffer != NULL) {
-        free(write_buffer);
-    }
-    if (read_buffer != NULL) {
-        free(read_buffer);
-    }
-    if (os_img_file != NULL) {
-        fclose(os_img_file);
+    if (workers != NULL) {
+        for (int i = 0; i < n_channels; i++) {
+            free(workers[i].records);
+        }
+        free(workers);
     }
+    free(chunks);
+    fpga_dma_buffer_free(&chunk_mem);
+    fpga_dma_buffer_free(&read_mem);
+    dma_os_fifo_destroy(&full_fifo);
+    dma_os_fifo_destroy(&free_fifo);
+    dma_os_image_close(&image);
     /* if there is an error code, exit with status 1 */
     return (rc != 0 ? 1 : 0);
 }
-
-
-
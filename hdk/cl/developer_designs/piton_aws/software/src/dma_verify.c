@@ -0,0 +1,192 @@
+/*
+ * Amazon FPGA Hardware Development Kit
+ *
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Amazon Software License (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *    http://aws.amazon.com/asl/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on
+ * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+#include <stdint.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "dma_os.h"
+
+/*
+ * Count the bytes which differ between two buffers. Blocks of 64 bytes are
+ * compared with SSE2 and only the equality masks of mismatching blocks are
+ * counted.
+ */
+uint64_t buffer_compare(uint8_t *bufa, uint8_t *bufb,
+    size_t buffer_size)
+{
+    size_t i = 0;
+    uint64_t differ = 0;
+
+#if defined(__SSE2__)
+    for (; i + 64 <= buffer_size; i += 64) {
+        uint64_t equal = 0;
+        for (int j = 0; j < 64; j += 16) {
+            __m128i a = _mm_loadu_si128((const __m128i *)(bufa + i + j));
+            __m128i b = _mm_loadu_si128((const __m128i *)(bufb + i + j));
+            equal |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) << j;
+        }
+        if (equal != UINT64_MAX) {
+            differ += 64 - __builtin_popcountll(equal);
+        }
+    }
+#endif
+    for (; i < buffer_size; ++i) {
+        if (bufa[i] != bufb[i]) {
+            differ += 1;
+        }
+    }
+
+    return differ;
+}
+
+/*
+ * XXH64, see https://github.com/Cyan4973/xxHash for the reference
+ * implementation and the specification of the algorithm.
+ */
+static const uint64_t XXH_PRIME64_1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t XXH_PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t XXH_PRIME64_3 = 0x165667B19E3779F9ULL;
+static const uint64_t XXH_PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t XXH_PRIME64_5 = 0x27D4EB2F165667C5ULL;
+
+static inline uint64_t xxh_rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t xxh_read64(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t xxh_read32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t xxh64_round(uint64_t acc, uint64_t input)
+{
+    acc += input * XXH_PRIME64_2;
+    acc = xxh_rotl64(acc, 31);
+    return acc * XXH_PRIME64_1;
+}
+
+static inline uint64_t xxh64_merge_round(uint64_t acc, uint64_t val)
+{
+    acc ^= xxh64_round(0, val);
+    return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+uint64_t buffer_hash(const uint8_t *buf, size_t len, uint64_t seed)
+{
+    const uint8_t *p = buf;
+    const uint8_t *end = buf + len;
+    uint64_t h;
+
+    if (len >= 32) {
+        uint64_t v1 = seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+        uint64_t v2 = seed + XXH_PRIME64_2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - XXH_PRIME64_1;
+
+        do {
+            v1 = xxh64_round(v1, xxh_read64(p));
+            v2 = xxh64_round(v2, xxh_read64(p + 8));
+            v3 = xxh64_round(v3, xxh_read64(p + 16));
+            v4 = xxh64_round(v4, xxh_read64(p + 24));
+            p += 32;
+        } while (p + 32 <= end);
+
+        h = xxh_rotl64(v1, 1) + xxh_rotl64(v2, 7) +
+            xxh_rotl64(v3, 12) + xxh_rotl64(v4, 18);
+        h = xxh64_merge_round(h, v1);
+        h = xxh64_merge_round(h, v2);
+        h = xxh64_merge_round(h, v3);
+        h = xxh64_merge_round(h, v4);
+    } else {
+        h = seed + XXH_PRIME64_5;
+    }
+
+    h += (uint64_t)len;
+
+    for (; p + 8 <= end; p += 8) {
+        h ^= xxh64_round(0, xxh_read64(p));
+        h = xxh_rotl64(h, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+    }
+    if (p + 4 <= end) {
+        h ^= (uint64_t)xxh_read32(p) * XXH_PRIME64_1;
+        h = xxh_rotl64(h, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+        p += 4;
+    }
+    for (; p < end; p++) {
+        h ^= (*p) * XXH_PRIME64_5;
+        h = xxh_rotl64(h, 11) * XXH_PRIME64_1;
+    }
+
+    h ^= h >> 33;
+    h *= XXH_PRIME64_2;
+    h ^= h >> 29;
+    h *= XXH_PRIME64_3;
+    h ^= h >> 32;
+
+    return h;
+}
+
+int parse_verify_mode(const char *str, enum dma_verify_mode *mode)
+{
+    static const char *names[] = {
+        [DMA_VERIFY_NONE] = "none",
+        [DMA_VERIFY_SAMPLE] = "sample",
+        [DMA_VERIFY_DEFERRED] = "deferred",
+        [DMA_VERIFY_FULL] = "full",
+    };
+
+    for (unsigned int i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (strcmp(str, names[i]) == 0) {
+            *mode = i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Offset of the sampled readback window inside a transfer. The window is
+ * page aligned so host and FPGA addresses keep the same alignment.
+ */
+size_t verify_sample_offset(size_t addr, size_t len)
+{
+    uint64_t x = addr ^ 0x9E3779B97F4A7C15ULL;
+
+    if (len <= DMA_VERIFY_SAMPLE_SIZE) {
+        return 0;
+    }
+
+    /* xorshift so samples move around inside consecutive transfers */
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return (x % ((len - DMA_VERIFY_SAMPLE_SIZE) / DMA_VERIFY_SAMPLE_SIZE + 1)) *
+        DMA_VERIFY_SAMPLE_SIZE;
+}
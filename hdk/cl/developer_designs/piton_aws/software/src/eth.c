@@ -0,0 +1,608 @@
+// Amazon FPGA Hardware Development Kit
+//
+// Copyright 2016 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Amazon Software License (the "License"). You may not use
+// this file except in compliance with the License. A copy of the License is
+// located at
+//
+//    http://aws.amazon.com/asl/
+//
+// or in the "license" file accompanying this file. This file is distributed on
+// an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, express or
+// implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * eth bridges frames between the host MAC of piton_aws_eth and a TAP
+ * device, so that the Piton guest's Ethernet Lite MAC reaches the host
+ * network stack.
+ *
+ * Frames go to the MAC with fpga_pci_write_burst() and are read from its
+ * buffers through the BAR mapping of fpga_pci_get_address(). The MAC's
+ * interrupt is not routed to the shell, so the bridge polls the receive
+ * buffers, doubling the interval while both directions are idle. A frame
+ * from the TAP wakes it immediately.
+ *
+ * --loopback-model replaces the MAC by a thread working on the same
+ * register map in host memory, which sends every transmitted frame back.
+ * Together with --bench this measures the bridge without hardware.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <linux/if_tun.h>
+#include <linux/if_ether.h>
+
+#include <fpga_pci.h>
+#include <fpga_mgmt.h>
+#include <utils/lcd.h>
+
+#include "eth.h"
+#include "piton_aws.h"
+
+/* use the standard out logger */
+static const struct logger *logger = &logger_stdout;
+
+struct eth_mac {
+    /* PCI_BAR_HANDLE_INIT when driving the loopback model */
+    pci_bar_handle_t pci_bar_handle;
+    uint64_t base;
+    volatile uint32_t *regs;
+    /* the MAC was built with pong buffers */
+    bool pong;
+    int tx_next;
+    int rx_next;
+
+    uint64_t tx_frames;
+    uint64_t tx_bytes;
+    uint64_t rx_frames;
+    uint64_t rx_bytes;
+    uint64_t dropped;
+};
+
+struct eth_model {
+    pthread_t thread;
+    struct eth_mac *mac;
+    int rx_next;
+    volatile bool stop;
+};
+
+static volatile bool eth_stop;
+
+void usage(const char* program_name) {
+    printf("usage: %s [--slot <slot-id>] --bar <bar> --offset <offset> [--tap <name>]\n"
+           "       [--pong] [--poll-max-us <us>] [--bench <seconds> [--frame-size <bytes>]]\n"
+           "       %s --loopback-model --bench <seconds> [--frame-size <bytes>] [--pong]\n"
+           "Bridges the MAC at <offset> of APP_PF <bar> to the TAP device <name>\n"
+           "(default %s), which has to be brought up separately. There is no default\n"
+           "MAC window: the UART consoles live in the APP_PF BARs as well.\n"
+           "--pong uses the MAC's second transmit and receive buffers.\n"
+           "--bench sends numbered frames for <seconds> and checks what comes back,\n"
+           "--loopback-model runs it against a software model of the MAC.\n",
+           program_name, program_name, ETH_TAP_DEFAULT);
+}
+
+static void eth_term_handler(int sig) {
+    eth_stop = true;
+}
+
+static double eth_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static inline uint32_t eth_reg_read(struct eth_mac *mac, uint32_t offset) {
+    return mac->regs[offset / sizeof(uint32_t)];
+}
+
+/* buffer contents have to be visible before a control register changes */
+static inline void eth_reg_write(struct eth_mac *mac, uint32_t offset, uint32_t value) {
+    __sync_synchronize();
+    mac->regs[offset / sizeof(uint32_t)] = value;
+}
+
+static int eth_write_buffer(struct eth_mac *mac, uint32_t offset, const uint8_t *frame,
+    size_t len) {
+    uint32_t words[(ETH_FRAME_MAX + 3) / sizeof(uint32_t)];
+    size_t n_words = (len + 3) / sizeof(uint32_t);
+
+    words[n_words - 1] = 0;
+    memcpy(words, frame, len);
+
+    if (mac->pci_bar_handle >= 0) {
+        return fpga_pci_write_burst(mac->pci_bar_handle, mac->base + offset, words, n_words);
+    }
+    for (size_t i = 0; i < n_words; i++) {
+        mac->regs[offset / sizeof(uint32_t) + i] = words[i];
+    }
+    return 0;
+}
+
+/* the MAC buffers only take 32-bit accesses */
+static void eth_read_buffer(struct eth_mac *mac, uint32_t offset, uint8_t *frame,
+    size_t begin, size_t end) {
+    for (size_t i = begin / sizeof(uint32_t); i < (end + 3) / sizeof(uint32_t); i++) {
+        uint32_t word = mac->regs[offset / sizeof(uint32_t) + i];
+        memcpy(frame + i * sizeof(uint32_t), &word, sizeof(word));
+    }
+}
+
+/* length of a received frame, from its EtherType and IP headers */
+static size_t eth_frame_len(const uint8_t *frame) {
+    uint16_t type = (frame[12] << 8) | frame[13];
+    size_t len;
+
+    switch (type) {
+    case ETH_P_IP:
+        len = ETH_HLEN + ((frame[16] << 8) | frame[17]);
+        break;
+    case ETH_P_IPV6:
+        len = ETH_HLEN + 40 + ((frame[18] << 8) | frame[19]);
+        break;
+    case ETH_P_ARP:
+        len = ETH_HLEN + 28;
+        break;
+    default:
+        /* an 802.3 length field, anything else is read in full */
+        len = (type <= ETH_DATA_LEN) ? ETH_HLEN + type : ETH_FRAME_MAX;
+        break;
+    }
+
+    return max(min(len, (size_t) ETH_FRAME_MAX), (size_t) ETH_FRAME_MIN);
+}
+
+/* returns 1 if the frame was queued, 0 if no transmit buffer is free */
+static int eth_mac_send(struct eth_mac *mac, const uint8_t *frame, size_t len) {
+    int rc;
+    uint8_t padded[ETH_FRAME_MIN];
+    uint32_t data = mac->tx_next ? ETH_TX_PONG_DATA : ETH_TX_PING_DATA;
+    uint32_t ctrl = mac->tx_next ? ETH_TX_PONG_CTRL : ETH_TX_PING_CTRL;
+
+    if (eth_reg_read(mac, ctrl) & ETH_TX_CTRL_BUSY) {
+        return 0;
+    }
+
+    if (len < ETH_FRAME_MIN) {
+        memset(padded, 0, sizeof(padded));
+        memcpy(padded, frame, len);
+        frame = padded;
+        len = ETH_FRAME_MIN;
+    }
+    rc = eth_write_buffer(mac, data, frame, len);
+    fail_on(rc, out, "Unable to write to the fpga !");
+    eth_reg_write(mac, mac->tx_next ? ETH_TX_PONG_LEN : ETH_TX_PING_LEN, len);
+    eth_reg_write(mac, ctrl, ETH_TX_CTRL_BUSY);
+
+    if (mac->pong) {
+        mac->tx_next ^= 1;
+    }
+    mac->tx_frames++;
+    mac->tx_bytes += len;
+    return 1;
+out:
+    return -1;
+}
+
+/* returns 1 and the frame if one was received, 0 otherwise */
+static int eth_mac_recv(struct eth_mac *mac, uint8_t *frame, size_t *len) {
+    uint32_t ctrl = mac->rx_next ? ETH_RX_PONG_CTRL : ETH_RX_PING_CTRL;
+    uint32_t data = mac->rx_next ? ETH_RX_PONG_DATA : ETH_RX_PING_DATA;
+
+    if (!(eth_reg_read(mac, ctrl) & ETH_RX_CTRL_READY)) {
+        return 0;
+    }
+
+    /* the length is in the headers, so only read as much as needed */
+    eth_read_buffer(mac, data, frame, 0, ETH_RX_HEADER_SIZE);
+    *len = eth_frame_len(frame);
+    eth_read_buffer(mac, data, frame, ETH_RX_HEADER_SIZE, *len);
+    eth_reg_write(mac, ctrl, eth_reg_read(mac, ctrl) & ~ETH_RX_CTRL_READY);
+
+    if (mac->pong) {
+        mac->rx_next ^= 1;
+    }
+    mac->rx_frames++;
+    mac->rx_bytes += *len;
+    return 1;
+}
+
+/* the MAC only accepts unicast frames for the address programmed here */
+static int eth_mac_set_address(struct eth_mac *mac, const uint8_t *addr) {
+    int rc;
+    double start = eth_now();
+
+    rc = eth_write_buffer(mac, ETH_TX_PING_DATA, addr, ETH_ALEN);
+    fail_on(rc, out, "Unable to write to the fpga !");
+    eth_reg_write(mac, ETH_TX_PING_CTRL, ETH_TX_CTRL_PROGRAM | ETH_TX_CTRL_BUSY);
+
+    while (eth_reg_read(mac, ETH_TX_PING_CTRL) & ETH_TX_CTRL_BUSY) {
+        fail_on((rc = (eth_now() - start > 1.0) ? 1 : 0), out,
+            "Timeout programming the MAC address");
+        usleep(ETH_POLL_MIN_US);
+    }
+
+out:
+    return (rc != 0 ? 1 : 0);
+}
+
+/*
+ * The loopback model moves each transmitted frame into the next receive
+ * buffer, in the same ping/pong order as the MAC. Unlike the MAC, it waits
+ * for a free receive buffer instead of dropping the frame.
+ */
+static void *eth_model_loop(void *arg) {
+    struct eth_model *model = arg;
+    volatile uint32_t *regs = model->mac->regs;
+    const uint32_t tx_ctrl[2] = { ETH_TX_PING_CTRL, ETH_TX_PONG_CTRL };
+    const uint32_t tx_len[2] = { ETH_TX_PING_LEN, ETH_TX_PONG_LEN };
+    const uint32_t tx_data[2] = { ETH_TX_PING_DATA, ETH_TX_PONG_DATA };
+    const uint32_t rx_ctrl[2] = { ETH_RX_PING_CTRL, ETH_RX_PONG_CTRL };
+    const uint32_t rx_data[2] = { ETH_RX_PING_DATA, ETH_RX_PONG_DATA };
+    int tx_next = 0;
+
+    while (!model->stop) {
+        uint32_t *ctrl = (uint32_t *) &regs[tx_ctrl[tx_next] / sizeof(uint32_t)];
+        uint32_t value = __atomic_load_n(ctrl, __ATOMIC_ACQUIRE);
+
+        if (!(value & ETH_TX_CTRL_BUSY)) {
+            sched_yield();
+            continue;
+        }
+        if (!(value & ETH_TX_CTRL_PROGRAM)) {
+            uint32_t *ready = (uint32_t *) &regs[rx_ctrl[model->rx_next] / sizeof(uint32_t)];
+            uint32_t len = regs[tx_len[tx_next] / sizeof(uint32_t)];
+
+            if (__atomic_load_n(ready, __ATOMIC_ACQUIRE) & ETH_RX_CTRL_READY) {
+                sched_yield();
+                continue;
+            }
+            memcpy((uint8_t *) &regs[rx_data[model->rx_next] / sizeof(uint32_t)],
+                (uint8_t *) &regs[tx_data[tx_next] / sizeof(uint32_t)], min(len, ETH_FRAME_MAX));
+            __atomic_store_n(ready, ETH_RX_CTRL_READY, __ATOMIC_RELEASE);
+            if (model->mac->pong) {
+                model->rx_next ^= 1;
+            }
+        }
+        __atomic_store_n(ctrl, value & ~(ETH_TX_CTRL_BUSY | ETH_TX_CTRL_PROGRAM),
+            __ATOMIC_RELEASE);
+        if (model->mac->pong) {
+            tx_next ^= 1;
+        }
+    }
+    return NULL;
+}
+
+static int eth_open_tap(const char *name, uint8_t *hwaddr) {
+    int rc;
+    int fd = -1;
+    int sock = -1;
+    struct ifreq ifr;
+
+    fd = open("/dev/net/tun", O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    fail_on((rc = (fd < 0) ? 1 : 0), err, "Unable to open /dev/net/tun");
+
+    memset(&ifr, 0, sizeof(ifr));
+    ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+    snprintf(ifr.ifr_name, IFNAMSIZ, "%s", name);
+    rc = ioctl(fd, TUNSETIFF, &ifr);
+    fail_on(rc, err, "Unable to create TAP device %s", name);
+
+    /* the MAC takes the TAP's address, so Piton's frames to the host pass its filter */
+    sock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    fail_on((rc = (sock < 0) ? 1 : 0), err, "Unable to create a socket");
+    rc = ioctl(sock, SIOCGIFHWADDR, &ifr);
+    fail_on(rc, err, "Unable to get the address of %s", name);
+    memcpy(hwaddr, ifr.ifr_hwaddr.sa_data, ETH_ALEN);
+    close(sock);
+
+    return fd;
+err:
+    if (sock >= 0) {
+        close(sock);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    return -1;
+}
+
+static int eth_bridge(struct eth_mac *mac, int tap_fd, unsigned int poll_max_us) {
+    uint8_t rx_frame[ETH_FRAME_MAX + 4];
+    uint8_t tx_frame[ETH_FRAME_MAX + 4];
+    size_t tx_len = 0;
+    bool tx_pending = false;
+    unsigned int backoff_us = ETH_POLL_MIN_US;
+
+    while (!eth_stop) {
+        bool progress = false;
+        int rc;
+
+        for (int i = 0; i < ETH_BATCH; i++) {
+            size_t len;
+
+            if (eth_mac_recv(mac, rx_frame, &len) == 0) {
+                break;
+            }
+            if (write(tap_fd, rx_frame, len) != (ssize_t) len) {
+                /* a TAP which nobody reads drops frames, as a wire would */
+                mac->dropped++;
+                errno = 0;
+            }
+            progress = true;
+        }
+
+        for (int i = 0; i < ETH_BATCH; i++) {
+            if (!tx_pending) {
+                ssize_t n = read(tap_fd, tx_frame, sizeof(tx_frame));
+                if (n <= 0) {
+                    errno = 0;
+                    break;
+                }
+                if (n > ETH_FRAME_MAX) {
+                    mac->dropped++;
+                    continue;
+                }
+                tx_len = n;
+                tx_pending = true;
+            }
+            rc = eth_mac_send(mac, tx_frame, tx_len);
+            fail_on(rc < 0, err, "Unable to send a frame");
+            if (rc == 0) {
+                break;
+            }
+            tx_pending = false;
+            progress = true;
+        }
+
+        if (progress) {
+            backoff_us = ETH_POLL_MIN_US;
+            continue;
+        }
+
+        /* a frame waiting for a transmit buffer must not make the TAP wake us */
+        struct pollfd pfd = { .fd = tap_fd, .events = tx_pending ? 0 : POLLIN };
+        struct timespec timeout = {
+            .tv_sec = backoff_us / 1000000,
+            .tv_nsec = (backoff_us % 1000000) * 1000,
+        };
+        ppoll(&pfd, 1, &timeout, NULL);
+        backoff_us = min(backoff_us * 2, poll_max_us);
+    }
+
+    return 0;
+err:
+    return 1;
+}
+
+static void eth_bench_frame(uint8_t *frame, size_t len, uint32_t seq) {
+    static const uint8_t src[ETH_ALEN] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+
+    memset(frame, 0xff, ETH_ALEN);
+    memcpy(frame + ETH_ALEN, src, ETH_ALEN);
+    frame[12] = ETH_P_IP >> 8;
+    frame[13] = ETH_P_IP & 0xff;
+    memset(frame + ETH_HLEN, 0, 20);
+    frame[ETH_HLEN] = 0x45;
+    frame[16] = (len - ETH_HLEN) >> 8;
+    frame[17] = (len - ETH_HLEN) & 0xff;
+    for (size_t i = ETH_HLEN + 20; i < len; i++) {
+        frame[i] = (uint8_t)(seq + i);
+    }
+    memcpy(frame + ETH_HLEN + 20, &seq, sizeof(seq));
+}
+
+/* send numbered frames for secs seconds and check the ones coming back */
+static int eth_bench(struct eth_mac *mac, unsigned int secs, size_t frame_size) {
+    int rc = 0;
+    uint8_t tx_frame[ETH_FRAME_MAX + 4];
+    uint8_t rx_frame[ETH_FRAME_MAX + 4];
+    uint8_t expected[ETH_FRAME_MAX + 4];
+    uint32_t tx_seq = 0, rx_seq = 0;
+    uint64_t errors = 0;
+    double start, elapsed;
+
+    eth_bench_frame(tx_frame, frame_size, tx_seq);
+    start = eth_now();
+    do {
+        size_t len;
+        bool progress = false;
+
+        rc = eth_mac_send(mac, tx_frame, frame_size);
+        fail_on(rc < 0, out, "Unable to send a frame");
+        if (rc == 1) {
+            eth_bench_frame(tx_frame, frame_size, ++tx_seq);
+            progress = true;
+        }
+
+        while (eth_mac_recv(mac, rx_frame, &len) == 1) {
+            eth_bench_frame(expected, frame_size, rx_seq++);
+            if (len != frame_size || memcmp(rx_frame, expected, len) != 0) {
+                errors++;
+            }
+            progress = true;
+        }
+
+        /* let the loopback model run when it shares the CPU */
+        if (!progress) {
+            sched_yield();
+        }
+        elapsed = eth_now() - start;
+    } while (elapsed < secs && !eth_stop);
+    rc = 0;
+
+    log_info("tx %" PRIu64 " frames, %.0f frames/sec, %.1f Mbit/s", mac->tx_frames,
+        mac->tx_frames / elapsed, mac->tx_bytes * 8 / elapsed / 1e6);
+    log_info("rx %" PRIu64 " frames, %.0f frames/sec, %.1f Mbit/s, %" PRIu64 " errors",
+        mac->rx_frames, mac->rx_frames / elapsed, mac->rx_bytes * 8 / elapsed / 1e6, errors);
+    rc = errors ? 1 : 0;
+
+out:
+    return (rc != 0 ? 1 : 0);
+}
+
+int main(int argc, char **argv) {
+    int rc;
+    int opt;
+    int slot_id = 0;
+    int bar_id = -1;
+    bool have_offset = false;
+    int tap_fd = -1;
+    const char *tap_name = ETH_TAP_DEFAULT;
+    unsigned int poll_max_us = ETH_POLL_MAX_US;
+    unsigned int bench_secs = 0;
+    size_t frame_size = ETH_FRAME_MAX;
+    bool loopback_model = false;
+    uint8_t hwaddr[ETH_ALEN];
+    struct sigaction sa;
+    struct eth_model model = { .stop = false };
+    bool model_started = false;
+    struct piton_aws ctx;
+    bool ctx_open = false;
+    struct eth_mac mac = {
+        .pci_bar_handle = PCI_BAR_HANDLE_INIT,
+    };
+
+    static struct option long_options[] = {
+        {"slot",           required_argument, 0, 'S'},
+        {"bar",            required_argument, 0, 'b'},
+        {"offset",         required_argument, 0, 'o'},
+        {"tap",            required_argument, 0, 't'},
+        {"pong",           no_argument,       0, 'P'},
+        {"poll-max-us",    required_argument, 0, 'p'},
+        {"bench",          required_argument, 0, 'B'},
+        {"frame-size",     required_argument, 0, 'f'},
+        {"loopback-model", no_argument,       0, 'L'},
+        {0, 0, 0, 0}
+    };
+
+    while ((opt = getopt_long(argc, argv, "S:b:o:t:Pp:B:f:L", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'S':
+            slot_id = atoi(optarg);
+            break;
+        case 'b':
+            bar_id = atoi(optarg);
+            break;
+        case 'o':
+            mac.base = strtoull(optarg, NULL, 0);
+            have_offset = true;
+            break;
+        case 't':
+            tap_name = optarg;
+            break;
+        case 'P':
+            mac.pong = true;
+            break;
+        case 'p':
+            poll_max_us = max(atoi(optarg), ETH_POLL_MIN_US);
+            break;
+        case 'B':
+            bench_secs = strtoul(optarg, NULL, 0);
+            break;
+        case 'f':
+            frame_size = strtoul(optarg, NULL, 0);
+            break;
+        case 'L':
+            loopback_model = true;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    /* the MAC window has to be named, unless the model stands in for it */
+    if (optind != argc || (loopback_model && !bench_secs) ||
+        (loopback_model ? (bar_id >= 0 || have_offset) : (bar_id < 0 || !have_offset)) ||
+        frame_size < ETH_FRAME_MIN || frame_size > ETH_FRAME_MAX) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    /* setup logging to print to stdout */
+    rc = log_init("eth");
+    fail_on(rc, out, "Unable to initialize the log.");
+    rc = log_attach(logger, NULL, 0);
+    fail_on(rc, out, "%s", "Unable to attach to the log.");
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = eth_term_handler;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    if (loopback_model) {
+        mac.regs = calloc(1, ETH_REGS_SIZE);
+        fail_on((rc = (mac.regs == NULL) ? -ENOMEM : 0), out, "Unable to allocate the model");
+        model.mac = &mac;
+        rc = pthread_create(&model.thread, NULL, eth_model_loop, &model);
+        fail_on(rc, out, "Unable to start the model");
+        model_started = true;
+    } else {
+        rc = piton_aws_open(&ctx);
+        ctx_open = true;
+        fail_on(rc, out, "Unable to initialize the fpga libraries");
+        rc = piton_aws_slot_ready(&ctx, slot_id);
+        fail_on(rc, out, "AFI not ready");
+
+        rc = piton_aws_bar(&ctx, slot_id, bar_id, &mac.pci_bar_handle);
+        fail_on(rc, out, "Unable to attach to the AFI on slot id %d", slot_id);
+        rc = fpga_pci_get_address(mac.pci_bar_handle, mac.base, ETH_REGS_SIZE,
+            (void **) &mac.regs);
+        fail_on(rc, out, "Unable to map the MAC registers");
+
+        /* the bridge polls, keep the MAC's interrupts off */
+        eth_reg_write(&mac, ETH_GIE, 0);
+    }
+
+    if (bench_secs) {
+        rc = eth_bench(&mac, bench_secs, frame_size);
+        fail_on(rc, out, "Benchmark failed");
+        goto out;
+    }
+
+    tap_fd = eth_open_tap(tap_name, hwaddr);
+    fail_on((rc = (tap_fd < 0) ? 1 : 0), out, "Unable to open the TAP device");
+    rc = eth_mac_set_address(&mac, hwaddr);
+    fail_on(rc, out, "Unable to program the MAC address");
+    log_info("Bridging slot %d to %s (%02x:%02x:%02x:%02x:%02x:%02x)", slot_id, tap_name,
+        hwaddr[0], hwaddr[1], hwaddr[2], hwaddr[3], hwaddr[4], hwaddr[5]);
+
+    rc = eth_bridge(&mac, tap_fd, poll_max_us);
+    log_info("tx %" PRIu64 " frames (%" PRIu64 " bytes), rx %" PRIu64 " frames (%" PRIu64
+        " bytes), %" PRIu64 " dropped", mac.tx_frames, mac.tx_bytes, mac.rx_frames,
+        mac.rx_bytes, mac.dropped);
+
+out:
+    if (model_started) {
+        model.stop = true;
+        pthread_join(model.thread, NULL);
+    }
+    if (loopback_model) {
+        free((void *) mac.regs);
+    }
+    if (tap_fd >= 0) {
+        close(tap_fd);
+    }
+    if (ctx_open) {
+        piton_aws_close(&ctx);
+    }
+    return (rc != 0 ? 1 : 0);
+}
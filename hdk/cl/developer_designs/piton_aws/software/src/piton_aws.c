@@ -0,0 +1,261 @@
+/*
+ * Amazon FPGA Hardware Development Kit
+ *
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Amazon Software License (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *    http://aws.amazon.com/asl/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on
+ * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include <fpga_pci.h>
+#include <fpga_mgmt.h>
+#include <fpga_dma.h>
+#include <utils/lcd.h>
+
+#include "piton_aws.h"
+
+int piton_aws_open(struct piton_aws *ctx) {
+    int rc;
+
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->slot_id = -1;
+    for (int slot_id = 0; slot_id < FPGA_SLOT_MAX; slot_id++) {
+        struct piton_aws_slot *slot = &ctx->slots[slot_id];
+
+        for (int i = 0; i < DMA_OS_CHANNELS_MAX; i++) {
+            slot->read_fds[i] = -1;
+            slot->write_fds[i] = -1;
+        }
+        for (int i = 0; i < FPGA_BAR_PER_PF_MAX; i++) {
+            slot->bars[i] = PCI_BAR_HANDLE_INIT;
+        }
+    }
+
+    rc = fpga_pci_init();
+    fail_on(rc, out, "Unable to initialize the fpga_pci library");
+
+    /* initialize the fpga_plat library */
+    rc = fpga_mgmt_init();
+    fail_on(rc, out, "Unable to initialize the fpga_mgmt library");
+
+out:
+    return (rc != 0 ? 1 : 0);
+}
+
+void piton_aws_close(struct piton_aws *ctx) {
+    for (int slot_id = 0; slot_id < FPGA_SLOT_MAX; slot_id++) {
+        struct piton_aws_slot *slot = &ctx->slots[slot_id];
+
+        for (int i = 0; i < DMA_OS_CHANNELS_MAX; i++) {
+            if (slot->read_fds[i] >= 0) {
+                close(slot->read_fds[i]);
+                slot->read_fds[i] = -1;
+            }
+            if (slot->write_fds[i] >= 0) {
+                close(slot->write_fds[i]);
+                slot->write_fds[i] = -1;
+            }
+        }
+        for (int i = 0; i < FPGA_BAR_PER_PF_MAX; i++) {
+            if (slot->bars[i] != PCI_BAR_HANDLE_INIT) {
+                fpga_pci_detach(slot->bars[i]);
+                slot->bars[i] = PCI_BAR_HANDLE_INIT;
+            }
+        }
+    }
+}
+
+static bool piton_aws_afi_matches(const struct fpga_mgmt_image_info *info) {
+    return info->spec.map[FPGA_APP_PF].vendor_id == PITON_AWS_PCI_VENDOR_ID &&
+        info->spec.map[FPGA_APP_PF].device_id == PITON_AWS_PCI_DEVICE_ID;
+}
+
+static int piton_aws_check_slot(int slot_id, struct fpga_mgmt_image_info *info) {
+    int rc;
+
+    /* get local image description, contains status, vendor id, and device id */
+    rc = fpga_mgmt_describe_local_image(slot_id, info, 0);
+    fail_on(rc, out, "Unable to get local image information. Are you running "
+        "as root?");
+
+    /* check to see if the slot is ready */
+    if (info->status != FPGA_STATUS_LOADED) {
+        rc = 1;
+        fail_on(rc, out, "Slot %d is not ready", slot_id);
+    }
+
+    /* confirm that the AFI that we expect is in fact loaded */
+    if (piton_aws_afi_matches(info)) {
+        goto out;
+    }
+
+    log_info("The AFI on slot %d does not show the expected PCI vendor and device "
+        "ID. If it was just loaded, it might need a rescan. Rescanning now.", slot_id);
+    rc = fpga_pci_rescan_slot_app_pfs(slot_id);
+    fail_on(rc, out, "Unable to update PF for slot %d", slot_id);
+    rc = fpga_mgmt_describe_local_image(slot_id, info, 0);
+    fail_on(rc, out, "Unable to get local image information");
+
+    if (!piton_aws_afi_matches(info)) {
+        rc = 1;
+        char sdk_path_buf[512];
+        char *sdk_env_var;
+        sdk_env_var = getenv("SDK_DIR");
+        snprintf(sdk_path_buf, sizeof(sdk_path_buf), "%s",
+            (sdk_env_var != NULL) ? sdk_env_var : "<aws-fpga>");
+        log_error(
+            "...\n"
+            "  The slot appears loaded, but the pci vendor or device ID doesn't match the\n"
+            "  expected values after a rescan.\n"
+            "  Note that rescanning can change which device file in /dev/ a FPGA will map to.\n");
+        log_error(
+            "...\n"
+            "  To remove and re-add your xdma driver and reset the device file mappings, run\n"
+            "    sudo rmmod xdma && sudo insmod \"%s/sdk/linux_kernel_drivers/xdma/xdma.ko\"\n",
+            sdk_path_buf);
+        fail_on(rc, out, "The PCI vendor id and device of the loaded image are "
+                         "not the expected values.");
+    }
+
+out:
+    return (rc != 0 ? 1 : 0);
+}
+
+int piton_aws_slot_ready(struct piton_aws *ctx, int slot_id) {
+    int rc;
+    struct fpga_mgmt_image_info info = {0};
+    struct piton_aws_slot *slot;
+
+    fail_on((rc = (slot_id < 0 || slot_id >= FPGA_SLOT_MAX) ? 1 : 0), out,
+        "Invalid slot %d", slot_id);
+    slot = &ctx->slots[slot_id];
+    if (slot->state != PITON_AWS_SLOT_UNKNOWN) {
+        return (slot->state == PITON_AWS_SLOT_READY) ? 0 : 1;
+    }
+
+    log_info("Checking to see if the right AFI is loaded...");
+    rc = piton_aws_check_slot(slot_id, &info);
+    slot->state = rc ? PITON_AWS_SLOT_NOT_READY : PITON_AWS_SLOT_READY;
+    fail_on(rc, out, "slot config is not correct");
+    slot->spec = info.spec;
+
+    char dbdf[16];
+    snprintf(dbdf,
+                  sizeof(dbdf),
+                  PCI_DEV_FMT,
+                  info.spec.map[FPGA_APP_PF].domain,
+                  info.spec.map[FPGA_APP_PF].bus,
+                  info.spec.map[FPGA_APP_PF].dev,
+                  info.spec.map[FPGA_APP_PF].func);
+    log_info("Operating on slot %d with id: %s", slot_id, dbdf);
+
+out:
+    return (rc != 0 ? 1 : 0);
+}
+
+int piton_aws_loaded_slots(struct piton_aws *ctx, uint32_t *slots) {
+    int rc = 0;
+    struct fpga_slot_spec specs[FPGA_SLOT_MAX];
+
+    if (!ctx->have_specs) {
+        memset(specs, 0, sizeof(specs));
+        rc = fpga_pci_get_all_slot_specs(specs, FPGA_SLOT_MAX);
+        fail_on(rc, out, "Unable to read the slot specs");
+        for (int slot_id = 0; slot_id < FPGA_SLOT_MAX; slot_id++) {
+            if (specs[slot_id].map[FPGA_APP_PF].vendor_id != 0) {
+                ctx->loaded_slots |= 1u << slot_id;
+            }
+        }
+        ctx->have_specs = true;
+    }
+    *slots = ctx->loaded_slots;
+
+out:
+    return (rc != 0 ? 1 : 0);
+}
+
+int piton_aws_dma_fd(struct piton_aws *ctx, int slot_id, int channel, bool is_read) {
+    int rc;
+    int *fd;
+
+    rc = piton_aws_slot_ready(ctx, slot_id);
+    fail_on(rc, out, "Slot %d is not ready", slot_id);
+    fail_on((rc = (channel < 0 || channel >= DMA_OS_CHANNELS_MAX) ? 1 : 0), out,
+        "Invalid DMA channel %d", channel);
+
+    fd = is_read ? &ctx->slots[slot_id].read_fds[channel] :
+        &ctx->slots[slot_id].write_fds[channel];
+    if (*fd < 0) {
+        *fd = fpga_dma_open_queue(FPGA_DMA_XDMA, slot_id, channel, is_read);
+        fail_on((rc = (*fd < 0) ? 1 : 0), out, "unable to open %s dma queue %d",
+            is_read ? "read" : "write", channel);
+    }
+    return *fd;
+
+out:
+    return -1;
+}
+
+int piton_aws_bar(struct piton_aws *ctx, int slot_id, int bar_id,
+    pci_bar_handle_t *handle) {
+    int rc;
+    pci_bar_handle_t *bar;
+
+    rc = piton_aws_slot_ready(ctx, slot_id);
+    fail_on(rc, out, "Slot %d is not ready", slot_id);
+    fail_on((rc = (bar_id < 0 || bar_id >= FPGA_BAR_PER_PF_MAX) ? 1 : 0), out,
+        "Invalid BAR %d", bar_id);
+
+    bar = &ctx->slots[slot_id].bars[bar_id];
+    if (*bar == PCI_BAR_HANDLE_INIT) {
+        rc = fpga_pci_attach(slot_id, FPGA_APP_PF, bar_id, 0, bar);
+        fail_on(rc, out, "Unable to attach to the AFI on slot id %d", slot_id);
+    }
+    *handle = *bar;
+
+out:
+    return (rc != 0 ? 1 : 0);
+}
+
+int piton_aws_default_slot(const struct piton_aws *ctx) {
+    return (ctx->slot_id >= 0) ? ctx->slot_id : 0;
+}
+
+int parse_size(const char *str, size_t *size) {
+    char *end = NULL;
+
+    errno = 0;
+    unsigned long long value = strtoull(str, &end, 0);
+    if (errno != 0 || end == str) {
+        errno = 0;
+        return -1;
+    }
+
+    switch (*end) {
+    case 'k': case 'K': value <<= 10; end++; break;
+    case 'm': case 'M': value <<= 20; end++; break;
+    case 'g': case 'G': value <<= 30; end++; break;
+    default: break;
+    }
+    if (*end != '\0') {
+        return -1;
+    }
+
+    *size = value;
+    return 0;
+}
@@ -0,0 +1,158 @@
+/*
+ * Amazon FPGA Hardware Development Kit
+ *
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Amazon Software License (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *    http://aws.amazon.com/asl/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on
+ * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * piton_aws runs one command, or a chain of commands separated by "+",
+ * against one libpiton_aws context:
+ *
+ *   piton_aws --slot 0 fill 8G 64M + load os.img + console
+ *
+ * checks the AFI and opens the DMA queues once for the whole chain. The chain
+ * stops at the first failing command. Invoked as dma_os, read_mem or uartd
+ * (the Makefile links those names to it) it runs load, dump or console with
+ * the old command line.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <libgen.h>
+
+#include <utils/lcd.h>
+
+#include "piton_aws.h"
+
+/* use the standard out logger */
+static const struct logger *logger = &logger_stdout;
+
+struct piton_aws_command {
+    const char *name;
+    /* standalone tool the command replaces, NULL if none */
+    const char *tool;
+    int (*run)(struct piton_aws *ctx, int argc, char **argv);
+    const char *help;
+};
+
+static const struct piton_aws_command commands[] = {
+    { "load",    "dma_os",   piton_aws_load,    "write an OS image to DRAM" },
+    { "dump",    "read_mem", piton_aws_dump,    "dump, snapshot or restore a DRAM range" },
+    { "fill",    NULL,       piton_aws_fill,    "fill a DRAM range with a byte" },
+    { "console", "uartd",    piton_aws_console, "serve the UART consoles" },
+};
+
+#define N_COMMANDS (sizeof(commands) / sizeof(commands[0]))
+
+static void usage(const char* program_name) {
+    printf("usage: %s [--slot <slot-id>] <command> [<args>] [+ <command> [<args>]]...\n"
+           "commands, see <command> --help:\n", program_name);
+    for (size_t i = 0; i < N_COMMANDS; i++) {
+        printf("  %-8s %s\n", commands[i].name, commands[i].help);
+    }
+    printf("--slot is the default slot of every command in the chain\n");
+}
+
+static const struct piton_aws_command *find_command(const char *name, bool tool) {
+    for (size_t i = 0; i < N_COMMANDS; i++) {
+        const char *match = tool ? commands[i].tool : commands[i].name;
+        if (match != NULL && strcmp(match, name) == 0) {
+            return &commands[i];
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    int rc;
+    int opt;
+    char *name = basename(argv[0]);
+    const struct piton_aws_command *tool = find_command(name, true);
+    struct piton_aws ctx;
+    int slot_id = -1;
+
+    static struct option long_options[] = {
+        {"slot", required_argument, 0, 'S'},
+        {0, 0, 0, 0}
+    };
+
+    /* global options stop at the first command */
+    if (tool == NULL) {
+        while ((opt = getopt_long(argc, argv, "+S:", long_options, NULL)) != -1) {
+            switch (opt) {
+            case 'S':
+                slot_id = atoi(optarg);
+                break;
+            default:
+                usage(name);
+                return 1;
+            }
+        }
+        if (optind == argc) {
+            usage(name);
+            return 1;
+        }
+        for (int i = optind; i < argc; i++) {
+            if (strcmp(argv[i], PITON_AWS_CHAIN) == 0 && (i == optind ||
+                i + 1 == argc || strcmp(argv[i + 1], PITON_AWS_CHAIN) == 0)) {
+                usage(name);
+                return 1;
+            }
+        }
+    }
+
+    /* setup logging to print to stdout */
+    rc = log_init(name);
+    fail_on(rc, out, "Unable to initialize the log.");
+    rc = log_attach(logger, NULL, 0);
+    fail_on(rc, out, "%s", "Unable to attach to the log.");
+
+    rc = piton_aws_open(&ctx);
+    fail_on(rc, out, "Unable to initialize the fpga libraries");
+    ctx.slot_id = slot_id;
+
+    if (tool != NULL) {
+        rc = tool->run(&ctx, argc, argv);
+        goto close;
+    }
+
+    for (int i = optind; i < argc && rc == 0; ) {
+        const struct piton_aws_command *command = find_command(argv[i], false);
+        int n = 0;
+
+        while (i + n < argc && strcmp(argv[i + n], PITON_AWS_CHAIN) != 0) {
+            n++;
+        }
+        /* commands parse their own argv, so terminate it at the separator */
+        if (i + n < argc) {
+            argv[i + n] = NULL;
+        }
+
+        if (command == NULL) {
+            log_error("Unknown command %s", argv[i]);
+            usage(name);
+            rc = 1;
+        } else {
+            rc = command->run(&ctx, n, &argv[i]);
+        }
+        i += n + 1;
+    }
+
+close:
+    piton_aws_close(&ctx);
+out:
+    return (rc != 0 ? 1 : 0);
+}
@@ -25,7 +25,9 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <stdint.h>
-#include <assert.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
 
 #include <fpga_pci.h>
 #include <fpga_mgmt.h>
@@ -34,230 +36,219 @@
 #include <utils/sh_dpi_tasks.h>
 
 #include "dma_os.h"
+#include "piton_aws.h"
+#include "snapshot.h"
 
-/* use the standard out logger */
-static const struct logger *logger = &logger_stdout;
-int read_mem(int read_fd, size_t begin, size_t end, size_t buffer_size);
+/*
+ * DRAM dump tunables
+ */
+struct read_mem_opts {
+    /* number of c2h channels read in parallel */
+    int n_channels;
+    /* bytes per DMA read and file write */
+    size_t chunk_size;
+    /* write the output file with O_DIRECT */
+    bool direct;
+};
+
+int read_mem(struct piton_aws *ctx, int slot_id, size_t begin, size_t end,
+    const char *out_filename, const struct read_mem_opts *opts);
+
+static void read_mem_usage(const char* program_name) {
+    printf("usage: %s [--slot <slot-id>] [--channels <1-%d>] [--chunk-size <MB>]\n"
+           "       [--buffered] <begin> <size> <output_file>\n"
+           "       %s [options] --snapshot <begin> <size> <snapshot_file>\n"
+           "       %s [options] --restore <snapshot_file>\n"
+           "begin and size accept a K, M or G suffix\n"
+           "--snapshot only rewrites chunks changed since the last snapshot to the\n"
+           "same file, --restore only writes back chunks which differ in DRAM\n",
+           program_name, DMA_OS_CHANNELS_MAX, program_name, program_name);
+}
 
-int main(int argc, char **argv) {
+int piton_aws_dump(struct piton_aws *ctx, int argc, char **argv) {
     int rc;
-    int slot_id = 0;
-
-    /* setup logging to print to stdout */
-    rc = log_init("test_dram_dma");
-    fail_on(rc, out, "Unable to initialize the log.");
-    rc = log_attach(logger, NULL, 0);
-    fail_on(rc, out, "%s", "Unable to attach to the log.");
-
-    /* initialize the fpga_plat library */
-    rc = fpga_mgmt_init();
-    fail_on(rc, out, "Unable to initialize the fpga_mgmt library");
-
-    /* check that the AFI is loaded */
-    log_info("Checking to see if the right AFI is loaded...");
-    rc = check_slot_config(slot_id);
-    fail_on(rc, out, "slot config is not correct");
-
-    /* get fds */
-    int read_fd = -1;
-    int write_fd = -1;
-    rc = get_fds(slot_id, &read_fd, &write_fd);
-    fail_on(rc, out, "Couldn't get file descriptors for DMA");
-
-    /* read mem */ 
-    rc = read_mem(read_fd, 2*MEM_1GB, 2*MEM_1GB + 32*MEM_1MB, MEM_1MB);
-    fail_on(rc, out, "read_mem failed!");
-
-out:
-    if (write_fd >= 0) {
-        close(write_fd);
-    }
-    if (read_fd >= 0) {
-        close(read_fd);
+    int opt;
+    int slot_id = piton_aws_default_slot(ctx);
+    size_t begin, size;
+    enum { READ_MEM_DUMP, READ_MEM_SNAPSHOT, READ_MEM_RESTORE } mode = READ_MEM_DUMP;
+    struct read_mem_opts opts = {
+        .n_channels = DMA_OS_CHANNELS_MAX,
+        .chunk_size = 4 * MEM_1MB,
+        .direct = true,
+    };
+
+    static struct option long_options[] = {
+        {"slot",       required_argument, 0, 'S'},
+        {"channels",   required_argument, 0, 'c'},
+        {"chunk-size", required_argument, 0, 's'},
+        {"buffered",   no_argument,       0, 'B'},
+        {"snapshot",   no_argument,       0, 'n'},
+        {"restore",    no_argument,       0, 'r'},
+        {0, 0, 0, 0}
+    };
+
+    optind = 0;
+    while ((opt = getopt_long(argc, argv, "S:c:s:Bnr", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'S':
+            slot_id = atoi(optarg);
+            break;
+        case 'c':
+            opts.n_channels = atoi(optarg);
+            break;
+        case 's':
+            opts.chunk_size = strtoull(optarg, NULL, 0) * MEM_1MB;
+            break;
+        case 'B':
+            opts.direct = false;
+            break;
+        case 'n':
+            mode = READ_MEM_SNAPSHOT;
+            break;
+        case 'r':
+            mode = READ_MEM_RESTORE;
+            break;
+        default:
+            read_mem_usage(argv[0]);
+            return 1;
+        }
     }
-    
-    log_info("Memory initialization %s", (rc == 0) ? "PASSED" : "FAILED");
-    return rc;
-}
-
-
-static const uint16_t AMZ_PCI_VENDOR_ID = 0x1D0F; /* Amazon PCI Vendor ID */
-static const uint16_t PCI_DEVICE_ID = 0xF001;
 
-uint64_t buffer_compare(uint8_t *bufa, uint8_t *bufb,
-    size_t buffer_size)
-{
-    size_t i;
-    uint64_t differ = 0;
-    for (i = 0; i < buffer_size; ++i) {
-        if (bufa[i] != bufb[i]) {
-            differ += 1;
+    if (mode == READ_MEM_RESTORE) {
+        if (optind != argc - 1) {
+            read_mem_usage(argv[0]);
+            return 1;
         }
+    } else if (optind != argc - 3 ||
+        parse_size(argv[optind], &begin) ||
+        parse_size(argv[optind + 1], &size)) {
+        read_mem_usage(argv[0]);
+        return 1;
     }
 
-    return differ;
-}
-
-int check_slot_config(int slot_id)
-{
-    int rc;
-    struct fpga_mgmt_image_info info = {0};
-
-    /* get local image description, contains status, vendor id, and device id */
-    rc = fpga_mgmt_describe_local_image(slot_id, &info, 0);
-    fail_on(rc, out, "Unable to get local image information. Are you running "
-        "as root?");
-
-    /* check to see if the slot is ready */
-    if (info.status != FPGA_STATUS_LOADED) {
-        rc = 1;
-        fail_on(rc, out, "Slot %d is not ready", slot_id);
-    }
+    /* check that the AFI is loaded */
+    rc = piton_aws_slot_ready(ctx, slot_id);
+    fail_on(rc, out, "slot config is not correct");
 
-    /* confirm that the AFI that we expect is in fact loaded */
-    if (info.spec.map[FPGA_APP_PF].vendor_id != AMZ_PCI_VENDOR_ID ||
-        info.spec.map[FPGA_APP_PF].device_id != PCI_DEVICE_ID)
-    {
-        rc = 1;
-        char sdk_path_buf[512];
-        char *sdk_env_var;
-        sdk_env_var = getenv("SDK_DIR");
-        snprintf(sdk_path_buf, sizeof(sdk_path_buf), "%s",
-            (sdk_env_var != NULL) ? sdk_env_var : "<aws-fpga>");
-        log_error(
-            "...\n"
-            "  The slot appears loaded, but the pci vendor or device ID doesn't match the\n"
-            "  expected values. You may need to rescan the fpga with \n"
-            "    fpga-describe-local-image -S %i -R\n"
-            "  Note that rescanning can change which device file in /dev/ a FPGA will map to.\n",
-            slot_id);
-        log_error(
-            "...\n"
-            "  To remove and re-add your xdma driver and reset the device file mappings, run\n"
-            "    sudo rmmod xdma && sudo insmod \"%s/sdk/linux_kernel_drivers/xdma/xdma.ko\"\n",
-            sdk_path_buf);
-        fail_on(rc, out, "The PCI vendor id and device of the loaded image are "
-                         "not the expected values.");
+    if (mode == READ_MEM_DUMP) {
+        /* read mem */
+        rc = read_mem(ctx, slot_id, begin, begin + size, argv[optind + 2], &opts);
+        fail_on(rc, out, "read_mem failed!");
+    } else {
+        struct snapshot_opts snap_opts = {
+            .n_channels = opts.n_channels,
+            .chunk_size = opts.chunk_size,
+        };
+
+        if (mode == READ_MEM_SNAPSHOT) {
+            rc = snapshot_save(ctx, slot_id, begin, begin + size, argv[optind + 2],
+                &snap_opts);
+            fail_on(rc, out, "snapshot failed!");
+        } else {
+            rc = snapshot_restore(ctx, slot_id, argv[optind], &snap_opts);
+            fail_on(rc, out, "restore failed!");
+        }
     }
 
-    char dbdf[16];
-    snprintf(dbdf,
-                  sizeof(dbdf),
-                  PCI_DEV_FMT,
-                  info.spec.map[FPGA_APP_PF].domain,
-                  info.spec.map[FPGA_APP_PF].bus,
-                  info.spec.map[FPGA_APP_PF].dev,
-                  info.spec.map[FPGA_APP_PF].func);
-    log_info("Operating on slot %d with id: %s", slot_id, dbdf);
-
-out:
-    return rc;
-}
-
-
-void usage(const char* program_name) {
-    printf("usage: %s <os_img_file>\n", program_name);
-}
-
-int get_fds(int slot_id, int* read_fd, int* write_fd) {
-    int rc;
-    
-    *read_fd = fpga_dma_open_queue(FPGA_DMA_XDMA, slot_id, /*channel*/ 0, /*is_read*/ true);
-    fail_on((rc = (read_fd < 0) ? -1 : 0), out, "unable to open read dma queue");
-
-    *write_fd = fpga_dma_open_queue(FPGA_DMA_XDMA, slot_id, /*channel*/ 0, /*is_read*/ false);
-    fail_on((rc = (write_fd < 0) ? -1 : 0), out, "unable to open write dma queue");
-
 out:
-    /* if there is an error code, exit with status 1 */
+    log_info("Memory dump %s", (rc == 0) ? "PASSED" : "FAILED");
     return (rc != 0 ? 1 : 0);
 }
 
+static void fill_usage(const char* program_name) {
+    printf("usage: %s [--slot <slot-id>] [--chunk-size <MB>]\n"
+           "       [--verify=none|sample|full] <begin> <size> [<byte>]\n"
+           "begin and size accept a K, M or G suffix, size must be a multiple\n"
+           "of the chunk size, byte defaults to 0\n",
+           program_name);
+}
 
-/**
- * Write OS into dimm3
- */
-int dma_os(int read_fd, int write_fd, const char* os_img_filename, size_t begin) {
+int piton_aws_fill(struct piton_aws *ctx, int argc, char **argv) {
     int rc;
-    
-    FILE* os_img_file = fopen(os_img_filename, "r");
-    if (os_img_file == NULL) {
-        rc = -ENOENT;
-        goto out;
-    }
-
-    size_t buffer_size = MEM_1MB;
-
-    uint8_t *write_buffer = calloc(buffer_size, sizeof(uint8_t));
-    uint8_t *read_buffer = calloc(buffer_size, sizeof(uint8_t));
-    if (write_buffer == NULL || read_buffer == NULL) {
-        rc = -ENOMEM;
-        goto out;
-    }
-
-    size_t pos = begin;
-    bool passed = true;
-    while(1) {
-        size_t bytes_read = fread(write_buffer, 1, buffer_size, os_img_file);
-
-        rc = fpga_dma_burst_write(write_fd, write_buffer, bytes_read, pos);
-        fail_on(rc, out, "DMA write failed");
-
-        rc = fpga_dma_burst_read(read_fd, read_buffer, bytes_read, pos);
-        fail_on(rc, out, "DMA read failed");
-
-        uint64_t differ = buffer_compare(read_buffer, write_buffer, bytes_read);
-    
-        if (differ != 0) {
-            log_error("OS image write failed with %lu bytes which differ", differ);
-            passed = false;
+    int opt;
+    int slot_id = piton_aws_default_slot(ctx);
+    int read_fd = -1, write_fd;
+    size_t begin, size;
+    size_t chunk_size = 4 * MEM_1MB;
+    uint8_t byte = 0;
+    enum dma_verify_mode verify = DMA_VERIFY_FULL;
+
+    static struct option long_options[] = {
+        {"slot",       required_argument, 0, 'S'},
+        {"chunk-size", required_argument, 0, 's'},
+        {"verify",     required_argument, 0, 'v'},
+        {0, 0, 0, 0}
+    };
+
+    optind = 0;
+    while ((opt = getopt_long(argc, argv, "S:s:v:", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'S':
+            slot_id = atoi(optarg);
             break;
-        }
-
-        if (bytes_read != buffer_size) {
+        case 's':
+            chunk_size = strtoull(optarg, NULL, 0) * MEM_1MB;
             break;
+        case 'v':
+            if (parse_verify_mode(optarg, &verify)) {
+                fill_usage(argv[0]);
+                return 1;
+            }
+            break;
+        default:
+            fill_usage(argv[0]);
+            return 1;
         }
-        pos += bytes_read;
     }
 
-    if (passed) {
-        log_info("OS image written!");
-    } else { 
-        log_info("OS image write failed!");
+    if (optind < argc - 3 || optind > argc - 2 || chunk_size == 0 ||
+        parse_size(argv[optind], &begin) ||
+        parse_size(argv[optind + 1], &size)) {
+        fill_usage(argv[0]);
+        return 1;
+    }
+    if (optind == argc - 3) {
+        byte = strtoul(argv[optind + 2], NULL, 0);
     }
 
-    
-    rc = (passed) ? 0 : 1;
+    rc = piton_aws_slot_ready(ctx, slot_id);
+    fail_on(rc, out, "slot config is not correct");
 
-out:
-    if (write_buffer != NULL) {
-        free(write_buffer);
+    write_fd = piton_aws_dma_fd(ctx, slot_id, 0, /*is_read*/ false);
+    fail_on((rc = (write_fd < 0) ? 1 : 0), out, "Couldn't get file descriptors for DMA");
+    if (verify != DMA_VERIFY_NONE) {
+        read_fd = piton_aws_dma_fd(ctx, slot_id, 0, /*is_read*/ true);
+        fail_on((rc = (read_fd < 0) ? 1 : 0), out, "Couldn't get file descriptors for DMA");
     }
-    if (read_buffer != NULL) {
-        free(read_buffer);
-    }
-    if (os_img_file != NULL) {
-        fclose(os_img_file);
-    }
-    /* if there is an error code, exit with status 1 */
+
+    log_info("Filling 0x%zx-0x%zx with 0x%02x", begin, begin + size, byte);
+    rc = fill_mem(slot_id, read_fd, write_fd, begin, begin + size, byte, chunk_size, verify);
+
+out:
     return (rc != 0 ? 1 : 0);
 }
 
-
-int fill_mem(int read_fd, int write_fd, size_t begin, size_t end, uint8_t byte, size_t buffer_size) {
+/*
+ * Fill [begin, end) with a byte pattern. The pattern is regenerated on
+ * readback, so DMA_VERIFY_DEFERRED behaves like DMA_VERIFY_FULL here.
+ */
+int fill_mem(int slot_id, int read_fd, int write_fd, size_t begin, size_t end,
+    uint8_t byte, size_t buffer_size, enum dma_verify_mode verify) {
     int rc = 0;
-    
+    struct fpga_dma_buffer mem = { 0 };
+    size_t stride = (buffer_size + DMA_OS_BUFFER_ALIGN - 1) &
+        ~(size_t)(DMA_OS_BUFFER_ALIGN - 1);
+
     if ( (end <= begin) || ((end - begin) % buffer_size != 0) ) {
         rc = -1;
     }
     fail_on(rc, out, "Wrong mem filling params");
 
-    uint8_t *write_buffer = calloc(buffer_size, sizeof(uint8_t));
-    uint8_t *read_buffer = calloc(buffer_size, sizeof(uint8_t));
-    if (write_buffer == NULL || read_buffer == NULL) {
-        rc = -ENOMEM;
-        goto out;
-    }
+    /* write and readback buffer, on the NUMA node of the slot */
+    rc = fpga_dma_buffer_alloc(slot_id, 2 * stride, &mem);
+    fail_on(rc, out, "Unable to allocate fill buffers");
+    uint8_t *write_buffer = mem.data;
+    uint8_t *read_buffer = mem.data + stride;
 
     memset(read_buffer, byte, buffer_size);
     memset(write_buffer, byte, buffer_size);
@@ -268,15 +259,24 @@ int fill_mem(int read_fd, int write_fd, size_t begin, size_t end, uint8_t byte,
         rc = fpga_dma_burst_write(write_fd, write_buffer, buffer_size, pos);
         fail_on(rc, out, "DMA write failed");
 
-        rc = fpga_dma_burst_read(read_fd, read_buffer, buffer_size, pos);
-        fail_on(rc, out, "DMA read failed");
+        if (verify != DMA_VERIFY_NONE) {
+            size_t off = 0;
+            size_t len = buffer_size;
+            if (verify == DMA_VERIFY_SAMPLE) {
+                off = verify_sample_offset(pos, buffer_size);
+                len = min(buffer_size, (size_t)DMA_VERIFY_SAMPLE_SIZE);
+            }
 
-        uint64_t differ = buffer_compare(read_buffer, write_buffer, buffer_size);
-    
-        if (differ != 0) {
-            log_error("Filling memory failed with %lu bytes which differ", differ);
-            passed = false;
-            break;
+            rc = fpga_dma_burst_read(read_fd, read_buffer + off, len, pos + off);
+            fail_on(rc, out, "DMA read failed");
+
+            uint64_t differ = buffer_compare(read_buffer + off, write_buffer + off, len);
+
+            if (differ != 0) {
+                log_error("Filling memory failed with %lu bytes which differ", differ);
+                passed = false;
+                break;
+            }
         }
 
         pos += buffer_size;
@@ -294,67 +294,168 @@ int fill_mem(int read_fd, int write_fd, size_t begin, size_t end, uint8_t byte,
     rc = (passed) ? 0 : 1;
 
 out:
-    if (write_buffer != NULL) {
-        free(write_buffer);
-    }
-    if (read_buffer != NULL) {
-        free(read_buffer);
-    }
-    
+    fpga_dma_buffer_free(&mem);
+
     /* if there is an error code, exit with status 1 */
     return (rc != 0 ? 1 : 0);
 }
 
-int read_mem(int read_fd, size_t begin, size_t end, size_t buffer_size) {
+/*
+ * The dump runs one worker per c2h channel. Workers claim chunks of the range
+ * in order, read them into their own aligned buffer and write them straight
+ * to the matching offset of the output file, so DMA reads on all channels
+ * and the file writes overlap.
+ */
+struct read_mem_job {
+    size_t begin;
+    size_t end;
+    size_t chunk_size;
+    int out_fd;
+    /* buffered fd for a tail which is not O_DIRECT aligned */
+    int tail_fd;
+    size_t next_chunk;
+    volatile bool failed;
+};
+
+struct read_mem_worker {
+    pthread_t thread;
+    int channel;
+    int read_fd;
+    uint8_t *buffer;
+    struct read_mem_job *job;
+};
+
+static void *read_mem_worker(void *arg) {
+    int rc;
+    struct read_mem_worker *worker = arg;
+    struct read_mem_job *job = worker->job;
+
+    while (!job->failed) {
+        size_t chunk = __atomic_fetch_add(&job->next_chunk, 1, __ATOMIC_RELAXED);
+        size_t offset = chunk * job->chunk_size;
+        if (offset >= job->end - job->begin) {
+            break;
+        }
+        size_t len = min(job->chunk_size, job->end - job->begin - offset);
+
+        rc = fpga_dma_burst_read(worker->read_fd, worker->buffer, len,
+            job->begin + offset);
+        if (rc) {
+            log_error("DMA read failed on channel %d at 0x%zx", worker->channel,
+                job->begin + offset);
+            job->failed = true;
+            break;
+        }
+
+        int fd = (len % DMA_OS_BUFFER_ALIGN == 0) ? job->out_fd : job->tail_fd;
+        if (pwrite(fd, worker->buffer, len, offset) != (ssize_t)len) {
+            log_error("Unable to write the dump at offset 0x%zx", offset);
+            job->failed = true;
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+int read_mem(struct piton_aws *ctx, int slot_id, size_t begin, size_t end,
+    const char *out_filename, const struct read_mem_opts *opts) {
     int rc = 0;
-    
-    if ( (end <= begin) || ((end - begin) % buffer_size != 0) ) {
+    int n_channels = opts->n_channels;
+    int n_started = 0;
+    struct read_mem_worker workers[DMA_OS_CHANNELS_MAX];
+    struct fpga_dma_buffer mem = { 0 };
+    struct read_mem_job job = {
+        .begin = begin,
+        .end = end,
+        .chunk_size = opts->chunk_size,
+        .out_fd = -1,
+        .tail_fd = -1,
+    };
+
+    memset(workers, 0, sizeof(workers));
+
+    if ( (end <= begin) || n_channels < 1 || n_channels > DMA_OS_CHANNELS_MAX ||
+         opts->chunk_size == 0 || opts->chunk_size % DMA_OS_BUFFER_ALIGN != 0 ) {
         rc = -1;
     }
-    fail_on(rc, out, "Wrong mem filling params");
+    fail_on(rc, out, "Wrong mem reading params");
+
+    job.tail_fd = open(out_filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    fail_on((rc = (job.tail_fd < 0) ? -errno : 0), out, "Unable to open %s",
+        out_filename);
+    job.out_fd = job.tail_fd;
+    if (opts->direct) {
+        job.out_fd = open(out_filename, O_WRONLY | O_DIRECT);
+        if (job.out_fd < 0) {
+            log_warning("O_DIRECT is not supported for %s, using buffered writes",
+                out_filename);
+            errno = 0;
+            job.out_fd = job.tail_fd;
+        }
+    }
 
-    uint8_t *read_buffer = calloc(buffer_size, sizeof(uint8_t));
-    if (read_buffer == NULL) {
-        rc = -ENOMEM;
-        goto out;
+    /* size the file up front so workers can write chunks in any order */
+    rc = ftruncate(job.tail_fd, end - begin);
+    fail_on((rc = rc ? -errno : 0), out, "Unable to size %s", out_filename);
+
+    /* one chunk buffer per channel, on the NUMA node of the slot */
+    rc = fpga_dma_buffer_alloc(slot_id, opts->chunk_size * n_channels, &mem);
+    fail_on(rc, out, "Unable to allocate read buffers");
+
+    for (int i = 0; i < n_channels; i++) {
+        struct read_mem_worker *worker = &workers[i];
+        worker->channel = i;
+        worker->job = &job;
+        worker->read_fd = piton_aws_dma_fd(ctx, slot_id, i, /*is_read*/ true);
+        fail_on((rc = (worker->read_fd < 0) ? -1 : 0), out,
+            "unable to open read dma queue %d", i);
+        worker->buffer = mem.data + opts->chunk_size * i;
     }
 
-    memset(read_buffer, 0x00, buffer_size);
-    FILE*  file = fopen("memory3.bin", "wb");
-    assert(file != NULL);
+    log_info("Dumping 0x%zx-0x%zx to %s on %d channel(s)%s", begin, end,
+        out_filename, n_channels, (job.out_fd != job.tail_fd) ? " with O_DIRECT" : "");
 
-    size_t pos = begin;
-    bool passed = true;
-    while(1) {
-        rc = fpga_dma_burst_read(read_fd, read_buffer, buffer_size, pos);
-        fail_on(rc, out, "DMA read failed");
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
 
-	for (uint64_t i = 0; i < buffer_size; i++) {
-            //printf("%02x", read_buffer[i]);
+    for (int i = 0; i < n_channels; i++) {
+        rc = pthread_create(&workers[i].thread, NULL, read_mem_worker, &workers[i]);
+        if (rc) {
+            log_error("Unable to start DMA worker %d", i);
+            job.failed = true;
+            break;
         }
-        //printf("\n");
-
-        fwrite(read_buffer, buffer_size, 1, file); 
+        n_started++;
+    }
+    for (int i = 0; i < n_started; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
 
-        pos += buffer_size;
-        if (pos >= end) {
-            break;
-        } 
+    if (!job.failed && fdatasync(job.tail_fd) != 0) {
+        log_error("Unable to flush %s", out_filename);
+        job.failed = true;
     }
 
-    fclose(file);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
 
-    if (passed) {
-        log_info("Reading memory: success!");
+    if (!job.failed) {
+        log_info("Reading memory: success! %zu bytes, %.3f GB/s", end - begin,
+            (secs > 0) ? (end - begin) / secs / 1e9 : 0.0);
     } else { 
         log_info("Reading memory: failure!");
     }
 
-    rc = (passed) ? 0 : 1;
+    rc = (!job.failed) ? 0 : 1;
 
 out:
-    if (read_buffer != NULL) {
-        free(read_buffer);
+    fpga_dma_buffer_free(&mem);
+    if (job.out_fd >= 0 && job.out_fd != job.tail_fd) {
+        close(job.out_fd);
+    }
+    if (job.tail_fd >= 0) {
+        close(job.tail_fd);
     }
     
     /* if there is an error code, exit with status 1 */
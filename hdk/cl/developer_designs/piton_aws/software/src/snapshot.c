@@ -0,0 +1,415 @@
+/*
+ * Amazon FPGA Hardware Development Kit
+ *
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Amazon Software License (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *    http://aws.amazon.com/asl/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on
+ * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <limits.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+#include <fpga_dma.h>
+#include <utils/lcd.h>
+#include <utils/io.h>
+
+#include "dma_os.h"
+#include "piton_aws.h"
+#include "snapshot.h"
+
+/*
+ * Snapshot and restore run one worker per XDMA channel. Workers claim chunks
+ * in order, read and hash them on their c2h queue and compare the hash with
+ * the manifest: a snapshot writes changed chunks to the image file, a
+ * restore writes changed chunks from the image file back to DRAM.
+ */
+struct snapshot_job {
+    bool restore;
+    size_t begin;
+    size_t size;
+    size_t chunk_size;
+    uint64_t n_chunks;
+    /* hashes of the existing manifest, NULL if there is none */
+    const uint64_t *old_hashes;
+    /* hashes of the DRAM contents, filled in by the workers */
+    uint64_t *new_hashes;
+    int image_fd;
+    uint64_t next_chunk;
+    uint64_t dirty_chunks;
+    uint64_t dirty_bytes;
+    volatile bool failed;
+};
+
+struct snapshot_worker {
+    pthread_t thread;
+    int channel;
+    int read_fd;
+    int write_fd;
+    uint8_t *buffer;
+    struct snapshot_job *job;
+};
+
+static int snapshot_manifest_name(const char *image_filename, char *name, size_t len) {
+    int rc = snprintf(name, len, "%s" SNAPSHOT_MANIFEST_EXT, image_filename);
+    return (rc < 0 || (size_t)rc >= len) ? -ENAMETOOLONG : 0;
+}
+
+/* read a manifest, *hashes is allocated and owned by the caller on success */
+static int snapshot_manifest_read(const char *image_filename,
+    struct snapshot_header *hdr, uint64_t **hashes) {
+    int rc;
+    int fd = -1;
+    char name[PATH_MAX];
+
+    *hashes = NULL;
+    rc = snapshot_manifest_name(image_filename, name, sizeof(name));
+    fail_on(rc, out, "Snapshot file name too long");
+
+    fd = open(name, O_RDONLY);
+    if (fd < 0) {
+        rc = -errno;
+        errno = 0;
+        goto out;
+    }
+
+    rc = read_loop(fd, hdr, sizeof(*hdr));
+    fail_on((rc = rc ? -EIO : 0), out, "Unable to read %s", name);
+    fail_on((rc = (hdr->magic != SNAPSHOT_MAGIC ||
+        hdr->version != SNAPSHOT_VERSION || hdr->chunk_size == 0 ||
+        hdr->n_chunks != (hdr->size + hdr->chunk_size - 1) / hdr->chunk_size) ?
+        -EINVAL : 0), out, "%s is not a valid snapshot manifest", name);
+
+    *hashes = malloc(hdr->n_chunks * sizeof(uint64_t));
+    fail_on((rc = (*hashes == NULL) ? -ENOMEM : 0), out, "Unable to allocate hashes");
+
+    rc = read_loop(fd, *hashes, hdr->n_chunks * sizeof(uint64_t));
+    fail_on((rc = rc ? -EIO : 0), out, "Unable to read %s", name);
+
+out:
+    if (rc && *hashes) {
+        free(*hashes);
+        *hashes = NULL;
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    return rc;
+}
+
+/* write the manifest next to the image, replacing the old one atomically */
+static int snapshot_manifest_write(const char *image_filename,
+    const struct snapshot_header *hdr, const uint64_t *hashes) {
+    int rc;
+    int fd = -1;
+    char name[PATH_MAX];
+    char tmp_name[PATH_MAX];
+
+    rc = snapshot_manifest_name(image_filename, name, sizeof(name));
+    fail_on(rc, out, "Snapshot file name too long");
+    rc = snprintf(tmp_name, sizeof(tmp_name), "%s.tmp", name);
+    fail_on((rc = (rc < 0 || (size_t)rc >= sizeof(tmp_name)) ? -ENAMETOOLONG : 0),
+        out, "Snapshot file name too long");
+
+    fd = open(tmp_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    fail_on((rc = (fd < 0) ? -errno : 0), out, "Unable to open %s", tmp_name);
+
+    rc = write_loop(fd, hdr, sizeof(*hdr));
+    fail_on((rc = rc ? -EIO : 0), out, "Unable to write %s", tmp_name);
+    rc = write_loop(fd, hashes, hdr->n_chunks * sizeof(uint64_t));
+    fail_on((rc = rc ? -EIO : 0), out, "Unable to write %s", tmp_name);
+    rc = fsync(fd);
+    fail_on((rc = rc ? -errno : 0), out, "Unable to flush %s", tmp_name);
+
+    rc = rename(tmp_name, name);
+    fail_on((rc = rc ? -errno : 0), out, "Unable to rename %s", tmp_name);
+
+out:
+    if (fd >= 0) {
+        close(fd);
+    }
+    return rc;
+}
+
+/*
+ * Remove the manifest before snapshot_save modifies the image, so that an
+ * interrupted snapshot leaves an image without a manifest: restore refuses
+ * it and the next snapshot rewrites it in full. The directory is synced so that the
+ * removal is durable before the first chunk lands in the image.
+ */
+static int snapshot_manifest_remove(const char *image_filename) {
+    int rc;
+    int dir_fd = -1;
+    char name[PATH_MAX];
+    char dir[PATH_MAX];
+
+    rc = snapshot_manifest_name(image_filename, name, sizeof(name));
+    fail_on(rc, out, "Snapshot file name too long");
+
+    rc = unlink(name);
+    if (rc && errno == ENOENT) {
+        errno = 0;
+        rc = 0;
+        goto out;
+    }
+    fail_on((rc = rc ? -errno : 0), out, "Unable to remove %s", name);
+
+    /* dirname may modify its argument */
+    strcpy(dir, name);
+    dir_fd = open(dirname(dir), O_RDONLY | O_DIRECTORY);
+    fail_on((rc = (dir_fd < 0) ? -errno : 0), out, "Unable to open the directory of %s",
+        name);
+    rc = fsync(dir_fd);
+    fail_on((rc = rc ? -errno : 0), out, "Unable to flush the directory of %s", name);
+
+out:
+    if (dir_fd >= 0) {
+        close(dir_fd);
+    }
+    return rc;
+}
+
+static void *snapshot_worker(void *arg) {
+    int rc;
+    struct snapshot_worker *worker = arg;
+    struct snapshot_job *job = worker->job;
+
+    while (!job->failed) {
+        uint64_t chunk = __atomic_fetch_add(&job->next_chunk, 1, __ATOMIC_RELAXED);
+        if (chunk >= job->n_chunks) {
+            break;
+        }
+        size_t offset = chunk * job->chunk_size;
+        size_t len = min(job->chunk_size, job->size - offset);
+        size_t addr = job->begin + offset;
+
+        rc = fpga_dma_burst_read(worker->read_fd, worker->buffer, len, addr);
+        if (rc) {
+            log_error("DMA read failed on channel %d at 0x%zx", worker->channel, addr);
+            goto fail;
+        }
+
+        uint64_t hash = buffer_hash(worker->buffer, len, 0);
+        job->new_hashes[chunk] = hash;
+        if (job->old_hashes && job->old_hashes[chunk] == hash) {
+            continue;
+        }
+
+        if (!job->restore) {
+            if (pwrite(job->image_fd, worker->buffer, len, offset) != (ssize_t)len) {
+                log_error("Unable to write the snapshot at offset 0x%zx", offset);
+                goto fail;
+            }
+        } else {
+            if (pread(job->image_fd, worker->buffer, len, offset) != (ssize_t)len) {
+                log_error("Unable to read the snapshot at offset 0x%zx", offset);
+                goto fail;
+            }
+            rc = fpga_dma_burst_write(worker->write_fd, worker->buffer, len, addr);
+            if (rc) {
+                log_error("DMA write failed on channel %d at 0x%zx", worker->channel, addr);
+                goto fail;
+            }
+        }
+
+        __atomic_fetch_add(&job->dirty_chunks, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&job->dirty_bytes, len, __ATOMIC_RELAXED);
+    }
+
+    return NULL;
+fail:
+    job->failed = true;
+    return NULL;
+}
+
+static int snapshot_run(struct piton_aws *ctx, int slot_id, struct snapshot_job *job,
+    int n_channels) {
+    int rc = 0;
+    int n_started = 0;
+    struct snapshot_worker workers[DMA_OS_CHANNELS_MAX];
+    struct fpga_dma_buffer mem = { 0 };
+    struct timespec t0, t1;
+
+    memset(workers, 0, sizeof(workers));
+
+    fail_on((rc = (n_channels < 1 || n_channels > DMA_OS_CHANNELS_MAX) ? -EINVAL : 0),
+        out, "Invalid channel count %d", n_channels);
+
+    /* one chunk buffer per channel, on the NUMA node of the slot */
+    rc = fpga_dma_buffer_alloc(slot_id, job->chunk_size * n_channels, &mem);
+    fail_on(rc, out, "Unable to allocate chunk buffers");
+
+    for (int i = 0; i < n_channels; i++) {
+        struct snapshot_worker *worker = &workers[i];
+        worker->channel = i;
+        worker->job = job;
+        worker->read_fd = piton_aws_dma_fd(ctx, slot_id, i, /*is_read*/ true);
+        fail_on((rc = (worker->read_fd < 0) ? -1 : 0), out,
+            "unable to open read dma queue %d", i);
+        if (job->restore) {
+            worker->write_fd = piton_aws_dma_fd(ctx, slot_id, i, /*is_read*/ false);
+            fail_on((rc = (worker->write_fd < 0) ? -1 : 0), out,
+                "unable to open write dma queue %d", i);
+        }
+        worker->buffer = mem.data + job->chunk_size * i;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int i = 0; i < n_channels; i++) {
+        rc = pthread_create(&workers[i].thread, NULL, snapshot_worker, &workers[i]);
+        if (rc) {
+            log_error("Unable to start snapshot worker %d", i);
+            job->failed = true;
+            break;
+        }
+        n_started++;
+    }
+    for (int i = 0; i < n_started; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    rc = job->failed ? 1 : 0;
+    if (!rc) {
+        double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+        log_info("%s: %" PRIu64 "/%" PRIu64 " chunks (%" PRIu64 " bytes) changed, "
+            "scanned %.3f GB/s", job->restore ? "Restore" : "Snapshot",
+            job->dirty_chunks, job->n_chunks, job->dirty_bytes,
+            (secs > 0) ? job->size / secs / 1e9 : 0.0);
+    }
+
+out:
+    fpga_dma_buffer_free(&mem);
+    return rc;
+}
+
+int snapshot_save(struct piton_aws *ctx, int slot_id, size_t begin, size_t end,
+    const char *image_filename, const struct snapshot_opts *opts) {
+    int rc;
+    struct stat st;
+    struct snapshot_header old_hdr;
+    uint64_t *old_hashes = NULL;
+    struct snapshot_header hdr = {
+        .magic = SNAPSHOT_MAGIC,
+        .version = SNAPSHOT_VERSION,
+        .begin = begin,
+        .size = end - begin,
+        .chunk_size = opts->chunk_size,
+    };
+    struct snapshot_job job = {
+        .begin = begin,
+        .size = end - begin,
+        .chunk_size = opts->chunk_size,
+        .image_fd = -1,
+    };
+
+    fail_on((rc = (end <= begin || opts->chunk_size == 0 ||
+        opts->chunk_size % DMA_OS_BUFFER_ALIGN != 0) ? -EINVAL : 0), out,
+        "Wrong snapshot params");
+    hdr.n_chunks = job.n_chunks = (hdr.size + hdr.chunk_size - 1) / hdr.chunk_size;
+
+    /* an earlier snapshot of the same range makes this one incremental */
+    if (snapshot_manifest_read(image_filename, &old_hdr, &old_hashes) == 0 &&
+        stat(image_filename, &st) == 0 && (uint64_t)st.st_size == old_hdr.size &&
+        old_hdr.begin == hdr.begin && old_hdr.size == hdr.size &&
+        old_hdr.chunk_size == hdr.chunk_size) {
+        log_info("Updating snapshot %s incrementally", image_filename);
+        job.old_hashes = old_hashes;
+    } else {
+        log_info("Creating snapshot %s", image_filename);
+    }
+    errno = 0;
+
+    job.new_hashes = calloc(job.n_chunks, sizeof(uint64_t));
+    fail_on((rc = (job.new_hashes == NULL) ? -ENOMEM : 0), out,
+        "Unable to allocate hashes");
+
+    rc = snapshot_manifest_remove(image_filename);
+    fail_on(rc, out, "Unable to invalidate the snapshot manifest");
+
+    job.image_fd = open(image_filename,
+        O_WRONLY | O_CREAT | (job.old_hashes ? 0 : O_TRUNC), 0644);
+    fail_on((rc = (job.image_fd < 0) ? -errno : 0), out, "Unable to open %s",
+        image_filename);
+    rc = ftruncate(job.image_fd, hdr.size);
+    fail_on((rc = rc ? -errno : 0), out, "Unable to size %s", image_filename);
+
+    rc = snapshot_run(ctx, slot_id, &job, opts->n_channels);
+    fail_on(rc, out, "Snapshot failed");
+
+    /* the manifest only describes an image which is on disk */
+    rc = fdatasync(job.image_fd);
+    fail_on((rc = rc ? -errno : 0), out, "Unable to flush %s", image_filename);
+
+    rc = snapshot_manifest_write(image_filename, &hdr, job.new_hashes);
+    fail_on(rc, out, "Unable to write the snapshot manifest");
+
+out:
+    if (job.image_fd >= 0) {
+        close(job.image_fd);
+    }
+    free(job.new_hashes);
+    free(old_hashes);
+    return (rc != 0 ? 1 : 0);
+}
+
+int snapshot_restore(struct piton_aws *ctx, int slot_id, const char *image_filename,
+    const struct snapshot_opts *opts) {
+    int rc;
+    struct snapshot_header hdr;
+    uint64_t *hashes = NULL;
+    struct snapshot_job job = {
+        .restore = true,
+        .image_fd = -1,
+    };
+
+    rc = snapshot_manifest_read(image_filename, &hdr, &hashes);
+    fail_on(rc, out, "Unable to read the manifest of %s", image_filename);
+
+    job.begin = hdr.begin;
+    job.size = hdr.size;
+    job.chunk_size = hdr.chunk_size;
+    job.n_chunks = hdr.n_chunks;
+    job.old_hashes = hashes;
+    job.new_hashes = calloc(job.n_chunks, sizeof(uint64_t));
+    fail_on((rc = (job.new_hashes == NULL) ? -ENOMEM : 0), out,
+        "Unable to allocate hashes");
+
+    job.image_fd = open(image_filename, O_RDONLY);
+    fail_on((rc = (job.image_fd < 0) ? -errno : 0), out, "Unable to open %s",
+        image_filename);
+
+    log_info("Restoring 0x%zx-0x%zx from %s", job.begin, job.begin + job.size,
+        image_filename);
+
+    rc = snapshot_run(ctx, slot_id, &job, opts->n_channels);
+    fail_on(rc, out, "Restore failed");
+
+out:
+    if (job.image_fd >= 0) {
+        close(job.image_fd);
+    }
+    free(job.new_hashes);
+    free(hashes);
+    return (rc != 0 ? 1 : 0);
+}
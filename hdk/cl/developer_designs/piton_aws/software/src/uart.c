@@ -14,6 +14,7 @@
 // limitations under the License.
 #include <stdio.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <stdbool.h>
 #include <stdarg.h>
 #include <assert.h>
@@ -26,63 +27,145 @@
 #include <stdlib.h>
 #include <fcntl.h>
 #include <time.h>
+#include <poll.h>
+#include <getopt.h>
 
 #include <utils/sh_dpi_tasks.h>
 #include <fpga_pci.h>
 #include <fpga_mgmt.h>
+#include <fpga_dma.h>
 #include <utils/lcd.h>
+#include <utils/io.h>
 
 #include "uart.h"
+#include "piton_aws.h"
 
-/*
- * pci_vendor_id and pci_device_id values below are Amazon's and avaliable to use for a given FPGA slot. 
- * Users may replace these with their own if allocated to them by PCI SIG
- */
-static uint16_t pci_vendor_id = 0x1D0F; /* Amazon PCI Vendor ID */
-static uint16_t pci_device_id = 0xF001; /* PCI Device ID preassigned by Amazon for F1 applications */
-
-
+/* uart2 is built from this file with the second console's BAR */
+#ifndef UART_PF_BAR
+#define UART_PF_BAR APP_PF_BAR0
+#endif
 
 /*
- * check if the corresponding AFI for hello_world is loaded
+ * State shared by the inbound and outbound halves of the console bridge
  */
-int check_afi_ready(int slot_id);
+struct uart_bridge {
+    pci_bar_handle_t pci_bar_handle;
+    struct uart_bar bar;
+    int pty_fd;
+    /* XDMA user interrupt events device, -1 to poll the LSR when idle */
+    int events_fd;
+    /* upper bound of the idle polling backoff */
+    unsigned int poll_max_us;
+    struct uart_speed speed;
+    /* run the throughput benchmark for this many seconds instead of bridging */
+    unsigned int bench_secs;
+};
 
 void usage(char* program_name) {
-    fprintf(stderr, "usage: %s [--slot <slot-id>][<poke-value>]\n", program_name);
+    fprintf(stderr, "usage: %s [--slot <slot-id>] [--irq <user-irq>] [--poll-max-us <us>]\n"
+            "       [--baud <rate> | --divisor <n> | --fast] [--clock-mhz <mhz>]\n"
+            "       [--bench <seconds>]\n"
+            "--irq waits on /dev/xdmaN_events_<user-irq> instead of polling when idle\n"
+            "--poll-max-us bounds the idle polling backoff (default %d), it is capped\n"
+            "at the time the %d byte receive FIFO takes to fill at the configured baud\n"
+            "--baud and --divisor set the line speed (default divisor %d), --fast\n"
+            "uses divisor 1, the highest rate the UART clock (default %u MHz)\n"
+            "supports. The Piton side has to be configured for the same rate.\n"
+            "--bench sends a test pattern instead of opening a pty and reports the\n"
+            "chars/sec sent and received against the line rate\n",
+            program_name, UART_POLL_MAX_US, UART_FIFO_DEPTH, UART_DIVISOR_DEFAULT,
+            UART_CLOCK_HZ / 1000000);
 }
 
 static pthread_t thread1, thread2;
-int pty_fd;
-
-int start_transmission(int slot_id, int pf_id, int bar_id);
+static struct uart_bridge bridge = {
+    .pci_bar_handle = PCI_BAR_HANDLE_INIT,
+    .pty_fd = -1,
+    .events_fd = -1,
+    .poll_max_us = UART_POLL_MAX_US,
+    .speed = {
+        .clock_hz = UART_CLOCK_HZ,
+        .divisor = UART_DIVISOR_DEFAULT,
+    },
+};
+
+int start_transmission(int slot_id, int pf_id, int bar_id, int irq);
 void fail_thread(int rc, const char* err_msg);
-void* inbound_handler(void* pci_bar_handle_ptr);
-void* outbound_handler(void* pci_bar_handle_ptr);
+void* inbound_handler(void* bridge_ptr);
+void* outbound_handler(void* bridge_ptr);
 
 static void term_handler(int sig) {
     pthread_cancel(thread1);     
     pthread_cancel(thread2);     
-    close(pty_fd);
+    close(bridge.pty_fd);
 }
 
 
 int main(int argc, char **argv) {
     int slot_id = 0;
+    int irq = -1;
+    int opt;
     int rc;
+    struct piton_aws ctx;
+
+    static struct option long_options[] = {
+        {"slot",        required_argument, 0, 'S'},
+        {"irq",         required_argument, 0, 'i'},
+        {"poll-max-us", required_argument, 0, 'p'},
+        {"baud",        required_argument, 0, 'B'},
+        {"divisor",     required_argument, 0, 'D'},
+        {"fast",        no_argument,       0, 'F'},
+        {"clock-mhz",   required_argument, 0, 'C'},
+        {"bench",       required_argument, 0, 'b'},
+        {0, 0, 0, 0}
+    };
+
+    while ((opt = getopt_long(argc, argv, "S:i:p:B:D:FC:b:", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'S':
+            slot_id = atoi(optarg);
+            break;
+        case 'i':
+            irq = atoi(optarg);
+            break;
+        case 'p':
+            bridge.poll_max_us = max(atoi(optarg), UART_POLL_MIN_US);
+            break;
+        case 'B':
+            bridge.speed.baud = strtoul(optarg, NULL, 0);
+            break;
+        case 'D':
+            bridge.speed.baud = 0;
+            bridge.speed.divisor = strtoul(optarg, NULL, 0);
+            break;
+        case 'F':
+            bridge.speed.baud = 0;
+            bridge.speed.divisor = 1;
+            break;
+        case 'C':
+            bridge.speed.clock_hz = strtoul(optarg, NULL, 0) * 1000000;
+            break;
+        case 'b':
+            bridge.bench_secs = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
 
-    /* initialize the fpga_pci library so we could have access to FPGA PCIe from this applications */
-    rc = fpga_pci_init();
-    fail_on(rc, out, "Unable to initialize the fpga_pci library");
+    rc = uart_resolve_speed(&bridge.speed);
+    fail_on(rc, out, "Unsupported line speed");
+    bridge.poll_max_us = min(bridge.poll_max_us, uart_fifo_fill_us(&bridge.speed));
 
-    /* initialize the fpga_plat library */
-    rc = fpga_mgmt_init();
-    fail_on(rc, out, "Unable to initialize the fpga_mgmt library");
+    /* initialize the fpga_pci and fpga_plat libraries */
+    rc = piton_aws_open(&ctx);
+    fail_on(rc, out, "Unable to initialize the fpga libraries");
 
-    rc = check_afi_ready(slot_id);
+    rc = piton_aws_slot_ready(&ctx, slot_id);
     fail_on(rc, out, "AFI not ready");
     
-    rc = start_transmission(slot_id, FPGA_APP_PF, APP_PF_BAR0);
+    rc = start_transmission(slot_id, FPGA_APP_PF, UART_PF_BAR, irq);
     fail_on(rc, out, "transmission couldn't start");
 
     return rc;
@@ -90,135 +173,105 @@ out:
     return 1;
 }
 
- int check_afi_ready(int slot_id) {
-    struct fpga_mgmt_image_info info = {0}; 
-    int rc;
-
-    /* get local image description, contains status, vendor id, and device id. */
-    rc = fpga_mgmt_describe_local_image(slot_id, &info,0);
-    fail_on(rc, out, "Unable to get AFI information from slot %d. Are you running as root?",slot_id);
+static double uart_now(void) {
+    struct timespec ts;
 
-    /* check to see if the slot is ready */
-    if (info.status != FPGA_STATUS_LOADED) {
-        rc = 1;
-        fail_on(rc, out, "AFI in Slot %d is not in READY state !", slot_id);
-    }
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
 
-    /* confirm that the AFI that we expect is in fact loaded */
-    if (info.spec.map[FPGA_APP_PF].vendor_id != pci_vendor_id ||
-       info.spec.map[FPGA_APP_PF].device_id != pci_device_id) {
-     fprintf(stderr, "AFI does not show expected PCI vendor id and device ID. If the AFI "
-            "was just loaded, it might need a rescan. Rescanning now.\n");
-
-     rc = fpga_pci_rescan_slot_app_pfs(slot_id);
-     fail_on(rc, out, "Unable to update PF for slot %d",slot_id);
-     /* get local image description, contains status, vendor id, and device id. */
-     rc = fpga_mgmt_describe_local_image(slot_id, &info,0);
-     fail_on(rc, out, "Unable to get AFI information from slot %d",slot_id);
-
-
-     /* confirm that the AFI that we expect is in fact loaded after rescan */
-     if (info.spec.map[FPGA_APP_PF].vendor_id != pci_vendor_id ||
-         info.spec.map[FPGA_APP_PF].device_id != pci_device_id) {
-       rc = 1;
-       fail_on(rc, out, "The PCI vendor id and device of the loaded AFI are not "
-               "the expected values.");
-     }
+/*
+ * Keep the transmit FIFO full with a test pattern for bench_secs and count
+ * what comes back on the receive side, e.g. when Piton echoes the console.
+ * At 8N1 a character takes 10 bit times, so the line rate is baud / 10.
+ */
+static int uart_bench(struct uart_bridge *bridge) {
+    int rc = 0;
+    uint8_t pattern[UART_FIFO_DEPTH];
+    uint8_t buffer[UART_BURST_SIZE];
+    uint64_t tx = 0, rx = 0;
+    double start, elapsed;
+
+    for (size_t i = 0; i < sizeof(pattern); i++) {
+        pattern[i] = 'a' + i;
     }
 
-    return rc;
- out:
-    return 1;
- }
-
-int init_uart(pci_bar_handle_t pci_bar_handle) {
-    /* init uart regs */
-    int rc;
+    start = uart_now();
+    do {
+        size_t n = 0;
 
-    rc = fpga_pci_poke(pci_bar_handle, IER_ADDR, UINT32_C(0));
-    fail_on(rc, out, "Unable to write to the fpga !");
+        rc = uart_write_fifo(&bridge->bar, pattern, sizeof(pattern), &n);
+        fail_on(rc, out, "Unable to write to the fpga !");
+        tx += n;
 
-    rc = fpga_pci_poke(pci_bar_handle, FCR_ADDR, UINT32_C(0));
-    fail_on(rc, out, "Unable to write to the fpga !");
-    
-    rc = fpga_pci_poke(pci_bar_handle, FCR_ADDR, FCR_XMIT_RESET|FCR_RCVR_RESET);
-    fail_on(rc, out, "Unable to write to the fpga !");
+        rc = uart_read_fifo(&bridge->bar, buffer, sizeof(buffer), &n);
+        fail_on(rc, out, "Unable to read from the fpga !");
+        rx += n;
 
-    rc = fpga_pci_poke(pci_bar_handle, FCR_ADDR, FCR_FIFO_ENABLE);
-    fail_on(rc, out, "Unable to write to the fpga !");
+        elapsed = uart_now() - start;
+    } while (elapsed < bridge->bench_secs);
 
-    rc = fpga_pci_poke(pci_bar_handle, LCR_ADDR, LCR_DLAB | LCR_8N1);
-    fail_on(rc, out, "Unable to write to the fpga !");
-
-    rc = fpga_pci_poke(pci_bar_handle, DLL_ADDR, 66);
-    fail_on(rc, out, "Unable to write to the fpga !");
-
-    rc = fpga_pci_poke(pci_bar_handle, DLM_ADDR, 0);
-    fail_on(rc, out, "Unable to write to the fpga !");
-    
-    rc = fpga_pci_poke(pci_bar_handle, LCR_ADDR, LCR_8N1);
-    fail_on(rc, out, "Unable to write to the fpga !");
+    fprintf(stdout, "line rate %.0f chars/sec\n"
+            "tx %" PRIu64 " chars, %.0f chars/sec (%.1f%%)\n"
+            "rx %" PRIu64 " chars, %.0f chars/sec (%.1f%%)\n",
+            bridge->speed.baud / 10.0,
+            tx, tx / elapsed, 100.0 * tx / elapsed / (bridge->speed.baud / 10.0),
+            rx, rx / elapsed, 100.0 * rx / elapsed / (bridge->speed.baud / 10.0));
 
-    /* if there is an error code, exit with status 1 */
 out:
     return (rc != 0 ? 1 : 0);
 }
 
-int open_pty_pair (int *amaster, char** slave_name) {
-    int master;
-    char *name;
-
-    master = getpt ();
-    if (master < 0)
-        return errno;
-
-    if (grantpt (master) < 0 || unlockpt (master) < 0)
-        goto close_master;
-    
-    name = ptsname (master);
-    if (name == NULL)
-        goto close_master;
-
-    *amaster = master;
-    *slave_name = name;
-    return 0;
-
-close_master:
-    close (master);
-    return errno;
-}
-
 /*
  * An example to attach to an arbitrary slot, pf, and bar with register access.
  */
-int start_transmission(int slot_id, int pf_id, int bar_id) {
+int start_transmission(int slot_id, int pf_id, int bar_id, int irq) {
     int rc;
-    pci_bar_handle_t pci_bar_handle = PCI_BAR_HANDLE_INIT;
 
     /* attach to the fpga, with a pci_bar_handle out param */
-    rc = fpga_pci_attach(slot_id, pf_id, bar_id, 0, &pci_bar_handle);
+    rc = fpga_pci_attach(slot_id, pf_id, bar_id, 0, &bridge.pci_bar_handle);
     fail_on(rc, out, "Unable to attach to the AFI on slot id %d", slot_id);
 
-    rc = init_uart(pci_bar_handle);
+    rc = uart_bar_view(bridge.pci_bar_handle, &bridge.bar);
+    fail_on(rc, out, "Unable to map the uart registers");
+
+    if (irq >= 0) {
+        bridge.events_fd = open_events(slot_id, irq);
+        fail_on((rc = (bridge.events_fd < 0) ? 1 : 0), out, "Unable to open the events device");
+    }
+
+    /* the receive interrupt is only enabled when somebody waits for it */
+    rc = init_uart(bridge.pci_bar_handle, (irq >= 0) ? IER_ERBFI : UINT32_C(0),
+        bridge.speed.divisor);
     fail_on(rc, out, "Unable to init uart regs");
-    
+    fprintf(stdout, "uart running at %u baud (divisor %u)\n", bridge.speed.baud,
+        bridge.speed.divisor);
+
+    if (bridge.bench_secs) {
+        rc = uart_bench(&bridge);
+        goto out;
+    }
+
     signal(SIGTERM, term_handler);
 
     char* slave_name = NULL;
-    rc = open_pty_pair(&pty_fd, &slave_name);
+    rc = open_pty_pair(&bridge.pty_fd, &slave_name);
     fail_on(rc, out, "Unable to get pty pair !");
     fprintf(stdout, "terminal is open at %s\n", slave_name);
     
-    pthread_create( &thread1, NULL, &inbound_handler,  (void*) &pci_bar_handle);
-    pthread_create( &thread2, NULL, &outbound_handler, (void*) &pci_bar_handle);
+    pthread_create( &thread1, NULL, &inbound_handler,  (void*) &bridge);
+    pthread_create( &thread2, NULL, &outbound_handler, (void*) &bridge);
 
     pthread_join(thread1, NULL);
     pthread_join(thread2, NULL);
 
 out:
     /* clean up */
-    if (pci_bar_handle >= 0) {
-        rc = fpga_pci_detach(pci_bar_handle);
+    if (bridge.events_fd >= 0) {
+        close(bridge.events_fd);
+    }
+    if (bridge.pci_bar_handle >= 0) {
+        rc = fpga_pci_detach(bridge.pci_bar_handle);
         if (rc) {
             fprintf(stderr, "Failure while detaching from the fpga.\n");
         }
@@ -228,23 +281,48 @@ out:
     return (rc != 0 ? 1 : 0);
 }
 
-void* inbound_handler(void* pci_bar_handle_ptr)  {
+/*
+ * Wait for the receive side to have something to do. With an events device
+ * this blocks on the interrupt; the timeout covers interrupts that are not
+ * wired up in the CL. Without one, the poll interval doubles on every idle
+ * round up to poll_max_us, and is reset as soon as data shows up.
+ */
+static void uart_idle_wait(struct uart_bridge *bridge, unsigned int *backoff_us) {
+    if (bridge->events_fd >= 0) {
+        struct pollfd pfd = { .fd = bridge->events_fd, .events = POLLIN };
+        uint32_t events;
+
+        if (poll(&pfd, 1, UART_EVENTS_TIMEOUT_MS) > 0 &&
+            read(bridge->events_fd, &events, sizeof(events)) != sizeof(events)) {
+            fail_thread(1, "Unable to read the events device !");
+        }
+        return;
+    }
+
+    usleep(*backoff_us);
+    *backoff_us = min(*backoff_us * 2, bridge->poll_max_us);
+}
+
+void* inbound_handler(void* bridge_ptr)  {
     int rc;
-    pci_bar_handle_t pci_bar_handle = * ((pci_bar_handle_t*) pci_bar_handle_ptr);
+    struct uart_bridge *bridge = bridge_ptr;
+    uint8_t buffer[UART_BURST_SIZE];
+    unsigned int backoff_us = UART_POLL_MIN_US;
+
     while (1) {
-        /* Read a value */
-        uint32_t value;
-        uint32_t drdy = 0;
-        do {
-            uint32_t tmp = 0;
-            rc = fpga_pci_peek(pci_bar_handle, LSR_ADDR, &tmp);
-            fail_thread(rc, "Unable to read read from the fpga !");
-            drdy = tmp & LSR_DRDY;
-        } while (!drdy);
-
-        rc = fpga_pci_peek(pci_bar_handle, RBR_ADDR, &value);
+        size_t n = 0;
+
+        /* drain the receive FIFO for as long as data is ready */
+        rc = uart_read_fifo(&bridge->bar, buffer, sizeof(buffer), &n);
         fail_thread(rc, "Unable to read read from the fpga !");
-	if (!write(pty_fd, &value, 1)) {
+
+        if (n == 0) {
+            uart_idle_wait(bridge, &backoff_us);
+            continue;
+        }
+        backoff_us = UART_POLL_MIN_US;
+
+        if (write_loop(bridge->pty_fd, buffer, n)) {
             rc = 1;
             fail_thread(rc, "Unable to write to stream!");
         }
@@ -252,26 +330,44 @@ void* inbound_handler(void* pci_bar_handle_ptr)  {
     return NULL;
 }
 
-void* outbound_handler(void* pci_bar_handle_ptr) {
+void* outbound_handler(void* bridge_ptr) {
     int rc;
-    pci_bar_handle_t pci_bar_handle = * ((pci_bar_handle_t*) pci_bar_handle_ptr);
+    struct uart_bridge *bridge = bridge_ptr;
+    uint8_t buffer[UART_BURST_SIZE];
+
     while (1) {
-        char c;
-	if (!read(pty_fd, &c, 1)) {
+        ssize_t n = read(bridge->pty_fd, buffer, sizeof(buffer));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && errno == EIO) {
+            /* the last terminal detached from the pty, wait for the next one */
+            msleep(UART_HANGUP_WAIT_MS);
+            continue;
+        }
+        if (n <= 0) {
             rc = 1;
-            fail_thread(rc, "Unable to write to stream!");
+            fail_thread(rc, "Unable to read from stream!");
+        }
+
+        /*
+         * The transmitter drains a full FIFO in UART_FIFO_DEPTH character
+         * times, so the backoff is kept short to not leave the line idle.
+         */
+        unsigned int backoff_us = UART_POLL_MIN_US;
+        for (ssize_t i = 0; i < n; ) {
+            size_t sent = 0;
+
+            rc = uart_write_fifo(&bridge->bar, buffer + i, n - i, &sent);
+            fail_thread(rc, "Unable to write to the fpga !");
+            if (sent == 0) {
+                usleep(backoff_us);
+                backoff_us = min(backoff_us * 2, (unsigned int) UART_TX_POLL_MAX_US);
+                continue;
+            }
+            backoff_us = UART_POLL_MIN_US;
+            i += sent;
         }
-        /* Send a value */
-        uint32_t temt = 0;
-        do {
-            uint32_t tmp = 0;
-            rc = fpga_pci_peek(pci_bar_handle, LSR_ADDR, &tmp);
-            fail_thread(rc, "Unable to read read from the fpga !");
-            temt = tmp & LSR_TEMT;
-        } while (!temt);
-
-        rc = fpga_pci_poke(pci_bar_handle, THR_ADDR, (uint32_t) c);
-        fail_thread(rc, "Unable to write to the fpga !");
     }
     return NULL;
 }
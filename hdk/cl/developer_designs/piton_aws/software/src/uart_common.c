@@ -0,0 +1,213 @@
+// Amazon FPGA Hardware Development Kit
+//
+// Copyright 2016 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Amazon Software License (the "License"). You may not use
+// this file except in compliance with the License. A copy of the License is
+// located at
+//
+//    http://aws.amazon.com/asl/
+//
+// or in the "license" file accompanying this file. This file is distributed on
+// an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, express or
+// implied. See the License for the specific language governing permissions and
+// limitations under the License.
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <limits.h>
+
+#include <fpga_pci.h>
+#include <fpga_mgmt.h>
+#include <fpga_dma.h>
+#include <utils/lcd.h>
+
+#include "uart.h"
+
+int init_uart(pci_bar_handle_t pci_bar_handle, uint32_t ier, uint32_t divisor) {
+    /* init uart regs */
+    int rc;
+    size_t failed_op;
+    const struct fpga_pci_reg_op init_ops[] = {
+        FPGA_PCI_REG_POKE(IER_ADDR, ier),
+        FPGA_PCI_REG_POKE(FCR_ADDR, UINT32_C(0)),
+        FPGA_PCI_REG_POKE(FCR_ADDR, FCR_XMIT_RESET|FCR_RCVR_RESET),
+        FPGA_PCI_REG_POKE(FCR_ADDR, FCR_FIFO_ENABLE),
+        FPGA_PCI_REG_POKE(LCR_ADDR, LCR_DLAB | LCR_8N1),
+        FPGA_PCI_REG_POKE(DLL_ADDR, divisor & 0xff),
+        FPGA_PCI_REG_POKE(DLM_ADDR, (divisor >> 8) & 0xff),
+        FPGA_PCI_REG_POKE(LCR_ADDR, LCR_8N1),
+    };
+
+    rc = fpga_pci_run_program(pci_bar_handle, init_ops, sizeof_array(init_ops), &failed_op);
+    fail_on(rc, out, "Unable to write to the fpga ! (register write %zu)", failed_op);
+
+    /* if there is an error code, exit with status 1 */
+out:
+    return (rc != 0 ? 1 : 0);
+}
+
+int uart_resolve_speed(struct uart_speed *speed) {
+    int rc = 0;
+
+    if (speed->baud) {
+        uint64_t rate = (uint64_t) speed->baud * 16;
+        uint64_t divisor = (speed->clock_hz + rate / 2) / rate;
+        uint64_t actual = divisor ? speed->clock_hz / (divisor * 16) : 0;
+        uint64_t error = (actual > speed->baud) ? actual - speed->baud : speed->baud - actual;
+
+        fail_on((rc = (divisor == 0 || divisor > 0xffff ||
+            error * 100 > (uint64_t) speed->baud * UART_BAUD_TOLERANCE_PCT) ? 1 : 0), out,
+            "No divisor of the %u Hz UART clock gives %u baud", speed->clock_hz, speed->baud);
+        speed->divisor = divisor;
+    }
+    fail_on((rc = (speed->divisor == 0 || speed->divisor > 0xffff) ? 1 : 0), out,
+        "Invalid divisor %u", speed->divisor);
+    speed->baud = speed->clock_hz / (speed->divisor * 16);
+
+out:
+    return (rc != 0 ? 1 : 0);
+}
+
+unsigned int uart_fifo_fill_us(const struct uart_speed *speed) {
+    /* 10 bit times per character at 8N1 */
+    uint64_t fill_us = UINT64_C(1000000) * UART_FIFO_DEPTH * 10 / speed->baud;
+
+    return max(fill_us, (uint64_t) UART_POLL_MIN_US);
+}
+
+int uart_bar_view(pci_bar_handle_t pci_bar_handle, struct uart_bar *bar) {
+    int rc;
+
+    bar->handle = pci_bar_handle;
+    bar->mapped = false;
+    rc = fpga_pci_get_bar_view(pci_bar_handle, &bar->view);
+    if (rc == -ENOTSUP) {
+        /* an emulated bar, fpga_pci_peek/poke check each access */
+        rc = 0;
+        goto out;
+    }
+    fail_on(rc, out, "Unable to get the view of the uart bar");
+
+    /* the FIFO accessors do not check their offsets, so check them all here */
+    fail_on((rc = fpga_pci_bar_view_fits(&bar->view, RBR_ADDR, SCR_ADDR + sizeof(uint32_t) - RBR_ADDR) ? 0 : 1),
+        out, "The uart registers are outside the bar");
+    bar->mapped = true;
+
+out:
+    return (rc != 0 ? 1 : 0);
+}
+
+static int uart_peek(const struct uart_bar *bar, uint64_t offset, uint32_t *value) {
+    if (bar->mapped) {
+        *value = fpga_pci_bar_view_peek(&bar->view, offset);
+        return 0;
+    }
+    return fpga_pci_peek(bar->handle, offset, value);
+}
+
+static int uart_poke(const struct uart_bar *bar, uint64_t offset, uint32_t value) {
+    if (bar->mapped) {
+        fpga_pci_bar_view_poke(&bar->view, offset, value);
+        return 0;
+    }
+    return fpga_pci_poke(bar->handle, offset, value);
+}
+
+int uart_read_fifo(const struct uart_bar *bar, uint8_t *buf, size_t size, size_t *n) {
+    int rc;
+    uint32_t lsr, rbr;
+
+    *n = 0;
+    rc = uart_peek(bar, LSR_ADDR, &lsr);
+    while (!rc && (lsr & LSR_DRDY) && *n < size) {
+        rc = uart_peek(bar, RBR_ADDR, &rbr);
+        fail_on(rc, out, "Unable to read the uart");
+        buf[(*n)++] = (uint8_t) rbr;
+        rc = uart_peek(bar, LSR_ADDR, &lsr);
+    }
+    fail_on(rc, out, "Unable to read the uart status");
+
+out:
+    return (rc != 0 ? 1 : 0);
+}
+
+int uart_write_fifo(const struct uart_bar *bar, const uint8_t *buf, size_t len, size_t *n) {
+    int rc;
+    uint32_t lsr;
+    size_t burst;
+
+    *n = 0;
+    rc = uart_peek(bar, LSR_ADDR, &lsr);
+    fail_on(rc, out, "Unable to read the uart status");
+    if (!(lsr & LSR_THRE)) {
+        goto out;
+    }
+
+    /* THRE means the transmit FIFO is empty, so a FIFO worth can go out */
+    burst = min(len, (size_t) UART_FIFO_DEPTH);
+    for (size_t i = 0; i < burst; i++) {
+        rc = uart_poke(bar, THR_ADDR, (uint32_t) buf[i]);
+        fail_on(rc, out, "Unable to write to the uart");
+        (*n)++;
+    }
+
+out:
+    return (rc != 0 ? 1 : 0);
+}
+
+int open_pty_pair (int *amaster, char** slave_name) {
+    int master;
+    char *name;
+
+    master = getpt ();
+    if (master < 0)
+        return errno;
+
+    if (grantpt (master) < 0 || unlockpt (master) < 0)
+        goto close_master;
+    
+    name = ptsname (master);
+    if (name == NULL)
+        goto close_master;
+
+    *amaster = master;
+    *slave_name = name;
+    return 0;
+
+close_master:
+    close (master);
+    return errno;
+}
+
+/*
+ * Open the XDMA events device of a user interrupt. Reads block until the
+ * interrupt fired at least once since the previous read.
+ */
+int open_events(int slot_id, int irq) {
+    int rc;
+    int fd;
+    int device_num;
+    char path[PATH_MAX];
+
+    rc = fpga_pci_get_dma_device_num(FPGA_DMA_XDMA, slot_id, &device_num);
+    fail_on(rc, out, "Unable to get the XDMA device number");
+
+    /* below the emulator root when running against fpga-emu */
+    rc = snprintf(path, sizeof(path), "%s/dev/xdma%d_events_%d",
+            fpga_pci_emu_root(), device_num, irq);
+    fail_on((rc = (rc < 0 || (size_t)rc >= sizeof(path)) ? 1 : 0), out,
+            "Unable to build the events device path");
+
+    fd = open(path, O_RDONLY);
+    fail_on((rc = (fd < 0) ? 1 : 0), out, "Unable to open %s", path);
+
+    fprintf(stdout, "waiting for uart interrupts on %s\n", path);
+    return fd;
+out:
+    return -1;
+}
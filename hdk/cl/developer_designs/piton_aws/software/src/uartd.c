@@ -0,0 +1,767 @@
+// Amazon FPGA Hardware Development Kit
+//
+// Copyright 2016 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Amazon Software License (the "License"). You may not use
+// this file except in compliance with the License. A copy of the License is
+// located at
+//
+//    http://aws.amazon.com/asl/
+//
+// or in the "license" file accompanying this file. This file is distributed on
+// an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, express or
+// implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * uartd (piton_aws console) bridges every Piton UART of every slot to a pty
+ * or a unix socket.
+ *
+ * Consoles are spread over a small pool of worker threads. Each worker owns
+ * an epoll fd, which watches the host side of its consoles (pty masters,
+ * listening sockets and their clients) and a timerfd. The UARTs have no fd
+ * to wait on, so the timer wakes the worker to drain the receive FIFOs; its
+ * interval doubles while all consoles are idle and is reset on traffic.
+ *
+ * Everything a console prints is also kept in a scrollback ring. The worker
+ * is the only writer, so readers (new socket clients, SIGUSR1 log dumps
+ * from the main thread) never take a lock.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <termios.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+
+#include <fpga_pci.h>
+#include <fpga_mgmt.h>
+#include <utils/lcd.h>
+#include <utils/io.h>
+
+#include "uart.h"
+#include "piton_aws.h"
+
+/*
+ * Scrollback ring. head counts every byte ever written and is published
+ * after the data, reserve is published before it. A reader copies up to
+ * head and then uses reserve to find out which part of its copy the writer
+ * may have overwritten meanwhile.
+ */
+struct console_ring {
+    uint8_t *data;
+    /* power of two */
+    size_t size;
+    uint64_t head;
+    uint64_t reserve;
+};
+
+struct console;
+
+/* an fd watched by a worker's epoll, arg.ptr points back to this struct */
+struct console_fd {
+    struct epoll_cb cb;
+    struct console *console;
+    bool polled;
+};
+
+struct console {
+    int slot_id;
+    int uart;
+    char name[32];
+    pci_bar_handle_t pci_bar_handle;
+    struct uart_bar bar;
+    struct uartd_worker *worker;
+
+    /* pty master or listening socket */
+    struct console_fd host;
+    /* the daemon keeps the pty slave open so the master never hangs up */
+    int pty_slave_fd;
+    char path[PATH_MAX];
+    struct console_fd clients[UARTD_CLIENTS_MAX];
+
+    /* host input waiting for the transmit FIFO */
+    uint8_t tx[UART_BURST_SIZE];
+    size_t tx_off;
+    size_t tx_len;
+    /* host input is not polled while tx is full */
+    bool paused;
+
+    struct console_ring scrollback;
+};
+
+struct uartd_worker {
+    pthread_t thread;
+    int epoll_fd;
+    struct console_fd timer;
+    struct console *consoles[UARTD_CONSOLES_MAX];
+    int n_consoles;
+    unsigned int poll_max_us;
+};
+
+struct uartd_opts {
+    /* bitmaps of the slots and UARTs to serve */
+    uint32_t slots;
+    uint32_t uarts;
+    int n_threads;
+    size_t scrollback_size;
+    unsigned int poll_max_us;
+    /* expose consoles as unix sockets in this directory instead of ptys */
+    const char *socket_dir;
+    /* directory for the scrollback dumps on SIGUSR1 */
+    const char *log_dir;
+    struct uart_speed speed;
+};
+
+static struct console consoles[UARTD_CONSOLES_MAX];
+static int n_consoles;
+static struct uartd_worker workers[UARTD_THREADS_MAX];
+static volatile bool uartd_stop;
+
+static void console_usage(const char* program_name) {
+    printf("usage: %s [--slot <slot-id>]... [--uart <0|1>]... [--threads <n>]\n"
+           "       [--socket-dir <dir>] [--scrollback <KB>] [--log-dir <dir>]\n"
+           "       [--poll-max-us <us>] [--baud <rate> | --divisor <n> | --fast]\n"
+           "       [--clock-mhz <mhz>]\n"
+           "Serves all UARTs of all slots with a loaded AFI unless --slot/--uart\n"
+           "restrict them. Consoles are ptys, or <dir>/slot<N>-uart<M>.sock with\n"
+           "--socket-dir. SIGUSR1 writes the scrollback of every console to\n"
+           "<log-dir>/slot<N>-uart<M>.log (default /tmp). The line speed options\n"
+           "are the same as uart's and apply to every console.\n",
+           program_name);
+}
+
+/* parse a --slot or --uart index, which has to be in [0, limit) */
+static int console_parse_index(const char *arg, int limit, int *index) {
+    char *end;
+    long value;
+
+    errno = 0;
+    value = strtol(arg, &end, 0);
+    if (errno || end == arg || *end != '\0' || value < 0 || value >= limit) {
+        errno = 0;
+        return -EINVAL;
+    }
+    *index = (int)value;
+    return 0;
+}
+
+static int ring_init(struct console_ring *ring, size_t size) {
+    ring->size = 1;
+    while (ring->size < size) {
+        ring->size <<= 1;
+    }
+    ring->head = 0;
+    ring->reserve = 0;
+    ring->data = malloc(ring->size);
+    return (ring->data == NULL) ? -ENOMEM : 0;
+}
+
+static void ring_write(struct console_ring *ring, const uint8_t *buf, size_t len) {
+    uint64_t head = ring->head;
+
+    if (len > ring->size) {
+        buf += len - ring->size;
+        head += len - ring->size;
+        len = ring->size;
+    }
+    __atomic_store_n(&ring->reserve, head + len, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for (size_t done = 0; done < len; ) {
+        size_t off = (head + done) & (ring->size - 1);
+        size_t n = min(len - done, ring->size - off);
+        memcpy(ring->data + off, buf + done, n);
+        done += n;
+    }
+    __atomic_store_n(&ring->head, head + len, __ATOMIC_RELEASE);
+}
+
+/* copy the scrollback into out, which holds ring->size bytes */
+static size_t ring_read(const struct console_ring *ring, uint8_t *out) {
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint64_t start = (head > ring->size) ? head - ring->size : 0;
+
+    for (uint64_t pos = start; pos < head; ) {
+        size_t off = pos & (ring->size - 1);
+        size_t n = min(head - pos, (uint64_t)(ring->size - off));
+        memcpy(out + (pos - start), ring->data + off, n);
+        pos += n;
+    }
+
+    /* drop whatever the writer overwrote while we were copying */
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    uint64_t end = __atomic_load_n(&ring->reserve, __ATOMIC_RELAXED);
+    uint64_t lost = (end - start > ring->size) ? end - start - ring->size : 0;
+    if (lost >= head - start) {
+        return 0;
+    }
+    memmove(out, out + lost, head - start - lost);
+    return head - start - lost;
+}
+
+static int console_fd_poll(struct console_fd *cfd, bool polled) {
+    int rc = 0;
+
+    if (cfd->cb.fd < 0 || cfd->polled == polled) {
+        return 0;
+    }
+    if (polled) {
+        rc = epoll_add(cfd->console->worker->epoll_fd, &cfd->cb);
+    } else {
+        rc = epoll_remove(cfd->console->worker->epoll_fd, &cfd->cb);
+    }
+    if (!rc) {
+        cfd->polled = polled;
+    }
+    return rc;
+}
+
+/* stop or resume reading host input while the transmit buffer is full */
+static void console_pause(struct console *console, bool paused) {
+    console->paused = paused;
+    if (console->pty_slave_fd >= 0) {
+        console_fd_poll(&console->host, !paused);
+    }
+    for (int i = 0; i < UARTD_CLIENTS_MAX; i++) {
+        console_fd_poll(&console->clients[i], !paused);
+    }
+}
+
+static void console_close_client(struct console_fd *client) {
+    console_fd_poll(client, false);
+    close(client->cb.fd);
+    client->cb.fd = -1;
+}
+
+/* send UART output to the pty or to every client, slow readers lose data */
+static void console_output(struct console *console, const uint8_t *buf, size_t len) {
+    if (console->pty_slave_fd >= 0) {
+        if (write(console->host.cb.fd, buf, len) < 0 && errno != EAGAIN) {
+            log_warning("%s: pty write failed", console->name);
+        }
+        errno = 0;
+        return;
+    }
+
+    for (int i = 0; i < UARTD_CLIENTS_MAX; i++) {
+        struct console_fd *client = &console->clients[i];
+        if (client->cb.fd >= 0 &&
+            send(client->cb.fd, buf, len, MSG_NOSIGNAL | MSG_DONTWAIT) < 0 &&
+            errno != EAGAIN) {
+            console_close_client(client);
+        }
+    }
+    errno = 0;
+}
+
+/* host input from the pty master or a socket client */
+static void console_input(union epoll_cb_arg *arg) {
+    struct console_fd *cfd = arg->ptr;
+    struct console *console = cfd->console;
+    ssize_t n;
+
+    if (console->tx_off > 0) {
+        memmove(console->tx, console->tx + console->tx_off,
+            console->tx_len - console->tx_off);
+        console->tx_len -= console->tx_off;
+        console->tx_off = 0;
+    }
+    if (console->tx_len == sizeof(console->tx)) {
+        console_pause(console, true);
+        return;
+    }
+
+    n = read(cfd->cb.fd, console->tx + console->tx_len,
+        sizeof(console->tx) - console->tx_len);
+    if (n > 0) {
+        console->tx_len += n;
+    } else if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+        if (cfd == &console->host) {
+            log_error("%s: pty read failed", console->name);
+            console_fd_poll(cfd, false);
+        } else {
+            console_close_client(cfd);
+        }
+    }
+    errno = 0;
+}
+
+static void console_accept(union epoll_cb_arg *arg) {
+    struct console_fd *cfd = arg->ptr;
+    struct console *console = cfd->console;
+    struct console_fd *client = NULL;
+    uint8_t *buf;
+    size_t len;
+
+    int fd = accept4(cfd->cb.fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+        errno = 0;
+        return;
+    }
+
+    for (int i = 0; i < UARTD_CLIENTS_MAX; i++) {
+        if (console->clients[i].cb.fd < 0) {
+            client = &console->clients[i];
+            break;
+        }
+    }
+    if (!client) {
+        log_warning("%s: too many clients", console->name);
+        close(fd);
+        return;
+    }
+
+    /* replay the scrollback so the client sees the console so far */
+    buf = malloc(console->scrollback.size);
+    if (buf) {
+        len = ring_read(&console->scrollback, buf);
+        if (len > 0 && send(fd, buf, len, MSG_NOSIGNAL | MSG_DONTWAIT) < 0) {
+            errno = 0;
+        }
+        free(buf);
+    }
+
+    client->cb.fd = fd;
+    client->polled = false;
+    if (!console->paused) {
+        console_fd_poll(client, true);
+    }
+}
+
+/* move data between the UART FIFOs and the host, returns true on traffic */
+static bool console_service(struct console *console) {
+    int rc;
+    uint8_t buf[UART_BURST_SIZE];
+    size_t n = 0;
+    bool active = false;
+
+    rc = uart_read_fifo(&console->bar, buf, sizeof(buf), &n);
+    if (rc) {
+        log_error("%s: unable to read the UART", console->name);
+    }
+    if (n > 0) {
+        ring_write(&console->scrollback, buf, n);
+        console_output(console, buf, n);
+        active = true;
+    }
+
+    if (console->tx_off < console->tx_len) {
+        rc = uart_write_fifo(&console->bar, console->tx + console->tx_off,
+            console->tx_len - console->tx_off, &n);
+        if (rc) {
+            log_error("%s: unable to write the UART", console->name);
+        }
+        console->tx_off += n;
+        if (console->tx_off == console->tx_len) {
+            console->tx_off = console->tx_len = 0;
+            if (console->paused) {
+                console_pause(console, false);
+            }
+        }
+        active = active || n > 0;
+    }
+
+    return active;
+}
+
+static void worker_timer(union epoll_cb_arg *arg) {
+    struct console_fd *cfd = arg->ptr;
+    uint64_t expirations;
+
+    if (read(cfd->cb.fd, &expirations, sizeof(expirations)) < 0) {
+        errno = 0;
+    }
+}
+
+static void *worker_loop(void *arg) {
+    struct uartd_worker *worker = arg;
+    struct epoll_event events[UARTD_EVENTS_MAX];
+    unsigned int backoff_us = UART_POLL_MIN_US;
+
+    while (!uartd_stop) {
+        struct itimerspec timer = {
+            .it_value = {
+                .tv_sec = backoff_us / 1000000,
+                .tv_nsec = (backoff_us % 1000000) * 1000,
+            },
+        };
+        bool active = false;
+        bool tx_pending = false;
+
+        timerfd_settime(worker->timer.cb.fd, 0, &timer, NULL);
+
+        int n = epoll_wait(worker->epoll_fd, events, UARTD_EVENTS_MAX, -1);
+        for (int i = 0; i < n; i++) {
+            struct epoll_cb *cb = events[i].data.ptr;
+            cb->fn(&cb->arg);
+        }
+
+        for (int i = 0; i < worker->n_consoles; i++) {
+            active = console_service(worker->consoles[i]) || active;
+            tx_pending = tx_pending ||
+                worker->consoles[i]->tx_off < worker->consoles[i]->tx_len;
+        }
+
+        /* a draining transmit FIFO needs attention within a few characters */
+        if (active) {
+            backoff_us = UART_POLL_MIN_US;
+        } else {
+            backoff_us = min(backoff_us * 2,
+                tx_pending ? (unsigned int) UART_TX_POLL_MAX_US : worker->poll_max_us);
+        }
+    }
+
+    return NULL;
+}
+
+static int console_open_pty(struct console *console) {
+    int rc;
+    char *slave_name = NULL;
+    struct termios tio;
+
+    rc = open_pty_pair(&console->host.cb.fd, &slave_name);
+    fail_on(rc, out, "Unable to get pty pair !");
+    snprintf(console->path, sizeof(console->path), "%s", slave_name);
+
+    rc = fcntl(console->host.cb.fd, F_SETFL, O_NONBLOCK);
+    fail_on(rc, out, "Unable to make the pty non-blocking");
+
+    /* raw, so console output is not echoed back into the UART */
+    console->pty_slave_fd = open(console->path, O_RDWR | O_NOCTTY | O_CLOEXEC);
+    fail_on((rc = (console->pty_slave_fd < 0) ? 1 : 0), out, "Unable to open %s",
+        console->path);
+    rc = tcgetattr(console->pty_slave_fd, &tio);
+    fail_on(rc, out, "Unable to get the pty attributes");
+    cfmakeraw(&tio);
+    rc = tcsetattr(console->pty_slave_fd, TCSANOW, &tio);
+    fail_on(rc, out, "Unable to set the pty attributes");
+
+    console->host.cb.fn = console_input;
+
+out:
+    return (rc != 0 ? 1 : 0);
+}
+
+static int console_open_socket(struct console *console, const char *dir) {
+    int rc;
+    int fd;
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+    rc = snprintf(console->path, sizeof(console->path), "%s/%s.sock", dir, console->name);
+    fail_on((rc = (rc < 0 || (size_t)rc >= sizeof(addr.sun_path)) ? 1 : 0), out,
+        "Socket path too long");
+    strcpy(addr.sun_path, console->path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    fail_on((rc = (fd < 0) ? 1 : 0), out, "Unable to create a socket");
+    console->host.cb.fd = fd;
+
+    unlink(console->path);
+    errno = 0;
+    rc = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    fail_on(rc, out, "Unable to bind %s", console->path);
+    rc = listen(fd, UARTD_CLIENTS_MAX);
+    fail_on(rc, out, "Unable to listen on %s", console->path);
+
+    console->host.cb.fn = console_accept;
+
+out:
+    return (rc != 0 ? 1 : 0);
+}
+
+static int console_open(struct piton_aws *ctx, struct console *console, int slot_id,
+    int uart, const struct uartd_opts *opts) {
+    int rc;
+
+    console->slot_id = slot_id;
+    console->uart = uart;
+    console->pci_bar_handle = PCI_BAR_HANDLE_INIT;
+    console->host.cb.fd = -1;
+    console->host.cb.arg.ptr = &console->host;
+    console->host.console = console;
+    console->pty_slave_fd = -1;
+    for (int i = 0; i < UARTD_CLIENTS_MAX; i++) {
+        console->clients[i].cb.fd = -1;
+        console->clients[i].cb.fn = console_input;
+        console->clients[i].cb.arg.ptr = &console->clients[i];
+        console->clients[i].console = console;
+    }
+    snprintf(console->name, sizeof(console->name), "slot%d-uart%d", slot_id, uart);
+
+    rc = ring_init(&console->scrollback, opts->scrollback_size);
+    fail_on(rc, out, "Unable to allocate the scrollback");
+
+    rc = piton_aws_bar(ctx, slot_id, uart ? APP_PF_BAR1 : APP_PF_BAR0,
+        &console->pci_bar_handle);
+    fail_on(rc, out, "Unable to attach to the AFI on slot id %d", slot_id);
+
+    rc = uart_bar_view(console->pci_bar_handle, &console->bar);
+    fail_on(rc, out, "Unable to map the uart registers");
+
+    rc = init_uart(console->pci_bar_handle, UINT32_C(0), opts->speed.divisor);
+    fail_on(rc, out, "Unable to init uart regs");
+
+    if (opts->socket_dir) {
+        rc = console_open_socket(console, opts->socket_dir);
+    } else {
+        rc = console_open_pty(console);
+    }
+    fail_on(rc, out, "Unable to open the host side of %s", console->name);
+
+    log_info("%s: %s", console->name, console->path);
+
+out:
+    return (rc != 0 ? 1 : 0);
+}
+
+static void console_close(struct console *console) {
+    for (int i = 0; i < UARTD_CLIENTS_MAX; i++) {
+        if (console->clients[i].cb.fd >= 0) {
+            close(console->clients[i].cb.fd);
+        }
+    }
+    if (console->host.cb.fd >= 0) {
+        close(console->host.cb.fd);
+        if (console->pty_slave_fd < 0 && console->path[0]) {
+            unlink(console->path);
+        }
+    }
+    if (console->pty_slave_fd >= 0) {
+        close(console->pty_slave_fd);
+    }
+    free(console->scrollback.data);
+}
+
+static void dump_scrollback(const char *log_dir) {
+    for (int i = 0; i < n_consoles; i++) {
+        struct console *console = &consoles[i];
+        char path[PATH_MAX];
+        uint8_t *buf = malloc(console->scrollback.size);
+        int fd = -1;
+
+        if (!buf) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%s.log", log_dir, console->name);
+        fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0 || write_loop(fd, buf, ring_read(&console->scrollback, buf))) {
+            log_error("%s: unable to write %s", console->name, path);
+        } else {
+            log_info("%s: scrollback written to %s", console->name, path);
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+        free(buf);
+    }
+}
+
+int piton_aws_console(struct piton_aws *ctx, int argc, char **argv) {
+    int rc;
+    int opt;
+    int index;
+    int n_started = 0;
+    sigset_t sigs;
+    struct uartd_opts opts = {
+        .slots = 0,
+        .uarts = 0,
+        .n_threads = UARTD_THREADS_DEFAULT,
+        .scrollback_size = UARTD_SCROLLBACK_KB * 1024,
+        .poll_max_us = UART_POLL_MAX_US,
+        .socket_dir = NULL,
+        .log_dir = "/tmp",
+        .speed = {
+            .clock_hz = UART_CLOCK_HZ,
+            .divisor = UART_DIVISOR_DEFAULT,
+        },
+    };
+
+    static struct option long_options[] = {
+        {"slot",        required_argument, 0, 'S'},
+        {"uart",        required_argument, 0, 'u'},
+        {"threads",     required_argument, 0, 't'},
+        {"socket-dir",  required_argument, 0, 'd'},
+        {"scrollback",  required_argument, 0, 'b'},
+        {"log-dir",     required_argument, 0, 'l'},
+        {"poll-max-us", required_argument, 0, 'p'},
+        {"baud",        required_argument, 0, 'B'},
+        {"divisor",     required_argument, 0, 'D'},
+        {"fast",        no_argument,       0, 'F'},
+        {"clock-mhz",   required_argument, 0, 'C'},
+        {0, 0, 0, 0}
+    };
+
+    n_consoles = 0;
+    uartd_stop = false;
+    memset(workers, 0, sizeof(workers));
+
+    optind = 0;
+    while ((opt = getopt_long(argc, argv, "S:u:t:d:b:l:p:B:D:FC:", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'S':
+            if (console_parse_index(optarg, FPGA_SLOT_MAX, &index)) {
+                console_usage(argv[0]);
+                return 1;
+            }
+            opts.slots |= 1u << index;
+            break;
+        case 'u':
+            if (console_parse_index(optarg, UARTD_UARTS_PER_SLOT, &index)) {
+                console_usage(argv[0]);
+                return 1;
+            }
+            opts.uarts |= 1u << index;
+            break;
+        case 't':
+            opts.n_threads = atoi(optarg);
+            break;
+        case 'd':
+            opts.socket_dir = optarg;
+            break;
+        case 'b':
+            opts.scrollback_size = max(strtoul(optarg, NULL, 0), 1ul) * 1024;
+            break;
+        case 'l':
+            opts.log_dir = optarg;
+            break;
+        case 'p':
+            opts.poll_max_us = max(atoi(optarg), UART_POLL_MIN_US);
+            break;
+        case 'B':
+            opts.speed.baud = strtoul(optarg, NULL, 0);
+            break;
+        case 'D':
+            opts.speed.baud = 0;
+            opts.speed.divisor = strtoul(optarg, NULL, 0);
+            break;
+        case 'F':
+            opts.speed.baud = 0;
+            opts.speed.divisor = 1;
+            break;
+        case 'C':
+            opts.speed.clock_hz = strtoul(optarg, NULL, 0) * 1000000;
+            break;
+        default:
+            console_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind != argc || opts.n_threads < 1 || opts.n_threads > UARTD_THREADS_MAX) {
+        console_usage(argv[0]);
+        return 1;
+    }
+    if (!opts.uarts) {
+        opts.uarts = (1u << UARTD_UARTS_PER_SLOT) - 1;
+    }
+
+    rc = uart_resolve_speed(&opts.speed);
+    fail_on(rc, out, "Unsupported line speed");
+    opts.poll_max_us = min(opts.poll_max_us, uart_fifo_fill_us(&opts.speed));
+    log_info("Consoles run at %u baud (divisor %u)", opts.speed.baud, opts.speed.divisor);
+
+    /* without --slot, serve every slot that has the AFI loaded */
+    if (!opts.slots && ctx->slot_id >= 0) {
+        opts.slots = 1u << ctx->slot_id;
+    } else if (!opts.slots) {
+        rc = piton_aws_loaded_slots(ctx, &opts.slots);
+        fail_on(rc, out, "Unable to read the slot specs");
+    }
+
+    for (int slot_id = 0; slot_id < FPGA_SLOT_MAX; slot_id++) {
+        if (!(opts.slots & (1u << slot_id))) {
+            continue;
+        }
+        if (piton_aws_slot_ready(ctx, slot_id)) {
+            log_warning("Skipping slot %d, the AFI is not ready", slot_id);
+            continue;
+        }
+        for (int uart = 0; uart < UARTD_UARTS_PER_SLOT; uart++) {
+            if (opts.uarts & (1u << uart)) {
+                rc = console_open(ctx, &consoles[n_consoles], slot_id, uart, &opts);
+                n_consoles++;
+                fail_on(rc, out, "Unable to open console %d on slot %d", uart, slot_id);
+            }
+        }
+    }
+    fail_on((rc = (n_consoles == 0) ? 1 : 0), out, "No console to serve");
+
+    /* the main thread handles the signals, the workers never see them */
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGINT);
+    sigaddset(&sigs, SIGTERM);
+    sigaddset(&sigs, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+
+    opts.n_threads = min(opts.n_threads, n_consoles);
+    for (int i = 0; i < opts.n_threads; i++) {
+        struct uartd_worker *worker = &workers[i];
+
+        worker->poll_max_us = opts.poll_max_us;
+        worker->timer.console = NULL;
+        worker->timer.cb.fn = worker_timer;
+        worker->timer.cb.arg.ptr = &worker->timer;
+        worker->timer.cb.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        fail_on((rc = (worker->timer.cb.fd < 0) ? 1 : 0), out, "Unable to create a timer");
+        rc = epoll_init(&worker->epoll_fd);
+        fail_on(rc, out, "Unable to create an epoll fd");
+        rc = epoll_add(worker->epoll_fd, &worker->timer.cb);
+        fail_on(rc, out, "Unable to poll the timer");
+    }
+    for (int i = 0; i < n_consoles; i++) {
+        struct uartd_worker *worker = &workers[i % opts.n_threads];
+
+        consoles[i].worker = worker;
+        worker->consoles[worker->n_consoles++] = &consoles[i];
+        rc = console_fd_poll(&consoles[i].host, true);
+        fail_on(rc, out, "Unable to poll %s", consoles[i].name);
+    }
+    for (int i = 0; i < opts.n_threads; i++) {
+        rc = pthread_create(&workers[i].thread, NULL, worker_loop, &workers[i]);
+        fail_on(rc, out, "Unable to start worker %d", i);
+        n_started++;
+    }
+    log_info("Serving %d consoles with %d threads", n_consoles, opts.n_threads);
+
+    while (1) {
+        int sig;
+
+        if (sigwait(&sigs, &sig)) {
+            continue;
+        }
+        if (sig != SIGUSR1) {
+            break;
+        }
+        dump_scrollback(opts.log_dir);
+    }
+
+out:
+    uartd_stop = true;
+    for (int i = 0; i < n_started; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+    for (int i = 0; i < UARTD_THREADS_MAX; i++) {
+        if (workers[i].timer.cb.fd > 0) {
+            close(workers[i].timer.cb.fd);
+        }
+        if (workers[i].epoll_fd > 0) {
+            close(workers[i].epoll_fd);
+        }
+    }
+    for (int i = 0; i < n_consoles; i++) {
+        console_close(&consoles[i]);
+    }
+    return (rc != 0 ? 1 : 0);
+}
@@ -110,12 +110,13 @@ int dma_example(int slot_id, size_t buffer_size) {
     write_fd = -1;
     read_fd = -1;
 
-    uint8_t *write_buffer = malloc(buffer_size);
-    uint8_t *read_buffer = malloc(buffer_size);
-    if (write_buffer == NULL || read_buffer == NULL) {
-        rc = -ENOMEM;
-        goto out;
-    }
+    /* huge pages on the NUMA node of the slot, see fpga_dma_buffer_alloc */
+    struct fpga_dma_buffer buffer = { 0 };
+    size_t stride = (buffer_size + getpagesize() - 1) & ~(size_t)(getpagesize() - 1);
+    rc = fpga_dma_buffer_alloc(slot_id, 2 * stride, &buffer);
+    fail_on(rc, out, "unable to allocate the DMA buffers");
+    uint8_t *write_buffer = buffer.data;
+    uint8_t *read_buffer = buffer.data + stride;
 
     read_fd = fpga_dma_open_queue(FPGA_DMA_XDMA, slot_id,
         /*channel*/ 0, /*is_read*/ true);
@@ -151,12 +152,7 @@ int dma_example(int slot_id, size_t buffer_size) {
     rc = (passed) ? 0 : 1;
 
 out:
-    if (write_buffer != NULL) {
-        free(write_buffer);
-    }
-    if (read_buffer != NULL) {
-        free(read_buffer);
-    }
+    fpga_dma_buffer_free(&buffer);
     if (write_fd >= 0) {
         close(write_fd);
     }
@@ -99,12 +99,13 @@ int retention_dma_example(int slot_id, size_t buffer_size)
     write_fd = -1;
     read_fd = -1;
 
-    uint8_t *write_buffer = malloc(buffer_size);
-    uint8_t *read_buffer = malloc(buffer_size);
-    if (write_buffer == NULL || read_buffer == NULL) {
-        rc = -ENOMEM;
-        goto out;
-    }
+    /* huge pages on the NUMA node of the slot, see fpga_dma_buffer_alloc */
+    struct fpga_dma_buffer buffer = { 0 };
+    size_t stride = (buffer_size + getpagesize() - 1) & ~(size_t)(getpagesize() - 1);
+    rc = fpga_dma_buffer_alloc(slot_id, 2 * stride, &buffer);
+    fail_on(rc, out, "unable to allocate the DMA buffers");
+    uint8_t *write_buffer = buffer.data;
+    uint8_t *read_buffer = buffer.data + stride;
 
     /* get local image description to get the AFI id */
     rc = fpga_mgmt_describe_local_image(slot_id, &info, 0);
@@ -171,12 +172,7 @@ int retention_dma_example(int slot_id, size_t buffer_size)
 
 out:
     /* clean up */
-    if (write_buffer != NULL) {
-        free(write_buffer);
-    }
-    if (read_buffer != NULL) {
-        free(read_buffer);
-    }
+    fpga_dma_buffer_free(&buffer);
     if (write_fd >= 0) {
         close(write_fd);
     }
@@ -24,10 +24,26 @@
 #define pr_fmt(fmt)     KBUILD_MODNAME ":%s: " fmt, __func__
 
 #include <asm/cacheflush.h>
+#include <linux/mm.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,11,0)
+#include <linux/sched/mm.h>
+#include <linux/sched/signal.h>
+#endif
 #include "libxdma_api.h"
 #include "xdma_cdev.h"
 #include "cdev_sgdma.h"
 
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,20,0)
+#define xdma_iter_is_bvec(io)	iov_iter_is_bvec(io)
+#else
+#define xdma_iter_is_bvec(io)	((io)->type & ITER_BVEC)
+#endif
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,11,0)
+#define mmgrab(mm)		atomic_inc(&(mm)->mm_count)
+#define mmget_not_zero(mm)	atomic_inc_not_zero(&(mm)->mm_users)
+#endif
+
 /* Module Parameters */
 unsigned int sgdma_timeout = 10;
 module_param(sgdma_timeout, uint, 0644);
@@ -199,7 +215,8 @@ static int char_sgdma_map_user_buf_to_sgl(struct xdma_io_cb *cb, bool write)
 		goto err_out;
 	}
 
-	rv = get_user_pages_fast((unsigned long)buf, pages_nr, 1/* write */,
+	/* the device only reads the pages of a write */
+	rv = get_user_pages_fast((unsigned long)buf, pages_nr, !write,
 				cb->pages);
 	/* No pages were pinned */
 	if (rv < 0) {
@@ -249,6 +266,305 @@ err_out:
 	return rv;
 }
 
+/*
+ * Map several user memory ranges into one scatterlist, in order, so they go
+ * out as a single descriptor chain. Unlike a single buffer, two ranges may
+ * share a page.
+ */
+static int char_sgdma_map_user_iov_to_sgl(struct xdma_io_cb *cb,
+		const struct iovec *iov, unsigned long nr_segs, bool write)
+{
+	struct sg_table *sgt = &cb->sgt;
+	struct scatterlist *sg;
+	unsigned int pages_nr = 0;
+	unsigned int idx = 0;
+	unsigned long seg;
+	int i;
+	int rv;
+
+	for (seg = 0; seg < nr_segs; seg++) {
+		unsigned long buf = (unsigned long)iov[seg].iov_base;
+
+		if (!iov[seg].iov_len)
+			continue;
+		pages_nr += ((buf + iov[seg].iov_len + PAGE_SIZE - 1) -
+			     (buf & PAGE_MASK)) >> PAGE_SHIFT;
+	}
+	if (pages_nr == 0)
+		return -EINVAL;
+
+	if (sg_alloc_table(sgt, pages_nr, GFP_KERNEL)) {
+		pr_err("sgl OOM.\n");
+		return -ENOMEM;
+	}
+
+	cb->pages = kcalloc(pages_nr, sizeof(struct page *), GFP_KERNEL);
+	if (!cb->pages) {
+		pr_err("pages OOM.\n");
+		rv = -ENOMEM;
+		goto err_out;
+	}
+	/* the unmap stops at the first page not pinned */
+	cb->pages_nr = pages_nr;
+
+	sg = sgt->sgl;
+	for (seg = 0; seg < nr_segs; seg++) {
+		char *buf = iov[seg].iov_base;
+		unsigned long len = iov[seg].iov_len;
+		unsigned int nr;
+
+		if (!len)
+			continue;
+		nr = (((unsigned long)buf + len + PAGE_SIZE - 1) -
+		      ((unsigned long)buf & PAGE_MASK)) >> PAGE_SHIFT;
+
+		rv = get_user_pages_fast((unsigned long)buf, nr, !write,
+					cb->pages + idx);
+		if (rv != nr) {
+			pr_err("unable to pin down %u user pages of segment %lu, %d.\n",
+				nr, seg, rv);
+			rv = rv < 0 ? rv : -EFAULT;
+			goto err_out;
+		}
+
+		for (i = 0; i < nr; i++, idx++, sg = sg_next(sg)) {
+			unsigned int offset = offset_in_page(buf);
+			unsigned int nbytes = min_t(unsigned long,
+						PAGE_SIZE - offset, len);
+
+			flush_dcache_page(cb->pages[idx]);
+			sg_set_page(sg, cb->pages[idx], nbytes, offset);
+
+			buf += nbytes;
+			len -= nbytes;
+		}
+		BUG_ON(len);
+	}
+
+	return 0;
+
+err_out:
+	char_sgdma_unmap_user_buf(cb, write);
+
+	return rv;
+}
+
+/*
+ * Registered buffers: user buffers pinned and DMA mapped once through
+ * IOCTL_XDMA_BUF_REGISTER. A registration belongs to the file which made it
+ * and is released by IOCTL_XDMA_BUF_UNREGISTER or when the file is closed.
+ */
+struct xdma_reg_buf {
+	struct list_head list;
+	struct file *file;		/* owner of the registration */
+	struct mm_struct *mm;		/* address space of cb.buf */
+	u32 handle;
+	unsigned int busy;		/* transfers using the buffer */
+	unsigned long locked_nr;	/* pages charged to mm->locked_vm */
+	struct xdma_io_cb cb;		/* pinned pages, sgt is DMA mapped */
+};
+
+/*
+ * Registered buffers stay pinned until they are released, so their pages
+ * are charged to the locked_vm of the registering process and count against
+ * its RLIMIT_MEMLOCK, as for VFIO and RDMA memory registrations.
+ */
+static int char_sgdma_buf_account(struct mm_struct *mm, unsigned long npages,
+		bool inc)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,2,0)
+	return account_locked_vm(mm, npages, inc);
+#else
+	unsigned long locked, limit;
+	int rv = 0;
+
+	if (!npages)
+		return 0;
+
+	down_write(&mm->mmap_sem);
+	if (inc) {
+		locked = mm->locked_vm + npages;
+		limit = rlimit(RLIMIT_MEMLOCK) >> PAGE_SHIFT;
+		if (locked > limit && !capable(CAP_IPC_LOCK))
+			rv = -ENOMEM;
+		else
+			mm->locked_vm = locked;
+	} else {
+		WARN_ON_ONCE(npages > mm->locked_vm);
+		mm->locked_vm -= min(npages, mm->locked_vm);
+	}
+	up_write(&mm->mmap_sem);
+
+	return rv;
+#endif
+}
+
+/* the file may outlive the address space, which is then not charged any more */
+static void char_sgdma_buf_unaccount(struct xdma_reg_buf *rb)
+{
+	if (rb->locked_nr && mmget_not_zero(rb->mm)) {
+		char_sgdma_buf_account(rb->mm, rb->locked_nr, false);
+		mmput(rb->mm);
+	}
+	rb->locked_nr = 0;
+}
+
+static void char_sgdma_buf_free(struct xdma_cdev *xcdev,
+		struct xdma_reg_buf *rb)
+{
+	struct xdma_engine *engine = xcdev->engine;
+
+	pci_unmap_sg(xcdev->xdev->pdev, rb->cb.sgt.sgl, rb->cb.sgt.orig_nents,
+		engine->dir);
+	char_sgdma_unmap_user_buf(&rb->cb, engine->dir == DMA_TO_DEVICE);
+	char_sgdma_buf_unaccount(rb);
+	mmdrop(rb->mm);
+	kfree(rb);
+}
+
+/* registered buffer of the file covering [buf, buf + count), if any */
+static struct xdma_reg_buf *char_sgdma_buf_get(struct file *file,
+		struct xdma_cdev *xcdev, char __user *buf, size_t count)
+{
+	struct xdma_reg_buf *rb;
+	struct xdma_reg_buf *found = NULL;
+
+	if (!count)
+		return NULL;
+
+	mutex_lock(&xcdev->buf_lock);
+	list_for_each_entry(rb, &xcdev->buf_list, list) {
+		unsigned long start = (unsigned long)rb->cb.buf;
+		unsigned long addr = (unsigned long)buf;
+
+		if (rb->file == file && rb->mm == current->mm &&
+		    addr >= start && addr - start < rb->cb.len &&
+		    count <= rb->cb.len - (addr - start)) {
+			rb->busy++;
+			found = rb;
+			break;
+		}
+	}
+	mutex_unlock(&xcdev->buf_lock);
+
+	return found;
+}
+
+static void char_sgdma_buf_put(struct xdma_cdev *xcdev,
+		struct xdma_reg_buf *rb)
+{
+	mutex_lock(&xcdev->buf_lock);
+	rb->busy--;
+	mutex_unlock(&xcdev->buf_lock);
+}
+
+/*
+ * Build a DMA mapped sg table for [buf, buf + count) out of the mapping of a
+ * registered buffer. Only the dma address and length of the entries are set,
+ * the pages stay pinned by the registration.
+ */
+static int char_sgdma_buf_to_sgl(struct xdma_reg_buf *rb, char __user *buf,
+		size_t count, struct sg_table *sgt)
+{
+	struct scatterlist *msg, *sg;
+	unsigned long skip = (unsigned long)buf - (unsigned long)rb->cb.buf;
+	unsigned long off = skip;
+	size_t left = count;
+	unsigned int nents = 0;
+	int i;
+
+	for_each_sg(rb->cb.sgt.sgl, msg, rb->cb.sgt.nents, i) {
+		unsigned int len = sg_dma_len(msg);
+
+		if (off >= len) {
+			off -= len;
+			continue;
+		}
+		nents++;
+		if (left <= len - off)
+			break;
+		left -= len - off;
+		off = 0;
+	}
+
+	if (sg_alloc_table(sgt, nents, GFP_KERNEL)) {
+		pr_err("sgl OOM.\n");
+		return -ENOMEM;
+	}
+
+	sg = sgt->sgl;
+	off = skip;
+	left = count;
+	for_each_sg(rb->cb.sgt.sgl, msg, rb->cb.sgt.nents, i) {
+		unsigned int len = sg_dma_len(msg);
+
+		if (off >= len) {
+			off -= len;
+			continue;
+		}
+		len = min_t(size_t, len - off, left);
+		sg_dma_address(sg) = sg_dma_address(msg) + off;
+		sg_dma_len(sg) = len;
+		left -= len;
+		off = 0;
+		if (!left)
+			break;
+		sg = sg_next(sg);
+	}
+	BUG_ON(left);
+	sgt->nents = nents;
+
+	return 0;
+}
+
+static void char_sgdma_buf_sync(struct xdma_dev *xdev, struct sg_table *sgt,
+		bool write, bool for_device)
+{
+	struct scatterlist *sg;
+	enum dma_data_direction dir = write ? DMA_TO_DEVICE : DMA_FROM_DEVICE;
+	int i;
+
+	for_each_sg(sgt->sgl, sg, sgt->nents, i) {
+		if (for_device)
+			pci_dma_sync_single_for_device(xdev->pdev,
+				sg_dma_address(sg), sg_dma_len(sg), dir);
+		else
+			pci_dma_sync_single_for_cpu(xdev->pdev,
+				sg_dma_address(sg), sg_dma_len(sg), dir);
+	}
+}
+
+static ssize_t char_sgdma_buf_read_write(struct xdma_cdev *xcdev,
+		struct xdma_reg_buf *rb, char __user *buf, size_t count,
+		loff_t *pos, bool write)
+{
+	struct xdma_dev *xdev = xcdev->xdev;
+	struct sg_table sgt;
+	ssize_t res;
+	int rv;
+
+	memset(&sgt, 0, sizeof(sgt));
+	rv = char_sgdma_buf_to_sgl(rb, buf, count, &sgt);
+	if (rv < 0)
+		return rv;
+
+	/*
+	 * The registration mapped the pages once, hand them to the device for
+	 * every transfer: a write flushes what the CPU wrote since the last
+	 * one, a read drops cache lines which would otherwise be written back
+	 * over the DMA data on non-coherent platforms.
+	 */
+	char_sgdma_buf_sync(xdev, &sgt, write, true);
+	res = xdma_xfer_submit(xdev, xcdev->engine->channel, write, *pos, &sgt,
+				1, sgdma_timeout * 1000);
+	if (!write)
+		char_sgdma_buf_sync(xdev, &sgt, write, false);
+
+	sg_free_table(&sgt);
+
+	return res;
+}
+
 static ssize_t char_sgdma_read_write(struct file *file, char __user *buf,
 		size_t count, loff_t *pos, bool write)
 {
@@ -258,6 +574,7 @@ static ssize_t char_sgdma_read_write(struct file *file, char __user *buf,
 	struct xdma_dev *xdev;
 	struct xdma_engine *engine;
 	struct xdma_io_cb cb;
+	struct xdma_reg_buf *rb;
 
 	rv = xcdev_check(__func__, xcdev, 1);
 	if (rv < 0)
@@ -282,6 +599,14 @@ static ssize_t char_sgdma_read_write(struct file *file, char __user *buf,
 		return rv;
 	}
 
+	rb = char_sgdma_buf_get(file, xcdev, buf, count);
+	if (rb) {
+		res = char_sgdma_buf_read_write(xcdev, rb, buf, count, pos,
+						write);
+		char_sgdma_buf_put(xcdev, rb);
+		return res;
+	}
+
 	memset(&cb, 0, sizeof(struct xdma_io_cb));
 	cb.buf = buf;
 	cb.len = count;
@@ -331,6 +656,193 @@ static ssize_t char_sgdma_read(struct file *file, char __user *buf,
         return char_sgdma_read_write(file, (char *)buf, count, pos, 0);
 }
 
+/*
+ * Write kernel pages, e.g. page cache pages spliced from a file by sendfile()
+ * or splice(), to the device. The pages are held by the caller for the
+ * duration of the call, so they are mapped without pinning or copying.
+ */
+static ssize_t char_sgdma_write_bvec(struct xdma_cdev *xcdev,
+		struct kiocb *iocb, struct iov_iter *io)
+{
+	struct xdma_engine *engine = xcdev->engine;
+	const struct bio_vec *bvec = io->bvec;
+	struct sg_table sgt;
+	struct scatterlist *sg;
+	unsigned long nr_segs = io->nr_segs;
+	unsigned long seg;
+	size_t left = iov_iter_count(io);
+	loff_t pos = iocb->ki_pos;
+	ssize_t res;
+	int rv;
+
+	/* the segments the iterator still covers */
+	for (seg = 0; seg < nr_segs && left; seg++) {
+		size_t skip = seg ? 0 : io->iov_offset;
+
+		left -= min_t(size_t, bvec[seg].bv_len - skip, left);
+	}
+	nr_segs = seg;
+	left = iov_iter_count(io);
+
+	memset(&sgt, 0, sizeof(sgt));
+	if (sg_alloc_table(&sgt, nr_segs, GFP_KERNEL)) {
+		pr_err("sgl OOM.\n");
+		return -ENOMEM;
+	}
+
+	sg = sgt.sgl;
+	for (seg = 0; seg < nr_segs && left; seg++, sg = sg_next(sg)) {
+		size_t skip = seg ? 0 : io->iov_offset;
+		unsigned int offset = bvec[seg].bv_offset + skip;
+		unsigned int len = min_t(size_t, bvec[seg].bv_len - skip, left);
+
+		/* only the low bits of the host address are checked */
+		rv = check_transfer_align(engine,
+				(const char __user *)(uintptr_t)offset, len,
+				pos, 1);
+		if (rv) {
+			pr_info("Invalid transfer alignment detected, segment %lu\n",
+				seg);
+			goto out;
+		}
+		sg_set_page(sg, bvec[seg].bv_page, len, offset);
+		left -= len;
+		pos += len;
+	}
+
+	res = xdma_xfer_submit(xcdev->xdev, engine->channel, 1, iocb->ki_pos,
+				&sgt, 0, sgdma_timeout * 1000);
+	if (res > 0) {
+		iocb->ki_pos += res;
+		iov_iter_advance(io, res);
+	}
+	sg_free_table(&sgt);
+	return res;
+
+out:
+	sg_free_table(&sgt);
+	return rv;
+}
+
+/* char_sgdma_read_write_iter() -- Vectored read from or write to the device
+ *
+ * The segments of the iov_iter map to consecutive device addresses starting
+ * at the file position, and are moved as one request.
+ */
+static ssize_t char_sgdma_read_write_iter(struct kiocb *iocb,
+		struct iov_iter *io, bool write)
+{
+	struct file *file = iocb->ki_filp;
+	struct xdma_cdev *xcdev = (struct xdma_cdev *)file->private_data;
+	struct xdma_dev *xdev;
+	struct xdma_engine *engine;
+	const struct iovec *iov;
+	struct iovec *segs;
+	unsigned long nr_segs;
+	unsigned long seg;
+	size_t left = iov_iter_count(io);
+	loff_t pos = iocb->ki_pos;
+	struct xdma_io_cb cb;
+	ssize_t res;
+	int rv;
+
+	rv = xcdev_check(__func__, xcdev, 1);
+	if (rv < 0)
+		return rv;
+	xdev = xcdev->xdev;
+	engine = xcdev->engine;
+
+	if ((write && engine->dir != DMA_TO_DEVICE) ||
+	    (!write && engine->dir != DMA_FROM_DEVICE)) {
+		pr_err("r/w mismatch. W %d, dir %d.\n",
+			write, engine->dir);
+		return -EINVAL;
+	}
+	if (!write && engine->streaming)
+		return -EINVAL;
+	if (!left)
+		return 0;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,0,0)
+	if (iter_is_ubuf(io)) {
+		res = char_sgdma_read_write(file, io->ubuf + io->iov_offset,
+					left, &iocb->ki_pos, write);
+		if (res > 0) {
+			iocb->ki_pos += res;
+			iov_iter_advance(io, res);
+		}
+		return res;
+	}
+#endif
+	if (write && xdma_iter_is_bvec(io))
+		return char_sgdma_write_bvec(xcdev, iocb, io);
+	if (!iter_is_iovec(io))
+		return -EINVAL;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,4,0)
+	iov = iter_iov(io);
+#else
+	iov = io->iov;
+#endif
+	nr_segs = io->nr_segs;
+
+	/* trim the segments to what is left of the iterator */
+	segs = kcalloc(nr_segs, sizeof(*segs), GFP_KERNEL);
+	if (!segs)
+		return -ENOMEM;
+	for (seg = 0; seg < nr_segs && left; seg++) {
+		size_t skip = seg ? 0 : io->iov_offset;
+
+		segs[seg].iov_base = iov[seg].iov_base + skip;
+		segs[seg].iov_len = min_t(size_t, iov[seg].iov_len - skip, left);
+		left -= segs[seg].iov_len;
+
+		rv = check_transfer_align(engine, segs[seg].iov_base,
+				segs[seg].iov_len, pos, 1);
+		if (rv) {
+			pr_info("Invalid transfer alignment detected, segment %lu\n",
+				seg);
+			goto out;
+		}
+		pos += segs[seg].iov_len;
+	}
+	nr_segs = seg;
+
+	dbg_tfr("file 0x%p, %lu segs,%llu, pos %llu, W %d, %s.\n",
+		file, nr_segs, (u64)iov_iter_count(io), (u64)iocb->ki_pos,
+		write, engine->name);
+
+	memset(&cb, 0, sizeof(struct xdma_io_cb));
+	rv = char_sgdma_map_user_iov_to_sgl(&cb, segs, nr_segs, write);
+	if (rv < 0)
+		goto out;
+
+	res = xdma_xfer_submit(xdev, engine->channel, write, iocb->ki_pos,
+				&cb.sgt, 0, sgdma_timeout * 1000);
+
+	char_sgdma_unmap_user_buf(&cb, write);
+
+	if (res > 0) {
+		iocb->ki_pos += res;
+		iov_iter_advance(io, res);
+	}
+	kfree(segs);
+	return res;
+
+out:
+	kfree(segs);
+	return rv;
+}
+
+static ssize_t char_sgdma_write_iter(struct kiocb *iocb, struct iov_iter *io)
+{
+	return char_sgdma_read_write_iter(iocb, io, 1);
+}
+
+static ssize_t char_sgdma_read_iter(struct kiocb *iocb, struct iov_iter *io)
+{
+	return char_sgdma_read_write_iter(iocb, io, 0);
+}
+
 static int ioctl_do_perf_start(struct xdma_engine *engine, unsigned long arg)
 {
         int rv;
@@ -463,6 +975,113 @@ static int ioctl_do_align_get(struct xdma_engine *engine, unsigned long arg)
 	return put_user(engine->addr_align, (int __user *)arg);
 }
 
+static int ioctl_do_buf_register(struct file *file, struct xdma_cdev *xcdev,
+		unsigned long arg)
+{
+	struct xdma_engine *engine = xcdev->engine;
+	struct xdma_buf_ioctl req;
+	struct xdma_reg_buf *rb;
+	unsigned long pages_nr;
+	int nents;
+	int rv;
+
+	if (copy_from_user(&req, (void __user *)arg, sizeof(req)))
+		return -EFAULT;
+	if (!req.len || req.addr + req.len < req.addr)
+		return -EINVAL;
+
+	rb = kzalloc(sizeof(*rb), GFP_KERNEL);
+	if (!rb)
+		return -ENOMEM;
+	rb->file = file;
+	rb->mm = current->mm;
+	mmgrab(rb->mm);
+
+	/* charge the pages before pinning them */
+	pages_nr = ((req.addr + req.len + PAGE_SIZE - 1) -
+		    (req.addr & PAGE_MASK)) >> PAGE_SHIFT;
+	rv = char_sgdma_buf_account(rb->mm, pages_nr, true);
+	if (rv < 0) {
+		pr_info("%s, %lu pages exceed RLIMIT_MEMLOCK.\n", engine->name,
+			pages_nr);
+		goto err_free;
+	}
+	rb->locked_nr = pages_nr;
+
+	rb->cb.buf = (void __user *)(uintptr_t)req.addr;
+	rb->cb.len = req.len;
+	rv = char_sgdma_map_user_buf_to_sgl(&rb->cb,
+					engine->dir == DMA_TO_DEVICE);
+	if (rv < 0)
+		goto err_free;
+
+	nents = pci_map_sg(xcdev->xdev->pdev, rb->cb.sgt.sgl,
+			rb->cb.sgt.orig_nents, engine->dir);
+	if (!nents) {
+		pr_info("map sgl failed, %llu bytes.\n", req.len);
+		char_sgdma_unmap_user_buf(&rb->cb, engine->dir == DMA_TO_DEVICE);
+		rv = -EIO;
+		goto err_free;
+	}
+	rb->cb.sgt.nents = nents;
+
+	mutex_lock(&xcdev->buf_lock);
+	/* 0 is never a valid handle */
+	if (!++xcdev->buf_handle_next)
+		++xcdev->buf_handle_next;
+	rb->handle = xcdev->buf_handle_next;
+	list_add(&rb->list, &xcdev->buf_list);
+	mutex_unlock(&xcdev->buf_lock);
+
+	dbg_tfr("%s, registered 0x%llx,%llu, handle %u, %d sg.\n",
+		engine->name, req.addr, req.len, rb->handle, nents);
+
+	req.handle = rb->handle;
+	if (copy_to_user((void __user *)arg, &req, sizeof(req))) {
+		mutex_lock(&xcdev->buf_lock);
+		list_del(&rb->list);
+		mutex_unlock(&xcdev->buf_lock);
+		char_sgdma_buf_free(xcdev, rb);
+		return -EFAULT;
+	}
+
+	return 0;
+
+err_free:
+	char_sgdma_buf_unaccount(rb);
+	mmdrop(rb->mm);
+	kfree(rb);
+	return rv;
+}
+
+static int ioctl_do_buf_unregister(struct file *file, struct xdma_cdev *xcdev,
+		unsigned long arg)
+{
+	struct xdma_reg_buf *rb;
+	struct xdma_reg_buf *found = NULL;
+	int rv = -EINVAL;
+
+	mutex_lock(&xcdev->buf_lock);
+	list_for_each_entry(rb, &xcdev->buf_list, list) {
+		if (rb->file == file && rb->handle == (u32)arg) {
+			if (rb->busy) {
+				rv = -EBUSY;
+			} else {
+				list_del(&rb->list);
+				found = rb;
+				rv = 0;
+			}
+			break;
+		}
+	}
+	mutex_unlock(&xcdev->buf_lock);
+
+	if (found)
+		char_sgdma_buf_free(xcdev, found);
+
+	return rv;
+}
+
 static long char_sgdma_ioctl(struct file *file, unsigned int cmd,
                 unsigned long arg)
 {
@@ -498,6 +1117,12 @@ static long char_sgdma_ioctl(struct file *file, unsigned int cmd,
 	case IOCTL_XDMA_ALIGN_GET:
 		rv = ioctl_do_align_get(engine, arg);
 		break;
+	case IOCTL_XDMA_BUF_REGISTER:
+		rv = ioctl_do_buf_register(file, xcdev, arg);
+		break;
+	case IOCTL_XDMA_BUF_UNREGISTER:
+		rv = ioctl_do_buf_unregister(file, xcdev, arg);
+		break;
         default:
                 dbg_perf("Unsupported operation\n");
                 rv = -EINVAL;
@@ -531,6 +1156,7 @@ static int char_sgdma_close(struct inode *inode, struct file *file)
 {
 	struct xdma_cdev *xcdev = (struct xdma_cdev *)file->private_data;
 	struct xdma_engine *engine;
+	struct xdma_reg_buf *rb, *tmp;
 	int rv;
 
 	rv = xcdev_check(__func__, xcdev, 1);
@@ -539,6 +1165,16 @@ static int char_sgdma_close(struct inode *inode, struct file *file)
 
 	engine = xcdev->engine;
 
+	/* release the buffers the file registered */
+	mutex_lock(&xcdev->buf_lock);
+	list_for_each_entry_safe(rb, tmp, &xcdev->buf_list, list) {
+		if (rb->file == file) {
+			list_del(&rb->list);
+			char_sgdma_buf_free(xcdev, rb);
+		}
+	}
+	mutex_unlock(&xcdev->buf_lock);
+
 	if (engine->streaming && engine->dir == DMA_FROM_DEVICE) {
 		engine->device_open = 0;
 		if (engine->cyclic_req)
@@ -553,11 +1189,16 @@ static const struct file_operations sgdma_fops = {
 	.release = char_sgdma_close,
 	.write = char_sgdma_write,
 	.read = char_sgdma_read,
+	.write_iter = char_sgdma_write_iter,
+	.read_iter = char_sgdma_read_iter,
+	.splice_write = iter_file_splice_write,
 	.unlocked_ioctl = char_sgdma_ioctl,
 	.llseek = char_sgdma_llseek,
 };
 
 void cdev_sgdma_init(struct xdma_cdev *xcdev)
 {
+	mutex_init(&xcdev->buf_lock);
+	INIT_LIST_HEAD(&xcdev->buf_list);
 	cdev_init(&xcdev->cdev, &sgdma_fops);
 }
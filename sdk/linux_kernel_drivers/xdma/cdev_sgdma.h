@@ -63,6 +63,21 @@ struct xdma_performance_ioctl
         uint64_t pending_count;
 };
 
+/*
+ * Buffer pinned and DMA mapped once by IOCTL_XDMA_BUF_REGISTER. Reads and
+ * writes of the same file which fall inside a registered buffer reuse its
+ * mapping instead of pinning and mapping the user pages on every call.
+ */
+struct xdma_buf_ioctl
+{
+        /* user address and length of the buffer */
+        uint64_t addr;
+        uint64_t len;
+        /* set by IOCTL_XDMA_BUF_REGISTER, passed to IOCTL_XDMA_BUF_UNREGISTER */
+        uint32_t handle;
+        uint32_t reserved;
+};
+
 
 
 /* IOCTL codes */
@@ -73,5 +88,7 @@ struct xdma_performance_ioctl
 #define IOCTL_XDMA_ADDRMODE_SET _IOW('q', 4, int)
 #define IOCTL_XDMA_ADDRMODE_GET _IOR('q', 5, int)
 #define IOCTL_XDMA_ALIGN_GET    _IOR('q', 6, int)
+#define IOCTL_XDMA_BUF_REGISTER   _IOWR('q', 7, struct xdma_buf_ioctl *)
+#define IOCTL_XDMA_BUF_UNREGISTER _IOW('q', 8, int)
 
 #endif /* _XDMA_IOCALLS_POSIX_H_ */
@@ -3123,7 +3123,11 @@ ssize_t xdma_xfer_submit(void *dev_hndl, int channel, bool write, u64 ep_addr,
 			transfer_dump(xfer);
 			sgt_dump(sgt);
 #endif
-			rv = -ERESTARTSYS;
+			/*
+			 * only restart the call for a signal, a restarted
+			 * call would run into the same timeout
+			 */
+			rv = signal_pending(current) ? -ERESTARTSYS : -ETIMEDOUT;
 			break;
 		}
 
@@ -3143,7 +3147,8 @@ unmap_sgl:
 	if (req)
 		xdma_request_free(req);
 
-	if (rv < 0)
+	/* report the completed transfers as a short read or write */
+	if (rv < 0 && !done)
 		return rv;
 
 	return done;
@@ -68,6 +68,10 @@ struct xdma_cdev {
 	struct xdma_user_irq *user_irq;	/* IRQ value, if needed */
 	struct device *sys_device;	/* sysfs device */
 	spinlock_t lock;
+	/* buffers registered through IOCTL_XDMA_BUF_REGISTER, SG DMA only */
+	struct mutex buf_lock;
+	struct list_head buf_list;
+	u32 buf_handle_next;
 };
 
 /* XDMA PCIe device specific book-keeping */
@@ -124,6 +124,18 @@ class BaseSdkTools(AwsFpgaTestBase):
         cls.mgmt_test_so.fpga_mgmt_test_readdir.restype = ctypes.c_int
         cls.mgmt_test_so.fpga_mgmt_test_readdir.argtypes = [ctypes.c_uint]
 
+        cls.mgmt_test_so.fpga_mgmt_test_reg_program.restype = ctypes.c_int
+        cls.mgmt_test_so.fpga_mgmt_test_reg_program.argtypes = []
+
+        cls.mgmt_test_so.fpga_mgmt_test_emu_peek_poke.restype = ctypes.c_int
+        cls.mgmt_test_so.fpga_mgmt_test_emu_peek_poke.argtypes = [ctypes.c_int]
+
+        cls.mgmt_test_so.fpga_mgmt_test_emu_dma.restype = ctypes.c_int
+        cls.mgmt_test_so.fpga_mgmt_test_emu_dma.argtypes = [ctypes.c_int]
+
+        cls.mgmt_test_so.fpga_mgmt_test_emu_uart.restype = ctypes.c_int
+        cls.mgmt_test_so.fpga_mgmt_test_emu_uart.argtypes = [ctypes.c_int, ctypes.c_char_p]
+
         cls.mgmt_test_so.fpga_mgmt_tests_init.restype = ctypes.c_int
         cls.mgmt_test_so.fpga_mgmt_tests_init.argtypes = []
 
@@ -0,0 +1,225 @@
+/*
+ * Amazon FPGA Hardware Development Kit
+ *
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Amazon Software License (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *    http://aws.amazon.com/asl/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on
+ * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fpga_pci.h>
+#include <fpga_dma.h>
+#include <utils/lcd.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "fpga_mgmt_tests.h"
+
+/*
+ * Tests of the libraries against fpga-emu, run with FPGA_PCI_EMU_ROOT set to
+ * the root of a running emulator. The registers used are those of the 16550
+ * UART the emulator puts at 0x1000 of the application PF BAR0.
+ */
+#define EMU_UART_RBR_THR 0x1000
+#define EMU_UART_LSR     0x1014
+#define EMU_UART_SCR     0x101c
+
+#define EMU_UART_LSR_DRDY 0x01
+#define EMU_UART_LSR_THRE 0x20
+
+#define EMU_UART_TIMEOUT_MS 2000
+
+int fpga_mgmt_test_emu_peek_poke(int slot_id)
+{
+    int rc;
+    pci_bar_handle_t handle = PCI_BAR_HANDLE_INIT;
+    fpga_pci_bar_view_t view;
+    uint32_t value = 0;
+    uint32_t scr = 0;
+    size_t failed_op;
+    struct fpga_pci_reg_op ops[] = {
+        FPGA_PCI_REG_POKE(EMU_UART_SCR, 0xa5),
+        FPGA_PCI_REG_PEEK(EMU_UART_SCR, &scr),
+        FPGA_PCI_REG_POLL(EMU_UART_LSR, EMU_UART_LSR_THRE, EMU_UART_LSR_THRE,
+            1000, NULL),
+    };
+
+    rc = fpga_pci_attach(slot_id, FPGA_APP_PF, APP_PF_BAR0, 0, &handle);
+    fail_on(rc, out, "Unable to attach to slot %d", slot_id);
+
+    rc = fpga_pci_poke(handle, EMU_UART_SCR, 0x5a);
+    fail_on(rc, out, "poke failed");
+    rc = fpga_pci_peek(handle, EMU_UART_SCR, &value);
+    fail_on(rc, out, "peek failed");
+    fail_on((rc = (value != 0x5a)), out, "peek read 0x%x instead of 0x5a", value);
+
+    /* the model serves the BAR, so it has no view and programs go to it */
+    rc = fpga_pci_get_bar_view(handle, &view);
+    fail_on((rc = (rc != -ENOTSUP)), out, "the view of an emulated BAR returned %d",
+        rc);
+    rc = fpga_pci_run_program(handle, ops, sizeof_array(ops), &failed_op);
+    fail_on(rc, out, "program failed with %d at op %zu", rc, failed_op);
+    fail_on((rc = (scr != 0xa5)), out, "program read 0x%x instead of 0xa5", scr);
+
+    /* an access outside the BAR fails rather than reading all ones */
+    rc = fpga_pci_peek(handle, UINT64_C(1) << 32, &value);
+    fail_on((rc = (rc == 0)), out, "peek outside the BAR succeeded");
+
+    log_info("emulator peek/poke tests passed");
+out:
+    if (handle != PCI_BAR_HANDLE_INIT) {
+        fpga_pci_detach(handle);
+    }
+    return rc;
+}
+
+int fpga_mgmt_test_emu_dma(int slot_id)
+{
+    int rc;
+    int write_fd = -1;
+    int read_fd = -1;
+    size_t size = 1 << 20;
+    /* not page aligned, to exercise the partial pages */
+    size_t address = 0x10000 + 0x123;
+    uint8_t *tx = NULL;
+    uint8_t *rx = NULL;
+
+    tx = malloc(size);
+    rx = malloc(size);
+    fail_on((rc = (!tx || !rx) ? -ENOMEM : 0), out, "Unable to allocate the buffers");
+    for (size_t i = 0; i < size; i++) {
+        tx[i] = (uint8_t) (i * 7 + (i >> 8));
+    }
+    memset(rx, 0, size);
+
+    write_fd = fpga_dma_open_queue(FPGA_DMA_XDMA, slot_id, 0, false);
+    fail_on((rc = (write_fd < 0) ? write_fd : 0), out, "Unable to open the write queue");
+    read_fd = fpga_dma_open_queue(FPGA_DMA_XDMA, slot_id, 0, true);
+    fail_on((rc = (read_fd < 0) ? read_fd : 0), out, "Unable to open the read queue");
+
+    rc = fpga_dma_burst_write(write_fd, tx, size, address);
+    fail_on(rc, out, "DMA write failed");
+    rc = fpga_dma_burst_read(read_fd, rx, size, address);
+    fail_on(rc, out, "DMA read failed");
+    fail_on((rc = memcmp(tx, rx, size) ? -1 : 0), out, "DMA read back other data");
+
+    log_info("emulator DMA round trip passed");
+out:
+    if (write_fd >= 0) {
+        close(write_fd);
+    }
+    if (read_fd >= 0) {
+        close(read_fd);
+    }
+    free(tx);
+    free(rx);
+    return rc;
+}
+
+/* read len bytes of the pty, or fail after EMU_UART_TIMEOUT_MS */
+static int emu_tty_read(int fd, uint8_t *buf, size_t len)
+{
+    size_t n = 0;
+
+    while (n < len) {
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        ssize_t ret;
+
+        if (poll(&pfd, 1, EMU_UART_TIMEOUT_MS) <= 0) {
+            return -ETIMEDOUT;
+        }
+        ret = read(fd, buf + n, len - n);
+        if (ret <= 0) {
+            return -EIO;
+        }
+        n += ret;
+    }
+    return 0;
+}
+
+/* read len bytes of the receive FIFO, or fail after EMU_UART_TIMEOUT_MS */
+static int emu_uart_read(pci_bar_handle_t handle, uint8_t *buf, size_t len)
+{
+    int rc = 0;
+    uint32_t value;
+    size_t n = 0;
+
+    for (int ms = 0; n < len && !rc; ) {
+        rc = fpga_pci_peek(handle, EMU_UART_LSR, &value);
+        if (rc || !(value & EMU_UART_LSR_DRDY)) {
+            if (++ms > EMU_UART_TIMEOUT_MS) {
+                rc = -ETIMEDOUT;
+            }
+            usleep(1000);
+            continue;
+        }
+        rc = fpga_pci_peek(handle, EMU_UART_RBR_THR, &value);
+        buf[n++] = (uint8_t) value;
+    }
+    return rc;
+}
+
+int fpga_mgmt_test_emu_uart(int slot_id, const char *tty_path)
+{
+    int rc;
+    int tty_fd = -1;
+    struct termios tio;
+    pci_bar_handle_t handle = PCI_BAR_HANDLE_INIT;
+    const uint8_t msg[] = "emulated uart\n";
+    uint8_t buf[sizeof(msg)];
+
+    tty_fd = open(tty_path, O_RDWR | O_NOCTTY);
+    fail_on((rc = (tty_fd < 0) ? -errno : 0), out, "Unable to open %s", tty_path);
+    rc = tcgetattr(tty_fd, &tio);
+    fail_on(rc, out, "Unable to get the attributes of %s", tty_path);
+    cfmakeraw(&tio);
+    rc = tcsetattr(tty_fd, TCSANOW, &tio);
+    fail_on(rc, out, "Unable to make %s raw", tty_path);
+
+    rc = fpga_pci_attach(slot_id, FPGA_APP_PF, APP_PF_BAR0, 0, &handle);
+    fail_on(rc, out, "Unable to attach to slot %d", slot_id);
+
+    /* host to Piton: THR writes come out of the pty */
+    for (size_t i = 0; i < sizeof(msg); i++) {
+        rc = fpga_pci_poke(handle, EMU_UART_RBR_THR, msg[i]);
+        fail_on(rc, out, "Unable to write THR");
+    }
+    memset(buf, 0, sizeof(buf));
+    rc = emu_tty_read(tty_fd, buf, sizeof(buf));
+    fail_on(rc, out, "Unable to read the pty");
+    fail_on((rc = memcmp(buf, msg, sizeof(msg)) ? -1 : 0), out,
+        "the pty read other data");
+
+    /* and back: what the pty echoes shows up in RBR */
+    fail_on((rc = (write(tty_fd, buf, sizeof(buf)) != sizeof(buf)) ? -EIO : 0),
+        out, "Unable to write the pty");
+    memset(buf, 0, sizeof(buf));
+    rc = emu_uart_read(handle, buf, sizeof(buf));
+    fail_on(rc, out, "Unable to read RBR");
+    fail_on((rc = memcmp(buf, msg, sizeof(msg)) ? -1 : 0), out,
+        "RBR read other data");
+
+    log_info("emulator uart loopback passed");
+out:
+    if (handle != PCI_BAR_HANDLE_INIT) {
+        fpga_pci_detach(handle);
+    }
+    if (tty_fd >= 0) {
+        close(tty_fd);
+    }
+    return rc;
+}
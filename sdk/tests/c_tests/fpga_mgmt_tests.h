@@ -24,3 +24,9 @@ int fpga_mgmt_tests_provide_logger(fpga_mgmt_tests_logger_f log_f, const char* l
 
 /* test implementations */
 int fpga_mgmt_test_readdir(unsigned int num_threads);
+int fpga_mgmt_test_reg_program(void);
+
+/* tests against a running fpga-emu, see emu_test.c */
+int fpga_mgmt_test_emu_peek_poke(int slot_id);
+int fpga_mgmt_test_emu_dma(int slot_id);
+int fpga_mgmt_test_emu_uart(int slot_id, const char *tty_path);
@@ -0,0 +1,146 @@
+/*
+ * Amazon FPGA Hardware Development Kit
+ *
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Amazon Software License (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *    http://aws.amazon.com/asl/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on
+ * an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fpga_pci.h>
+#include <utils/lcd.h>
+
+#include <errno.h>
+#include <string.h>
+
+#include "fpga_mgmt_tests.h"
+
+/*
+ * Register programs run against a mock BAR: plain memory described by a
+ * view. A register of the mock BAR keeps the last value written, so a read
+ * shows which of the writes before it have run.
+ */
+#define MOCK_BAR_DWORDS 16
+
+static int test_program_order(const fpga_pci_bar_view_t *view, uint32_t *regs)
+{
+    int rc;
+    size_t failed_op;
+    uint32_t first = 0;
+    uint32_t second[3] = { 0 };
+    uint32_t fifo_in[4] = { 0x10, 0x11, 0x12, 0x13 };
+    uint32_t fifo_out = 0;
+    struct fpga_pci_reg_op ops[] = {
+        FPGA_PCI_REG_POKE(0x0, 0x1),
+        FPGA_PCI_REG_PEEK(0x0, &first),
+        FPGA_PCI_REG_POKE(0x0, 0x2),
+        FPGA_PCI_REG_PEEK_N(0x0, second, sizeof_array(second)),
+        FPGA_PCI_REG_POKE_N(0x8, fifo_in, sizeof_array(fifo_in)),
+        FPGA_PCI_REG_PEEK(0x8, &fifo_out),
+        FPGA_PCI_REG_DELAY(1),
+        FPGA_PCI_REG_POLL(0x8, 0xff, 0x13, 1000, NULL),
+    };
+
+    rc = fpga_pci_bar_view_run_program(view, ops, sizeof_array(ops), &failed_op);
+    fail_on(rc, out, "program failed with %d at op %zu", rc, failed_op);
+    fail_on((rc = (failed_op != sizeof_array(ops))), out,
+        "failed_op is %zu on success", failed_op);
+
+    fail_on((rc = (first != 0x1)), out, "peek read 0x%x instead of 0x1", first);
+    for (size_t i = 0; i < sizeof_array(second); i++) {
+        fail_on((rc = (second[i] != 0x2)), out,
+            "peek_n read 0x%x at %zu instead of 0x2", second[i], i);
+    }
+    fail_on((rc = (fifo_out != 0x13 || regs[2] != 0x13)), out,
+        "poke_n left 0x%x instead of its last DWORD", fifo_out);
+    fail_on((rc = (regs[0] != 0x2)), out, "register 0 is 0x%x", regs[0]);
+out:
+    return rc;
+}
+
+static int test_program_timeout(const fpga_pci_bar_view_t *view, uint32_t *regs)
+{
+    int rc;
+    size_t failed_op = 0;
+    uint32_t last = 0;
+    struct fpga_pci_reg_op ops[] = {
+        FPGA_PCI_REG_POKE(0x4, 0x5a),
+        FPGA_PCI_REG_POLL(0x4, 0x1, 0x1, 1000, &last),
+        FPGA_PCI_REG_POKE(0xc, 0x1),
+    };
+
+    rc = fpga_pci_bar_view_run_program(view, ops, sizeof_array(ops), &failed_op);
+    fail_on((rc = (rc != -ETIMEDOUT)), out, "poll returned %d instead of -ETIMEDOUT",
+        rc);
+    fail_on((rc = (failed_op != 1)), out, "failed_op is %zu instead of 1", failed_op);
+    fail_on((rc = (last != 0x5a)), out, "poll reported 0x%x instead of 0x5a", last);
+    fail_on((rc = (regs[3] != 0)), out, "the op after the failed poll ran");
+out:
+    return rc;
+}
+
+static int test_program_invalid(const fpga_pci_bar_view_t *view, uint32_t *regs)
+{
+    int rc;
+    size_t failed_op = 0;
+    uint32_t value = 0;
+    struct fpga_pci_reg_op out_of_range[] = {
+        FPGA_PCI_REG_POKE(0x0, 0xdead),
+        FPGA_PCI_REG_PEEK(0x0, &value),
+        FPGA_PCI_REG_POKE(MOCK_BAR_DWORDS * sizeof(uint32_t), 0x1),
+    };
+    struct fpga_pci_reg_op misaligned[] = {
+        FPGA_PCI_REG_POKE(0x0, 0xdead),
+        FPGA_PCI_REG_PEEK(0x2, &value),
+    };
+
+    rc = fpga_pci_bar_view_run_program(view, out_of_range,
+        sizeof_array(out_of_range), &failed_op);
+    fail_on((rc = (rc != -EINVAL)), out, "out of range offset returned %d", rc);
+    fail_on((rc = (failed_op != 2)), out, "failed_op is %zu instead of 2", failed_op);
+
+    rc = fpga_pci_bar_view_run_program(view, misaligned, sizeof_array(misaligned),
+        &failed_op);
+    fail_on((rc = (rc != -EINVAL)), out, "misaligned offset returned %d", rc);
+    fail_on((rc = (failed_op != 1)), out, "failed_op is %zu instead of 1", failed_op);
+
+    /* nothing of either program ran */
+    fail_on((rc = (regs[0] != 0 || value != 0)), out,
+        "an invalid program accessed the BAR");
+out:
+    return rc;
+}
+
+int fpga_mgmt_test_reg_program(void)
+{
+    int rc;
+    uint32_t regs[MOCK_BAR_DWORDS];
+    fpga_pci_bar_view_t view = {
+        .base = (volatile uint8_t *)regs,
+        .size = sizeof(regs),
+    };
+
+    memset(regs, 0, sizeof(regs));
+    rc = test_program_order(&view, regs);
+    fail_on(rc, out, "register program ordering test failed");
+
+    memset(regs, 0, sizeof(regs));
+    rc = test_program_timeout(&view, regs);
+    fail_on(rc, out, "register program timeout test failed");
+
+    memset(regs, 0, sizeof(regs));
+    rc = test_program_invalid(&view, regs);
+    fail_on(rc, out, "register program validation test failed");
+
+    log_info("register program tests passed");
+out:
+    return rc;
+}
@@ -0,0 +1,118 @@
+#! /user/bin/env python2.7
+
+# Amazon FPGA Hardware Development Kit
+#
+# Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+#
+# Licensed under the Amazon Software License (the "License"). You may not use
+# this file except in compliance with the License. A copy of the License is
+# located at
+#
+#    http://aws.amazon.com/asl/
+#
+# or in the "license" file accompanying this file. This file is distributed on
+# an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, express or
+# implied. See the License for the specific language governing permissions and
+# limitations under the License.
+
+
+from __future__ import print_function
+import ctypes
+import os
+import shutil
+import signal
+import subprocess
+import sys
+import tempfile
+import traceback
+from base_sdk import BaseSdkTools
+
+try:
+    from aws_fpga_test_utils.AwsFpgaTestBase import AwsFpgaTestBase
+    import aws_fpga_utils
+except ImportError as e:
+    traceback.print_tb(sys.exc_info()[2])
+    print("error: {}\nMake sure to source sdk_setup.sh".format(sys.exc_info()[1]))
+    sys.exit(1)
+
+logger = aws_fpga_utils.get_logger(__name__)
+
+class TestFpgaEmu(BaseSdkTools):
+    '''
+    Pytest test class.
+
+    NOTE: Cannot have an __init__ method.
+
+    Smoke tests of the tools and libraries against fpga-emu, described in
+    ../userspace/fpga_emu/README.md. They need no FPGA, so they also run off F1.
+
+    The libraries read FPGA_PCI_EMU_ROOT once, so run this module in its own
+    pytest process.
+    '''
+
+    @classmethod
+    def setup_class(cls):
+        '''
+        Start the emulator in a temporary root, then load the libraries.
+        '''
+        AwsFpgaTestBase.setup_class(cls, __file__)
+
+        AwsFpgaTestBase.assert_sdk_setup()
+
+        cls.emu_dir = "{}/sdk/userspace/fpga_emu/src".format(AwsFpgaTestBase.WORKSPACE)
+        cls.tools_dir = "{}/sdk/userspace/fpga_mgmt_tools/src".format(AwsFpgaTestBase.WORKSPACE)
+        env = dict(os.environ)
+        env['SDK_DIR'] = AwsFpgaTestBase.WORKSPACE + "/sdk"
+        make_proc = subprocess.Popen("make", cwd=cls.emu_dir, env=env)
+        if make_proc.wait() != 0:
+            raise Exception("Unable to build fpga-emu")
+
+        # The sockets of the emulated BARs need a short path
+        cls.emu_root = tempfile.mkdtemp(prefix="fpga_emu.", dir="/tmp")
+        cls.emu_proc = subprocess.Popen([cls.emu_dir + "/fpga-emu", "--ddr-size", "1G", cls.emu_root],
+                                        stdout=subprocess.PIPE)
+        while True:
+            line = cls.emu_proc.stdout.readline()
+            assert line, "fpga-emu exited with rc={}".format(cls.emu_proc.wait())
+            logger.info("fpga-emu: {}".format(line.strip()))
+            if line.startswith(b"serving"):
+                break
+
+        os.environ['FPGA_PCI_EMU_ROOT'] = cls.emu_root
+        cls.load_mgmt_so()
+        cls.load_mgmt_test_so()
+
+        cls.mgmt_so.fpga_pci_emu_root.restype = ctypes.c_char_p
+        cls.mgmt_so.fpga_pci_emu_root.argtypes = []
+        assert cls.mgmt_so.fpga_pci_emu_root() == cls.emu_root.encode(), \
+            "The libraries were already loaded without FPGA_PCI_EMU_ROOT"
+        return
+
+    @classmethod
+    def teardown_class(cls):
+        cls.emu_proc.send_signal(signal.SIGTERM)
+        cls.emu_proc.wait()
+        del os.environ['FPGA_PCI_EMU_ROOT']
+        shutil.rmtree(cls.emu_root, ignore_errors=True)
+
+    def test_describe_load(self):
+        agfi = "agfi-0123456789abcdef0"
+        (rc, stdout, stderr) = self.run_cmd("{}/fpga-local-cmd DescribeFpgaImage -S 0 -H".format(self.tools_dir))
+        assert rc == 0
+        assert stdout[1].split()[3] == "loaded", stdout
+        (rc, stdout, stderr) = self.run_cmd("{}/fpga-local-cmd LoadFpgaImage -S 0 -I {}".format(self.tools_dir, agfi))
+        assert rc == 0
+        (rc, stdout, stderr) = self.run_cmd("{}/fpga-local-cmd DescribeFpgaImage -S 0 -H".format(self.tools_dir))
+        assert rc == 0
+        assert stdout[1].split()[2] == agfi, stdout
+        assert stdout[3].split()[2:4] == ["0x1d0f", "0xf001"], stdout
+
+    def test_peek_poke(self):
+        assert self.mgmt_test_so.fpga_mgmt_test_emu_peek_poke(0) == 0
+
+    def test_dma(self):
+        assert self.mgmt_test_so.fpga_mgmt_test_emu_dma(0) == 0
+
+    def test_uart(self):
+        tty_path = "{}/tty/slot0-bar0".format(self.emu_root)
+        assert self.mgmt_test_so.fpga_mgmt_test_emu_uart(0, tty_path.encode()) == 0
@@ -0,0 +1,57 @@
+#! /user/bin/env python2.7
+
+# Amazon FPGA Hardware Development Kit
+#
+# Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+#
+# Licensed under the Amazon Software License (the "License"). You may not use
+# this file except in compliance with the License. A copy of the License is
+# located at
+#
+#    http://aws.amazon.com/asl/
+#
+# or in the "license" file accompanying this file. This file is distributed on
+# an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, express or
+# implied. See the License for the specific language governing permissions and
+# limitations under the License.
+
+
+from __future__ import print_function
+import sys
+import traceback
+from base_sdk import BaseSdkTools
+
+try:
+    from aws_fpga_test_utils.AwsFpgaTestBase import AwsFpgaTestBase
+    import aws_fpga_utils
+except ImportError as e:
+    traceback.print_tb(sys.exc_info()[2])
+    print("error: {}\nMake sure to source sdk_setup.sh".format(sys.exc_info()[1]))
+    sys.exit(1)
+
+logger = aws_fpga_utils.get_logger(__name__)
+
+class TestSdkLocal(BaseSdkTools):
+    '''
+    Pytest test class.
+
+    NOTE: Cannot have an __init__ method.
+
+    Tests of the SDK libraries which need no FPGA, so they also run off F1.
+    '''
+
+    @classmethod
+    def setup_class(cls):
+        '''
+        Do any setup required for tests.
+        '''
+        AwsFpgaTestBase.setup_class(cls, __file__)
+
+        AwsFpgaTestBase.assert_sdk_setup()
+
+        cls.load_mgmt_so()
+        cls.load_mgmt_test_so()
+        return
+
+    def test_reg_program(self):
+        assert self.mgmt_test_so.fpga_mgmt_test_reg_program() == 0
@@ -0,0 +1,351 @@
+/*
+ * Copyright 2015-2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may
+ * not use this file except in compliance with the License. A copy of the
+ * License is located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/*
+ * fpga-bar-bench measures the throughput of copies to and from a BAR of the
+ * application PF, e.g. the PCIS window of APP_PF_BAR4, and reports it as
+ * JSON. Each point writes, reads or fills size bytes three ways:
+ *
+ *  - peek_poke: one fpga_pci_peek/fpga_pci_poke per DWORD,
+ *  - dword: a loop of 32-bit accesses through fpga_pci_get_address, which is
+ *    what fpga_pci_write_burst and fpga_pci_memset used to do,
+ *  - burst: fpga_pci_read_burst, fpga_pci_write_burst and fpga_pci_memset.
+ *
+ * The BAR is attached BURST_CAPABLE (write combining) unless --uncached is
+ * given; the burst routines only use wide accesses on such a BAR.
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+
+#include <fpga_pci.h>
+#include <utils/lcd.h>
+
+#define BENCH_POINTS_MAX    (16)
+
+/* use the standard out logger */
+static const struct logger *logger = &logger_stdout;
+
+enum bench_op {
+    BENCH_WRITE,
+    BENCH_READ,
+    BENCH_MEMSET,
+    BENCH_OPS,
+};
+
+enum bench_method {
+    BENCH_PEEK_POKE,
+    BENCH_DWORD,
+    BENCH_BURST,
+    BENCH_METHODS,
+};
+
+static const char *bench_op_names[BENCH_OPS] = { "write", "read", "memset" };
+static const char *bench_method_names[BENCH_METHODS] = {
+    "peek_poke", "dword", "burst"
+};
+
+struct bench_list {
+    int n;
+    size_t values[BENCH_POINTS_MAX];
+};
+
+struct bench_opts {
+    int slot_id;
+    int bar_id;
+    size_t offset;
+    bool uncached;
+    /* time spent on each point */
+    uint64_t point_ns;
+    struct bench_list sizes;
+    FILE *out;
+};
+
+static uint64_t bench_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int bench_parse_size(const char *str, size_t *size)
+{
+    char *end = NULL;
+    unsigned long long value;
+
+    errno = 0;
+    value = strtoull(str, &end, 0);
+    if (errno != 0 || end == str) {
+        errno = 0;
+        return -EINVAL;
+    }
+    switch (*end) {
+    case 'k': case 'K': value <<= 10; end++; break;
+    case 'm': case 'M': value <<= 20; end++; break;
+    case 'g': case 'G': value <<= 30; end++; break;
+    default: break;
+    }
+    if (*end != '\0') {
+        return -EINVAL;
+    }
+    *size = value;
+    return 0;
+}
+
+/* comma separated sizes, e.g. 4K,64K,1M */
+static int bench_parse_list(char *str, struct bench_list *list)
+{
+    char *save = NULL;
+
+    list->n = 0;
+    for (char *tok = strtok_r(str, ",", &save); tok != NULL;
+        tok = strtok_r(NULL, ",", &save)) {
+        if (list->n == BENCH_POINTS_MAX ||
+            bench_parse_size(tok, &list->values[list->n]) != 0) {
+            return -EINVAL;
+        }
+        list->n++;
+    }
+    return (list->n > 0) ? 0 : -EINVAL;
+}
+
+/* one copy of size bytes between buf and the BAR at offset */
+static int bench_copy(pci_bar_handle_t handle, volatile uint32_t *bar,
+    uint64_t offset, uint32_t *buf, size_t size, enum bench_op op,
+    enum bench_method method)
+{
+    int rc = 0;
+    uint64_t dwords = size / sizeof(uint32_t);
+
+    switch (method) {
+    case BENCH_PEEK_POKE:
+        for (uint64_t i = 0; i < dwords && rc == 0; i++) {
+            uint64_t reg = offset + i * sizeof(uint32_t);
+
+            rc = (op == BENCH_READ) ? fpga_pci_peek(handle, reg, &buf[i]) :
+                fpga_pci_poke(handle, reg,
+                    (op == BENCH_WRITE) ? buf[i] : buf[0]);
+        }
+        break;
+    case BENCH_DWORD:
+        for (uint64_t i = 0; i < dwords; i++) {
+            if (op == BENCH_READ) {
+                buf[i] = bar[i];
+            } else {
+                bar[i] = (op == BENCH_WRITE) ? buf[i] : buf[0];
+            }
+        }
+        break;
+    default:
+        rc = (op == BENCH_READ) ?
+            fpga_pci_read_burst(handle, offset, buf, dwords) :
+            (op == BENCH_WRITE) ?
+            fpga_pci_write_burst(handle, offset, buf, dwords) :
+            fpga_pci_memset(handle, offset, buf[0], dwords);
+        break;
+    }
+    return rc;
+}
+
+/* repeat a copy for opts->point_ns, *mbps is its throughput */
+static int bench_run(const struct bench_opts *opts, pci_bar_handle_t handle,
+    volatile uint32_t *bar, uint32_t *buf, size_t size, enum bench_op op,
+    enum bench_method method, double *mbps)
+{
+    int rc;
+    uint64_t copies = 0;
+    uint64_t begin = bench_now_ns();
+    uint64_t elapsed;
+
+    do {
+        rc = bench_copy(handle, bar, opts->offset, buf, size, op, method);
+        fail_on(rc, out, "%s %s of %zu bytes failed", bench_method_names[method],
+            bench_op_names[op], size);
+        copies++;
+        elapsed = bench_now_ns() - begin;
+    } while (elapsed < opts->point_ns);
+
+    *mbps = (double)size * copies / elapsed * 1e3;
+out:
+    return rc;
+}
+
+static void usage(const char *program_name)
+{
+    printf("usage: %s [options]\n"
+        "  -S, --slot <id>          FPGA slot, default 0\n"
+        "  -B, --bar <id>           BAR of the application PF, default 4\n"
+        "  -O, --offset <bytes>     offset of the test window, default 0\n"
+        "  -s, --sizes <list>       copy sizes, default 64,4K,64K,1M\n"
+        "  -t, --time <ms>          time spent on each point, default 200\n"
+        "  -u, --uncached           attach without BURST_CAPABLE\n"
+        "  -o, --output <file>      write the JSON report to a file\n"
+        "sizes are comma separated, multiples of 4 and take K/M/G suffixes\n",
+        program_name);
+}
+
+static int bench_parse_args(int argc, char **argv, struct bench_opts *opts)
+{
+    int opt;
+    char sizes[] = "64,4K,64K,1M";
+
+    static struct option long_options[] = {
+        {"slot",     required_argument, 0, 'S'},
+        {"bar",      required_argument, 0, 'B'},
+        {"offset",   required_argument, 0, 'O'},
+        {"sizes",    required_argument, 0, 's'},
+        {"time",     required_argument, 0, 't'},
+        {"uncached", no_argument,       0, 'u'},
+        {"output",   required_argument, 0, 'o'},
+        {"help",     no_argument,       0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    memset(opts, 0, sizeof(*opts));
+    opts->bar_id = APP_PF_BAR4;
+    opts->point_ns = 200 * 1000000ull;
+    opts->out = stdout;
+    bench_parse_list(sizes, &opts->sizes);
+
+    while ((opt = getopt_long(argc, argv, "S:B:O:s:t:uo:h", long_options,
+        NULL)) != -1) {
+        int rc = 0;
+
+        switch (opt) {
+        case 'S':
+            opts->slot_id = atoi(optarg);
+            break;
+        case 'B':
+            opts->bar_id = atoi(optarg);
+            break;
+        case 'O':
+            rc = bench_parse_size(optarg, &opts->offset);
+            break;
+        case 's':
+            rc = bench_parse_list(optarg, &opts->sizes);
+            break;
+        case 't':
+            opts->point_ns = strtoull(optarg, NULL, 0) * 1000000ull;
+            rc = (opts->point_ns == 0) ? -EINVAL : 0;
+            break;
+        case 'u':
+            opts->uncached = true;
+            break;
+        case 'o':
+            opts->out = fopen(optarg, "w");
+            rc = (opts->out == NULL) ? -errno : 0;
+            break;
+        default:
+            usage(argv[0]);
+            return -EINVAL;
+        }
+        if (rc) {
+            usage(argv[0]);
+            return rc;
+        }
+    }
+
+    for (int i = 0; i < opts->sizes.n; i++) {
+        if (opts->sizes.values[i] == 0 ||
+            opts->sizes.values[i] % sizeof(uint32_t) != 0) {
+            usage(argv[0]);
+            return -EINVAL;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int rc;
+    bool first = true;
+    struct bench_opts opts;
+    pci_bar_handle_t handle = PCI_BAR_HANDLE_INIT;
+    size_t size_max = 0;
+    uint32_t *buf = NULL;
+    void *bar;
+
+    rc = bench_parse_args(argc, argv, &opts);
+    if (rc) {
+        return 1;
+    }
+
+    rc = log_init("fpga-bar-bench");
+    fail_on(rc, out, "Unable to initialize the log.");
+    rc = log_attach(logger, NULL, 0);
+    fail_on(rc, out, "%s", "Unable to attach to the log.");
+
+    rc = fpga_pci_init();
+    fail_on(rc, out, "Unable to initialize the fpga_pci library");
+    rc = fpga_pci_attach(opts.slot_id, FPGA_APP_PF, opts.bar_id,
+        opts.uncached ? 0 : BURST_CAPABLE, &handle);
+    fail_on(rc, out, "Unable to attach to BAR %d of slot %d", opts.bar_id,
+        opts.slot_id);
+
+    for (int s = 0; s < opts.sizes.n; s++) {
+        if (opts.sizes.values[s] > size_max) {
+            size_max = opts.sizes.values[s];
+        }
+    }
+    rc = fpga_pci_get_address(handle, opts.offset, size_max, &bar);
+    fail_on(rc, out, "The test window does not fit the BAR");
+    buf = malloc(size_max);
+    fail_on((rc = (buf == NULL) ? -ENOMEM : 0), out,
+        "Unable to allocate the buffer");
+    for (size_t i = 0; i < size_max / sizeof(uint32_t); i++) {
+        buf[i] = (uint32_t)i * 0x9e3779b9u;
+    }
+
+    fprintf(opts.out, "{\"slot\": %d, \"bar\": %d, \"offset\": %zu, "
+        "\"write_combining\": %s, \"results\": [\n", opts.slot_id,
+        opts.bar_id, opts.offset, opts.uncached ? "false" : "true");
+    for (int op = 0; op < BENCH_OPS; op++)
+    for (int s = 0; s < opts.sizes.n; s++) {
+        size_t size = opts.sizes.values[s];
+        double mbps[BENCH_METHODS];
+
+        for (int method = 0; method < BENCH_METHODS; method++) {
+            rc = bench_run(&opts, handle, bar, buf, size, op, method,
+                &mbps[method]);
+            fail_on(rc, out_json, "Benchmark failed");
+        }
+        fprintf(opts.out,
+            "%s    {\"op\": \"%s\", \"size\": %zu, "
+            "\"peek_poke_mbps\": %.2f, \"dword_mbps\": %.2f, "
+            "\"burst_mbps\": %.2f, \"burst_speedup\": %.2f}",
+            first ? "" : ",\n", bench_op_names[op], size,
+            mbps[BENCH_PEEK_POKE], mbps[BENCH_DWORD], mbps[BENCH_BURST],
+            mbps[BENCH_BURST] / mbps[BENCH_DWORD]);
+        fflush(opts.out);
+        first = false;
+    }
+
+out_json:
+    fprintf(opts.out, "\n]}\n");
+out:
+    free(buf);
+    if (handle != PCI_BAR_HANDLE_INIT) {
+        fpga_pci_detach(handle);
+    }
+    if (opts.out != NULL && opts.out != stdout) {
+        fclose(opts.out);
+    }
+    return (rc != 0 ? 1 : 0);
+}
@@ -0,0 +1,507 @@
+/*
+ * Copyright 2015-2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may
+ * not use this file except in compliance with the License. A copy of the
+ * License is located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/*
+ * fpga-dma-bench sweeps transfer size, queue depth, channel count, direction
+ * and host buffer alignment over the fpga_dma API and reports bandwidth,
+ * latency percentiles and CPU time per GB of every point as JSON.
+ *
+ * Each point keeps depth transfers in flight on each of its channels through
+ * one fpga_dma_async context. A transfer's latency runs from its submission
+ * to its completion being reaped.
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include <fpga_dma.h>
+#include <utils/lcd.h>
+
+#define BENCH_POINTS_MAX     (16)
+#define BENCH_ITERATIONS_MIN (100)
+
+/* use the standard out logger */
+static const struct logger *logger = &logger_stdout;
+
+struct bench_list {
+    int n;
+    size_t values[BENCH_POINTS_MAX];
+};
+
+struct bench_opts {
+    int slot_id;
+    size_t address;
+    size_t window;
+    size_t bytes;
+    size_t iterations;
+    bool do_read;
+    bool do_write;
+    bool do_register;
+    struct bench_list sizes;
+    struct bench_list depths;
+    struct bench_list channels;
+    struct bench_list aligns;
+    FILE *out;
+};
+
+struct bench_point {
+    bool is_read;
+    size_t size;
+    int depth;
+    int channels;
+    size_t align;
+    size_t iterations;
+};
+
+struct bench_result {
+    double seconds;
+    double cpu_seconds;
+    bool registered;
+    /* page size backing the buffer */
+    size_t page_size;
+    /* latency of each transfer in ns */
+    uint64_t *latency;
+};
+
+static uint64_t bench_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static double bench_cpu_seconds(void)
+{
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+        usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+static int bench_parse_size(const char *str, size_t *size)
+{
+    char *end = NULL;
+    unsigned long long value;
+
+    errno = 0;
+    value = strtoull(str, &end, 0);
+    if (errno != 0 || end == str) {
+        errno = 0;
+        return -EINVAL;
+    }
+    switch (*end) {
+    case 'k': case 'K': value <<= 10; end++; break;
+    case 'm': case 'M': value <<= 20; end++; break;
+    case 'g': case 'G': value <<= 30; end++; break;
+    default: break;
+    }
+    if (*end != '\0') {
+        return -EINVAL;
+    }
+    *size = value;
+    return 0;
+}
+
+/* comma separated sizes, e.g. 4K,64K,1M */
+static int bench_parse_list(char *str, struct bench_list *list)
+{
+    char *save = NULL;
+
+    list->n = 0;
+    for (char *tok = strtok_r(str, ",", &save); tok != NULL;
+        tok = strtok_r(NULL, ",", &save)) {
+        if (list->n == BENCH_POINTS_MAX ||
+            bench_parse_size(tok, &list->values[list->n]) != 0) {
+            return -EINVAL;
+        }
+        list->n++;
+    }
+    return (list->n > 0) ? 0 : -EINVAL;
+}
+
+static int bench_cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+/* nearest rank percentile of sorted samples, in us */
+static double bench_percentile(const uint64_t *sorted, size_t n, double p)
+{
+    size_t rank = (size_t)(p * n + 0.999999);
+
+    if (rank == 0) {
+        rank = 1;
+    }
+    if (rank > n) {
+        rank = n;
+    }
+    return sorted[rank - 1] / 1e3;
+}
+
+static int bench_run(const struct bench_opts *opts,
+    const struct fpga_dma_queues *queues, const struct bench_point *point,
+    struct bench_result *result)
+{
+    int rc;
+    int n_slots = point->depth * point->channels;
+    size_t slot_size = point->size + point->align;
+    size_t window = opts->window;
+    size_t next = 0;
+    size_t done = 0;
+    struct fpga_dma_async *ctx = NULL;
+    struct fpga_dma_buffer buffer = { 0 };
+    struct fpga_dma_event *events = NULL;
+    uint64_t *started = NULL;
+    int *free_slots = NULL;
+    int n_free = 0;
+    uint32_t handles[FPGA_DMA_CHANNELS_MAX];
+    uint64_t begin;
+    uint64_t now;
+    int n_events;
+    double cpu_begin;
+
+    memset(handles, 0, sizeof(handles));
+    memset(result, 0, sizeof(*result));
+    if (window < point->size) {
+        window = point->size;
+    }
+
+    rc = fpga_dma_async_init(n_slots, &ctx);
+    fail_on(rc, out, "unable to set up %d transfers in flight", n_slots);
+    rc = fpga_dma_buffer_alloc(opts->slot_id, slot_size * n_slots, &buffer);
+    fail_on(rc, out, "unable to allocate the DMA buffers");
+    result->page_size = buffer.page_size;
+    memset(buffer.data, 0xa5, buffer.size);
+
+    events = calloc(n_slots, sizeof(*events));
+    started = calloc(n_slots, sizeof(*started));
+    free_slots = calloc(n_slots, sizeof(*free_slots));
+    result->latency = calloc(point->iterations, sizeof(*result->latency));
+    fail_on(rc = (!events || !started || !free_slots || !result->latency) ?
+        -ENOMEM : 0, out, "out of memory");
+    while (n_free < n_slots) {
+        free_slots[n_free] = n_slots - 1 - n_free;
+        n_free++;
+    }
+
+    if (opts->do_register) {
+        for (int ch = 0; ch < point->channels; ch++) {
+            int fd = point->is_read ? queues->read_fds[ch] :
+                queues->write_fds[ch];
+            rc = fpga_dma_buffer_register(fd, buffer.data, buffer.size,
+                &handles[ch]);
+            if (rc == -EINVAL || rc == -ENOTTY) {
+                /* the driver moves unregistered buffers */
+                rc = 0;
+                break;
+            }
+            fail_on(rc, out, "unable to register the DMA buffers");
+        }
+        result->registered = handles[0] != 0;
+    }
+
+    cpu_begin = bench_cpu_seconds();
+    begin = bench_now_ns();
+    while (done < point->iterations) {
+        /* slot s always moves on channel s % channels with buffer s */
+        while (next < point->iterations && n_free > 0) {
+            int slot = free_slots[--n_free];
+            int ch = slot % point->channels;
+            struct iovec iov = {
+                .iov_base = buffer.data + slot * slot_size + point->align,
+                .iov_len = point->size,
+            };
+            size_t address = opts->address +
+                (next * point->size) % (window - window % point->size);
+
+            started[slot] = bench_now_ns();
+            rc = fpga_dma_submit(ctx, point->is_read ? queues->read_fds[ch] :
+                queues->write_fds[ch], point->is_read, &iov, &address, 1, slot);
+            fail_on(rc = (rc == 1) ? 0 : (rc < 0 ? rc : -EAGAIN), out,
+                "unable to submit a transfer");
+            next++;
+        }
+
+        n_events = fpga_dma_poll(ctx, events, n_slots, 1);
+        fail_on(rc = (n_events > 0) ? 0 : (n_events < 0 ? n_events : -EIO),
+            out, "unable to reap a transfer");
+        now = bench_now_ns();
+        for (int i = 0; i < n_events; i++) {
+            fail_on(rc = events[i].rc, out, "transfer of %zu bytes failed",
+                point->size);
+            result->latency[done++] = now - started[events[i].tag];
+            free_slots[n_free++] = events[i].tag;
+        }
+    }
+    result->seconds = (bench_now_ns() - begin) / 1e9;
+    result->cpu_seconds = bench_cpu_seconds() - cpu_begin;
+
+out:
+    if (ctx != NULL) {
+        fpga_dma_async_free(ctx);
+    }
+    for (int ch = 0; ch < point->channels; ch++) {
+        if (handles[ch] != 0) {
+            fpga_dma_buffer_unregister(point->is_read ? queues->read_fds[ch] :
+                queues->write_fds[ch], handles[ch]);
+        }
+    }
+    fpga_dma_buffer_free(&buffer);
+    free(events);
+    free(started);
+    free(free_slots);
+    return rc;
+}
+
+static void bench_report(const struct bench_opts *opts,
+    const struct bench_point *point, struct bench_result *result, bool first)
+{
+    size_t n = point->iterations;
+    double bytes = (double)point->size * n;
+
+    qsort(result->latency, n, sizeof(*result->latency), bench_cmp_u64);
+    fprintf(opts->out,
+        "%s    {\"direction\": \"%s\", \"size\": %zu, \"depth\": %d, "
+        "\"channels\": %d, \"align\": %zu, \"registered\": %s, "
+        "\"page_size\": %zu, \"iterations\": %zu, \"seconds\": %.6f, "
+        "\"bandwidth_mbps\": %.2f, "
+        "\"latency_us\": {\"p50\": %.2f, \"p99\": %.2f, \"p999\": %.2f, "
+        "\"max\": %.2f}, \"cpu_seconds_per_gb\": %.4f}",
+        first ? "" : ",\n", point->is_read ? "read" : "write", point->size,
+        point->depth, point->channels, point->align,
+        result->registered ? "true" : "false", result->page_size, n,
+        result->seconds,
+        bytes / result->seconds / 1e6,
+        bench_percentile(result->latency, n, 0.50),
+        bench_percentile(result->latency, n, 0.99),
+        bench_percentile(result->latency, n, 0.999),
+        result->latency[n - 1] / 1e3,
+        result->cpu_seconds / (bytes / 1e9));
+    fflush(opts->out);
+}
+
+static void usage(const char *program_name)
+{
+    printf("usage: %s [options]\n"
+        "  -S, --slot <id>          FPGA slot, default 0\n"
+        "  -s, --sizes <list>       transfer sizes, default 4K,64K,1M,8M\n"
+        "  -q, --depths <list>      transfers in flight per channel, default 1,4\n"
+        "  -c, --channels <list>    DMA channels, default 1,%d\n"
+        "  -a, --align <list>       host buffer offsets from a page, default 0\n"
+        "  -d, --direction <dir>    read, write or both, default both\n"
+        "  -A, --address <addr>     FPGA address of the test window, default 0\n"
+        "  -w, --window <bytes>     size of the test window, default 1G\n"
+        "  -b, --bytes <bytes>      bytes per point, default 256M\n"
+        "  -n, --iterations <n>     transfers per point, overrides --bytes\n"
+        "  -r, --register           register the buffers with the driver\n"
+        "  -o, --output <file>      write the JSON report to a file\n"
+        "lists are comma separated and take K/M/G suffixes; every point runs\n"
+        "at least %d transfers\n",
+        program_name, FPGA_DMA_CHANNELS_MAX, BENCH_ITERATIONS_MIN);
+}
+
+static int bench_parse_args(int argc, char **argv, struct bench_opts *opts)
+{
+    int opt;
+    char sizes[] = "4K,64K,1M,8M";
+    char depths[] = "1,4";
+    char channels[] = "1,4";
+    char aligns[] = "0";
+
+    static struct option long_options[] = {
+        {"slot",       required_argument, 0, 'S'},
+        {"sizes",      required_argument, 0, 's'},
+        {"depths",     required_argument, 0, 'q'},
+        {"channels",   required_argument, 0, 'c'},
+        {"align",      required_argument, 0, 'a'},
+        {"direction",  required_argument, 0, 'd'},
+        {"address",    required_argument, 0, 'A'},
+        {"window",     required_argument, 0, 'w'},
+        {"bytes",      required_argument, 0, 'b'},
+        {"iterations", required_argument, 0, 'n'},
+        {"register",   no_argument,       0, 'r'},
+        {"output",     required_argument, 0, 'o'},
+        {"help",       no_argument,       0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    memset(opts, 0, sizeof(*opts));
+    opts->window = 1ull << 30;
+    opts->bytes = 256 << 20;
+    opts->do_read = opts->do_write = true;
+    opts->out = stdout;
+    bench_parse_list(sizes, &opts->sizes);
+    bench_parse_list(depths, &opts->depths);
+    bench_parse_list(channels, &opts->channels);
+    bench_parse_list(aligns, &opts->aligns);
+
+    while ((opt = getopt_long(argc, argv, "S:s:q:c:a:d:A:w:b:n:ro:h",
+        long_options, NULL)) != -1) {
+        int rc = 0;
+
+        switch (opt) {
+        case 'S':
+            opts->slot_id = atoi(optarg);
+            break;
+        case 's':
+            rc = bench_parse_list(optarg, &opts->sizes);
+            break;
+        case 'q':
+            rc = bench_parse_list(optarg, &opts->depths);
+            break;
+        case 'c':
+            rc = bench_parse_list(optarg, &opts->channels);
+            break;
+        case 'a':
+            rc = bench_parse_list(optarg, &opts->aligns);
+            break;
+        case 'd':
+            opts->do_read = strcmp(optarg, "write") != 0;
+            opts->do_write = strcmp(optarg, "read") != 0;
+            rc = (strcmp(optarg, "read") && strcmp(optarg, "write") &&
+                strcmp(optarg, "both")) ? -EINVAL : 0;
+            break;
+        case 'A':
+            rc = bench_parse_size(optarg, &opts->address);
+            break;
+        case 'w':
+            rc = bench_parse_size(optarg, &opts->window);
+            break;
+        case 'b':
+            rc = bench_parse_size(optarg, &opts->bytes);
+            break;
+        case 'n':
+            rc = bench_parse_size(optarg, &opts->iterations);
+            break;
+        case 'r':
+            opts->do_register = true;
+            break;
+        case 'o':
+            opts->out = fopen(optarg, "w");
+            rc = (opts->out == NULL) ? -errno : 0;
+            break;
+        default:
+            usage(argv[0]);
+            return -EINVAL;
+        }
+        if (rc) {
+            usage(argv[0]);
+            return rc;
+        }
+    }
+
+    for (int i = 0; i < opts->sizes.n; i++) {
+        if (opts->sizes.values[i] == 0) {
+            goto err_usage;
+        }
+    }
+    for (int i = 0; i < opts->depths.n; i++) {
+        if (opts->depths.values[i] == 0 ||
+            opts->depths.values[i] * FPGA_DMA_CHANNELS_MAX > 4096) {
+            goto err_usage;
+        }
+    }
+    for (int i = 0; i < opts->channels.n; i++) {
+        if (opts->channels.values[i] == 0 ||
+            opts->channels.values[i] > FPGA_DMA_CHANNELS_MAX) {
+            goto err_usage;
+        }
+    }
+    return 0;
+
+err_usage:
+    usage(argv[0]);
+    return -EINVAL;
+}
+
+int main(int argc, char **argv)
+{
+    int rc;
+    bool first = true;
+    struct bench_opts opts;
+    struct fpga_dma_queues queues = { .n_channels = 0 };
+
+    rc = bench_parse_args(argc, argv, &opts);
+    if (rc) {
+        return 1;
+    }
+
+    rc = log_init("fpga-dma-bench");
+    fail_on(rc, out, "Unable to initialize the log.");
+    rc = log_attach(logger, NULL, 0);
+    fail_on(rc, out, "%s", "Unable to attach to the log.");
+
+    rc = fpga_dma_open_all_queues(FPGA_DMA_XDMA, opts.slot_id, &queues);
+    fail_on(rc, out, "Unable to open the DMA queues of slot %d", opts.slot_id);
+
+    fprintf(opts.out, "{\"slot\": %d, \"address\": %zu, \"results\": [\n",
+        opts.slot_id, opts.address);
+    for (int dir = 0; dir < 2; dir++) {
+        if (!(dir ? opts.do_read : opts.do_write)) {
+            continue;
+        }
+        for (int s = 0; s < opts.sizes.n; s++)
+        for (int q = 0; q < opts.depths.n; q++)
+        for (int c = 0; c < opts.channels.n; c++)
+        for (int a = 0; a < opts.aligns.n; a++) {
+            struct bench_result result;
+            struct bench_point point = {
+                .is_read = dir,
+                .size = opts.sizes.values[s],
+                .depth = opts.depths.values[q],
+                .channels = opts.channels.values[c],
+                .align = opts.aligns.values[a],
+                .iterations = opts.iterations,
+            };
+
+            if (point.iterations == 0) {
+                point.iterations = opts.bytes / point.size;
+            }
+            if (point.iterations < BENCH_ITERATIONS_MIN) {
+                point.iterations = BENCH_ITERATIONS_MIN;
+            }
+
+            rc = bench_run(&opts, &queues, &point, &result);
+            if (rc == 0) {
+                bench_report(&opts, &point, &result, first);
+                first = false;
+            }
+            free(result.latency);
+            fail_on(rc, out_json, "%s of %zu bytes, depth %d, %d channels "
+                "failed", dir ? "read" : "write", point.size, point.depth,
+                point.channels);
+        }
+    }
+
+out_json:
+    fprintf(opts.out, "\n]}\n");
+out:
+    fpga_dma_close_all_queues(&queues);
+    if (opts.out != NULL && opts.out != stdout) {
+        fclose(opts.out);
+    }
+    return (rc != 0 ? 1 : 0);
+}
@@ -0,0 +1,397 @@
+/*
+ * Copyright 2015-2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may
+ * not use this file except in compliance with the License. A copy of the
+ * License is located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/*
+ * fpga-dma-top shows the DMA traffic of the processes which run with the
+ * fpga_dma transfer statistics enabled (FPGA_DMA_STATS=1, see fpga_dma.h).
+ * Every interval it reads their statistics files and prints the bandwidth of
+ * each slot, then one line per process and DMA queue with its bandwidth,
+ * transfer rate, latency percentiles, errors and retries over the interval.
+ * A process seen for the first time is shown since it enabled the stats.
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <signal.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <fpga_dma.h>
+
+#define TOP_PROCS_MAX (256)
+#define TOP_ROWS_MAX \
+    (TOP_PROCS_MAX * (FPGA_SLOT_MAX * 2 * FPGA_DMA_CHANNELS_MAX + 1))
+
+struct top_opts {
+    double interval;
+    unsigned long iterations;
+    int slot_id;
+    int pid;
+    bool all;
+    bool batch;
+};
+
+struct top_proc {
+    struct fpga_dma_stats stats;
+    /* CLOCK_MONOTONIC time of the copy */
+    uint64_t now_ns;
+};
+
+struct top_snapshot {
+    int n;
+    struct top_proc procs[TOP_PROCS_MAX];
+};
+
+struct top_row {
+    int pid;
+    const char *comm;
+    /* -1 for the other fds */
+    int slot_id;
+    bool is_read;
+    int channel;
+    double seconds;
+    struct fpga_dma_queue_stats delta;
+};
+
+static uint64_t top_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static bool top_pid_alive(int pid)
+{
+    return kill(pid, 0) == 0 || errno != ESRCH;
+}
+
+/* copy the statistics of one process, false if the file is not usable */
+static bool top_read_proc(const char *path, struct top_proc *proc)
+{
+    bool ok = false;
+    struct stat st;
+    const struct fpga_dma_stats *map;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0) {
+        return false;
+    }
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(*map)) {
+        goto out;
+    }
+    map = mmap(NULL, sizeof(*map), PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        goto out;
+    }
+    if (__atomic_load_n(&map->magic, __ATOMIC_ACQUIRE) == FPGA_DMA_STATS_MAGIC &&
+        map->version == FPGA_DMA_STATS_VERSION) {
+        memcpy(&proc->stats, map, sizeof(*map));
+        proc->now_ns = top_now_ns();
+        ok = top_pid_alive(proc->stats.pid);
+    }
+    munmap((void *)map, sizeof(*map));
+out:
+    close(fd);
+    return ok;
+}
+
+static void top_read_all(const struct top_opts *opts, struct top_snapshot *snap)
+{
+    char path[512];
+    struct dirent *entry;
+    DIR *dir = opendir(FPGA_DMA_STATS_DIR);
+
+    snap->n = 0;
+    if (dir == NULL) {
+        return;
+    }
+    while ((entry = readdir(dir)) != NULL && snap->n < TOP_PROCS_MAX) {
+        struct top_proc *proc = &snap->procs[snap->n];
+
+        if (strncmp(entry->d_name, FPGA_DMA_STATS_PREFIX,
+            strlen(FPGA_DMA_STATS_PREFIX)) != 0) {
+            continue;
+        }
+        snprintf(path, sizeof(path), FPGA_DMA_STATS_DIR "/%s", entry->d_name);
+        if (!top_read_proc(path, proc)) {
+            continue;
+        }
+        if (opts->pid > 0 && proc->stats.pid != opts->pid) {
+            continue;
+        }
+        snap->n++;
+    }
+    closedir(dir);
+}
+
+static const struct top_proc *top_find_proc(const struct top_snapshot *snap,
+    const struct top_proc *proc)
+{
+    for (int i = 0; i < snap->n; i++) {
+        if (snap->procs[i].stats.pid == proc->stats.pid &&
+            snap->procs[i].stats.start_ns == proc->stats.start_ns) {
+            return &snap->procs[i];
+        }
+    }
+    return NULL;
+}
+
+static void top_delta(const struct fpga_dma_queue_stats *cur,
+    const struct fpga_dma_queue_stats *prev, struct fpga_dma_queue_stats *delta)
+{
+    static const struct fpga_dma_queue_stats zero;
+
+    if (prev == NULL) {
+        prev = &zero;
+    }
+    delta->calls = cur->calls - prev->calls;
+    delta->bytes = cur->bytes - prev->bytes;
+    delta->errors = cur->errors - prev->errors;
+    delta->retries = cur->retries - prev->retries;
+    delta->busy_ns = cur->busy_ns - prev->busy_ns;
+    for (int i = 0; i < FPGA_DMA_STATS_LATENCY_BUCKETS; i++) {
+        delta->latency[i] = cur->latency[i] - prev->latency[i];
+    }
+}
+
+/* upper bound of the latency bucket holding the given fraction of the calls */
+static void top_percentile(const struct fpga_dma_queue_stats *delta,
+    double fraction, char *out, size_t size)
+{
+    uint64_t seen = 0;
+    uint64_t rank = (uint64_t)(fraction * delta->calls);
+    int i;
+
+    if (delta->calls == 0) {
+        snprintf(out, size, "-");
+        return;
+    }
+    for (i = 0; i < FPGA_DMA_STATS_LATENCY_BUCKETS - 1; i++) {
+        seen += delta->latency[i];
+        if (seen > rank) {
+            break;
+        }
+    }
+    if (i == FPGA_DMA_STATS_LATENCY_BUCKETS - 1) {
+        snprintf(out, size, ">%llu", 1ull << (i - 1));
+    } else {
+        snprintf(out, size, "<%llu", 1ull << i);
+    }
+}
+
+static int top_cmp_rows(const void *a, const void *b)
+{
+    const struct top_row *ra = a;
+    const struct top_row *rb = b;
+    double ba = ra->delta.bytes / ra->seconds;
+    double bb = rb->delta.bytes / rb->seconds;
+
+    return (ba < bb) - (ba > bb);
+}
+
+static void top_print(const struct top_opts *opts,
+    const struct top_snapshot *prev, const struct top_snapshot *cur,
+    struct top_row *rows)
+{
+    int n_rows = 0;
+    double slot_bw[FPGA_SLOT_MAX][2];
+
+    memset(slot_bw, 0, sizeof(slot_bw));
+    for (int p = 0; p < cur->n; p++) {
+        const struct top_proc *proc = &cur->procs[p];
+        const struct top_proc *old = top_find_proc(prev, proc);
+        uint64_t since = (old != NULL) ? old->now_ns : proc->stats.start_ns;
+        double seconds = (proc->now_ns - since) / 1e9;
+
+        if (seconds <= 0) {
+            continue;
+        }
+        for (int q = 0; q <= FPGA_SLOT_MAX * 2 * FPGA_DMA_CHANNELS_MAX; q++) {
+            bool is_other = q == FPGA_SLOT_MAX * 2 * FPGA_DMA_CHANNELS_MAX;
+            const struct fpga_dma_queue_stats *stats = is_other ?
+                &proc->stats.other : &proc->stats.queues[0][0][0] + q;
+            const struct fpga_dma_queue_stats *old_stats = (old == NULL) ? NULL :
+                is_other ? &old->stats.other : &old->stats.queues[0][0][0] + q;
+            struct top_row *row = &rows[n_rows];
+
+            row->slot_id = is_other ? -1 : q / (2 * FPGA_DMA_CHANNELS_MAX);
+            row->is_read = !is_other && (q / FPGA_DMA_CHANNELS_MAX) % 2;
+            row->channel = q % FPGA_DMA_CHANNELS_MAX;
+            if (opts->slot_id >= 0 && row->slot_id != opts->slot_id) {
+                continue;
+            }
+            top_delta(stats, old_stats, &row->delta);
+            if (row->delta.calls == 0 && !(opts->all && stats->calls != 0)) {
+                continue;
+            }
+            row->pid = proc->stats.pid;
+            row->comm = proc->stats.comm;
+            row->seconds = seconds;
+            if (!is_other) {
+                slot_bw[row->slot_id][row->is_read] += row->delta.bytes / seconds;
+            }
+            n_rows++;
+        }
+    }
+    qsort(rows, n_rows, sizeof(*rows), top_cmp_rows);
+
+    if (!opts->batch) {
+        printf("\033[H\033[2J");
+    }
+    printf("%d process(es) with DMA statistics\n", cur->n);
+    for (int s = 0; s < FPGA_SLOT_MAX; s++) {
+        if (slot_bw[s][0] > 0 || slot_bw[s][1] > 0) {
+            printf("slot %d: h2c %9.1f MB/s  c2h %9.1f MB/s\n", s,
+                slot_bw[s][0] / 1e6, slot_bw[s][1] / 1e6);
+        }
+    }
+    printf("\n%7s %-15s %4s %-5s %10s %9s %9s %8s %8s %7s %7s\n", "PID", "COMMAND",
+        "SLOT", "QUEUE", "MB/s", "XFER/s", "AVG_US", "P50_US", "P99_US",
+        "ERRORS", "RETRIES");
+    for (int r = 0; r < n_rows; r++) {
+        const struct top_row *row = &rows[r];
+        char slot[8], queue[8], p50[16], p99[16];
+
+        if (row->slot_id < 0) {
+            snprintf(slot, sizeof(slot), "-");
+            snprintf(queue, sizeof(queue), "other");
+        } else {
+            snprintf(slot, sizeof(slot), "%d", row->slot_id);
+            snprintf(queue, sizeof(queue), "%s%d", row->is_read ? "c2h" : "h2c",
+                row->channel);
+        }
+        top_percentile(&row->delta, 0.50, p50, sizeof(p50));
+        top_percentile(&row->delta, 0.99, p99, sizeof(p99));
+        printf("%7d %-15s %4s %-5s %10.1f %9.1f %9.1f %8s %8s %7llu %7llu\n",
+            row->pid, row->comm, slot, queue,
+            row->delta.bytes / row->seconds / 1e6,
+            row->delta.calls / row->seconds,
+            row->delta.calls ? row->delta.busy_ns / 1e3 / row->delta.calls : 0.0,
+            p50, p99, (unsigned long long)row->delta.errors,
+            (unsigned long long)row->delta.retries);
+    }
+    if (opts->batch) {
+        printf("\n");
+    }
+    fflush(stdout);
+}
+
+static void usage(const char *program_name)
+{
+    printf("usage: %s [options]\n"
+        "  -i, --interval <sec>     refresh interval, default 1\n"
+        "  -n, --iterations <n>     stop after n refreshes, default never\n"
+        "  -S, --slot <id>          only show the queues of one slot\n"
+        "  -p, --pid <pid>          only show one process\n"
+        "  -a, --all                also show queues idle in the interval\n"
+        "  -b, --batch              do not clear the screen between refreshes\n"
+        "processes are shown once they run with FPGA_DMA_STATS=1\n",
+        program_name);
+}
+
+int main(int argc, char **argv)
+{
+    int opt;
+    int rc = 1;
+    struct top_opts opts = { .interval = 1.0, .slot_id = -1 };
+    struct top_snapshot *prev = NULL;
+    struct top_snapshot *cur = NULL;
+    struct top_row *rows = NULL;
+
+    static struct option long_options[] = {
+        {"interval",   required_argument, 0, 'i'},
+        {"iterations", required_argument, 0, 'n'},
+        {"slot",       required_argument, 0, 'S'},
+        {"pid",        required_argument, 0, 'p'},
+        {"all",        no_argument,       0, 'a'},
+        {"batch",      no_argument,       0, 'b'},
+        {"help",       no_argument,       0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    while ((opt = getopt_long(argc, argv, "i:n:S:p:abh", long_options,
+        NULL)) != -1) {
+        switch (opt) {
+        case 'i':
+            opts.interval = atof(optarg);
+            break;
+        case 'n':
+            opts.iterations = strtoul(optarg, NULL, 0);
+            break;
+        case 'S':
+            opts.slot_id = atoi(optarg);
+            break;
+        case 'p':
+            opts.pid = atoi(optarg);
+            break;
+        case 'a':
+            opts.all = true;
+            break;
+        case 'b':
+            opts.batch = true;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind != argc || opts.interval <= 0 || opts.slot_id >= FPGA_SLOT_MAX) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (!isatty(STDOUT_FILENO)) {
+        opts.batch = true;
+    }
+
+    prev = calloc(1, sizeof(*prev));
+    cur = calloc(1, sizeof(*cur));
+    rows = calloc(TOP_ROWS_MAX, sizeof(*rows));
+    if (prev == NULL || cur == NULL || rows == NULL) {
+        fprintf(stderr, "out of memory\n");
+        goto out;
+    }
+
+    for (unsigned long i = 0; opts.iterations == 0 || i < opts.iterations; i++) {
+        struct top_snapshot *tmp;
+        struct timespec delay = {
+            .tv_sec = (time_t)opts.interval,
+            .tv_nsec = (long)((opts.interval - (time_t)opts.interval) * 1e9),
+        };
+
+        if (i > 0) {
+            nanosleep(&delay, NULL);
+        }
+        top_read_all(&opts, cur);
+        top_print(&opts, prev, cur, rows);
+        tmp = prev;
+        prev = cur;
+        cur = tmp;
+    }
+    rc = 0;
+
+out:
+    free(prev);
+    free(cur);
+    free(rows);
+    return rc;
+}
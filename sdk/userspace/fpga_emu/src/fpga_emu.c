@@ -0,0 +1,670 @@
+/*
+ * Copyright 2015-2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may
+ * not use this file except in compliance with the License. A copy of the
+ * License is located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/*
+ * fpga-emu serves emulated FPGA slots below a root directory, so the host
+ * tools can run without an F1 instance: with FPGA_PCI_EMU_ROOT=<root> in
+ * their environment the fpga_pci and fpga_dma libraries use the /sys and
+ * /dev files it creates there (see fpga_pci_emu.h). Each slot has
+ *
+ *  - a mailbox PF, with the mailbox and SH version register at BAR0 and the
+ *    virtual JTAG (XVC) registers at BAR2,
+ *  - an application PF, with a 16550 console UART at 0x1000 of BAR0 and of
+ *    BAR1, as Piton has, and the DDR at BAR4,
+ *  - the XDMA queues and user interrupt events devices of the application PF.
+ *
+ * The DDR of a slot is a sparse file, mapped by BAR4 and read and written by
+ * the DMA queues. The register BARs are sockets served by the device models
+ * of fpga_emu_models.c, all from the one thread of this process. Each console
+ * UART is bridged to a pty, linked from <root>/tty/slot<slot>-bar<bar>.
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <signal.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <fpga_pci.h>
+#include <fpga_pci_emu.h>
+#include <utils/lcd.h>
+
+#include "fpga_emu.h"
+
+/* PCI device of the application PF of a slot, the mailbox PF is the next */
+#define EMU_APP_DEV(slot)   (0x0f + 2 * (slot))
+#define EMU_MBOX_VENDOR_ID  (0x1d0f)
+#define EMU_MBOX_DEVICE_ID  (0x1041)
+/* resources listed in the resource file of a device */
+#define EMU_RESOURCES       (6)
+#define EMU_CONNS_MAX       (64)
+
+/* the register BARs of a slot */
+#define EMU_BARS_PER_SLOT   (4)
+
+static const struct {
+    const struct emu_model *model;
+    int pf_id;
+    int bar_id;
+} emu_slot_bars[EMU_BARS_PER_SLOT] = {
+    { &emu_mbox_model, FPGA_MGMT_PF, MGMT_PF_BAR0 },
+    { &emu_xvc_model,  FPGA_MGMT_PF, MGMT_PF_BAR2 },
+    { &emu_uart_model, FPGA_APP_PF,  APP_PF_BAR0 },
+    { &emu_uart_model, FPGA_APP_PF,  APP_PF_BAR1 },
+};
+
+struct emu_conn {
+    int fd;
+    struct emu_bar *bar;
+};
+
+/* what each entry of the poll set stands for */
+struct emu_pollent {
+    enum { EMU_POLL_LISTEN, EMU_POLL_CONN, EMU_POLL_MODEL } kind;
+    void *ptr;
+};
+
+/* use the standard out logger */
+static const struct logger *logger = &logger_stdout;
+
+static volatile sig_atomic_t emu_stop;
+
+static struct emu_slot emu_slots[FPGA_SLOT_MAX];
+static struct emu_bar emu_bars[FPGA_SLOT_MAX * EMU_BARS_PER_SLOT];
+static int emu_n_bars;
+static struct emu_conn emu_conns[EMU_CONNS_MAX];
+
+int emu_path(const struct emu_opts *opts, char *path, size_t size,
+    const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+    int rc;
+
+    n = snprintf(path, size, "%s/", opts->root);
+    if (n < 0 || (size_t)n >= size) {
+        return -ENAMETOOLONG;
+    }
+    va_start(ap, fmt);
+    rc = vsnprintf(path + n, size - n, fmt, ap);
+    va_end(ap);
+    return (rc < 0 || (size_t)rc >= size - n) ? -ENAMETOOLONG : 0;
+}
+
+/* mkdir -p of the directory of path */
+static int emu_mkdirs(char *path)
+{
+    for (char *p = strchr(path + 1, '/'); p != NULL; p = strchr(p + 1, '/')) {
+        *p = '\0';
+        int rc = mkdir(path, 0755);
+        *p = '/';
+        if (rc != 0 && errno != EEXIST) {
+            return -errno;
+        }
+    }
+    return 0;
+}
+
+static int emu_write_file(const char *path, const char *fmt, ...)
+{
+    va_list ap;
+    int rc;
+    FILE *fp = fopen(path, "w");
+
+    if (fp == NULL) {
+        return -errno;
+    }
+    va_start(ap, fmt);
+    rc = vfprintf(fp, fmt, ap);
+    va_end(ap);
+    return (fclose(fp) != 0 || rc < 0) ? -EIO : 0;
+}
+
+static int emu_symlink(const char *target, const char *path)
+{
+    unlink(path);
+    return (symlink(target, path) != 0) ? -errno : 0;
+}
+
+/*
+ * Create the sysfs directory of a PCI device. sizes are the sizes of its
+ * resources, 0 for those it does not have.
+ */
+static int emu_create_device(const struct emu_opts *opts, const char *dbdf,
+    const uint16_t ids[4], const uint64_t sizes[EMU_RESOURCES], int index)
+{
+    static const char *id_files[4] = {
+        "vendor", "device", "subsystem_vendor", "subsystem_device"
+    };
+    char path[PATH_MAX];
+    char resources[EMU_RESOURCES * 64] = "";
+    size_t len = 0;
+    int rc;
+
+    rc = emu_path(opts, path, sizeof(path), "sys/bus/pci/devices/%s/remove",
+        dbdf);
+    fail_on(rc, out, "Path too long for %s", dbdf);
+    rc = emu_mkdirs(path);
+    fail_on(rc, out, "Unable to create the directory of %s", path);
+    rc = emu_write_file(path, "0\n");
+    fail_on(rc, out, "Unable to create %s", path);
+
+    for (int i = 0; i < 4; i++) {
+        emu_path(opts, path, sizeof(path), "sys/bus/pci/devices/%s/%s", dbdf,
+            id_files[i]);
+        rc = emu_write_file(path, "0x%04x\n", ids[i]);
+        fail_on(rc, out, "Unable to create %s", path);
+    }
+    emu_path(opts, path, sizeof(path), "sys/bus/pci/devices/%s/numa_node",
+        dbdf);
+    rc = emu_write_file(path, "-1\n");
+    fail_on(rc, out, "Unable to create %s", path);
+
+    /* made up but distinct bus addresses, each resource in its own 1 TiB */
+    for (int i = 0; i < EMU_RESOURCES; i++) {
+        uint64_t start = ((uint64_t)(index * EMU_RESOURCES + i + 1)) << 40;
+
+        len += snprintf(resources + len, sizeof(resources) - len,
+            "0x%016" PRIx64 " 0x%016" PRIx64 " 0x%016" PRIx64 "\n",
+            sizes[i] ? start : 0, sizes[i] ? start + sizes[i] - 1 : 0,
+            sizes[i] ? UINT64_C(0x40200) : 0);
+    }
+    emu_path(opts, path, sizeof(path), "sys/bus/pci/devices/%s/resource",
+        dbdf);
+    rc = emu_write_file(path, "%s", resources);
+    fail_on(rc, out, "Unable to create %s", path);
+out:
+    return rc;
+}
+
+static int emu_listen(struct emu_bar *bar, const char *dbdf)
+{
+    struct sockaddr_un addr;
+    char path[PATH_MAX];
+    int rc;
+
+    rc = emu_path(bar->slot->opts, path, sizeof(path),
+        "sys/bus/pci/devices/%s/resource%d", dbdf, bar->bar_id);
+    fail_on(rc || strlen(path) >= sizeof(addr.sun_path), out,
+        "Socket path too long for %s resource%d, use a shorter root", dbdf,
+        bar->bar_id);
+
+    bar->listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK |
+        SOCK_CLOEXEC, 0);
+    fail_on((rc = (bar->listen_fd < 0) ? -errno : 0), out, "socket failed");
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    rc = bind(bar->listen_fd, (struct sockaddr *)&addr, sizeof(addr));
+    fail_on((rc = rc ? -errno : 0), out, "Unable to bind %s", path);
+    rc = listen(bar->listen_fd, 16);
+    fail_on((rc = rc ? -errno : 0), out, "Unable to listen on %s", path);
+out:
+    return rc;
+}
+
+/* the DDR, the XDMA devices and events of a slot's application PF */
+static int emu_create_dma(struct emu_slot *slot, const char *app_dbdf)
+{
+    const struct emu_opts *opts = slot->opts;
+    char path[PATH_MAX];
+    char target[PATH_MAX];
+    int rc;
+    int fd;
+
+    emu_path(opts, path, sizeof(path), "slot%d_ddr", slot->slot_id);
+    fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    fail_on((rc = (fd < 0) ? -errno : 0), out, "Unable to create %s", path);
+    rc = ftruncate(fd, opts->dram_size);
+    rc = rc ? -errno : 0;
+    close(fd);
+    fail_on(rc, out, "Unable to size %s", path);
+
+    /* BAR4 maps the DDR */
+    snprintf(target, sizeof(target), "../../../../../slot%d_ddr",
+        slot->slot_id);
+    emu_path(opts, path, sizeof(path), "sys/bus/pci/devices/%s/resource4",
+        app_dbdf);
+    rc = emu_symlink(target, path);
+    fail_on(rc, out, "Unable to create %s", path);
+    emu_path(opts, path, sizeof(path), "sys/bus/pci/devices/%s/resource4_wc",
+        app_dbdf);
+    rc = emu_symlink(target, path);
+    fail_on(rc, out, "Unable to create %s", path);
+
+    emu_path(opts, path, sizeof(path), "sys/class/xdma/xdma%d_control/device",
+        slot->slot_id);
+    rc = emu_mkdirs(path);
+    fail_on(rc, out, "Unable to create the directory of %s", path);
+    snprintf(target, sizeof(target), "../../../bus/pci/devices/%s", app_dbdf);
+    rc = emu_symlink(target, path);
+    fail_on(rc, out, "Unable to create %s", path);
+
+    /* the queues read and write the DDR */
+    snprintf(target, sizeof(target), "../slot%d_ddr", slot->slot_id);
+    for (int c = 0; c < EMU_DMA_CHANNELS * 2; c++) {
+        emu_path(opts, path, sizeof(path), "dev/xdma%d_%s_%d", slot->slot_id,
+            (c & 1) ? "c2h" : "h2c", c / 2);
+        rc = emu_mkdirs(path);
+        fail_on(rc, out, "Unable to create the directory of %s", path);
+        rc = emu_symlink(target, path);
+        fail_on(rc, out, "Unable to create %s", path);
+    }
+
+    /* a read of an events device returns once an interrupt was signaled */
+    for (int irq = 0; irq < EMU_IRQS; irq++) {
+        emu_path(opts, path, sizeof(path), "dev/xdma%d_events_%d",
+            slot->slot_id, irq);
+        unlink(path);
+        rc = mkfifo(path, 0666);
+        fail_on((rc = rc ? -errno : 0), out, "Unable to create %s", path);
+        slot->events_fds[irq] = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+        fail_on((rc = (slot->events_fds[irq] < 0) ? -errno : 0), out,
+            "Unable to open %s", path);
+    }
+out:
+    return rc;
+}
+
+static int emu_create_slot(struct emu_slot *slot)
+{
+    const struct emu_opts *opts = slot->opts;
+    char dbdf[FPGA_PF_MAX][16];
+    uint64_t sizes[FPGA_PF_MAX][EMU_RESOURCES];
+    const uint16_t ids[FPGA_PF_MAX][4] = {
+        [FPGA_APP_PF] = { opts->vendor_id, opts->device_id,
+            opts->subsystem_vendor_id, opts->subsystem_device_id },
+        [FPGA_MGMT_PF] = { EMU_MBOX_VENDOR_ID, EMU_MBOX_DEVICE_ID,
+            EMU_MBOX_VENDOR_ID, EMU_MBOX_DEVICE_ID },
+    };
+    int rc = 0;
+
+    memset(sizes, 0, sizeof(sizes));
+    sizes[FPGA_APP_PF][APP_PF_BAR4] = opts->dram_size;
+    for (int i = 0; i < EMU_BARS_PER_SLOT; i++) {
+        sizes[emu_slot_bars[i].pf_id][emu_slot_bars[i].bar_id] =
+            emu_slot_bars[i].model->size;
+    }
+
+    for (int pf = 0; pf < FPGA_PF_MAX; pf++) {
+        snprintf(dbdf[pf], sizeof(dbdf[pf]), PCI_DEV_FMT, 0, 0,
+            EMU_APP_DEV(slot->slot_id) + (pf == FPGA_MGMT_PF), 0);
+        rc = emu_create_device(opts, dbdf[pf], ids[pf], sizes[pf],
+            slot->slot_id * FPGA_PF_MAX + pf);
+        fail_on(rc, out, "Unable to create PCI device %s", dbdf[pf]);
+    }
+
+    for (int i = 0; i < EMU_BARS_PER_SLOT; i++) {
+        struct emu_bar *bar = &emu_bars[emu_n_bars++];
+
+        bar->model = emu_slot_bars[i].model;
+        bar->slot = slot;
+        bar->pf_id = emu_slot_bars[i].pf_id;
+        bar->bar_id = emu_slot_bars[i].bar_id;
+        rc = emu_listen(bar, dbdf[bar->pf_id]);
+        fail_on(rc, out, "Unable to serve %s resource%d", dbdf[bar->pf_id],
+            bar->bar_id);
+        rc = bar->model->init ? bar->model->init(bar) : 0;
+        fail_on(rc, out, "Unable to start the %s model", bar->model->name);
+    }
+
+    rc = emu_create_dma(slot, dbdf[FPGA_APP_PF]);
+    fail_on(rc, out, "Unable to create the DMA devices of slot %d",
+        slot->slot_id);
+    printf("slot %d: application PF %s, mailbox PF %s, DDR %" PRIu64 " MiB\n",
+        slot->slot_id, dbdf[FPGA_APP_PF], dbdf[FPGA_MGMT_PF],
+        opts->dram_size >> 20);
+out:
+    return rc;
+}
+
+void emu_raise_irq(struct emu_slot *slot, int irq)
+{
+    uint32_t events = 1;
+
+    if (irq >= 0 && irq < EMU_IRQS && slot->events_fds[irq] >= 0) {
+        /* a full pipe already has a wakeup pending */
+        if (write(slot->events_fds[irq], &events, sizeof(events)) < 0) {
+            return;
+        }
+    }
+}
+
+static void emu_accept(struct emu_bar *bar)
+{
+    int fd = accept(bar->listen_fd, NULL, NULL);
+
+    if (fd < 0) {
+        return;
+    }
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    for (int i = 0; i < EMU_CONNS_MAX; i++) {
+        if (emu_conns[i].bar == NULL) {
+            emu_conns[i].fd = fd;
+            emu_conns[i].bar = bar;
+            return;
+        }
+    }
+    log_error("Too many connections, dropping one to the %s model",
+        bar->model->name);
+    close(fd);
+}
+
+static void emu_close(struct emu_conn *conn)
+{
+    close(conn->fd);
+    conn->fd = -1;
+    conn->bar = NULL;
+}
+
+/* answer one access of a connection */
+static void emu_serve(struct emu_conn *conn)
+{
+    const struct emu_model *model = conn->bar->model;
+    struct fpga_pci_emu_req req;
+    struct fpga_pci_emu_rsp rsp;
+    ssize_t n;
+
+    n = recv(conn->fd, &req, sizeof(req), 0);
+    if (n <= 0) {
+        if (n == 0 || (errno != EINTR && errno != EAGAIN)) {
+            emu_close(conn);
+        }
+        return;
+    }
+
+    memset(&rsp, 0, sizeof(rsp));
+    if (n != sizeof(req) || (req.width != 1 && req.width != 4 &&
+        req.width != 8) || req.offset % req.width != 0 ||
+        req.offset > model->size || req.width > model->size - req.offset) {
+        rsp.status = -EINVAL;
+    } else if (req.op == FPGA_PCI_EMU_READ) {
+        uint64_t value = 0;
+
+        rsp.status = model->read(conn->bar, req.offset, req.width, &value);
+        rsp.value = value;
+    } else if (req.op == FPGA_PCI_EMU_WRITE) {
+        rsp.status = model->write(conn->bar, req.offset, req.width, req.value);
+    } else {
+        rsp.status = -EINVAL;
+    }
+
+    if (send(conn->fd, &rsp, sizeof(rsp), MSG_NOSIGNAL) != sizeof(rsp)) {
+        emu_close(conn);
+    }
+}
+
+static int emu_run(void)
+{
+    struct pollfd pfds[FPGA_SLOT_MAX * EMU_BARS_PER_SLOT * 2 + EMU_CONNS_MAX];
+    struct emu_pollent ents[sizeof_array(pfds)];
+
+    while (!emu_stop) {
+        int n = 0;
+
+        for (int i = 0; i < emu_n_bars; i++) {
+            struct emu_bar *bar = &emu_bars[i];
+            short events = 0;
+            int fd;
+
+            pfds[n] = (struct pollfd){ .fd = bar->listen_fd, .events = POLLIN };
+            ents[n++] = (struct emu_pollent){ EMU_POLL_LISTEN, bar };
+            fd = bar->model->poll_fd ? bar->model->poll_fd(bar, &events) : -1;
+            if (fd >= 0) {
+                pfds[n] = (struct pollfd){ .fd = fd, .events = events };
+                ents[n++] = (struct emu_pollent){ EMU_POLL_MODEL, bar };
+            }
+        }
+        for (int i = 0; i < EMU_CONNS_MAX; i++) {
+            if (emu_conns[i].bar != NULL) {
+                pfds[n] = (struct pollfd){ .fd = emu_conns[i].fd,
+                    .events = POLLIN };
+                ents[n++] = (struct emu_pollent){ EMU_POLL_CONN, &emu_conns[i] };
+            }
+        }
+
+        if (poll(pfds, n, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fail_on(true, err, "poll failed");
+        }
+
+        for (int i = 0; i < n; i++) {
+            if (pfds[i].revents == 0) {
+                continue;
+            }
+            switch (ents[i].kind) {
+            case EMU_POLL_LISTEN:
+                emu_accept(ents[i].ptr);
+                break;
+            case EMU_POLL_CONN:
+                emu_serve(ents[i].ptr);
+                break;
+            case EMU_POLL_MODEL: {
+                struct emu_bar *bar = ents[i].ptr;
+                bar->model->poll_ready(bar, pfds[i].revents);
+                break;
+            }
+            }
+        }
+    }
+    return 0;
+err:
+    return -1;
+}
+
+static void emu_signal(int sig)
+{
+    (void)sig;
+    emu_stop = 1;
+}
+
+static int emu_parse_size(const char *str, uint64_t *size)
+{
+    char *end = NULL;
+    unsigned long long value;
+
+    errno = 0;
+    value = strtoull(str, &end, 0);
+    if (errno != 0 || end == str) {
+        errno = 0;
+        return -EINVAL;
+    }
+    switch (*end) {
+    case 'k': case 'K': value <<= 10; end++; break;
+    case 'm': case 'M': value <<= 20; end++; break;
+    case 'g': case 'G': value <<= 30; end++; break;
+    default: break;
+    }
+    if (*end != '\0') {
+        return -EINVAL;
+    }
+    *size = value;
+    return 0;
+}
+
+static int emu_parse_id(const char *str, uint16_t *id)
+{
+    char *end = NULL;
+    unsigned long value = strtoul(str, &end, 16);
+
+    if (end == str || *end != '\0' || value > UINT16_MAX) {
+        return -EINVAL;
+    }
+    *id = value;
+    return 0;
+}
+
+static void usage(const char *program_name)
+{
+    printf("usage: %s [options] <root>\n"
+        "  -S, --slots <n>              slots to emulate, default 1\n"
+        "  -m, --ddr-size <bytes>       DDR of each slot, default 64G\n"
+        "  -V, --vendor-id <id>         application PF vendor id, default 1d0f\n"
+        "  -D, --device-id <id>         application PF device id, default f001\n"
+        "  -s, --subsystem-vendor-id <id>  default fedd\n"
+        "  -d, --subsystem-device-id <id>  default 1d51\n"
+        "  -a, --afi-id <id>            AFI reported as loaded\n"
+        "  -v, --sh-version <version>   SH version register, default 0x071417d3\n"
+        "Run the host tools with FPGA_PCI_EMU_ROOT=<root> in their environment.\n"
+        "sizes take K/M/G suffixes, the DDR is a sparse file below <root>\n",
+        program_name);
+}
+
+static int emu_parse_args(int argc, char **argv, struct emu_opts *opts)
+{
+    int opt;
+
+    static struct option long_options[] = {
+        {"slots",               required_argument, 0, 'S'},
+        {"ddr-size",            required_argument, 0, 'm'},
+        {"vendor-id",           required_argument, 0, 'V'},
+        {"device-id",           required_argument, 0, 'D'},
+        {"subsystem-vendor-id", required_argument, 0, 's'},
+        {"subsystem-device-id", required_argument, 0, 'd'},
+        {"afi-id",              required_argument, 0, 'a'},
+        {"sh-version",          required_argument, 0, 'v'},
+        {"help",                no_argument,       0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    memset(opts, 0, sizeof(*opts));
+    opts->slots = 1;
+    opts->dram_size = UINT64_C(64) << 30;
+    /* Piton's AFI */
+    opts->vendor_id = 0x1d0f;
+    opts->device_id = 0xf001;
+    opts->subsystem_vendor_id = 0xfedd;
+    opts->subsystem_device_id = 0x1d51;
+    opts->afi_id = "agfi-0000000000000000e";
+    opts->sh_version = 0x071417d3;
+
+    while ((opt = getopt_long(argc, argv, "S:m:V:D:s:d:a:v:h", long_options,
+        NULL)) != -1) {
+        int rc = 0;
+
+        switch (opt) {
+        case 'S':
+            opts->slots = atoi(optarg);
+            rc = (opts->slots < 1 || opts->slots > FPGA_SLOT_MAX) ? -EINVAL : 0;
+            break;
+        case 'm':
+            rc = emu_parse_size(optarg, &opts->dram_size);
+            rc = (rc == 0 && opts->dram_size == 0) ? -EINVAL : rc;
+            break;
+        case 'V':
+            rc = emu_parse_id(optarg, &opts->vendor_id);
+            break;
+        case 'D':
+            rc = emu_parse_id(optarg, &opts->device_id);
+            break;
+        case 's':
+            rc = emu_parse_id(optarg, &opts->subsystem_vendor_id);
+            break;
+        case 'd':
+            rc = emu_parse_id(optarg, &opts->subsystem_device_id);
+            break;
+        case 'a':
+            opts->afi_id = optarg;
+            rc = (strlen(optarg) >= AFI_ID_STR_MAX) ? -EINVAL : 0;
+            break;
+        case 'v':
+            opts->sh_version = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+            return -EINVAL;
+        }
+        if (rc) {
+            usage(argv[0]);
+            return rc;
+        }
+    }
+
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return -EINVAL;
+    }
+    opts->root = argv[optind];
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int rc;
+    struct emu_opts opts;
+    struct sigaction sa;
+    char path[PATH_MAX];
+
+    /* the slot and console lines are read by scripts */
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    rc = emu_parse_args(argc, argv, &opts);
+    if (rc) {
+        return 1;
+    }
+
+    rc = log_init("fpga-emu");
+    fail_on(rc, out, "Unable to initialize the log.");
+    rc = log_attach(logger, NULL, 0);
+    fail_on(rc, out, "%s", "Unable to attach to the log.");
+
+    for (int i = 0; i < EMU_CONNS_MAX; i++) {
+        emu_conns[i].fd = -1;
+    }
+
+    /* the libraries write 1 to the rescan file of the PCI bus */
+    rc = emu_path(&opts, path, sizeof(path), "sys/bus/pci/rescan");
+    fail_on(rc, out, "Root path too long");
+    rc = emu_mkdirs(path);
+    fail_on(rc, out, "Unable to create the directory of %s", path);
+    rc = emu_write_file(path, "0\n");
+    fail_on(rc, out, "Unable to create %s", path);
+
+    for (int s = 0; s < opts.slots; s++) {
+        struct emu_slot *slot = &emu_slots[s];
+
+        slot->slot_id = s;
+        slot->opts = &opts;
+        for (int irq = 0; irq < EMU_IRQS; irq++) {
+            slot->events_fds[irq] = -1;
+        }
+        rc = emu_create_slot(slot);
+        fail_on(rc, out, "Unable to create slot %d", s);
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = emu_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    printf("serving %d slot(s), run the host tools with %s=%s\n", opts.slots,
+        FPGA_PCI_EMU_ROOT_ENV, opts.root);
+    fflush(stdout);
+    rc = emu_run();
+out:
+    return (rc != 0 ? 1 : 0);
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright 2015-2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may
+ * not use this file except in compliance with the License. A copy of the
+ * License is located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <poll.h>
+
+#include <fpga_pci.h>
+
+/* XDMA user interrupts, one events device each */
+#define EMU_IRQS            (16)
+/* XDMA channels per direction */
+#define EMU_DMA_CHANNELS    (4)
+
+struct emu_opts {
+    const char *root;
+    int slots;
+    uint64_t dram_size;
+    /* PCI ids of the application PF */
+    uint16_t vendor_id;
+    uint16_t device_id;
+    uint16_t subsystem_vendor_id;
+    uint16_t subsystem_device_id;
+    /* AFI reported as loaded */
+    const char *afi_id;
+    uint32_t sh_version;
+};
+
+struct emu_slot {
+    int slot_id;
+    const struct emu_opts *opts;
+    /* write ends of the events devices, -1 if missing */
+    int events_fds[EMU_IRQS];
+};
+
+struct emu_bar;
+
+/*
+ * A device model serving one register BAR. read and write get accesses
+ * which are aligned to their width (1, 4 or 8 bytes) and within size, and
+ * return 0 or a negative errno. A model which also waits on a file, e.g. a
+ * pty, returns it from poll_fd with the events to wait for, or -1, and is
+ * called back on poll_ready when they occur.
+ */
+struct emu_model {
+    const char *name;
+    uint64_t size;
+    int (*init)(struct emu_bar *bar);
+    int (*read)(struct emu_bar *bar, uint64_t offset, uint32_t width,
+        uint64_t *value);
+    int (*write)(struct emu_bar *bar, uint64_t offset, uint32_t width,
+        uint64_t value);
+    int (*poll_fd)(struct emu_bar *bar, short *events);
+    void (*poll_ready)(struct emu_bar *bar, short revents);
+};
+
+struct emu_bar {
+    const struct emu_model *model;
+    struct emu_slot *slot;
+    int pf_id;
+    int bar_id;
+    int listen_fd;
+    void *state;
+};
+
+extern const struct emu_model emu_mbox_model;
+extern const struct emu_model emu_xvc_model;
+extern const struct emu_model emu_uart_model;
+
+/* signal a user interrupt on the events device of the slot */
+void emu_raise_irq(struct emu_slot *slot, int irq);
+
+/* path below the emulator root, e.g. "sys/bus/pci/rescan" */
+int emu_path(const struct emu_opts *opts, char *path, size_t size,
+    const char *fmt, ...) __attribute__((format(printf, 4, 5)));
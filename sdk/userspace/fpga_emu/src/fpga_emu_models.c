@@ -0,0 +1,519 @@
+/*
+ * Copyright 2015-2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may
+ * not use this file except in compliance with the License. A copy of the
+ * License is located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/*
+ * The device models of fpga-emu: the mailbox of the mailbox PF, which answers
+ * the AFI commands of fpga_mgmt, the virtual JTAG registers, and the 16550
+ * console UARTs of the application PF.
+ */
+
+/* posix_openpt and cfmakeraw */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <termios.h>
+#include <sys/stat.h>
+
+#include <fpga_mgmt.h>
+#include <afi_cmd_api.h>
+#include <fpga_hal_mbox.h>
+#include <fpga_hal_mbox_regs.h>
+#include <fpga_mgmt_internal.h>
+
+#include "fpga_emu.h"
+
+/* mailbox */
+
+#define EMU_MBOX_DWORDS     (FPGA_MBOX_MSG_DATA_LEN / sizeof(uint32_t))
+
+struct emu_mbox {
+    uint32_t status;
+    uint32_t dip_led;
+    uint32_t vdip;
+    uint32_t wr_index;
+    uint32_t rd_index;
+    uint32_t rd_len;
+    uint32_t wr_buf[EMU_MBOX_DWORDS];
+    uint32_t rd_buf[EMU_MBOX_DWORDS];
+    /* the loaded AFI, empty when cleared */
+    char afi_id[AFI_ID_STR_MAX];
+};
+
+static int emu_mbox_init(struct emu_bar *bar)
+{
+    struct emu_mbox *mbox = calloc(1, sizeof(*mbox));
+
+    if (mbox == NULL) {
+        return -ENOMEM;
+    }
+    strncpy(mbox->afi_id, bar->slot->opts->afi_id, sizeof(mbox->afi_id) - 1);
+    bar->state = mbox;
+    return 0;
+}
+
+/* answer the AFI command in wr_buf, the response goes to rd_buf */
+static void emu_mbox_command(struct emu_bar *bar, uint32_t len)
+{
+    struct emu_mbox *mbox = bar->state;
+    const struct emu_opts *opts = bar->slot->opts;
+    const union afi_cmd *cmd = (const void *)mbox->wr_buf;
+    union afi_cmd *rsp = (void *)mbox->rd_buf;
+    uint32_t payload_len = cmd->hdr.len_flags & AFI_CMD_HDR_LEN_MASK;
+    uint32_t rsp_len = 0;
+    int32_t error = 0;
+
+    memset(mbox->rd_buf, 0, sizeof(mbox->rd_buf));
+    rsp->hdr.version = cmd->hdr.version;
+    rsp->hdr.op = cmd->hdr.op;
+    rsp->hdr.id = cmd->hdr.id;
+
+    if (len < sizeof(struct afi_cmd_hdr) ||
+        payload_len > len - sizeof(struct afi_cmd_hdr)) {
+        error = FPGA_ERR_AFI_CMD_MALFORMED;
+    } else if (MAJOR_VERSION(cmd->hdr.version) != AFI_CMD_API_MAJOR_VERSION) {
+        error = FPGA_ERR_AFI_CMD_API_VERSION_INVALID;
+    } else {
+        switch (cmd->hdr.op) {
+        case AFI_CMD_LOAD: {
+            const struct afi_cmd_load_req *req = (const void *)cmd->body;
+
+            if (payload_len < sizeof(*req)) {
+                error = FPGA_ERR_AFI_CMD_MALFORMED;
+                break;
+            }
+            memcpy(mbox->afi_id, req->ids.afi_id, sizeof(mbox->afi_id));
+            mbox->afi_id[sizeof(mbox->afi_id) - 1] = '\0';
+            printf("slot %d: loaded %s\n", bar->slot->slot_id, mbox->afi_id);
+            break;
+        }
+        case AFI_CMD_CLEAR:
+            memset(mbox->afi_id, 0, sizeof(mbox->afi_id));
+            printf("slot %d: cleared\n", bar->slot->slot_id);
+            break;
+        case AFI_CMD_METRICS:
+            break;
+        default:
+            error = FPGA_ERR_AFI_CMD_MALFORMED;
+            break;
+        }
+    }
+
+    if (error) {
+        struct afi_cmd_err_rsp *err_rsp = (void *)rsp->body;
+        uint32_t *version = (void *)err_rsp->error_info;
+
+        rsp->hdr.op = AFI_CMD_ERROR;
+        err_rsp->error = error;
+        *version = AFI_CMD_API_VERSION;
+        rsp_len = sizeof(*err_rsp) + sizeof(*version);
+    } else {
+        /* each command is answered with the metrics */
+        struct afi_cmd_metrics_rsp *metrics = (void *)rsp->body;
+
+        memcpy(metrics->ids.afi_id, mbox->afi_id, sizeof(mbox->afi_id));
+        metrics->ids.afi_device_ids.vendor_id = opts->vendor_id;
+        metrics->ids.afi_device_ids.device_id = opts->device_id;
+        metrics->ids.afi_device_ids.svid = opts->subsystem_vendor_id;
+        metrics->ids.afi_device_ids.ssid = opts->subsystem_device_id;
+        metrics->status = (mbox->afi_id[0]) ?
+            FPGA_STATUS_LOADED : FPGA_STATUS_CLEARED;
+        rsp_len = sizeof(*metrics);
+    }
+    rsp->hdr.len_flags = rsp_len |
+        (AFI_CMD_HDR_IS_RSP << AFI_CMD_HDR_FLAGS_SHIFT);
+
+    mbox->rd_len = (sizeof(struct afi_cmd_hdr) + rsp_len +
+        sizeof(uint32_t) - 1) / sizeof(uint32_t);
+    mbox->status |= FMB_TX_EVT | FMB_RX_EVT;
+}
+
+static int emu_mbox_read(struct emu_bar *bar, uint64_t offset, uint32_t width,
+    uint64_t *value)
+{
+    struct emu_mbox *mbox = bar->state;
+
+    (void)width;
+    switch (offset) {
+    case FMB_REG_SH_VERSION:
+        *value = bar->slot->opts->sh_version;
+        break;
+    case FMB_REG_VIRT_DIP_LED:
+        *value = mbox->dip_led;
+        break;
+    case FMB_REG_STATUS:
+        *value = mbox->status;
+        break;
+    case FMB_REG_DEPTH:
+        *value = EMU_MBOX_DWORDS;
+        break;
+    case FMB_REG_RD_DATA:
+        *value = (mbox->rd_index < EMU_MBOX_DWORDS) ?
+            mbox->rd_buf[mbox->rd_index++] : 0;
+        break;
+    case FMB_REG_RD_LEN:
+        *value = mbox->rd_len;
+        break;
+    case F1_VIRTUAL_LED_REG_OFFSET:
+        *value = mbox->dip_led >> FMB_VIRT_LED_SHIFT;
+        break;
+    case F1_VIRTUAL_DIP_REG_OFFSET:
+        *value = mbox->vdip;
+        break;
+    default:
+        *value = 0;
+        break;
+    }
+    return 0;
+}
+
+static int emu_mbox_write(struct emu_bar *bar, uint64_t offset, uint32_t width,
+    uint64_t value)
+{
+    struct emu_mbox *mbox = bar->state;
+
+    (void)width;
+    switch (offset) {
+    case FMB_REG_STATUS:
+        /* write 1 to clear */
+        mbox->status &= ~(uint32_t)value;
+        break;
+    case FMB_REG_WR_INDEX:
+        mbox->wr_index = value;
+        break;
+    case FMB_REG_WR_DATA:
+        if (mbox->wr_index < EMU_MBOX_DWORDS) {
+            mbox->wr_buf[mbox->wr_index++] = value;
+        }
+        break;
+    case FMB_REG_WR_LEN:
+        if (value > EMU_MBOX_DWORDS) {
+            return -EINVAL;
+        }
+        emu_mbox_command(bar, value * sizeof(uint32_t));
+        break;
+    case FMB_REG_RD_INDEX:
+        mbox->rd_index = value;
+        break;
+    case F1_VIRTUAL_DIP_REG_OFFSET:
+        mbox->vdip = value & FMB_VIRT_DIP_MASK;
+        break;
+    default:
+        break;
+    }
+    return 0;
+}
+
+const struct emu_model emu_mbox_model = {
+    .name = "mailbox",
+    .size = 0x4000,
+    .init = emu_mbox_init,
+    .read = emu_mbox_read,
+    .write = emu_mbox_write,
+};
+
+/* virtual JTAG, TDO loops back TDI */
+
+#define XVC_LENGTH          (0x0)
+#define XVC_TMS             (0x4)
+#define XVC_TDI             (0x8)
+#define XVC_TDO             (0xc)
+#define XVC_CONTROL         (0x10)
+
+struct emu_xvc {
+    uint32_t regs[XVC_CONTROL / sizeof(uint32_t) + 1];
+};
+
+static int emu_xvc_init(struct emu_bar *bar)
+{
+    bar->state = calloc(1, sizeof(struct emu_xvc));
+    return (bar->state == NULL) ? -ENOMEM : 0;
+}
+
+static int emu_xvc_read(struct emu_bar *bar, uint64_t offset, uint32_t width,
+    uint64_t *value)
+{
+    struct emu_xvc *xvc = bar->state;
+
+    (void)width;
+    *value = (offset <= XVC_CONTROL) ? xvc->regs[offset / sizeof(uint32_t)] : 0;
+    return 0;
+}
+
+static int emu_xvc_write(struct emu_bar *bar, uint64_t offset, uint32_t width,
+    uint64_t value)
+{
+    struct emu_xvc *xvc = bar->state;
+
+    (void)width;
+    if (offset == XVC_CONTROL) {
+        /* the shift is done at once */
+        xvc->regs[XVC_TDO / sizeof(uint32_t)] =
+            xvc->regs[XVC_TDI / sizeof(uint32_t)];
+        value &= ~UINT64_C(1);
+    }
+    if (offset <= XVC_CONTROL && offset != XVC_TDO) {
+        xvc->regs[offset / sizeof(uint32_t)] = value;
+    }
+    return 0;
+}
+
+const struct emu_model emu_xvc_model = {
+    .name = "virtual JTAG",
+    .size = 0x1000,
+    .init = emu_xvc_init,
+    .read = emu_xvc_read,
+    .write = emu_xvc_write,
+};
+
+/* 16550 UART at 0x1000, bridged to a pty */
+
+#define UART_BASE           (0x1000)
+#define UART_RBR_THR_DLL    (0x00)
+#define UART_IER_DLM        (0x04)
+#define UART_IIR_FCR        (0x08)
+#define UART_LCR            (0x0c)
+#define UART_MCR            (0x10)
+#define UART_LSR            (0x14)
+#define UART_MSR            (0x18)
+#define UART_SCR            (0x1c)
+
+#define UART_LSR_DRDY       (0x01)
+#define UART_LSR_THRE       (0x20)
+#define UART_LSR_TEMT       (0x40)
+#define UART_IER_ERBFI      (0x01)
+#define UART_FCR_RCVR_RESET (0x02)
+#define UART_LCR_DLAB       (0x80)
+/* FIFOs enabled, no interrupt pending or received data available */
+#define UART_IIR_NONE       (0xc1)
+#define UART_IIR_RDA        (0xc4)
+
+#define UART_FIFO_DEPTH     (16)
+
+struct emu_uart {
+    int master_fd;
+    int slave_fd;
+    uint8_t ier;
+    uint8_t lcr;
+    uint8_t mcr;
+    uint8_t scr;
+    uint8_t dll;
+    uint8_t dlm;
+    uint8_t rx[UART_FIFO_DEPTH];
+    unsigned rx_head;
+    unsigned rx_count;
+};
+
+static int emu_uart_init(struct emu_bar *bar)
+{
+    struct emu_uart *uart;
+    struct termios tio;
+    char path[PATH_MAX];
+    const char *slave;
+    int rc = -ENOMEM;
+
+    uart = calloc(1, sizeof(*uart));
+    if (uart == NULL) {
+        goto err;
+    }
+    uart->slave_fd = -1;
+    uart->master_fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (uart->master_fd < 0 || grantpt(uart->master_fd) != 0 ||
+        unlockpt(uart->master_fd) != 0 ||
+        (slave = ptsname(uart->master_fd)) == NULL) {
+        rc = -errno;
+        goto err;
+    }
+    /* keep the slave open, so the pty survives its clients */
+    uart->slave_fd = open(slave, O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (uart->slave_fd < 0 || tcgetattr(uart->slave_fd, &tio) != 0) {
+        rc = -errno;
+        goto err;
+    }
+    cfmakeraw(&tio);
+    tcsetattr(uart->slave_fd, TCSANOW, &tio);
+
+    rc = emu_path(bar->slot->opts, path, sizeof(path), "tty/slot%d-bar%d",
+        bar->slot->slot_id, bar->bar_id);
+    if (rc == 0) {
+        char *dir = strrchr(path, '/');
+
+        *dir = '\0';
+        mkdir(path, 0755);
+        *dir = '/';
+        unlink(path);
+        rc = (symlink(slave, path) != 0) ? -errno : 0;
+    }
+    if (rc != 0) {
+        goto err;
+    }
+    printf("slot %d: BAR%d console at %s (%s)\n", bar->slot->slot_id,
+        bar->bar_id, path, slave);
+    bar->state = uart;
+    return 0;
+err:
+    if (uart) {
+        if (uart->slave_fd >= 0) {
+            close(uart->slave_fd);
+        }
+        if (uart->master_fd >= 0) {
+            close(uart->master_fd);
+        }
+        free(uart);
+    }
+    return rc;
+}
+
+static int emu_uart_read(struct emu_bar *bar, uint64_t offset, uint32_t width,
+    uint64_t *value)
+{
+    struct emu_uart *uart = bar->state;
+    bool dlab = uart->lcr & UART_LCR_DLAB;
+
+    (void)width;
+    if (offset < UART_BASE) {
+        *value = 0;
+        return 0;
+    }
+    switch (offset - UART_BASE) {
+    case UART_RBR_THR_DLL:
+        if (dlab) {
+            *value = uart->dll;
+        } else if (uart->rx_count) {
+            *value = uart->rx[uart->rx_head];
+            uart->rx_head = (uart->rx_head + 1) % UART_FIFO_DEPTH;
+            uart->rx_count--;
+        } else {
+            *value = 0;
+        }
+        break;
+    case UART_IER_DLM:
+        *value = dlab ? uart->dlm : uart->ier;
+        break;
+    case UART_IIR_FCR:
+        *value = (uart->rx_count && (uart->ier & UART_IER_ERBFI)) ?
+            UART_IIR_RDA : UART_IIR_NONE;
+        break;
+    case UART_LCR:
+        *value = uart->lcr;
+        break;
+    case UART_MCR:
+        *value = uart->mcr;
+        break;
+    case UART_LSR:
+        /* the transmitter is always empty, bytes go to the pty at once */
+        *value = UART_LSR_THRE | UART_LSR_TEMT |
+            (uart->rx_count ? UART_LSR_DRDY : 0);
+        break;
+    case UART_SCR:
+        *value = uart->scr;
+        break;
+    default:
+        *value = 0;
+        break;
+    }
+    return 0;
+}
+
+static int emu_uart_write(struct emu_bar *bar, uint64_t offset, uint32_t width,
+    uint64_t value)
+{
+    struct emu_uart *uart = bar->state;
+    bool dlab = uart->lcr & UART_LCR_DLAB;
+    uint8_t byte = value;
+
+    (void)width;
+    if (offset < UART_BASE) {
+        return 0;
+    }
+    switch (offset - UART_BASE) {
+    case UART_RBR_THR_DLL:
+        if (dlab) {
+            uart->dll = byte;
+        } else if (write(uart->master_fd, &byte, 1) != 1) {
+            /* nobody reads the console, drop the byte like a line would */
+        }
+        break;
+    case UART_IER_DLM:
+        if (dlab) {
+            uart->dlm = byte;
+        } else {
+            uart->ier = byte;
+        }
+        break;
+    case UART_IIR_FCR:
+        if (byte & UART_FCR_RCVR_RESET) {
+            uart->rx_head = 0;
+            uart->rx_count = 0;
+        }
+        break;
+    case UART_LCR:
+        uart->lcr = byte;
+        break;
+    case UART_MCR:
+        uart->mcr = byte;
+        break;
+    case UART_SCR:
+        uart->scr = byte;
+        break;
+    default:
+        break;
+    }
+    return 0;
+}
+
+/* wait for input while the receive FIFO has room */
+static int emu_uart_poll_fd(struct emu_bar *bar, short *events)
+{
+    struct emu_uart *uart = bar->state;
+
+    *events = POLLIN;
+    return (uart->rx_count < UART_FIFO_DEPTH) ? uart->master_fd : -1;
+}
+
+static void emu_uart_poll_ready(struct emu_bar *bar, short revents)
+{
+    struct emu_uart *uart = bar->state;
+    uint8_t buf[UART_FIFO_DEPTH];
+    bool was_empty = (uart->rx_count == 0);
+    ssize_t n;
+
+    if (!(revents & POLLIN)) {
+        return;
+    }
+    n = read(uart->master_fd, buf, UART_FIFO_DEPTH - uart->rx_count);
+    for (ssize_t i = 0; i < n; i++) {
+        uart->rx[(uart->rx_head + uart->rx_count++) % UART_FIFO_DEPTH] = buf[i];
+    }
+    /* the user interrupt of the console follows its BAR */
+    if (n > 0 && was_empty && (uart->ier & UART_IER_ERBFI)) {
+        emu_raise_irq(bar->slot, bar->bar_id);
+    }
+}
+
+const struct emu_model emu_uart_model = {
+    .name = "UART",
+    .size = 0x2000,
+    .init = emu_uart_init,
+    .read = emu_uart_read,
+    .write = emu_uart_write,
+    .poll_fd = emu_uart_poll_fd,
+    .poll_ready = emu_uart_poll_ready,
+};
@@ -0,0 +1,453 @@
+/*
+ * Copyright 2015-2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may
+ * not use this file except in compliance with the License. A copy of the
+ * License is located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/*
+ * Asynchronous transfers on DMA queue fds. Transfers are queued on an
+ * io_uring; the driver's read and write handlers block, so the kernel runs
+ * them from its io_uring workers and one thread can keep many transfers on
+ * several channels in flight. Short transfers are resubmitted for the
+ * remainder, as fpga_dma_burst_read/write loop, and so are transfers too
+ * long for one sqe.
+ *
+ * Without io_uring, or with one which lacks IORING_OP_READ/WRITE (kernels
+ * before 5.6, old headers, or io_uring blocked by seccomp) transfers
+ * run synchronously in fpga_dma_submit and are reported by the next
+ * fpga_dma_poll, so callers need no second code path.
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+#if defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+/* IORING_OP_READ/WRITE and the opcode probe came with Linux 5.6 */
+#if defined(IO_URING_OP_SUPPORTED)
+#define FPGA_DMA_IO_URING
+#endif
+#endif
+
+#include "utils/log.h"
+#include "fpga_dma.h"
+#include "fpga_dma_internal.h"
+
+#define FPGA_DMA_ASYNC_DEPTH_MAX 4096
+
+/*
+ * Longest read or write queued as one sqe. sqe->len is 32 bits and cqe->res
+ * a signed int, so larger transfers are queued in chunks of this size and
+ * completed like short transfers.
+ */
+#define FPGA_DMA_URING_CHUNK_MAX (1ul << 30)
+
+struct fpga_dma_op {
+    uint64_t tag;
+    int index;
+    int fd;
+    bool is_read;
+    uint8_t *buffer;
+    size_t len;
+    size_t address;
+    /* bytes transferred so far */
+    size_t done;
+    /* result of a synchronous transfer */
+    int rc;
+    /* for the transfer statistics */
+    uint64_t begin_ns;
+    unsigned retries;
+};
+
+#if defined(FPGA_DMA_IO_URING)
+struct fpga_dma_uring {
+    int fd;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+    /* sqes filled in but not passed to the kernel yet */
+    unsigned queued;
+};
+#endif
+
+struct fpga_dma_async {
+    unsigned depth;
+    struct fpga_dma_op *ops;
+    /* stack of free op indices */
+    unsigned *free_ops;
+    unsigned n_free;
+    bool use_uring;
+#if defined(FPGA_DMA_IO_URING)
+    struct fpga_dma_uring uring;
+#endif
+    /* ops completed synchronously, a FIFO reported by the next poll */
+    unsigned *done_ops;
+    unsigned done_head;
+    unsigned n_done;
+};
+
+#if defined(FPGA_DMA_IO_URING)
+/* check that the kernel supports the opcodes used for the transfers */
+static int fpga_dma_uring_probe(int fd)
+{
+    int rc;
+    struct io_uring_probe *probe;
+    const unsigned n_ops = 256;
+
+    probe = calloc(1, sizeof(*probe) + n_ops * sizeof(struct io_uring_probe_op));
+    if (!probe) {
+        return -ENOMEM;
+    }
+    rc = syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, n_ops);
+    if (rc < 0) {
+        rc = -errno;
+    } else if (probe->last_op < IORING_OP_WRITE ||
+        !(probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED) ||
+        !(probe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED)) {
+        rc = -EOPNOTSUPP;
+    }
+    free(probe);
+    return rc;
+}
+
+static int fpga_dma_uring_init(struct fpga_dma_uring *uring, unsigned depth)
+{
+    int rc;
+    struct io_uring_params params;
+    uint8_t *sq, *cq;
+
+    memset(&params, 0, sizeof(params));
+    uring->sq_ring = MAP_FAILED;
+    uring->cq_ring = MAP_FAILED;
+    uring->sqes = MAP_FAILED;
+
+    uring->fd = syscall(__NR_io_uring_setup, depth, &params);
+    if (uring->fd < 0) {
+        rc = -errno;
+        goto err;
+    }
+    rc = fpga_dma_uring_probe(uring->fd);
+    if (rc) {
+        goto err;
+    }
+
+    uring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    uring->cq_ring_size = params.cq_off.cqes +
+        params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (uring->cq_ring_size > uring->sq_ring_size) {
+            uring->sq_ring_size = uring->cq_ring_size;
+        }
+        uring->cq_ring_size = uring->sq_ring_size;
+    }
+
+    uring->sq_ring = mmap(NULL, uring->sq_ring_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQ_RING);
+    fail_on_with_code(uring->sq_ring == MAP_FAILED, err, rc, -errno,
+        "unable to map the submission ring");
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        uring->cq_ring = uring->sq_ring;
+    } else {
+        uring->cq_ring = mmap(NULL, uring->cq_ring_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_CQ_RING);
+        fail_on_with_code(uring->cq_ring == MAP_FAILED, err, rc, -errno,
+            "unable to map the completion ring");
+    }
+    uring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    uring->sqes = mmap(NULL, uring->sqes_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQES);
+    fail_on_with_code(uring->sqes == MAP_FAILED, err, rc, -errno,
+        "unable to map the submission entries");
+
+    sq = uring->sq_ring;
+    cq = uring->cq_ring;
+    uring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    uring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    uring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    uring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    uring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    uring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    uring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    uring->queued = 0;
+    return 0;
+
+err:
+    return rc;
+}
+
+static void fpga_dma_uring_free(struct fpga_dma_uring *uring)
+{
+    if (uring->sqes != MAP_FAILED) {
+        munmap(uring->sqes, uring->sqes_size);
+    }
+    if (uring->cq_ring != MAP_FAILED && uring->cq_ring != uring->sq_ring) {
+        munmap(uring->cq_ring, uring->cq_ring_size);
+    }
+    if (uring->sq_ring != MAP_FAILED) {
+        munmap(uring->sq_ring, uring->sq_ring_size);
+    }
+    if (uring->fd >= 0) {
+        close(uring->fd);
+    }
+}
+
+/*
+ * Queue the remainder of an op, at most FPGA_DMA_URING_CHUNK_MAX bytes of it;
+ * there is an sqe for every op
+ */
+static void fpga_dma_uring_queue(struct fpga_dma_uring *uring,
+    struct fpga_dma_op *op, unsigned op_index)
+{
+    unsigned tail = *uring->sq_tail;
+    unsigned index = tail & *uring->sq_mask;
+    struct io_uring_sqe *sqe = &uring->sqes[index];
+    size_t len = op->len - op->done;
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = op->is_read ? IORING_OP_READ : IORING_OP_WRITE;
+    sqe->fd = op->fd;
+    sqe->addr = (uintptr_t)(op->buffer + op->done);
+    sqe->len = (len > FPGA_DMA_URING_CHUNK_MAX) ? FPGA_DMA_URING_CHUNK_MAX : len;
+    sqe->off = op->address + op->done;
+    sqe->user_data = op_index;
+    uring->sq_array[index] = index;
+
+    /* publish the sqe before the tail */
+    __atomic_store_n(uring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    uring->queued++;
+}
+
+static int fpga_dma_uring_enter(struct fpga_dma_uring *uring, unsigned min_complete)
+{
+    int rc;
+
+    do {
+        rc = syscall(__NR_io_uring_enter, uring->fd, uring->queued, min_complete,
+            min_complete ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    } while (rc < 0 && errno == EINTR);
+    if (rc < 0) {
+        rc = -errno;
+        errno = 0;
+        return rc;
+    }
+    uring->queued -= rc;
+    return 0;
+}
+#endif
+
+static void fpga_dma_op_done(struct fpga_dma_async *ctx, unsigned op_index,
+    int rc, struct fpga_dma_event *event)
+{
+    struct fpga_dma_op *op = &ctx->ops[op_index];
+
+    event->tag = op->tag;
+    event->index = op->index;
+    event->rc = rc;
+    ctx->free_ops[ctx->n_free++] = op_index;
+}
+
+int fpga_dma_async_init(unsigned depth, struct fpga_dma_async **ctx_out)
+{
+    int rc;
+    struct fpga_dma_async *ctx = NULL;
+
+    fail_on(rc = (depth == 0 || depth > FPGA_DMA_ASYNC_DEPTH_MAX || !ctx_out) ?
+        -EINVAL : 0, err, "invalid queue depth %u", depth);
+
+    ctx = calloc(1, sizeof(*ctx));
+    fail_on(rc = (ctx == NULL) ? -ENOMEM : 0, err, "unable to allocate context");
+    ctx->depth = depth;
+    ctx->ops = calloc(depth, sizeof(*ctx->ops));
+    ctx->free_ops = calloc(depth, sizeof(*ctx->free_ops));
+    ctx->done_ops = calloc(depth, sizeof(*ctx->done_ops));
+    fail_on(rc = (!ctx->ops || !ctx->free_ops || !ctx->done_ops) ? -ENOMEM : 0, err,
+        "unable to allocate the queues");
+    for (unsigned i = 0; i < depth; i++) {
+        ctx->free_ops[i] = depth - 1 - i;
+    }
+    ctx->n_free = depth;
+
+#if defined(FPGA_DMA_IO_URING)
+    rc = fpga_dma_uring_init(&ctx->uring, depth);
+    if (rc == 0) {
+        ctx->use_uring = true;
+    } else {
+        fpga_dma_uring_free(&ctx->uring);
+    }
+#else
+    rc = -ENOSYS;
+#endif
+    if (rc != 0) {
+        log_info("io_uring is not available (%d), DMA transfers complete "
+            "synchronously", rc);
+        errno = 0;
+    }
+
+    *ctx_out = ctx;
+    return 0;
+
+err:
+    fpga_dma_async_free(ctx);
+    return rc;
+}
+
+void fpga_dma_async_free(struct fpga_dma_async *ctx)
+{
+    if (!ctx) {
+        return;
+    }
+#if defined(FPGA_DMA_IO_URING)
+    if (ctx->use_uring) {
+        /* the kernel owns the buffers of transfers in flight until they end */
+        if (ctx->n_free != ctx->depth) {
+            struct fpga_dma_event event;
+            while (fpga_dma_poll(ctx, &event, 1, 1) > 0);
+        }
+        fpga_dma_uring_free(&ctx->uring);
+    }
+#endif
+    free(ctx->ops);
+    free(ctx->free_ops);
+    free(ctx->done_ops);
+    free(ctx);
+}
+
+int fpga_dma_submit(struct fpga_dma_async *ctx, int fd, bool is_read,
+    const struct iovec iov[], const size_t address[], int count, uint64_t tag)
+{
+    int rc;
+    int n;
+
+    fail_on(rc = (!ctx || fd < 0 || count < 0 || (count && (!iov || !address))) ?
+        -EINVAL : 0, out, "invalid transfer");
+
+    for (n = 0; n < count && ctx->n_free > 0; n++) {
+        unsigned op_index = ctx->free_ops[--ctx->n_free];
+        struct fpga_dma_op *op = &ctx->ops[op_index];
+
+        op->tag = tag;
+        op->index = n;
+        op->fd = fd;
+        op->is_read = is_read;
+        op->buffer = iov[n].iov_base;
+        op->len = iov[n].iov_len;
+        op->address = address[n];
+        op->done = 0;
+
+#if defined(FPGA_DMA_IO_URING)
+        if (ctx->use_uring && op->len > 0) {
+            op->begin_ns = fpga_dma_stats_begin();
+            op->retries = 0;
+            fpga_dma_uring_queue(&ctx->uring, op, op_index);
+            continue;
+        }
+#endif
+        op->rc = is_read ?
+            fpga_dma_burst_read(fd, op->buffer, op->len, op->address) :
+            fpga_dma_burst_write(fd, op->buffer, op->len, op->address);
+        ctx->done_ops[(ctx->done_head + ctx->n_done) % ctx->depth] = op_index;
+        ctx->n_done++;
+    }
+
+#if defined(FPGA_DMA_IO_URING)
+    if (ctx->use_uring && ctx->uring.queued) {
+        rc = fpga_dma_uring_enter(&ctx->uring, 0);
+        fail_on(rc, out, "unable to submit DMA transfers");
+    }
+#endif
+    rc = n;
+out:
+    return rc;
+}
+
+int fpga_dma_poll(struct fpga_dma_async *ctx, struct fpga_dma_event *events,
+    int max_events, int min_events)
+{
+    int rc = 0;
+    int n = 0;
+
+    fail_on(rc = (!ctx || max_events < 0 || (max_events && !events)) ? -EINVAL : 0,
+        out, "invalid poll");
+    if (min_events > max_events) {
+        min_events = max_events;
+    }
+
+    while (n < max_events && ctx->n_done > 0) {
+        unsigned op_index = ctx->done_ops[ctx->done_head];
+
+        fpga_dma_op_done(ctx, op_index, ctx->ops[op_index].rc, &events[n++]);
+        ctx->done_head = (ctx->done_head + 1) % ctx->depth;
+        ctx->n_done--;
+    }
+
+#if defined(FPGA_DMA_IO_URING)
+    while (ctx->use_uring && n < max_events) {
+        struct fpga_dma_uring *uring = &ctx->uring;
+        unsigned head = *uring->cq_head;
+        unsigned tail = __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE);
+
+        for (; head != tail && n < max_events; head++) {
+            struct io_uring_cqe *cqe = &uring->cqes[head & *uring->cq_mask];
+            unsigned op_index = cqe->user_data;
+            struct fpga_dma_op *op = &ctx->ops[op_index];
+
+            if (cqe->res > 0 && op->done + cqe->res < op->len) {
+                op->done += cqe->res;
+                op->retries++;
+                fpga_dma_uring_queue(uring, op, op_index);
+                continue;
+            }
+            rc = (cqe->res < 0) ? cqe->res : (cqe->res == 0) ? -EIO : 0;
+            fpga_dma_stats_end(op->fd, op->begin_ns,
+                op->done + ((rc == 0) ? cqe->res : 0), rc, op->retries);
+            fpga_dma_op_done(ctx, op_index, rc, &events[n++]);
+        }
+        __atomic_store_n(uring->cq_head, head, __ATOMIC_RELEASE);
+
+        /* nothing left to wait for */
+        if (n >= min_events || ctx->n_free == ctx->depth) {
+            if (uring->queued) {
+                rc = fpga_dma_uring_enter(uring, 0);
+                fail_on(rc, out, "unable to submit DMA transfers");
+            }
+            break;
+        }
+        rc = fpga_dma_uring_enter(uring, 1);
+        fail_on(rc, out, "unable to wait for DMA transfers");
+    }
+#endif
+
+    rc = n;
+out:
+    return rc;
+}
+
+int fpga_dma_async_pending(struct fpga_dma_async *ctx)
+{
+    return ctx->depth - ctx->n_free;
+}
@@ -0,0 +1,123 @@
+/*
+ * Copyright 2015-2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may
+ * not use this file except in compliance with the License. A copy of the
+ * License is located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/*
+ * DMA buffers. The XDMA driver pins and maps the user pages of every read
+ * and write; a buffer registered on a DMA queue is pinned and mapped once and
+ * transfers inside it reuse that mapping.
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+
+#include "utils/log.h"
+#include "utils/hugepage.h"
+#include "fpga_dma.h"
+#include "fpga_pci.h"
+
+/* must match struct xdma_buf_ioctl and the ioctl codes of cdev_sgdma.h */
+struct fpga_dma_xdma_buf_ioctl {
+    uint64_t addr;
+    uint64_t len;
+    uint32_t handle;
+    uint32_t reserved;
+};
+
+#define FPGA_DMA_IOCTL_BUF_REGISTER \
+    _IOWR('q', 7, struct fpga_dma_xdma_buf_ioctl *)
+#define FPGA_DMA_IOCTL_BUF_UNREGISTER _IOW('q', 8, int)
+
+int fpga_dma_buffer_alloc(int slot_id, size_t size, struct fpga_dma_buffer *buf)
+{
+    int rc;
+    int numa_node = -1;
+    struct hugepage_buf huge;
+
+    fail_on(rc = (buf == NULL || size == 0 || slot_id >= FPGA_SLOT_MAX) ?
+        -EINVAL : 0, out, "invalid DMA buffer");
+    memset(buf, 0, sizeof(*buf));
+
+    /* any node will do if sysfs does not tell */
+    if (slot_id >= 0 && fpga_pci_get_numa_node(slot_id, &numa_node) != 0) {
+        numa_node = -1;
+    }
+
+    rc = hugepage_alloc(size, numa_node, &huge);
+    fail_on(rc = rc ? -ENOMEM : 0, out, "unable to allocate a %zu byte DMA "
+        "buffer", size);
+
+    buf->data = huge.data;
+    buf->size = huge.size;
+    buf->map_size = huge.map_size;
+    buf->page_size = huge.page_size;
+    buf->numa_node = huge.numa_node;
+out:
+    return rc;
+}
+
+void fpga_dma_buffer_free(struct fpga_dma_buffer *buf)
+{
+    if (buf == NULL || buf->data == NULL) {
+        return;
+    }
+    munmap(buf->data, buf->map_size);
+    memset(buf, 0, sizeof(*buf));
+}
+
+int fpga_dma_buffer_register(int fd, const void *buffer, size_t size,
+    uint32_t *handle)
+{
+    int rc;
+    struct fpga_dma_xdma_buf_ioctl req;
+
+    fail_on(rc = (fd < 0 || buffer == NULL || size == 0 || handle == NULL) ?
+        -EINVAL : 0, out, "invalid DMA buffer registration");
+
+    memset(&req, 0, sizeof(req));
+    req.addr = (uintptr_t)buffer;
+    req.len = size;
+    rc = ioctl(fd, FPGA_DMA_IOCTL_BUF_REGISTER, &req);
+    if (rc < 0) {
+        rc = -errno;
+        /* older drivers reject the ioctl, transfers work unregistered */
+        if (rc == -EINVAL || rc == -ENOTTY) {
+            errno = 0;
+            log_info("DMA buffer registration is not supported by the driver");
+            goto out;
+        }
+        fail_on(rc, out, "unable to register a %zu byte DMA buffer", size);
+    }
+    *handle = req.handle;
+out:
+    return rc;
+}
+
+int fpga_dma_buffer_unregister(int fd, uint32_t handle)
+{
+    int rc;
+
+    fail_on(rc = (fd < 0 || handle == 0) ? -EINVAL : 0, out,
+        "invalid DMA buffer handle");
+    rc = ioctl(fd, FPGA_DMA_IOCTL_BUF_UNREGISTER, (unsigned long)handle);
+    fail_on_with_code(rc < 0, out, rc, -errno,
+        "unable to unregister DMA buffer %u", handle);
+out:
+    return rc;
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright 2015-2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may
+ * not use this file except in compliance with the License. A copy of the
+ * License is located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "fpga_dma.h"
+
+/*
+ * Transfer statistics hooks, see fpga_dma_stats.c. A transfer is timed with
+ * fpga_dma_stats_begin, which returns 0 while the stats are off, and counted
+ * with fpga_dma_stats_end.
+ */
+enum fpga_dma_stats_state {
+    FPGA_DMA_STATS_UNKNOWN,
+    FPGA_DMA_STATS_OFF,
+    FPGA_DMA_STATS_ON,
+};
+
+extern int fpga_dma_stats_state;
+
+uint64_t fpga_dma_stats_start(void);
+void fpga_dma_stats_count(int fd, uint64_t begin_ns, size_t bytes, int rc,
+    unsigned retries);
+void fpga_dma_stats_queue_opened(int fd, int slot_id, int channel,
+    bool is_read);
+/* forget the queue of fd before it is closed, the fd number may be reused */
+void fpga_dma_stats_queue_closed(int fd);
+
+static inline uint64_t fpga_dma_stats_begin(void)
+{
+    if (__atomic_load_n(&fpga_dma_stats_state, __ATOMIC_RELAXED) ==
+        FPGA_DMA_STATS_OFF) {
+        return 0;
+    }
+    return fpga_dma_stats_start();
+}
+
+static inline void fpga_dma_stats_end(int fd, uint64_t begin_ns, size_t bytes,
+    int rc, unsigned retries)
+{
+    if (begin_ns != 0) {
+        fpga_dma_stats_count(fd, begin_ns, bytes, rc, retries);
+    }
+}
@@ -0,0 +1,209 @@
+/*
+ * Copyright 2015-2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may
+ * not use this file except in compliance with the License. A copy of the
+ * License is located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/*
+ * Transfer statistics. The counters of a process live in its own file on
+ * /dev/shm so fpga-dma-top can read them while the process runs. Transfers
+ * only carry an fd, so fpga_dma_open_queue records the slot, direction and
+ * channel of each queue it opens; transfers on other fds are counted apart.
+ */
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "utils/log.h"
+#include "fpga_dma.h"
+#include "fpga_dma_internal.h"
+
+/* fds above this are counted as other fds */
+#define FPGA_DMA_STATS_FDS_MAX (4096)
+
+#define FPGA_DMA_STATS_QUEUES \
+    (FPGA_SLOT_MAX * 2 * FPGA_DMA_CHANNELS_MAX)
+
+_Static_assert(FPGA_DMA_STATS_QUEUES < 256,
+    "queue indexes must fit stats_fd_queues");
+
+int fpga_dma_stats_state = FPGA_DMA_STATS_UNKNOWN;
+
+/* serializes enabling the stats */
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct fpga_dma_stats *stats;
+static char stats_path[64];
+/* queue of each fd, index into stats->queues plus one, 0 for other fds */
+static uint8_t stats_fd_queues[FPGA_DMA_STATS_FDS_MAX];
+
+static uint64_t fpga_dma_stats_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void fpga_dma_stats_unlink(void)
+{
+    unlink(stats_path);
+}
+
+/* called with stats_lock held */
+static int fpga_dma_stats_map(void)
+{
+    int rc;
+    int fd;
+    struct fpga_dma_stats *map;
+    FILE *fp;
+
+    if (stats != NULL) {
+        return 0;
+    }
+
+    snprintf(stats_path, sizeof(stats_path),
+        FPGA_DMA_STATS_DIR "/" FPGA_DMA_STATS_PREFIX "%d", getpid());
+    fd = open(stats_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    fail_on_with_code(fd < 0, out, rc, -errno, "unable to create %s",
+        stats_path);
+    rc = ftruncate(fd, sizeof(*map));
+    fail_on_with_code(rc < 0, err_unlink, rc, -errno, "unable to size %s",
+        stats_path);
+    map = mmap(NULL, sizeof(*map), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    fail_on_with_code(map == MAP_FAILED, err_unlink, rc, -errno,
+        "unable to map %s", stats_path);
+    close(fd);
+
+    map->version = FPGA_DMA_STATS_VERSION;
+    map->pid = getpid();
+    map->start_ns = fpga_dma_stats_now_ns();
+    fp = fopen("/proc/self/comm", "r");
+    if (fp != NULL) {
+        if (fgets(map->comm, sizeof(map->comm), fp) != NULL) {
+            map->comm[strcspn(map->comm, "\n")] = '\0';
+        }
+        fclose(fp);
+    }
+    /* readers skip the file until the header is complete */
+    __atomic_store_n(&map->magic, FPGA_DMA_STATS_MAGIC, __ATOMIC_RELEASE);
+
+    __atomic_store_n(&stats, map, __ATOMIC_RELEASE);
+    atexit(fpga_dma_stats_unlink);
+    return 0;
+
+err_unlink:
+    close(fd);
+    unlink(stats_path);
+out:
+    return rc;
+}
+
+int fpga_dma_stats_enable(void)
+{
+    int rc;
+
+    pthread_mutex_lock(&stats_lock);
+    rc = fpga_dma_stats_map();
+    if (rc == 0) {
+        __atomic_store_n(&fpga_dma_stats_state, FPGA_DMA_STATS_ON,
+            __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&stats_lock);
+    return rc;
+}
+
+uint64_t fpga_dma_stats_start(void)
+{
+    int state = __atomic_load_n(&fpga_dma_stats_state, __ATOMIC_ACQUIRE);
+
+    /* the first transfer checks the environment */
+    if (state == FPGA_DMA_STATS_UNKNOWN) {
+        const char *env = getenv("FPGA_DMA_STATS");
+
+        pthread_mutex_lock(&stats_lock);
+        state = fpga_dma_stats_state;
+        if (state == FPGA_DMA_STATS_UNKNOWN) {
+            state = (env != NULL && *env != '\0' && strcmp(env, "0") != 0 &&
+                fpga_dma_stats_map() == 0) ?
+                FPGA_DMA_STATS_ON : FPGA_DMA_STATS_OFF;
+            __atomic_store_n(&fpga_dma_stats_state, state, __ATOMIC_RELEASE);
+        }
+        pthread_mutex_unlock(&stats_lock);
+    }
+    return (state == FPGA_DMA_STATS_ON) ? fpga_dma_stats_now_ns() : 0;
+}
+
+void fpga_dma_stats_count(int fd, uint64_t begin_ns, size_t bytes, int rc,
+    unsigned retries)
+{
+    struct fpga_dma_stats *map = __atomic_load_n(&stats, __ATOMIC_ACQUIRE);
+    struct fpga_dma_queue_stats *queue;
+    unsigned index = 0;
+    unsigned bucket = 0;
+    uint64_t ns;
+
+    if (map == NULL) {
+        return;
+    }
+
+    if (fd >= 0 && fd < FPGA_DMA_STATS_FDS_MAX) {
+        index = __atomic_load_n(&stats_fd_queues[fd], __ATOMIC_RELAXED);
+    }
+    queue = (index != 0) ? &map->queues[0][0][0] + index - 1 : &map->other;
+
+    ns = fpga_dma_stats_now_ns() - begin_ns;
+    if (ns >= 1000) {
+        bucket = 64 - __builtin_clzll(ns / 1000);
+        if (bucket >= FPGA_DMA_STATS_LATENCY_BUCKETS) {
+            bucket = FPGA_DMA_STATS_LATENCY_BUCKETS - 1;
+        }
+    }
+
+    __atomic_fetch_add(&queue->calls, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&queue->bytes, bytes, __ATOMIC_RELAXED);
+    if (rc != 0) {
+        __atomic_fetch_add(&queue->errors, 1, __ATOMIC_RELAXED);
+    }
+    if (retries != 0) {
+        __atomic_fetch_add(&queue->retries, retries, __ATOMIC_RELAXED);
+    }
+    __atomic_fetch_add(&queue->busy_ns, ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&queue->latency[bucket], 1, __ATOMIC_RELAXED);
+}
+
+void fpga_dma_stats_queue_opened(int fd, int slot_id, int channel,
+    bool is_read)
+{
+    unsigned index;
+
+    if (fd < 0 || fd >= FPGA_DMA_STATS_FDS_MAX || slot_id < 0 ||
+        slot_id >= FPGA_SLOT_MAX || channel < 0 ||
+        channel >= FPGA_DMA_CHANNELS_MAX) {
+        return;
+    }
+    index = (slot_id * 2 + is_read) * FPGA_DMA_CHANNELS_MAX + channel + 1;
+    __atomic_store_n(&stats_fd_queues[fd], index, __ATOMIC_RELAXED);
+}
+
+void fpga_dma_stats_queue_closed(int fd)
+{
+    if (fd >= 0 && fd < FPGA_DMA_STATS_FDS_MAX) {
+        __atomic_store_n(&stats_fd_queues[fd], 0, __ATOMIC_RELAXED);
+    }
+}
@@ -0,0 +1,277 @@
+/*
+ * Copyright 2015-2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may
+ * not use this file except in compliance with the License. A copy of the
+ * License is located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/*
+ * Striped transfers. A transfer is cut into stripes which the calling thread
+ * and a pool of worker threads, one per additional channel, claim in order
+ * and move with fpga_dma_burst_read/write on their own channel. The pool and
+ * the DMA queues are set up on first use and kept for later transfers.
+ * Striped transfers are serialized, each one uses all requested channels.
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+
+#include "utils/log.h"
+#include "fpga_dma.h"
+#include "fpga_pci.h"
+#include "fpga_dma_internal.h"
+
+struct fpga_dma_stripe_job {
+    bool is_read;
+    uint8_t *buffer;
+    size_t xfer_sz;
+    size_t address;
+    size_t stripe_size;
+    int fds[FPGA_DMA_STRIPED_CHANNELS_MAX];
+    size_t next_stripe;
+    /* first error of any channel, stops the others */
+    int rc;
+    /* workers still busy with the job */
+    int active;
+};
+
+struct fpga_dma_stripe_worker {
+    pthread_t thread;
+    /* channel of the worker, the caller uses channel 0 */
+    int channel;
+};
+
+static struct {
+    /* serializes the striped transfers */
+    pthread_mutex_t xfer_lock;
+    /* protects the fields below, cond wakes workers, done wakes the caller */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_cond_t done;
+    struct fpga_dma_stripe_job *job;
+    uint64_t generation;
+    int n_workers;
+    struct fpga_dma_stripe_worker workers[FPGA_DMA_STRIPED_CHANNELS_MAX - 1];
+    /* [slot][is_read][channel], 0 if not open yet, else fd + 1 */
+    int fds[FPGA_SLOT_MAX][2][FPGA_DMA_STRIPED_CHANNELS_MAX];
+} stripe_pool = {
+    .xfer_lock = PTHREAD_MUTEX_INITIALIZER,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+    .done = PTHREAD_COND_INITIALIZER,
+};
+
+static void fpga_dma_stripe_run(struct fpga_dma_stripe_job *job, int channel)
+{
+    int rc;
+    size_t n_stripes = (job->xfer_sz + job->stripe_size - 1) / job->stripe_size;
+
+    while (!__atomic_load_n(&job->rc, __ATOMIC_RELAXED)) {
+        size_t stripe = __atomic_fetch_add(&job->next_stripe, 1, __ATOMIC_RELAXED);
+        if (stripe >= n_stripes) {
+            break;
+        }
+
+        size_t offset = stripe * job->stripe_size;
+        size_t len = job->xfer_sz - offset;
+        if (len > job->stripe_size) {
+            len = job->stripe_size;
+        }
+
+        rc = job->is_read ?
+            fpga_dma_burst_read(job->fds[channel], job->buffer + offset, len,
+                job->address + offset) :
+            fpga_dma_burst_write(job->fds[channel], job->buffer + offset, len,
+                job->address + offset);
+        if (rc) {
+            log_error("striped %s failed on channel %d at 0x%zx",
+                job->is_read ? "read" : "write", channel, job->address + offset);
+            __atomic_compare_exchange_n(&job->rc, &(int){0}, rc, false,
+                __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+            break;
+        }
+    }
+}
+
+static void *fpga_dma_stripe_worker(void *arg)
+{
+    struct fpga_dma_stripe_worker *worker = arg;
+    uint64_t generation = 0;
+
+    pthread_mutex_lock(&stripe_pool.lock);
+    while (true) {
+        while (stripe_pool.generation == generation) {
+            pthread_cond_wait(&stripe_pool.cond, &stripe_pool.lock);
+        }
+        generation = stripe_pool.generation;
+        struct fpga_dma_stripe_job *job = stripe_pool.job;
+        if (job == NULL || job->fds[worker->channel] < 0) {
+            continue;
+        }
+        pthread_mutex_unlock(&stripe_pool.lock);
+
+        fpga_dma_stripe_run(job, worker->channel);
+
+        pthread_mutex_lock(&stripe_pool.lock);
+        if (--job->active == 0) {
+            pthread_cond_signal(&stripe_pool.done);
+        }
+    }
+    return NULL;
+}
+
+/* called with xfer_lock held */
+static int fpga_dma_stripe_workers(int n_workers)
+{
+    int rc = 0;
+    sigset_t all, old;
+
+    /* workers never handle signals, the caller's threads do */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    while (stripe_pool.n_workers < n_workers) {
+        struct fpga_dma_stripe_worker *worker =
+            &stripe_pool.workers[stripe_pool.n_workers];
+
+        worker->channel = stripe_pool.n_workers + 1;
+        rc = pthread_create(&worker->thread, NULL, fpga_dma_stripe_worker, worker);
+        fail_on(rc = rc ? -rc : 0, out, "unable to start DMA worker");
+        pthread_detach(worker->thread);
+        stripe_pool.n_workers++;
+    }
+out:
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    return rc;
+}
+
+/* called with xfer_lock held */
+static int fpga_dma_stripe_queue(int slot_id, int channel, bool is_read)
+{
+    int *fd = &stripe_pool.fds[slot_id][is_read][channel];
+
+    if (*fd == 0) {
+        int rc = fpga_dma_open_queue(FPGA_DMA_XDMA, slot_id, channel, is_read);
+        if (rc < 0) {
+            return rc;
+        }
+        *fd = rc + 1;
+    }
+    return *fd - 1;
+}
+
+static int fpga_dma_striped_xfer(int slot_id, bool is_read, uint8_t *buffer,
+    size_t xfer_sz, size_t address, const struct fpga_dma_striped_opts *opts)
+{
+    int rc;
+    int n_channels = FPGA_DMA_STRIPED_CHANNELS_MAX;
+    size_t stripe_size = FPGA_DMA_STRIPE_SIZE_DEFAULT;
+    struct fpga_dma_stripe_job job;
+
+    if (opts != NULL && opts->n_channels > 0) {
+        n_channels = opts->n_channels;
+    }
+    if (opts != NULL && opts->stripe_size > 0) {
+        stripe_size = opts->stripe_size;
+    }
+    fail_on(rc = (slot_id < 0 || slot_id >= FPGA_SLOT_MAX || buffer == NULL ||
+        n_channels > FPGA_DMA_STRIPED_CHANNELS_MAX) ? -EINVAL : 0, err,
+        "invalid striped transfer");
+
+    /* no point in more channels than stripes */
+    if ((xfer_sz + stripe_size - 1) / stripe_size < (size_t)n_channels) {
+        n_channels = (xfer_sz + stripe_size - 1) / stripe_size;
+    }
+    if (n_channels == 0) {
+        return 0;
+    }
+
+    memset(&job, 0, sizeof(job));
+    job.is_read = is_read;
+    job.buffer = buffer;
+    job.xfer_sz = xfer_sz;
+    job.address = address;
+    job.stripe_size = stripe_size;
+    for (int i = 0; i < FPGA_DMA_STRIPED_CHANNELS_MAX; i++) {
+        job.fds[i] = -1;
+    }
+
+    pthread_mutex_lock(&stripe_pool.xfer_lock);
+    for (int i = 0; i < n_channels; i++) {
+        job.fds[i] = fpga_dma_stripe_queue(slot_id, i, is_read);
+        fail_on(rc = (job.fds[i] < 0) ? job.fds[i] : 0, err_unlock,
+            "unable to open DMA queue %d", i);
+    }
+    rc = fpga_dma_stripe_workers(n_channels - 1);
+    fail_on(rc, err_unlock, "unable to start the DMA workers");
+
+    if (n_channels > 1) {
+        pthread_mutex_lock(&stripe_pool.lock);
+        job.active = n_channels - 1;
+        stripe_pool.job = &job;
+        stripe_pool.generation++;
+        pthread_cond_broadcast(&stripe_pool.cond);
+        pthread_mutex_unlock(&stripe_pool.lock);
+    }
+
+    fpga_dma_stripe_run(&job, 0);
+
+    if (n_channels > 1) {
+        pthread_mutex_lock(&stripe_pool.lock);
+        while (job.active > 0) {
+            pthread_cond_wait(&stripe_pool.done, &stripe_pool.lock);
+        }
+        stripe_pool.job = NULL;
+        pthread_mutex_unlock(&stripe_pool.lock);
+    }
+    rc = job.rc;
+
+err_unlock:
+    pthread_mutex_unlock(&stripe_pool.xfer_lock);
+err:
+    return rc;
+}
+
+int fpga_dma_striped_read(int slot_id, uint8_t *buffer, size_t xfer_sz,
+    size_t address, const struct fpga_dma_striped_opts *opts)
+{
+    return fpga_dma_striped_xfer(slot_id, true, buffer, xfer_sz, address, opts);
+}
+
+int fpga_dma_striped_write(int slot_id, uint8_t *buffer, size_t xfer_sz,
+    size_t address, const struct fpga_dma_striped_opts *opts)
+{
+    return fpga_dma_striped_xfer(slot_id, false, buffer, xfer_sz, address, opts);
+}
+
+void fpga_dma_striped_close(int slot_id)
+{
+    if (slot_id < 0 || slot_id >= FPGA_SLOT_MAX) {
+        return;
+    }
+
+    pthread_mutex_lock(&stripe_pool.xfer_lock);
+    for (int is_read = 0; is_read < 2; is_read++) {
+        for (int i = 0; i < FPGA_DMA_STRIPED_CHANNELS_MAX; i++) {
+            int *fd = &stripe_pool.fds[slot_id][is_read][i];
+            if (*fd > 0) {
+                fpga_dma_stats_queue_closed(*fd - 1);
+                close(*fd - 1);
+                *fd = 0;
+            }
+        }
+    }
+    pthread_mutex_unlock(&stripe_pool.xfer_lock);
+}
@@ -20,8 +20,13 @@
 #include <unistd.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
 #include <fcntl.h>
 #include <libgen.h>
+#include <limits.h>
+#include <pthread.h>
+#include <time.h>
 
 #include <sys/types.h>
 #include <dirent.h>
@@ -29,6 +34,7 @@
 #include "utils/log.h"
 #include "fpga_dma.h"
 #include "fpga_pci.h"
+#include "fpga_dma_internal.h"
 
 #define MAX_FD_LEN  256
 #define PCI_DEV_FMT "%04x:%02x:%02x.%d"
@@ -45,6 +51,23 @@ struct dma_opts_s {
 };
 
 static int fpga_dma_get_xdma_dev_number(char *device_name, int *device_num);
+static int fpga_dma_find_device_num(enum fpga_dma_driver which_driver,
+    int slot_id, int *device_num);
+
+/**
+ * Device numbers found by fpga_pci_get_dma_device_num. Finding one walks
+ * /sys/class/<driver> under fpga_pci_readdir_mutex; it only changes when the
+ * slot is rescanned, which bumps its fpga_pci_slot_generation.
+ */
+struct dma_device_num_cache_s {
+    bool valid;
+    enum fpga_dma_driver which_driver;
+    uint32_t generation;
+    int device_num;
+};
+
+static pthread_mutex_t dma_device_num_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct dma_device_num_cache_s dma_device_nums[FPGA_SLOT_MAX];
 
 static const struct dma_opts_s xdma_opts = {
     .drv_name = "xdma",
@@ -81,11 +104,64 @@ int fpga_dma_open_queue(enum fpga_dma_driver which_driver, int slot_id,
     fail_on_with_code(fd < 0, err, rc, fd, "unable to open DMA device queue: %s",
         device_file);
 
+    fpga_dma_stats_queue_opened(fd, slot_id, channel, is_read);
     return fd;
 err:
     return rc;
 }
 
+int fpga_dma_open_all_queues(enum fpga_dma_driver which_driver, int slot_id,
+    struct fpga_dma_queues *queues)
+{
+    int rc = 0;
+    const struct dma_opts_s *dma_opts = fpga_dma_get_dma_opts(which_driver);
+
+    fail_on(rc = (dma_opts == NULL || queues == NULL) ? -EINVAL : 0, err,
+        "invalid DMA driver");
+    queues->n_channels = dma_opts->n_channels;
+    for (int i = 0; i < FPGA_DMA_CHANNELS_MAX; i++) {
+        queues->read_fds[i] = -1;
+        queues->write_fds[i] = -1;
+    }
+
+    for (int i = 0; i < queues->n_channels; i++) {
+        queues->read_fds[i] = fpga_dma_open_queue(which_driver, slot_id, i,
+            true);
+        fail_on(rc = (queues->read_fds[i] < 0) ? queues->read_fds[i] : 0,
+            err_close, "unable to open read queue %d", i);
+        queues->write_fds[i] = fpga_dma_open_queue(which_driver, slot_id, i,
+            false);
+        fail_on(rc = (queues->write_fds[i] < 0) ? queues->write_fds[i] : 0,
+            err_close, "unable to open write queue %d", i);
+    }
+    return 0;
+
+err_close:
+    fpga_dma_close_all_queues(queues);
+err:
+    return rc;
+}
+
+void fpga_dma_close_all_queues(struct fpga_dma_queues *queues)
+{
+    if (queues == NULL) {
+        return;
+    }
+    for (int i = 0; i < FPGA_DMA_CHANNELS_MAX; i++) {
+        if (queues->read_fds[i] >= 0) {
+            fpga_dma_stats_queue_closed(queues->read_fds[i]);
+            close(queues->read_fds[i]);
+            queues->read_fds[i] = -1;
+        }
+        if (queues->write_fds[i] >= 0) {
+            fpga_dma_stats_queue_closed(queues->write_fds[i]);
+            close(queues->write_fds[i]);
+            queues->write_fds[i] = -1;
+        }
+    }
+    queues->n_channels = 0;
+}
+
 int fpga_dma_device_id(enum fpga_dma_driver which_driver, int slot_id,
     int channel, bool is_read,
     char device_file[static FPGA_DEVICE_FILE_NAME_MAX_LEN])
@@ -115,84 +191,381 @@ int fpga_dma_device_id(enum fpga_dma_driver which_driver, int slot_id,
     fail_on(rc != 0, out, "Unable to get device number");
 
 
-    rc = snprintf(device_file, MAX_FD_LEN, "/dev/%s%i_%s_%d",
+    rc = snprintf(device_file, MAX_FD_LEN, "%s/dev/%s%i_%s_%d",
+                  fpga_pci_emu_root(),
                   dma_opts->drv_name,
                   device_num,
                   read_or_write,
                   channel);
-    fail_on_with_code(rc < 0, out, rc, FPGA_ERR_SOFTWARE_PROBLEM,
-        "Could not generate device_file");
+    fail_on_with_code(rc < 0 || rc >= MAX_FD_LEN, out, rc,
+        FPGA_ERR_SOFTWARE_PROBLEM, "Could not generate device_file");
     rc = 0;
 
 out:
     return rc;
 }
 
-int fpga_dma_burst_read(int fd, uint8_t *buffer, size_t xfer_sz,
-    size_t address)
+/* -ERESTARTSYS, which older drivers return from a timed out transfer */
+#define FPGA_DMA_ERESTARTSYS  (512)
+
+static uint64_t fpga_dma_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* errors of a DMA call which a smaller call may get past */
+static bool fpga_dma_xfer_retryable(int err)
+{
+    switch (err) {
+    case EIO:
+    case EAGAIN:
+    case EBUSY:
+    case ETIMEDOUT:
+    case FPGA_DMA_ERESTARTSYS:
+        return true;
+    default:
+        return false;
+    }
+}
+
+void fpga_dma_xfer_ctl_init(struct fpga_dma_xfer_ctl *ctl)
+{
+    memset(ctl, 0, sizeof(*ctl));
+    ctl->max_retries = FPGA_DMA_RETRIES_DEFAULT;
+    ctl->min_chunk = FPGA_DMA_MIN_CHUNK;
+}
+
+void fpga_dma_cancel(struct fpga_dma_xfer_ctl *ctl)
+{
+    __atomic_store_n(&ctl->cancelled, 1, __ATOMIC_RELEASE);
+}
+
+static int fpga_dma_burst_xfer(int fd, bool is_read, uint8_t *buffer,
+    size_t xfer_sz, size_t address, struct fpga_dma_xfer_ctl *ctl)
 {
     int rc;
-    size_t read_offset = 0;
+    int err;
+    struct fpga_dma_xfer_ctl defaults;
+    size_t offset = 0;
+    size_t chunk;
+    size_t min_chunk;
+    ssize_t n;
+    unsigned failures = 0;
+    uint64_t deadline_ns = 0;
+    uint64_t begin_ns = 0;
+    unsigned retries = 0;
+
+    if (ctl == NULL) {
+        fpga_dma_xfer_ctl_init(&defaults);
+        ctl = &defaults;
+    }
+    ctl->done = 0;
     fail_on(rc = (fd < 0) ? -EINVAL : 0, out,
         "Invalid file descriptor passed to function.");
 
-    while (read_offset < xfer_sz) {
-        rc = pread(fd,
-            /* buf pointer  */ buffer + read_offset,
-            /* size of xfer */ xfer_sz - read_offset,
-            /* read address */ address + read_offset);
-        if (rc < 0) {
-            fail_on_with_code(rc < 0, out, rc, -errno, "call to pread failed.");
+    chunk = (ctl->chunk_size != 0) ? ctl->chunk_size : xfer_sz;
+    min_chunk = (ctl->min_chunk != 0) ? ctl->min_chunk : 1;
+    if (ctl->timeout_ms != 0) {
+        deadline_ns = fpga_dma_now_ns() + ctl->timeout_ms * 1000000ull;
+    }
+
+    begin_ns = fpga_dma_stats_begin();
+    while (offset < xfer_sz) {
+        size_t len = xfer_sz - offset;
+
+        if (__atomic_load_n(&ctl->cancelled, __ATOMIC_ACQUIRE)) {
+            rc = -ECANCELED;
+            goto out;
+        }
+        if (deadline_ns != 0 && fpga_dma_now_ns() >= deadline_ns) {
+            errno = ETIMEDOUT;
+            fail_on_with_code(errno, out, rc, -errno,
+                "transfer timed out after %zu of %zu bytes", offset, xfer_sz);
+        }
+
+        if (len > chunk) {
+            len = chunk;
+        }
+        n = is_read ? pread(fd, buffer + offset, len, address + offset) :
+            pwrite(fd, buffer + offset, len, address + offset);
+        if (n > 0) {
+            /* the rest of a short call goes with the next one */
+            retries += ((size_t)n < len);
+            offset += n;
+            failures = 0;
+            continue;
+        }
+
+        /* a call which moves nothing would otherwise repeat forever */
+        err = (n == 0) ? EIO : errno;
+        retries++;
+        if (err == EINTR) {
+            continue;
+        }
+        errno = err;
+        fail_on_with_code(!fpga_dma_xfer_retryable(err) ||
+            failures >= ctl->max_retries, out, rc, -err,
+            "call to %s failed at %zu of %zu bytes.",
+            is_read ? "pread" : "pwrite", offset, xfer_sz);
+        failures++;
+        /* the driver aborts a failed call whole, retry a smaller piece */
+        chunk = len / 2 / min_chunk * min_chunk;
+        if (chunk < min_chunk) {
+            chunk = min_chunk;
         }
-        read_offset += rc;
     }
     rc = 0;
 out:
+    ctl->done = offset;
+    fpga_dma_stats_end(fd, begin_ns, offset, rc, retries);
     return rc;
 }
 
+int fpga_dma_burst_read(int fd, uint8_t *buffer, size_t xfer_sz,
+    size_t address)
+{
+    return fpga_dma_burst_xfer(fd, true, buffer, xfer_sz, address, NULL);
+}
 
 int fpga_dma_burst_write(int fd, uint8_t *buffer, size_t xfer_sz,
     size_t address)
+{
+    return fpga_dma_burst_xfer(fd, false, buffer, xfer_sz, address, NULL);
+}
+
+int fpga_dma_burst_read_ctl(int fd, uint8_t *buffer, size_t xfer_sz,
+    size_t address, struct fpga_dma_xfer_ctl *ctl)
+{
+    return fpga_dma_burst_xfer(fd, true, buffer, xfer_sz, address, ctl);
+}
+
+int fpga_dma_burst_write_ctl(int fd, uint8_t *buffer, size_t xfer_sz,
+    size_t address, struct fpga_dma_xfer_ctl *ctl)
+{
+    return fpga_dma_burst_xfer(fd, false, buffer, xfer_sz, address, ctl);
+}
+
+/* set once a driver refused to DMA from a read only mapping */
+static bool fpga_dma_ro_pin_unsupported;
+
+/*
+ * Write a file range from a shared read only mapping of the file, so the
+ * driver pins the page cache pages themselves. Drivers which pin every buffer
+ * writable fail that with EFAULT; those get a private writable mapping, which
+ * copies each page once.
+ */
+static int fpga_dma_write_file_mapped(int fd, int file_fd, size_t file_offset,
+    size_t xfer_sz, size_t address)
 {
     int rc;
-    size_t write_offset = 0;
-    fail_on(rc = (fd < 0) ? -EINVAL : 0, out,
+    size_t delta = file_offset % getpagesize();
+    size_t map_size = xfer_sz + delta;
+    bool writable = __atomic_load_n(&fpga_dma_ro_pin_unsupported, __ATOMIC_RELAXED);
+    uint8_t *map;
+
+retry:
+    map = mmap(NULL, map_size, writable ? PROT_READ | PROT_WRITE : PROT_READ,
+        writable ? MAP_PRIVATE : MAP_SHARED, file_fd, file_offset - delta);
+    fail_on_with_code(map == MAP_FAILED, out, rc, -errno,
+        "unable to map %zu bytes of the file", xfer_sz);
+    madvise(map, map_size, MADV_SEQUENTIAL);
+
+    rc = fpga_dma_burst_write(fd, map + delta, xfer_sz, address);
+    munmap(map, map_size);
+    if (rc == -EFAULT && !writable) {
+        __atomic_store_n(&fpga_dma_ro_pin_unsupported, true, __ATOMIC_RELAXED);
+        writable = true;
+        errno = 0;
+        goto retry;
+    }
+out:
+    return rc;
+}
+
+int fpga_dma_burst_write_file(int fd, int file_fd, size_t file_offset,
+    size_t xfer_sz, size_t address)
+{
+    int rc = 0;
+    off_t offset = file_offset;
+    size_t done = 0;
+    uint64_t begin_ns = 0;
+    unsigned retries = 0;
+
+    fail_on(rc = (fd < 0 || file_fd < 0) ? -EINVAL : 0, out,
         "Invalid file descriptor passed to function.");
 
-    while (write_offset < xfer_sz) {
-        rc = pwrite(fd,
-            /* buf pointer  */ buffer + write_offset,
-            /* size of xfer */ xfer_sz - write_offset,
-            /* read address */ address + write_offset);
-        if (rc < 0) {
-            fail_on_with_code(rc < 0, out, rc, -errno, "call to pwrite failed.");
+    /* sendfile writes at the file position of the queue */
+    fail_on_with_code(lseek(fd, address, SEEK_SET) < 0, out, rc, -errno,
+        "unable to seek the DMA queue");
+    begin_ns = fpga_dma_stats_begin();
+    while (done < xfer_sz) {
+        retries += (done != 0);
+        ssize_t n = sendfile(fd, file_fd, &offset, xfer_sz - done);
+        if (n < 0 && errno == EINTR) {
+            retries++;
+            continue;
+        }
+        if (n < 0 && done == 0 && (errno == EINVAL || errno == ENOSYS)) {
+            /* the driver cannot take spliced pages, burst_write counts it */
+            errno = 0;
+            begin_ns = 0;
+            rc = fpga_dma_write_file_mapped(fd, file_fd, file_offset, xfer_sz,
+                address);
+            goto out;
+        }
+        fail_on_with_code(n < 0, out, rc, -errno, "call to sendfile failed.");
+        fail_on_with_code(n == 0, out, rc, -EIO,
+            "file ends %zu bytes short of the transfer", xfer_sz - done);
+        done += n;
+    }
+out:
+    fpga_dma_stats_end(fd, begin_ns, done, rc, retries);
+    return rc;
+}
+
+/* iovecs passed to one preadv/pwritev call */
+#define FPGA_DMA_IOV_BATCH  (256)
+
+static int fpga_dma_burst_xferv(int fd, bool is_read, const struct iovec *iov,
+    int iovcnt, size_t address)
+{
+    int rc;
+    int idx = 0;
+    size_t offset = 0;
+    size_t moved = 0;
+    uint64_t begin_ns = 0;
+    unsigned retries = 0;
+    struct iovec batch[FPGA_DMA_IOV_BATCH];
+
+    fail_on(rc = (fd < 0 || iovcnt < 0 || (iov == NULL && iovcnt > 0)) ?
+        -EINVAL : 0, out, "Invalid arguments passed to function.");
+
+    begin_ns = fpga_dma_stats_begin();
+    while (true) {
+        int n = 0;
+        size_t batch_len = 0;
+        ssize_t done;
+
+        /* skip what has been moved, then gather the next batch */
+        while (idx < iovcnt && offset == iov[idx].iov_len) {
+            idx++;
+            offset = 0;
+        }
+        if (idx == iovcnt) {
+            break;
+        }
+        for (int i = idx; i < iovcnt && n < FPGA_DMA_IOV_BATCH; i++) {
+            size_t skip = (i == idx) ? offset : 0;
+            batch[n].iov_base = (uint8_t *)iov[i].iov_base + skip;
+            batch[n].iov_len = iov[i].iov_len - skip;
+            batch_len += batch[n].iov_len;
+            n++;
+        }
+
+        done = is_read ? preadv(fd, batch, n, address) :
+            pwritev(fd, batch, n, address);
+        if (done < 0 && errno == EINTR) {
+            retries++;
+            continue;
+        }
+        fail_on_with_code(done < 0, out, rc, -errno, "call to %s failed.",
+            is_read ? "preadv" : "pwritev");
+        fail_on_with_code(done == 0, out, rc, -EIO, "%s moved no data.",
+            is_read ? "preadv" : "pwritev");
+
+        address += done;
+        moved += done;
+        /* the rest of a short batch goes with the next call */
+        retries += ((size_t)done < batch_len);
+        while (done > 0) {
+            size_t step = iov[idx].iov_len - offset;
+            if ((size_t)done < step) {
+                offset += done;
+                break;
+            }
+            done -= step;
+            idx++;
+            offset = 0;
         }
-        write_offset += rc;
     }
     rc = 0;
 out:
+    fpga_dma_stats_end(fd, begin_ns, moved, rc, retries);
     return rc;
 }
 
+int fpga_dma_burst_readv(int fd, const struct iovec *iov, int iovcnt,
+    size_t address)
+{
+    return fpga_dma_burst_xferv(fd, true, iov, iovcnt, address);
+}
+
+int fpga_dma_burst_writev(int fd, const struct iovec *iov, int iovcnt,
+    size_t address)
+{
+    return fpga_dma_burst_xferv(fd, false, iov, iovcnt, address);
+}
+
 int fpga_pci_get_dma_device_num(enum fpga_dma_driver which_driver,
     int slot_id, int *device_num)
+{
+    int rc;
+    uint32_t generation;
+    struct dma_device_num_cache_s *cached;
+
+    fail_on(rc = (slot_id < 0 || slot_id >= FPGA_SLOT_MAX ||
+        device_num == NULL) ? -EINVAL : 0, out, "invalid slot");
+
+    /* read before the lookup, so a rescan during the lookup invalidates it */
+    generation = fpga_pci_slot_generation(slot_id);
+    cached = &dma_device_nums[slot_id];
+
+    pthread_mutex_lock(&dma_device_num_lock);
+    if (cached->valid && cached->which_driver == which_driver &&
+        cached->generation == generation) {
+        *device_num = cached->device_num;
+        pthread_mutex_unlock(&dma_device_num_lock);
+        return 0;
+    }
+    pthread_mutex_unlock(&dma_device_num_lock);
+
+    rc = fpga_dma_find_device_num(which_driver, slot_id, device_num);
+    if (rc) {
+        goto out;
+    }
+
+    pthread_mutex_lock(&dma_device_num_lock);
+    cached->valid = true;
+    cached->which_driver = which_driver;
+    cached->generation = generation;
+    cached->device_num = *device_num;
+    pthread_mutex_unlock(&dma_device_num_lock);
+out:
+    return rc;
+}
+
+static int fpga_dma_find_device_num(enum fpga_dma_driver which_driver,
+    int slot_id, int *device_num)
 {
     int rc;
     char dbdf[16];
-    char path[64];
+    char path[MAX_FD_LEN];
     int _device_num;
     struct dirent *entry;
-    char real_path[MAX_FD_LEN];
+    char real_path[PATH_MAX];
     char *possible_dbdf = NULL;
     struct fpga_pci_resource_map resource;
     char sysfs_path_instance[MAX_FD_LEN + sizeof(entry->d_name) + sizeof(path)];
 
     const struct dma_opts_s *dma_opts = fpga_dma_get_dma_opts(which_driver);
     fail_on_with_code(!dma_opts, err, rc, -EINVAL, "invalid DMA driver");
-    rc = snprintf(path, sizeof(path), "/sys/class/%s", dma_opts->drv_name);
-    fail_on_with_code(rc < 1, err, rc, FPGA_ERR_SOFTWARE_PROBLEM,
-        "snprintf failed");
+    rc = snprintf(path, sizeof(path), "%s/sys/class/%s", fpga_pci_emu_root(),
+        dma_opts->drv_name);
+    fail_on_with_code(rc < 1 || (size_t)rc >= sizeof(path), err, rc,
+        FPGA_ERR_SOFTWARE_PROBLEM, "snprintf failed");
 
     /* This call must be before the lock, because the call holds the lock. */
     rc = fpga_pci_get_resource_map(slot_id, FPGA_APP_PF, &resource);
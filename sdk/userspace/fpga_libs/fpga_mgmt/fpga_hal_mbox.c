@@ -167,23 +167,16 @@ fpga_hal_mbox_read_async(pci_bar_handle_t handle, void *msg, uint32_t *len)
 	ret = fpga_hal_mbox_check_len(mb_rd_len << 2);
 	fail_on(ret != 0, err_rx_ack, "fpga_hal_mbox_check_len failed");
 
-	/** Reset the read index to 0 */
-	ret = fpga_pci_poke(handle, FMB_REG_RD_INDEX, 0);
-	fail_on(ret != 0, err_rx_ack, "fpga_pci_poke(mb_rd_index) failed");
-
-	/** Read the data.  Index is auto-incremented */
-	uint32_t i;
-	uint32_t *m32 = msg;
-	for (i = 0; i < mb_rd_len; i++) {
-		ret = fpga_pci_peek(handle, FMB_REG_RD_DATA, m32);
-		fail_on(ret != 0, err_rx_ack, "fpga_pci_peek(mb_rd_data) failed");
-
-		m32++;
-	}
-
-	/** Acknowledge the RX event */
-	ret = fpga_pci_poke(handle, FMB_REG_STATUS, FMB_RX_EVT);
-	fail_on(ret != 0, err_code, "fpga_pci_poke(status) failed");
+	const struct fpga_pci_reg_op read_ops[] = {
+		/** Reset the read index to 0 */
+		FPGA_PCI_REG_POKE(FMB_REG_RD_INDEX, 0),
+		/** Read the data.  Index is auto-incremented */
+		FPGA_PCI_REG_PEEK_N(FMB_REG_RD_DATA, msg, mb_rd_len),
+		/** Acknowledge the RX event */
+		FPGA_PCI_REG_POKE(FMB_REG_STATUS, FMB_RX_EVT),
+	};
+	ret = fpga_pci_run_program(handle, read_ops, sizeof_array(read_ops), NULL);
+	fail_on(ret != 0, err_rx_ack, "reading the message failed");
 
 	*len = mb_rd_len << 2;
 	log_debug("Read len=%u", *len);
@@ -238,24 +231,17 @@ fpga_hal_mbox_write_async(pci_bar_handle_t handle, void *msg, uint32_t len)
 	ret = fpga_hal_mbox_write_async_tc_ack(handle, &ack);
 	fail_on(ret != 0, err, "fpga_hal_mbox_write_async_tc_ack failed");
 
-	/** Reset the write index to 0 */
-	ret = fpga_pci_poke(handle, FMB_REG_WR_INDEX, 0);
-	fail_on(ret != 0, err, "fpga_pci_poke(mb_wr_index) failed");
-
-	/** Write the data.  Index is auto-incremented */
 	uint32_t mb_wr_len = len >> 2;
-	uint32_t *m32 = msg;
-	uint32_t i;
-	for (i = 0; i < mb_wr_len; i++) {
-		ret = fpga_pci_poke(handle, FMB_REG_WR_DATA, *m32);
-		fail_on(ret != 0, err, "fpga_pci_poke(mb_wr_data) failed");
-
-		m32++;
-	}
-
-	/** Write the (32b word) data length */
-	ret = fpga_pci_poke(handle, FMB_REG_WR_LEN, mb_wr_len);
-	fail_on(ret != 0, err, "fpga_pci_poke(mb_wr_len) failed");
+	const struct fpga_pci_reg_op write_ops[] = {
+		/** Reset the write index to 0 */
+		FPGA_PCI_REG_POKE(FMB_REG_WR_INDEX, 0),
+		/** Write the data.  Index is auto-incremented */
+		FPGA_PCI_REG_POKE_N(FMB_REG_WR_DATA, msg, mb_wr_len),
+		/** Write the (32b word) data length */
+		FPGA_PCI_REG_POKE(FMB_REG_WR_LEN, mb_wr_len),
+	};
+	ret = fpga_pci_run_program(handle, write_ops, sizeof_array(write_ops), NULL);
+	fail_on(ret != 0, err, "writing the message failed");
 
 	log_debug("Wrote len=%u", len);
 	return 0;
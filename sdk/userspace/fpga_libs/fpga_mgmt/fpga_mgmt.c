@@ -313,6 +313,11 @@ int fpga_mgmt_clear_local_image_sync(int slot_id,
 	ret = fpga_mgmt_get_sh_version(slot_id, &prev_sh_version);
 	fail_on(ret != 0, out, "fpga_mgmt_get_sh_version failed");
 
+	/**
+	 * The rescan decision below compares against the ids sysfs has now,
+	 * which another process may have changed since they were cached.
+	 */
+	fpga_pci_invalidate_slot_specs();
 	ret = fpga_pci_get_resource_map(slot_id, FPGA_APP_PF, &app_map);
 	fail_on(ret != 0, out, "fpga_pci_get_resource_map failed");
 
@@ -478,6 +483,11 @@ int fpga_mgmt_load_local_image_sync_with_options(union fpga_mgmt_load_local_imag
 	ret = fpga_mgmt_get_sh_version(opt->slot_id, &prev_sh_version);
 	fail_on(ret != 0, out, "fpga_mgmt_get_sh_version failed");
 
+	/**
+	 * The rescan decision below compares against the ids sysfs has now,
+	 * which another process may have changed since they were cached.
+	 */
+	fpga_pci_invalidate_slot_specs();
 	ret = fpga_pci_get_resource_map(opt->slot_id, FPGA_APP_PF, &app_map);
 	fail_on(ret != 0, out, "fpga_pci_get_resource_map failed");
 
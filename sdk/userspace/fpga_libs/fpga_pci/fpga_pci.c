@@ -36,8 +36,12 @@ static pthread_mutex_t bars_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 static struct fpga_pci_bar {
 	bool	 allocated;
+	/** Attached with BURST_CAPABLE, i.e. mapped write combining */
+	bool	 burst_capable;
 	void	*mem_base;
 	size_t	 mem_size;
+	/** Set instead of mem_base for a BAR served by a device model */
+	struct fpga_pci_emu *emu;
 } bars[FPGA_PCI_BARS_MAX];
 
 static inline struct fpga_pci_bar *
@@ -53,6 +57,15 @@ err:
 	return NULL;
 }
 
+struct fpga_pci_emu *
+fpga_pci_bar_get_emu(pci_bar_handle_t handle)
+{
+	if (handle < 0 || handle >= FPGA_PCI_BARS_MAX || !bars[handle].allocated) {
+		return NULL;
+	}
+	return bars[handle].emu;
+}
+
 static int 
 fpga_pci_bar_set_mem_base_size(pci_bar_handle_t handle, void *mem_base, size_t mem_size)
 {
@@ -171,6 +184,7 @@ fpga_pci_bar_attach(struct fpga_slot_spec *spec, int pf_id, int bar_id,
 	log_debug("enter");
 
 	void *mem_base = NULL;
+	struct fpga_pci_emu *emu = NULL;
 
 	fail_on_with_code(!spec, err, ret, FPGA_ERR_SOFTWARE_PROBLEM,
 		"spec is NULL");
@@ -191,8 +205,8 @@ fpga_pci_bar_attach(struct fpga_slot_spec *spec, int pf_id, int bar_id,
 	/** Sanity check the vendor */
 	char sysfs_name[NAME_MAX + 1];
 	ret = snprintf(sysfs_name, sizeof(sysfs_name),
-			"/sys/bus/pci/devices/" PCI_DEV_FMT "/vendor",
-			map->domain, map->bus, map->dev, map->func);
+			"%s/sys/bus/pci/devices/" PCI_DEV_FMT "/vendor",
+			fpga_pci_emu_root(), map->domain, map->bus, map->dev, map->func);
 
 	fail_on_with_code(ret < 0, err, ret, FPGA_ERR_SOFTWARE_PROBLEM,
 		"Error building the sysfs path for vendor");
@@ -206,8 +220,8 @@ fpga_pci_bar_attach(struct fpga_slot_spec *spec, int pf_id, int bar_id,
 
 	/** Sanity check the device */
 	ret = snprintf(sysfs_name, sizeof(sysfs_name), 
-			"/sys/bus/pci/devices/" PCI_DEV_FMT "/device", 
-			map->domain, map->bus, map->dev, map->func);
+			"%s/sys/bus/pci/devices/" PCI_DEV_FMT "/device", 
+			fpga_pci_emu_root(), map->domain, map->bus, map->dev, map->func);
 
 	fail_on_with_code(ret < 0, err, ret, FPGA_ERR_SOFTWARE_PROBLEM,
 		"Error building the sysfs path for device");
@@ -228,15 +242,36 @@ fpga_pci_bar_attach(struct fpga_slot_spec *spec, int pf_id, int bar_id,
 	 * Open and memory map the resource.
 	 *  -"_wc" is added if the memory bar is burstable.
 	 */
-	snprintf(sysfs_name, sizeof(sysfs_name), 
-			"/sys/bus/pci/devices/" PCI_DEV_FMT "/resource%u%s", 
-			map->domain, map->bus, map->dev, map->func, bar_id, wc_suffix);
+	ret = snprintf(sysfs_name, sizeof(sysfs_name), 
+			"%s/sys/bus/pci/devices/" PCI_DEV_FMT "/resource%u%s", 
+			fpga_pci_emu_root(), map->domain, map->bus, map->dev, map->func,
+			bar_id, wc_suffix);
 
 	fail_on_with_code(ret < 0, err, ret, FPGA_ERR_SOFTWARE_PROBLEM,
 		"Error building the sysfs path for resource");
 	fail_on_with_code((size_t) ret >= sizeof(sysfs_name), err, ret,
 		FPGA_ERR_SOFTWARE_PROBLEM, "sysfs path too long for resource");
 
+	/** A socket in place of the resource is served by a device model */
+	struct stat file_stat;
+	if (stat(sysfs_name, &file_stat) == 0 && S_ISSOCK(file_stat.st_mode)) {
+		log_debug("Connecting to sysfs_name=%s", sysfs_name);
+
+		ret = fpga_pci_emu_connect(sysfs_name, map->resource_size[bar_id],
+			&emu);
+		fail_on_with_code(ret != 0, err, ret, FPGA_ERR_UNRESPONSIVE,
+			"fpga_pci_emu_connect failed");
+
+		int tmp_handle = fpga_pci_bar_alloc();
+		fail_on_with_code(tmp_handle < 0, err, ret, -ENOMEM,
+			"fpga_pci_bar_alloc failed");
+
+		bars[tmp_handle].emu = emu;
+		bars[tmp_handle].mem_size = map->resource_size[bar_id];
+		*handle = tmp_handle;
+		return 0;
+	}
+
 	log_debug("Opening sysfs_name=%s", sysfs_name);
 
 	fd = open(sysfs_name, O_RDWR | O_SYNC);
@@ -259,6 +294,8 @@ fpga_pci_bar_attach(struct fpga_slot_spec *spec, int pf_id, int bar_id,
 			map->resource_size[bar_id]);
 	fail_on(ret != 0, err_unmap, "fpga_pci_set_mem_base_size failed");
 
+	bars[tmp_handle].burst_capable = write_combining;
+
 	/** Setup handle for return */
 	*handle = tmp_handle;
 
@@ -272,6 +309,9 @@ err:
 	if (fd != -1) {
 		close(fd);
 	}
+	if (emu) {
+		fpga_pci_emu_close(emu);
+	}
 	errno = 0;
 	return ret;
 }
@@ -322,7 +362,12 @@ fpga_pci_detach(pci_bar_handle_t handle) {
 	struct fpga_pci_bar *bar = fpga_pci_bar_get(handle);
 	fail_on(!bar, err, "fpga_pci_bar_get failed");
 
-	int ret = munmap(bar->mem_base, bar->mem_size);
+	int ret = 0;
+	if (bar->emu) {
+		fpga_pci_emu_close(bar->emu);
+	} else {
+		ret = munmap(bar->mem_base, bar->mem_size);
+	}
 	fail_on(ret != 0, err, "munmap failed");
 
 	ret = fpga_pci_bar_free(handle);
@@ -338,6 +383,11 @@ fpga_pci_poke(pci_bar_handle_t handle, uint64_t offset, uint32_t value) {
 	log_debug("handle=%d, offset=0x%" PRIx64 ", value=0x%08x", 
 			handle, offset, value);
 
+	struct fpga_pci_emu *emu = fpga_pci_bar_get_emu(handle);
+	if (emu) {
+		return fpga_pci_emu_write(emu, offset, sizeof(value), value);
+	}
+
 	uint32_t *reg_ptr = (uint32_t *)fpga_pci_bar_get_mem_at_offset(handle, 
 			offset, sizeof(uint32_t));
 	fail_on(!reg_ptr, err, "fpga_pci_bar_get_mem_at_offset failed");
@@ -354,6 +404,11 @@ fpga_pci_poke8(pci_bar_handle_t handle, uint64_t offset, uint8_t value) {
 	log_debug("handle=%d, offset=0x%" PRIx64 ", value=0x%08x", 
 			handle, offset, value);
 
+	struct fpga_pci_emu *emu = fpga_pci_bar_get_emu(handle);
+	if (emu) {
+		return fpga_pci_emu_write(emu, offset, sizeof(value), value);
+	}
+
 	uint8_t *reg_ptr = (uint8_t *)fpga_pci_bar_get_mem_at_offset(handle, 
 			offset, sizeof(uint8_t));
 	fail_on(!reg_ptr, err, "fpga_pci_bar_get_mem_at_offset failed");
@@ -370,6 +425,11 @@ fpga_pci_poke64(pci_bar_handle_t handle, uint64_t offset, uint64_t value) {
 	log_debug("handle=%d, offset=0x%" PRIx64 ", value=0x%" PRIx64, 
 			handle, offset, value);
 
+	struct fpga_pci_emu *emu = fpga_pci_bar_get_emu(handle);
+	if (emu) {
+		return fpga_pci_emu_write(emu, offset, sizeof(value), value);
+	}
+
 	uint64_t *reg_ptr = (uint64_t *)fpga_pci_bar_get_mem_at_offset(handle,
 			offset, sizeof(uint64_t));
 	fail_on(!reg_ptr, err, "fpga_plat_get_mem_at_offset failed");
@@ -385,6 +445,14 @@ int
 fpga_pci_peek(pci_bar_handle_t handle, uint64_t offset, uint32_t *value) {
 	fail_on(!value, err, "value is NULL");
 
+	struct fpga_pci_emu *emu = fpga_pci_bar_get_emu(handle);
+	if (emu) {
+		uint64_t tmp;
+		int ret = fpga_pci_emu_read(emu, offset, sizeof(*value), &tmp);
+		*value = tmp;
+		return ret;
+	}
+
 	uint32_t *reg_ptr = (uint32_t *)fpga_pci_bar_get_mem_at_offset(handle, 
 			offset, sizeof(uint32_t));
 	fail_on(!reg_ptr, err, "fpga_plat_get_mem_at_offset failed");
@@ -402,6 +470,14 @@ int
 fpga_pci_peek8(pci_bar_handle_t handle, uint64_t offset, uint8_t *value) {
 	fail_on(!value, err, "value is NULL");
 
+	struct fpga_pci_emu *emu = fpga_pci_bar_get_emu(handle);
+	if (emu) {
+		uint64_t tmp;
+		int ret = fpga_pci_emu_read(emu, offset, sizeof(*value), &tmp);
+		*value = tmp;
+		return ret;
+	}
+
 	uint8_t *reg_ptr = (uint8_t *)fpga_pci_bar_get_mem_at_offset(handle,
 			offset, sizeof(uint8_t));
 	fail_on(!reg_ptr, err, "fpga_plat_get_mem_at_offset failed");
@@ -419,6 +495,14 @@ int
 fpga_pci_peek64(pci_bar_handle_t handle, uint64_t offset, uint64_t *value) {
 	fail_on(!value, err, "value is NULL");
 
+	struct fpga_pci_emu *emu = fpga_pci_bar_get_emu(handle);
+	if (emu) {
+		uint64_t tmp;
+		int ret = fpga_pci_emu_read(emu, offset, sizeof(*value), &tmp);
+		*value = tmp;
+		return ret;
+	}
+
 	uint64_t *reg_ptr = (uint64_t *)fpga_pci_bar_get_mem_at_offset(handle,
 			offset, sizeof(uint64_t));
 	fail_on(!reg_ptr, err, "fpga_plat_get_mem_at_offset failed");
@@ -432,20 +516,72 @@ err:
 	return -EINVAL;
 }
 
+int
+fpga_pci_get_bar_view(pci_bar_handle_t handle, fpga_pci_bar_view_t *view)
+{
+	log_debug("handle=%d", handle);
+
+	fail_on(!view, err, "view is NULL");
+	fail_on(handle < 0, err, "Invalid handle=%d", handle);
+
+	struct fpga_pci_bar *bar = fpga_pci_bar_get(handle);
+	fail_on(!bar, err, "fpga_pci_bar_get failed");
+	fail_on(!bar->allocated, err, "Not attached");
+	if (bar->emu) {
+		log_debug("handle=%d is served by a device model", handle);
+		return -ENOTSUP;
+	}
+	fail_on(!bar->mem_base, err, "mem_base is NULL");
+
+	view->base = bar->mem_base;
+	view->size = bar->mem_size;
+	return 0;
+err:
+	return -EINVAL;
+}
+
 int fpga_pci_write_burst(pci_bar_handle_t handle, uint64_t offset, uint32_t* datap, uint64_t dword_len) {
-	uint64_t i;
 	log_debug("handle=%d, offset=0x%" PRIx64, handle, offset);
 
+	struct fpga_pci_emu *emu = fpga_pci_bar_get_emu(handle);
+	if (emu) {
+		return fpga_pci_emu_write_dwords(emu, offset, datap, 0, dword_len);
+	}
+
 	/** get the pointer to the beginning of the range */
 	uint32_t *reg_ptr = (uint32_t *)fpga_pci_bar_get_mem_at_offset(handle,
 			offset, sizeof(uint32_t)*dword_len);
 	fail_on(!reg_ptr, err, "fpga_plat_get_mem_at_offset failed");
 
-	/** memcpy */
-	for (i = 0; i < dword_len; ++i) {
-		reg_ptr[i] = datap[i];
+	fpga_pci_burst_write(reg_ptr, datap, sizeof(uint32_t) * dword_len,
+		bars[handle].burst_capable);
+
+	return 0;
+err:
+	return -EINVAL;
+}
+
+int
+fpga_pci_read_burst(pci_bar_handle_t handle, uint64_t offset, uint32_t *datap,
+	uint64_t dword_len)
+{
+	log_debug("handle=%d, offset=0x%" PRIx64, handle, offset);
+
+	fail_on(!datap && dword_len, err, "datap is NULL");
+
+	struct fpga_pci_emu *emu = fpga_pci_bar_get_emu(handle);
+	if (emu) {
+		return fpga_pci_emu_read_dwords(emu, offset, datap, dword_len);
 	}
 
+	/** get the pointer to the beginning of the range */
+	uint32_t *reg_ptr = (uint32_t *)fpga_pci_bar_get_mem_at_offset(handle,
+			offset, sizeof(uint32_t)*dword_len);
+	fail_on(!reg_ptr, err, "fpga_plat_get_mem_at_offset failed");
+
+	fpga_pci_burst_read(datap, reg_ptr, sizeof(uint32_t) * dword_len,
+		bars[handle].burst_capable);
+
 	return 0;
 err:
 	return -EINVAL;
@@ -468,18 +604,20 @@ int
 fpga_pci_memset(pci_bar_handle_t handle, uint64_t offset, uint32_t value,
 	uint64_t dword_len)
 {
-	uint64_t i;
 	log_debug("handle=%d, offset=0x%" PRIx64, handle, offset);
 
+	struct fpga_pci_emu *emu = fpga_pci_bar_get_emu(handle);
+	if (emu) {
+		return fpga_pci_emu_write_dwords(emu, offset, NULL, value, dword_len);
+	}
+
 	/** get the pointer to the beginning of the range */
 	uint32_t *reg_ptr = (uint32_t *)fpga_pci_bar_get_mem_at_offset(handle,
 			offset, sizeof(uint32_t)*dword_len);
 	fail_on(!reg_ptr, err, "fpga_plat_get_mem_at_offset failed");
 
-	/** memset */
-	for (i = 0; i < dword_len; ++i) {
-		reg_ptr[i] = value;
-	}
+	fpga_pci_burst_set(reg_ptr, value, sizeof(uint32_t) * dword_len,
+		bars[handle].burst_capable);
 
 	return 0;
 err:
@@ -0,0 +1,275 @@
+/*
+ * Copyright 2015-2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may
+ * not use this file except in compliance with the License. A copy of the
+ * License is located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/** @file
+ * Copies to and from a mapped BAR.
+ *
+ * A BAR attached without BURST_CAPABLE may be a register space which only
+ * takes 32-bit accesses, so it is accessed one DWORD at a time. A burst
+ * capable BAR is a memory space mapped write combining: stores go out as
+ * 64-byte non-temporal stores where the CPU has AVX-512 (32-byte with AVX),
+ * so each fills a whole write combining buffer, and loads are 128-bit.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "fpga_pci_internal.h"
+
+#define FPGA_PCI_BURST_NONE	0
+#define FPGA_PCI_BURST_AVX	1
+#define FPGA_PCI_BURST_AVX512	2
+
+/**
+ * Store len bytes of src, or of the repeated value if src is NULL, one DWORD
+ * at a time, and advance the pointers past them.
+ */
+static inline void
+fpga_pci_burst_store_dwords(volatile uint8_t **dst, const uint8_t **src,
+	uint32_t value, size_t len)
+{
+	for (; len >= sizeof(uint32_t); len -= sizeof(uint32_t)) {
+		uint32_t v = value;
+		if (*src) {
+			__builtin_memcpy(&v, *src, sizeof(v));
+			*src += sizeof(v);
+		}
+		*(volatile uint32_t *)*dst = v;
+		*dst += sizeof(v);
+	}
+}
+
+/** Load len bytes one DWORD at a time and advance the pointers past them. */
+static inline void
+fpga_pci_burst_load_dwords(uint8_t **dst, const volatile uint8_t **src,
+	size_t len)
+{
+	for (; len >= sizeof(uint32_t); len -= sizeof(uint32_t)) {
+		uint32_t v = *(const volatile uint32_t *)*src;
+		__builtin_memcpy(*dst, &v, sizeof(v));
+		*src += sizeof(v);
+		*dst += sizeof(v);
+	}
+}
+
+/**
+ * DWORDs to access one at a time, in bytes, before ptr is aligned to align.
+ * ptr is DWORD aligned.
+ */
+static inline size_t
+fpga_pci_burst_head(const volatile uint8_t *ptr, size_t len, size_t align)
+{
+	size_t head = -(uintptr_t)ptr & (align - 1);
+
+	return (head < len) ? head : len & ~(sizeof(uint32_t) - 1);
+}
+
+/**
+ * Store len bytes of src, or of the repeated value if src is NULL, as 64-bit
+ * stores where dst is aligned if wide, else one DWORD at a time.
+ */
+static void
+fpga_pci_burst_store(volatile uint8_t *dst, const uint8_t *src,
+	uint32_t value, size_t len, bool wide)
+{
+	if (wide) {
+		uint64_t value64 = ((uint64_t)value << 32) | value;
+		size_t head = fpga_pci_burst_head(dst, len, sizeof(uint64_t));
+
+		fpga_pci_burst_store_dwords(&dst, &src, value, head);
+		len -= head;
+		for (; len >= sizeof(uint64_t); len -= sizeof(uint64_t)) {
+			uint64_t v = value64;
+			if (src) {
+				__builtin_memcpy(&v, src, sizeof(v));
+				src += sizeof(v);
+			}
+			*(volatile uint64_t *)dst = v;
+			dst += sizeof(v);
+		}
+	}
+	fpga_pci_burst_store_dwords(&dst, &src, value, len);
+}
+
+#if defined(__x86_64__)
+
+static int
+fpga_pci_burst_isa(void)
+{
+	static int isa = -1;
+
+	if (isa < 0) {
+		__builtin_cpu_init();
+		isa = __builtin_cpu_supports("avx512f") ? FPGA_PCI_BURST_AVX512 :
+			__builtin_cpu_supports("avx") ? FPGA_PCI_BURST_AVX :
+			FPGA_PCI_BURST_NONE;
+	}
+	return isa;
+}
+
+__attribute__((target("avx512f")))
+static void
+fpga_pci_burst_store_avx512(volatile uint8_t *dst, const uint8_t *src,
+	uint32_t value, size_t len)
+{
+	__m512i v = _mm512_set1_epi32(value);
+	size_t head = fpga_pci_burst_head(dst, len, sizeof(__m512i));
+
+	fpga_pci_burst_store_dwords(&dst, &src, value, head);
+	len -= head;
+	for (; len >= sizeof(__m512i); len -= sizeof(__m512i)) {
+		if (src) {
+			v = _mm512_loadu_si512((const void *)src);
+			src += sizeof(__m512i);
+		}
+		_mm512_stream_si512((__m512i *)dst, v);
+		dst += sizeof(__m512i);
+	}
+	fpga_pci_burst_store(dst, src, value, len, true);
+}
+
+__attribute__((target("avx")))
+static void
+fpga_pci_burst_store_avx(volatile uint8_t *dst, const uint8_t *src,
+	uint32_t value, size_t len)
+{
+	__m256i v = _mm256_set1_epi32(value);
+	size_t head = fpga_pci_burst_head(dst, len, sizeof(__m256i));
+
+	fpga_pci_burst_store_dwords(&dst, &src, value, head);
+	len -= head;
+	for (; len >= sizeof(__m256i); len -= sizeof(__m256i)) {
+		if (src) {
+			v = _mm256_loadu_si256((const __m256i *)src);
+			src += sizeof(__m256i);
+		}
+		_mm256_stream_si256((__m256i *)dst, v);
+		dst += sizeof(__m256i);
+	}
+	fpga_pci_burst_store(dst, src, value, len, true);
+}
+
+static void
+fpga_pci_burst_store_wc(volatile uint8_t *dst, const uint8_t *src,
+	uint32_t value, size_t len)
+{
+	switch (fpga_pci_burst_isa()) {
+	case FPGA_PCI_BURST_AVX512:
+		fpga_pci_burst_store_avx512(dst, src, value, len);
+		break;
+	case FPGA_PCI_BURST_AVX:
+		fpga_pci_burst_store_avx(dst, src, value, len);
+		break;
+	default:
+		fpga_pci_burst_store(dst, src, value, len, true);
+		break;
+	}
+	/** Drain the write combining buffers before any later register write */
+	_mm_sfence();
+}
+
+static void
+fpga_pci_burst_load_wide(uint8_t *dst, const volatile uint8_t *src,
+	size_t len)
+{
+	size_t head = fpga_pci_burst_head(src, len, sizeof(__m128i));
+
+	fpga_pci_burst_load_dwords(&dst, &src, head);
+	len -= head;
+	for (; len >= sizeof(__m128i); len -= sizeof(__m128i)) {
+		_mm_storeu_si128((__m128i *)dst,
+			_mm_load_si128((const __m128i *)src));
+		src += sizeof(__m128i);
+		dst += sizeof(__m128i);
+	}
+	fpga_pci_burst_load_dwords(&dst, &src, len);
+}
+
+#else
+
+static void
+fpga_pci_burst_store_wc(volatile uint8_t *dst, const uint8_t *src,
+	uint32_t value, size_t len)
+{
+	fpga_pci_burst_store(dst, src, value, len, true);
+	__sync_synchronize();
+}
+
+static void
+fpga_pci_burst_load_wide(uint8_t *dst, const volatile uint8_t *src,
+	size_t len)
+{
+	size_t head = fpga_pci_burst_head(src, len, sizeof(uint64_t));
+
+	fpga_pci_burst_load_dwords(&dst, &src, head);
+	len -= head;
+	for (; len >= sizeof(uint64_t); len -= sizeof(uint64_t)) {
+		uint64_t v = *(const volatile uint64_t *)src;
+		__builtin_memcpy(dst, &v, sizeof(v));
+		src += sizeof(v);
+		dst += sizeof(v);
+	}
+	fpga_pci_burst_load_dwords(&dst, &src, len);
+}
+
+#endif
+
+/** Wide accesses need a DWORD aligned BAR address, which offsets normally are */
+static inline bool
+fpga_pci_burst_wide(const volatile void *bar, bool burst_capable)
+{
+	return burst_capable && ((uintptr_t)bar & (sizeof(uint32_t) - 1)) == 0;
+}
+
+void
+fpga_pci_burst_write(volatile void *dst, const void *src, size_t len,
+	bool burst_capable)
+{
+	if (fpga_pci_burst_wide(dst, burst_capable)) {
+		fpga_pci_burst_store_wc(dst, src, 0, len);
+	} else {
+		fpga_pci_burst_store(dst, src, 0, len, false);
+	}
+}
+
+void
+fpga_pci_burst_set(volatile void *dst, uint32_t value, size_t len,
+	bool burst_capable)
+{
+	if (fpga_pci_burst_wide(dst, burst_capable)) {
+		fpga_pci_burst_store_wc(dst, NULL, value, len);
+	} else {
+		fpga_pci_burst_store(dst, NULL, value, len, false);
+	}
+}
+
+void
+fpga_pci_burst_read(void *dst, const volatile void *src, size_t len,
+	bool burst_capable)
+{
+	if (fpga_pci_burst_wide(src, burst_capable)) {
+		fpga_pci_burst_load_wide(dst, src, len);
+	} else {
+		uint8_t *d = dst;
+		const volatile uint8_t *s = src;
+
+		fpga_pci_burst_load_dwords(&d, &s, len);
+	}
+}
@@ -0,0 +1,194 @@
+/*
+ * Copyright 2015-2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may
+ * not use this file except in compliance with the License. A copy of the
+ * License is located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/** @file
+ * BARs served by a device model, see fpga_pci_emu.h.
+ *
+ * Each attach of such a BAR opens its own connection to the model, so the
+ * model sees the accesses of an attachment in order. The connection is
+ * shared by the threads using the attachment, one access at a time.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <fpga_pci_emu.h>
+
+#include "fpga_pci_internal.h"
+
+struct fpga_pci_emu {
+	int fd;
+	uint64_t size;
+	pthread_mutex_t lock;
+};
+
+const char *
+fpga_pci_emu_root(void)
+{
+	static const char *root;
+	const char *tmp = __atomic_load_n(&root, __ATOMIC_ACQUIRE);
+
+	if (!tmp) {
+		tmp = getenv(FPGA_PCI_EMU_ROOT_ENV);
+		tmp = (tmp) ? tmp : "";
+		__atomic_store_n(&root, tmp, __ATOMIC_RELEASE);
+	}
+	return tmp;
+}
+
+int
+fpga_pci_emu_connect(const char *path, uint64_t size,
+	struct fpga_pci_emu **emu)
+{
+	struct sockaddr_un addr;
+	struct fpga_pci_emu *tmp = NULL;
+	int ret = -EINVAL;
+
+	fail_on(!path || !emu, err, "Invalid parameters");
+	fail_on(strlen(path) >= sizeof(addr.sun_path), err,
+		"Socket path too long, path=%s", path);
+
+	tmp = calloc(1, sizeof(*tmp));
+	fail_on_with_code(!tmp, err, ret, -ENOMEM, "calloc failed");
+	tmp->size = size;
+	pthread_mutex_init(&tmp->lock, NULL);
+
+	tmp->fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	fail_on_with_code(tmp->fd < 0, err, ret, -errno, "socket failed");
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	ret = connect(tmp->fd, (struct sockaddr *)&addr, sizeof(addr));
+	fail_on_with_code(ret != 0, err, ret, -errno,
+		"Unable to reach the device model, path=%s", path);
+
+	*emu = tmp;
+	return 0;
+err:
+	if (tmp) {
+		fpga_pci_emu_close(tmp);
+	}
+	errno = 0;
+	return ret;
+}
+
+void
+fpga_pci_emu_close(struct fpga_pci_emu *emu)
+{
+	if (emu->fd >= 0) {
+		close(emu->fd);
+	}
+	pthread_mutex_destroy(&emu->lock);
+	free(emu);
+}
+
+/** One request and its response */
+static int
+fpga_pci_emu_access(struct fpga_pci_emu *emu, uint32_t op, uint64_t offset,
+	uint32_t width, uint64_t *value)
+{
+	struct fpga_pci_emu_req req = {
+		.op = op,
+		.width = width,
+		.offset = offset,
+		.value = *value,
+	};
+	struct fpga_pci_emu_rsp rsp;
+	ssize_t n;
+	int ret = -EINVAL;
+
+	fail_on(offset > emu->size || width > emu->size - offset, err,
+		"Invalid offset + size =0x%" PRIx64 " exceeds range",
+		offset + width);
+
+	pthread_mutex_lock(&emu->lock);
+	do {
+		n = send(emu->fd, &req, sizeof(req), MSG_NOSIGNAL);
+	} while (n < 0 && errno == EINTR);
+	if (n == (ssize_t)sizeof(req)) {
+		do {
+			n = recv(emu->fd, &rsp, sizeof(rsp), 0);
+		} while (n < 0 && errno == EINTR);
+	}
+	pthread_mutex_unlock(&emu->lock);
+
+	fail_on_with_code(n != (ssize_t)sizeof(rsp), err, ret,
+		(n < 0) ? -errno : -EPIPE, "The device model did not answer");
+	ret = rsp.status;
+	fail_on(ret != 0, err, "The device model failed the access, "
+		"offset=0x%" PRIx64, offset);
+
+	*value = rsp.value;
+	return 0;
+err:
+	errno = 0;
+	return ret;
+}
+
+int
+fpga_pci_emu_read(struct fpga_pci_emu *emu, uint64_t offset, uint32_t width,
+	uint64_t *value)
+{
+	*value = 0;
+	return fpga_pci_emu_access(emu, FPGA_PCI_EMU_READ, offset, width, value);
+}
+
+int
+fpga_pci_emu_write(struct fpga_pci_emu *emu, uint64_t offset, uint32_t width,
+	uint64_t value)
+{
+	return fpga_pci_emu_access(emu, FPGA_PCI_EMU_WRITE, offset, width, &value);
+}
+
+int
+fpga_pci_emu_read_dwords(struct fpga_pci_emu *emu, uint64_t offset,
+	uint32_t *dst, uint64_t dword_len)
+{
+	for (uint64_t i = 0; i < dword_len; i++) {
+		uint64_t value;
+		int ret = fpga_pci_emu_read(emu, offset + i * sizeof(uint32_t),
+			sizeof(uint32_t), &value);
+		if (ret) {
+			return ret;
+		}
+		dst[i] = value;
+	}
+	return 0;
+}
+
+int
+fpga_pci_emu_write_dwords(struct fpga_pci_emu *emu, uint64_t offset,
+	const uint32_t *src, uint32_t value, uint64_t dword_len)
+{
+	for (uint64_t i = 0; i < dword_len; i++) {
+		int ret = fpga_pci_emu_write(emu, offset + i * sizeof(uint32_t),
+			sizeof(uint32_t), (src) ? src[i] : value);
+		if (ret) {
+			return ret;
+		}
+	}
+	return 0;
+}
+
+uint64_t
+fpga_pci_emu_size(struct fpga_pci_emu *emu)
+{
+	return emu->size;
+}
@@ -32,3 +32,38 @@
 #define F1_CHECK_APP_PF_MAX_RETRIES		3
 #define F1_REMOVE_APP_PF_SHORT_DELAY_MSEC	500	
 #define F1_REMOVE_APP_PF_LONG_DELAY_MSEC	3000
+
+/**
+ * Copies to and from a mapped BAR, see fpga_pci_burst.c. len is a multiple of
+ * 4 bytes. burst_capable BARs (attached with BURST_CAPABLE) are accessed with
+ * the widest loads and stores available, others one DWORD at a time.
+ */
+void fpga_pci_burst_write(volatile void *dst, const void *src, size_t len,
+	bool burst_capable);
+void fpga_pci_burst_set(volatile void *dst, uint32_t value, size_t len,
+	bool burst_capable);
+void fpga_pci_burst_read(void *dst, const volatile void *src, size_t len,
+	bool burst_capable);
+
+/**
+ * Register BARs served by a device model, see fpga_pci_emu.c. Accesses are
+ * checked against the size of the BAR. The dword copies write the repeated
+ * value when src is NULL.
+ */
+struct fpga_pci_emu;
+
+int fpga_pci_emu_connect(const char *path, uint64_t size,
+	struct fpga_pci_emu **emu);
+void fpga_pci_emu_close(struct fpga_pci_emu *emu);
+uint64_t fpga_pci_emu_size(struct fpga_pci_emu *emu);
+int fpga_pci_emu_read(struct fpga_pci_emu *emu, uint64_t offset, uint32_t width,
+	uint64_t *value);
+int fpga_pci_emu_write(struct fpga_pci_emu *emu, uint64_t offset, uint32_t width,
+	uint64_t value);
+int fpga_pci_emu_read_dwords(struct fpga_pci_emu *emu, uint64_t offset,
+	uint32_t *dst, uint64_t dword_len);
+int fpga_pci_emu_write_dwords(struct fpga_pci_emu *emu, uint64_t offset,
+	const uint32_t *src, uint32_t value, uint64_t dword_len);
+
+/** The device model serving an attached BAR, NULL for a mapped BAR */
+struct fpga_pci_emu *fpga_pci_bar_get_emu(pci_bar_handle_t handle);
@@ -0,0 +1,218 @@
+/*
+ * Copyright 2015-2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may
+ * not use this file except in compliance with the License. A copy of the
+ * License is located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/** @file
+ * Register programs, see fpga_pci.h.
+ */
+
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fpga_pci_internal.h"
+
+/**
+ * The BAR a program runs on: a view of a mapped BAR, or a BAR served by a
+ * device model, which has no view.
+ */
+struct fpga_pci_program_bar {
+	const fpga_pci_bar_view_t *view;
+	struct fpga_pci_emu *emu;
+	uint64_t size;
+};
+
+static uint64_t
+fpga_pci_program_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int
+fpga_pci_program_peek(const struct fpga_pci_program_bar *bar, uint64_t offset,
+	uint32_t *value)
+{
+	uint64_t tmp;
+	int ret;
+
+	if (bar->view) {
+		*value = fpga_pci_bar_view_peek(bar->view, offset);
+		return 0;
+	}
+	ret = fpga_pci_emu_read(bar->emu, offset, sizeof(uint32_t), &tmp);
+	*value = (uint32_t)tmp;
+	return ret;
+}
+
+static int
+fpga_pci_program_poke(const struct fpga_pci_program_bar *bar, uint64_t offset,
+	uint32_t value)
+{
+	if (bar->view) {
+		fpga_pci_bar_view_poke(bar->view, offset, value);
+		return 0;
+	}
+	return fpga_pci_emu_write(bar->emu, offset, sizeof(uint32_t), value);
+}
+
+/** Check an operation before any of the program runs. */
+static int
+fpga_pci_program_check(const struct fpga_pci_program_bar *bar,
+	const struct fpga_pci_reg_op *op)
+{
+	switch (op->op) {
+	case FPGA_PCI_REG_OP_DELAY:
+		return 0;
+	case FPGA_PCI_REG_OP_PEEK:
+	case FPGA_PCI_REG_OP_POKE_N:
+	case FPGA_PCI_REG_OP_PEEK_N:
+		fail_on(!op->data && (op->op == FPGA_PCI_REG_OP_PEEK ||
+			op->count), err, "data is NULL");
+		/* fall through */
+	case FPGA_PCI_REG_OP_POKE:
+	case FPGA_PCI_REG_OP_POLL:
+		fail_on(op->offset % sizeof(uint32_t) || op->offset > bar->size ||
+			bar->size - op->offset < sizeof(uint32_t),
+			err, "Invalid offset=0x%" PRIx64, op->offset);
+		return 0;
+	default:
+		fail_on(true, err, "Invalid op=%u", op->op);
+	}
+err:
+	return -EINVAL;
+}
+
+static int
+fpga_pci_program_poll(const struct fpga_pci_program_bar *bar,
+	const struct fpga_pci_reg_op *op)
+{
+	uint64_t deadline = fpga_pci_program_now_us() + op->count;
+	uint32_t value;
+	int ret;
+
+	for (;;) {
+		ret = fpga_pci_program_peek(bar, op->offset, &value);
+		if (ret) {
+			return ret;
+		}
+		if ((value & op->mask) == op->value) {
+			break;
+		}
+		if (fpga_pci_program_now_us() >= deadline) {
+			if (op->data) {
+				*op->data = value;
+			}
+			return -ETIMEDOUT;
+		}
+	}
+	if (op->data) {
+		*op->data = value;
+	}
+	return 0;
+}
+
+static int
+fpga_pci_program_run(const struct fpga_pci_program_bar *bar,
+	const struct fpga_pci_reg_op *ops, size_t n_ops, size_t *failed_op)
+{
+	int ret = -EINVAL;
+	size_t i = 0;
+
+	fail_on((!bar->view && !bar->emu) || (!ops && n_ops), out,
+		"Invalid program");
+	for (i = 0; i < n_ops; i++) {
+		ret = fpga_pci_program_check(bar, &ops[i]);
+		fail_on(ret, out, "Invalid operation %zu", i);
+	}
+
+	for (i = 0; i < n_ops; i++) {
+		const struct fpga_pci_reg_op *op = &ops[i];
+
+		switch (op->op) {
+		case FPGA_PCI_REG_OP_POKE:
+			ret = fpga_pci_program_poke(bar, op->offset, op->value);
+			break;
+		case FPGA_PCI_REG_OP_PEEK:
+			ret = fpga_pci_program_peek(bar, op->offset, op->data);
+			break;
+		case FPGA_PCI_REG_OP_POKE_N:
+			for (uint32_t n = 0; n < op->count && !ret; n++) {
+				ret = fpga_pci_program_poke(bar, op->offset, op->data[n]);
+			}
+			break;
+		case FPGA_PCI_REG_OP_PEEK_N:
+			for (uint32_t n = 0; n < op->count && !ret; n++) {
+				ret = fpga_pci_program_peek(bar, op->offset, &op->data[n]);
+			}
+			break;
+		case FPGA_PCI_REG_OP_POLL:
+			ret = fpga_pci_program_poll(bar, op);
+			fail_on(ret == -ETIMEDOUT, out, "Timed out polling offset=0x%"
+				PRIx64 " for 0x%08x under mask 0x%08x", op->offset,
+				op->value, op->mask);
+			break;
+		case FPGA_PCI_REG_OP_DELAY:
+			usleep(op->count);
+			break;
+		}
+		fail_on(ret, out, "Access of offset=0x%" PRIx64 " failed",
+			op->offset);
+	}
+	ret = 0;
+out:
+	if (failed_op) {
+		*failed_op = i;
+	}
+	errno = 0;
+	return ret;
+}
+
+int
+fpga_pci_bar_view_run_program(const fpga_pci_bar_view_t *view,
+	const struct fpga_pci_reg_op *ops, size_t n_ops, size_t *failed_op)
+{
+	struct fpga_pci_program_bar bar = {
+		.view = view,
+		.size = (view) ? view->size : 0,
+	};
+
+	return fpga_pci_program_run(&bar, ops, n_ops, failed_op);
+}
+
+int
+fpga_pci_run_program(pci_bar_handle_t handle,
+	const struct fpga_pci_reg_op *ops, size_t n_ops, size_t *failed_op)
+{
+	fpga_pci_bar_view_t view;
+	struct fpga_pci_program_bar bar = { .view = &view };
+
+	int ret = fpga_pci_get_bar_view(handle, &view);
+	if (ret == -ENOTSUP) {
+		/* served by a device model: every access goes to the model */
+		bar.view = NULL;
+		bar.emu = fpga_pci_bar_get_emu(handle);
+		bar.size = fpga_pci_emu_size(bar.emu);
+	} else if (ret) {
+		if (failed_op) {
+			*failed_op = 0;
+		}
+		return ret;
+	} else {
+		bar.size = view.size;
+	}
+	return fpga_pci_program_run(&bar, ops, n_ops, failed_op);
+}
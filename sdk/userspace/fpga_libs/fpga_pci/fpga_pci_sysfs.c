@@ -136,6 +136,50 @@ err:
 	return ret;
 }
 
+/**
+ * Return the size of a PCI resource from the resource file of the device,
+ * which lists the start, end and flags of each resource on a line.
+ *
+ * @param[in]		dir_name		the PCI device directory name
+ * @param[in]		resource_num	the resource number
+ * @param[in,out]   resource_size	the returned resource size
+ *
+ * @returns
+ *  0	on success
+ * -1	on failure
+ */
+static int
+fpga_pci_get_resource_file_size(char *dir_name, uint8_t resource_num,
+		uint64_t *resource_size)
+{
+	int ret;
+	uint64_t start = 0, end = 0, flags;
+
+	char sysfs_name[NAME_MAX + 1];
+	ret = snprintf(sysfs_name, sizeof(sysfs_name),
+			"%s/sys/bus/pci/devices/%s/resource", fpga_pci_emu_root(),
+			dir_name);
+	fail_on(ret < 0 || (size_t) ret >= sizeof(sysfs_name), err,
+		"Error building the sysfs path for resource");
+
+	FILE *fp = fopen(sysfs_name, "r");
+	fail_on(!fp, err, "Error opening %s", sysfs_name);
+	for (unsigned int i = 0; i <= resource_num; i++) {
+		ret = fscanf(fp, "%" SCNx64 " %" SCNx64 " %" SCNx64, &start, &end,
+			&flags);
+		if (ret != 3) {
+			break;
+		}
+	}
+	fclose(fp);
+	fail_on(ret != 3 || end < start, err, "Error parsing %s", sysfs_name);
+
+	*resource_size = end - start + 1;
+	return 0;
+err:
+	return -1;
+}
+
 /**
  * Return PCI resource info using the PCI directory name and resource
  * number.
@@ -166,8 +210,8 @@ fpga_pci_get_pci_resource_info(char *dir_name,
 
 	char sysfs_name[NAME_MAX + 1];
 	ret = snprintf(sysfs_name, sizeof(sysfs_name),
-			"/sys/bus/pci/devices/%s/resource%u", dir_name,
-			resource_num);
+			"%s/sys/bus/pci/devices/%s/resource%u",
+			fpga_pci_emu_root(), dir_name, resource_num);
 
 	fail_on_with_code(ret < 0, err, err_rc, FPGA_ERR_SOFTWARE_PROBLEM,
 		"Error building the sysfs path for resource%u", resource_num);
@@ -182,10 +226,17 @@ fpga_pci_get_pci_resource_info(char *dir_name,
 		"stat failed, path=%s", sysfs_name);
 
 	*resource_size = file_stat.st_size;
+	if (S_ISSOCK(file_stat.st_mode)) {
+		/** Served by a device model, which has no file size */
+		ret = fpga_pci_get_resource_file_size(dir_name, resource_num,
+			resource_size);
+		fail_on_with_code(ret != 0, err, err_rc, FPGA_ERR_PCI_MISSING,
+			"Unable to read the size of resource%u", resource_num);
+	}
 
 	ret = snprintf(sysfs_name, sizeof(sysfs_name),
-			"/sys/bus/pci/devices/%s/resource%u_wc", dir_name,
-			resource_num);
+			"%s/sys/bus/pci/devices/%s/resource%u_wc",
+			fpga_pci_emu_root(), dir_name, resource_num);
 
 	fail_on_with_code(ret < 0, err, err_rc, FPGA_ERR_SOFTWARE_PROBLEM,
 		"Error building the sysfs path for resource%u", resource_num);
@@ -243,6 +294,36 @@ fpga_pci_get_resources(char *dir_name, struct fpga_pci_resource_map *map)
 }
 
 
+/**
+ * Return the PCI Vendor ID for the given sysfs directory name.
+ *
+ * @param[in]		dir_name	the PCI device directory name
+ * @param[in,out]	vendor_id	the returned vendor id
+ *
+ * @returns
+ *  0	on success
+ * -1	on failure
+ */
+static int
+fpga_pci_get_vendor_id(char *dir_name, uint16_t *vendor_id)
+{
+	int ret;
+
+	char sysfs_name[NAME_MAX + 1];
+	ret = snprintf(sysfs_name, sizeof(sysfs_name),
+			"%s/sys/bus/pci/devices/%s/vendor",
+			fpga_pci_emu_root(), dir_name);
+
+	fail_on_with_code(ret < 0, err, ret, FPGA_ERR_SOFTWARE_PROBLEM,
+		"Error building the sysfs path for vendor");
+	fail_on_with_code((size_t) ret >= sizeof(sysfs_name), err, ret,
+		FPGA_ERR_SOFTWARE_PROBLEM, "sysfs path too long for vendor");
+
+	ret = fpga_pci_get_id(sysfs_name, vendor_id);
+err:
+	return ret;
+}
+
 /**
  * Return the PCI resource map identifiers for the given sysfs directory name.
  *
@@ -268,7 +349,8 @@ fpga_pci_get_resource_map_ids(char *dir_name, struct fpga_pci_resource_map *map)
 	/** Setup and read the PCI Vendor ID */
 	char sysfs_name[NAME_MAX + 1];
 	ret = snprintf(sysfs_name, sizeof(sysfs_name),
-			"/sys/bus/pci/devices/%s/vendor", dir_name);
+			"%s/sys/bus/pci/devices/%s/vendor",
+			fpga_pci_emu_root(), dir_name);
 
 	fail_on_with_code(ret < 0, err, ret, FPGA_ERR_SOFTWARE_PROBLEM,
 		"Error building the sysfs path for vendor");
@@ -280,7 +362,8 @@ fpga_pci_get_resource_map_ids(char *dir_name, struct fpga_pci_resource_map *map)
 
 	/** Setup and read the PCI Device ID */
 	ret = snprintf(sysfs_name, sizeof(sysfs_name),
-			"/sys/bus/pci/devices/%s/device", dir_name);
+			"%s/sys/bus/pci/devices/%s/device",
+			fpga_pci_emu_root(), dir_name);
 
 	fail_on_with_code(ret < 0, err, ret, FPGA_ERR_SOFTWARE_PROBLEM,
 		"Error building the sysfs path for device");
@@ -292,7 +375,8 @@ fpga_pci_get_resource_map_ids(char *dir_name, struct fpga_pci_resource_map *map)
 
 	/** Setup and read the PCI Subsystem Vendor ID */
 	ret = snprintf(sysfs_name, sizeof(sysfs_name),
-			"/sys/bus/pci/devices/%s/subsystem_vendor", dir_name);
+			"%s/sys/bus/pci/devices/%s/subsystem_vendor",
+			fpga_pci_emu_root(), dir_name);
 
 	fail_on_with_code(ret < 0, err, ret, FPGA_ERR_SOFTWARE_PROBLEM,
 		"Error building the sysfs path for subsystem_vendor");
@@ -304,7 +388,8 @@ fpga_pci_get_resource_map_ids(char *dir_name, struct fpga_pci_resource_map *map)
 
 	/** Setup and read the PCI Subsystem Device ID */
 	ret = snprintf(sysfs_name, sizeof(sysfs_name),
-			"/sys/bus/pci/devices/%s/subsystem_device", dir_name);
+			"%s/sys/bus/pci/devices/%s/subsystem_device",
+			fpga_pci_emu_root(), dir_name);
 
 	fail_on_with_code(ret < 0, err, ret, FPGA_ERR_SOFTWARE_PROBLEM,
 		"Error building the sysfs path for subsystem_device");
@@ -401,14 +486,74 @@ err:
 pthread_mutex_t fpga_pci_readdir_mutex = PTHREAD_MUTEX_INITIALIZER;
 #endif
 
-int
-fpga_pci_get_all_slot_specs(struct fpga_slot_spec spec_array[], int size)
+/** Bumped by fpga_pci_rescan_slot_app_pfs, see fpga_pci_slot_generation */
+static uint32_t fpga_pci_slot_generations[FPGA_SLOT_MAX];
+
+/** Bumped along with any slot generation */
+static uint32_t fpga_pci_specs_generation;
+
+/**
+ * Slot specs found by the last complete scan of the PCI devices, valid while
+ * its generation matches fpga_pci_specs_generation.
+ */
+static struct {
+	pthread_mutex_t lock;
+	bool valid;
+	uint32_t generation;
+	int n_slots;
+	struct fpga_slot_spec specs[FPGA_SLOT_MAX];
+} fpga_pci_spec_cache = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+uint32_t
+fpga_pci_slot_generation(int slot_id)
+{
+	if (slot_id < 0 || slot_id >= FPGA_SLOT_MAX) {
+		return 0;
+	}
+	return __atomic_load_n(&fpga_pci_slot_generations[slot_id],
+		__ATOMIC_ACQUIRE);
+}
+
+void
+fpga_pci_invalidate_slot_specs(void)
+{
+	for (int i = 0; i < FPGA_SLOT_MAX; i++) {
+		__atomic_add_fetch(&fpga_pci_slot_generations[i], 1, __ATOMIC_RELEASE);
+	}
+	__atomic_add_fetch(&fpga_pci_specs_generation, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Scan the sysfs PCI devices for the FPGA slots, in a single pass over the
+ * directory.
+ *
+ * @param[out]		spec_array	the slot specs found
+ * @param[in]		size		size of spec_array
+ * @param[out]		n_slots		number of slot specs found
+ *
+ * @returns
+ *  0	on success
+ * -1	on failure
+ */
+static int
+fpga_pci_scan_slot_specs(struct fpga_slot_spec spec_array[], int size,
+	int *n_slots)
 {
 	int ret;
 	bool found_afi_slot = false;
-	char *path = "/sys/bus/pci/devices";
-	DIR *dirp = opendir(path);
-	fail_on(!dirp, err, "opendir failed for path=%s", path);
+	char path[NAME_MAX + 1];
+	DIR *dirp = NULL;
+
+	ret = snprintf(path, sizeof(path), "%s/sys/bus/pci/devices",
+		fpga_pci_emu_root());
+	fail_on_with_code((size_t) ret >= sizeof(path), err, ret,
+		FPGA_ERR_SOFTWARE_PROBLEM, "sysfs path too long");
+
+	dirp = opendir(path);
+	fail_on_with_code(!dirp, err, ret, FPGA_ERR_PCI_MISSING,
+		"opendir failed for path=%s", path);
 
 	struct dirent *entry;
 #if defined(FPGA_PCI_USE_READDIR_R)
@@ -457,7 +602,16 @@ fpga_pci_get_all_slot_specs(struct fpga_slot_spec spec_array[], int size)
 		}
 #endif
 
-		/** Handle the current directory entry */
+		/**
+		 * Handle the current directory entry
+		 * -the devices of other vendors are skipped after reading one file.
+		 */
+		uint16_t vendor_id = 0;
+		ret = fpga_pci_get_vendor_id(entry->d_name, &vendor_id);
+		if (ret != 0 || vendor_id != F1_MBOX_VENDOR_ID) {
+			continue;
+		}
+
 		memset(&search_map, 0, sizeof(struct fpga_pci_resource_map));
 		ret = fpga_pci_get_resource_map_ids(entry->d_name, &search_map);
 		if (ret != 0) {
@@ -499,6 +653,7 @@ fpga_pci_get_all_slot_specs(struct fpga_slot_spec spec_array[], int size)
 
 	closedir(dirp);
 
+	*n_slots = slot_dev_index;
 	errno = 0;
 	return 0;
 
@@ -515,25 +670,84 @@ err:
 	return ret;
 }
 
+/**
+ * Return the slot specs from the cache, scanning the PCI devices when it is
+ * stale.
+ *
+ * @param[out]		spec_array	the slot specs
+ * @param[out]		n_slots		number of slot specs
+ *
+ * @returns
+ *  0	on success
+ * -1	on failure
+ */
+static int
+fpga_pci_get_cached_slot_specs(struct fpga_slot_spec spec_array[FPGA_SLOT_MAX],
+	int *n_slots)
+{
+	/** Read before the scan, so an invalidation during the scan wins */
+	uint32_t generation = __atomic_load_n(&fpga_pci_specs_generation,
+		__ATOMIC_ACQUIRE);
+
+	pthread_mutex_lock(&fpga_pci_spec_cache.lock);
+	if (fpga_pci_spec_cache.valid &&
+		fpga_pci_spec_cache.generation == generation) {
+		*n_slots = fpga_pci_spec_cache.n_slots;
+		memcpy(spec_array, fpga_pci_spec_cache.specs,
+			sizeof(fpga_pci_spec_cache.specs));
+		pthread_mutex_unlock(&fpga_pci_spec_cache.lock);
+		return 0;
+	}
+	pthread_mutex_unlock(&fpga_pci_spec_cache.lock);
+
+	memset(spec_array, 0, sizeof(fpga_pci_spec_cache.specs));
+	int ret = fpga_pci_scan_slot_specs(spec_array, FPGA_SLOT_MAX, n_slots);
+	if (ret != 0) {
+		return ret;
+	}
+
+	pthread_mutex_lock(&fpga_pci_spec_cache.lock);
+	fpga_pci_spec_cache.valid = true;
+	fpga_pci_spec_cache.generation = generation;
+	fpga_pci_spec_cache.n_slots = *n_slots;
+	memcpy(fpga_pci_spec_cache.specs, spec_array,
+		sizeof(fpga_pci_spec_cache.specs));
+	pthread_mutex_unlock(&fpga_pci_spec_cache.lock);
+	return 0;
+}
+
+int
+fpga_pci_get_all_slot_specs(struct fpga_slot_spec spec_array[], int size)
+{
+	struct fpga_slot_spec specs[FPGA_SLOT_MAX];
+	int n_slots = 0;
+
+	int ret = fpga_pci_get_cached_slot_specs(specs, &n_slots);
+	if (ret != 0) {
+		return ret;
+	}
+
+	for (int i = 0; i < n_slots && i < size; i++) {
+		spec_array[i] = specs[i];
+	}
+	return 0;
+}
+
 int
 fpga_pci_get_slot_spec(int slot_id, struct fpga_slot_spec *spec)
 {
-	unsigned int size;
 	struct fpga_slot_spec spec_array[FPGA_SLOT_MAX];
+	int n_slots = 0;
 
 	int ret = -EINVAL;
 	fail_on(slot_id < 0 || slot_id >= FPGA_SLOT_MAX, err,
 			"Invalid slot_id=%d", slot_id);
 	fail_on(!spec, err, "spec is NULL");
 
-	memset(spec_array, 0, sizeof(spec_array));
-
-	/* tell fpga_pci_get_all_slot_specs not to search past the slot number */
-	size = min(sizeof_array(spec_array), (unsigned) slot_id + 1);
-	ret = fpga_pci_get_all_slot_specs(spec_array, size);
+	ret = fpga_pci_get_cached_slot_specs(spec_array, &n_slots);
 	fail_on(ret, err, "Unable to read PCI device information.");
 
-	if (spec_array[slot_id].map[FPGA_APP_PF].vendor_id == 0) {
+	if (slot_id >= n_slots) {
 		log_error("No device matching specified id: %d", slot_id);
 		return -ENOENT;
 	}
@@ -567,6 +781,41 @@ out:
 	return ret;
 }
 
+int
+fpga_pci_get_numa_node(int slot_id, int *numa_node)
+{
+	int ret;
+	struct fpga_pci_resource_map app_map;
+
+	fail_on_with_code(!numa_node, err, ret, -EINVAL, "numa_node is NULL");
+
+	ret = fpga_pci_get_resource_map(slot_id, FPGA_APP_PF, &app_map);
+	fail_on(ret, err, "fpga_pci_get_resource_map failed");
+
+	/** Setup and read the NUMA node of the app PF */
+	char sysfs_name[NAME_MAX + 1];
+	ret = snprintf(sysfs_name, sizeof(sysfs_name),
+		"%s/sys/bus/pci/devices/" PCI_DEV_FMT "/numa_node",
+		fpga_pci_emu_root(), app_map.domain, app_map.bus, app_map.dev, app_map.func);
+
+	fail_on_with_code(ret < 0, err, ret, FPGA_ERR_SOFTWARE_PROBLEM,
+		"Error building the sysfs path for numa_node");
+	fail_on_with_code((size_t) ret >= sizeof(sysfs_name), err, ret,
+		FPGA_ERR_SOFTWARE_PROBLEM, "sysfs path too long for numa_node");
+
+	FILE *fp = fopen(sysfs_name, "r");
+	fail_on_with_code(!fp, err, ret, -errno, "Error opening %s", sysfs_name);
+	ret = fscanf(fp, "%d", numa_node);
+	fclose(fp);
+	fail_on_with_code(ret != 1, err, ret, FPGA_ERR_UNRESPONSIVE,
+		"Error parsing %s", sysfs_name);
+
+	ret = 0;
+err:
+	errno = 0;
+	return ret;
+}
+
 /**
  * Check if there is a driver attached for the given app_map.
  *
@@ -600,7 +849,8 @@ fpga_pci_check_app_pf_driver(struct fpga_pci_resource_map *app_map,
 	/** Setup the path to the app_pf */
 	char sysfs_name[NAME_MAX + 1];
 	ret = snprintf(sysfs_name, sizeof(sysfs_name),
-		"/sys/bus/pci/devices/%s/driver", dir_name);
+		"%s/sys/bus/pci/devices/%s/driver",
+		fpga_pci_emu_root(), dir_name);
 
 	fail_on_with_code(ret < 0, err, ret, FPGA_ERR_SOFTWARE_PROBLEM,
 		"Error building the sysfs path for app_pf");
@@ -643,7 +893,8 @@ fpga_pci_check_app_pf_sysfs(char *dir_name, bool exists)
 	/** Setup the path to the app_pf */
 	char sysfs_name[NAME_MAX + 1];
 	ret = snprintf(sysfs_name, sizeof(sysfs_name),
-		"/sys/bus/pci/devices/%s", dir_name);
+		"%s/sys/bus/pci/devices/%s",
+		fpga_pci_emu_root(), dir_name);
 
 	fail_on_with_code(ret < 0, err, ret, FPGA_ERR_SOFTWARE_PROBLEM,
 		"Error building the sysfs path for app_pf");
@@ -740,7 +991,8 @@ fpga_pci_remove_app_pf(struct fpga_pci_resource_map *app_map)
 	/** Setup the path to the device's remove file */
 	char sysfs_name[NAME_MAX + 1];
 	ret = snprintf(sysfs_name, sizeof(sysfs_name),
-		"/sys/bus/pci/devices/%s/remove", dir_name);
+		"%s/sys/bus/pci/devices/%s/remove",
+		fpga_pci_emu_root(), dir_name);
 
 	fail_on_with_code(ret < 0, err, ret, FPGA_ERR_SOFTWARE_PROBLEM,
 		"Error building the sysfs path for remove file");
@@ -781,7 +1033,8 @@ fpga_pci_rescan(void)
 {
 	/** Setup and write '1' to the PCI rescan file */
 	char sysfs_name[NAME_MAX + 1];
-	int ret = snprintf(sysfs_name, sizeof(sysfs_name), "/sys/bus/pci/rescan");
+	int ret = snprintf(sysfs_name, sizeof(sysfs_name), "%s/sys/bus/pci/rescan",
+		fpga_pci_emu_root());
 
 	fail_on_with_code(ret < 0, err, ret, FPGA_ERR_SOFTWARE_PROBLEM,
 		"Error building the sysfs path for PCI rescan file");
@@ -842,5 +1095,14 @@ fpga_pci_rescan_slot_app_pfs(int slot_id)
 
 	ret = 0;
 err:
+	/**
+	 * Whatever was cached about the slot may be stale now, even if the
+	 * rescan failed half way.
+	 */
+	if (slot_id >= 0 && slot_id < FPGA_SLOT_MAX) {
+		__atomic_add_fetch(&fpga_pci_slot_generations[slot_id], 1,
+			__ATOMIC_RELEASE);
+		__atomic_add_fetch(&fpga_pci_specs_generation, 1, __ATOMIC_RELEASE);
+	}
 	return ret;
 }
@@ -33,6 +33,7 @@
 #include <sys/time.h>
 
 #include <fpga_pci.h>
+#include <utils/macros.h>
 
 #include <sys/ioctl.h>
 #include <errno.h>
@@ -63,49 +64,36 @@ void set_tck( unsigned long nsperiod, unsigned long *result) {
     *result = nsperiod;
 }
 
-static int xvc_shift_bits(pci_bar_handle_t jtag_pci_bar, uint32_t tms_bits, uint32_t tdi_bits, uint32_t *tdo_bits) {
-	int status;
-	uint32_t control_reg_data;
-	int count = 100;
+// Upper bound of one shift operation
+#define XVC_SHIFT_TIMEOUT_US	1000
 
-	// Set tms bits
-	status = fpga_pci_poke(jtag_pci_bar, TMS_REG_OFFSET, tms_bits);
-	if (status != 0) {
-		return status;
+// Registers go through the view of the BAR, or its handle when it has no view
+static int xvc_set_length(pci_bar_handle_t jtag_pci_bar, const fpga_pci_bar_view_t *jtag_bar, uint32_t bits) {
+	if (!jtag_bar) {
+		return fpga_pci_poke(jtag_pci_bar, LENGTH_REG_OFFSET, bits);
 	}
+	fpga_pci_bar_view_poke(jtag_bar, LENGTH_REG_OFFSET, bits);
+	return 0;
+}
 
-	// Set tdi bits and shift data out
-	status = fpga_pci_poke(jtag_pci_bar, TDI_REG_OFFSET, tdi_bits);
-	if (status != 0) {
-		return status;
-	}
-	// Enable shift operation
-	status = fpga_pci_poke(jtag_pci_bar, CONTROL_REG_OFFSET, 0x01);
-	if (status != 0) {
-		return status;
+static int xvc_shift_bits(pci_bar_handle_t jtag_pci_bar, const fpga_pci_bar_view_t *jtag_bar, uint32_t tms_bits, uint32_t tdi_bits, uint32_t *tdo_bits) {
+	const struct fpga_pci_reg_op shift_ops[] = {
+		// Set tms bits
+		FPGA_PCI_REG_POKE(TMS_REG_OFFSET, tms_bits),
+		// Set tdi bits and shift data out
+		FPGA_PCI_REG_POKE(TDI_REG_OFFSET, tdi_bits),
+		// Enable shift operation
+		FPGA_PCI_REG_POKE(CONTROL_REG_OFFSET, 0x01),
+		// Wait for the shift operation to complete
+		FPGA_PCI_REG_POLL(CONTROL_REG_OFFSET, 0x01, 0x00, XVC_SHIFT_TIMEOUT_US, NULL),
+		// Read tdo bits back out
+		FPGA_PCI_REG_PEEK(TDO_REG_OFFSET, tdo_bits),
+	};
+
+	if (!jtag_bar) {
+		return fpga_pci_run_program(jtag_pci_bar, shift_ops, sizeof_array(shift_ops), NULL);
 	}
-	while (count) {
-	// Read control reg to check shift operation completion
-		status = fpga_pci_peek(jtag_pci_bar, CONTROL_REG_OFFSET, &control_reg_data);
-		if (status != 0) {
-			return status;
-		}
-	
-		if ((control_reg_data & 0x01) == 0)	{
-			break;
-		}
-		count--;
-
-		if (count == 0)	{
-			//printk(KERN_ERR LOG_PREFIX "XVC bar transaction timed out (%0X)\n", control_reg_data);
-			return -ETIMEDOUT;
-		}
-	}
-  
-  // Read tdo bits back out
-	// note that tdo_bits already defined as pointer to an integer and not an integer
-  status = fpga_pci_peek(jtag_pci_bar, TDO_REG_OFFSET, tdo_bits);
-	return status;
+	return fpga_pci_bar_view_run_program(jtag_bar, shift_ops, sizeof_array(shift_ops), NULL);
 }
 
 
@@ -123,6 +111,8 @@ void shift_tms_tdi(
 	unsigned char* tms_buf_tmp;
 	unsigned char* tdi_buf_tmp;
 	unsigned char* tdo_buf_tmp;
+	fpga_pci_bar_view_t jtag_view;
+	const fpga_pci_bar_view_t *jtag_bar = NULL;
 
 	int status = 0;
 
@@ -130,9 +120,22 @@ void shift_tms_tdi(
     	
 	gettimeofday(&start, NULL);
 
+	// Registers are accessed through a view, checked once per call. An
+	// emulated BAR has no view, its handle checks each access instead.
+	status = fpga_pci_get_bar_view(jtag_pci_bar, &jtag_view);
+	if (!status) {
+		if (!fpga_pci_bar_view_fits(&jtag_view, 0,
+				CONTROL_REG_OFFSET + sizeof(uint32_t))) {
+			goto cleanup;
+		}
+		jtag_bar = &jtag_view;
+	} else if (status != -ENOTSUP) {
+		goto cleanup;
+	}
+
 	// Set length register to 32 initially if more than one word-transaction is to be done
 	if (num_bits >= 32) {
-		status = fpga_pci_poke(jtag_pci_bar, LENGTH_REG_OFFSET, 0x20);
+		status = xvc_set_length(jtag_pci_bar, jtag_bar, 0x20);
 		if (status) {
 			goto cleanup;
 		}
@@ -145,8 +148,8 @@ void shift_tms_tdi(
 			shift_num_bits = num_bits - current_bit;
 			// do LENGTH_REG_OFFSET here
 			// Set number of bits to shift out
-			status = fpga_pci_poke(jtag_pci_bar, LENGTH_REG_OFFSET, shift_num_bits);
-			if (status != 0) {
+			status = xvc_set_length(jtag_pci_bar, jtag_bar, shift_num_bits);
+			if (status) {
 				goto cleanup;
 			}
 		}
@@ -160,7 +163,7 @@ void shift_tms_tdi(
 		memcpy(&tdi_store, tdi_buf_tmp, shift_num_bytes);
 
 		// Shift data out and copy to output buffer
-		status = xvc_shift_bits(jtag_pci_bar, tms_store, tdi_store, &tdo_store);
+		status = xvc_shift_bits(jtag_pci_bar, jtag_bar, tms_store, tdi_store, &tdo_store);
 		if (status) {
 			goto cleanup;
 		}
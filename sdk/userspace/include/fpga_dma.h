@@ -24,6 +24,9 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <sys/uio.h>
+
+#include "hal/fpga_common.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -53,6 +56,36 @@ enum fpga_dma_driver {
 int fpga_dma_open_queue(enum fpga_dma_driver which_driver, int slot_id,
     int channel, bool is_read);
 
+/* DMA channels per slot */
+#define FPGA_DMA_CHANNELS_MAX (4)
+
+struct fpga_dma_queues {
+    /* channels of the driver */
+    int n_channels;
+    /* queue of each channel, -1 if not open */
+    int read_fds[FPGA_DMA_CHANNELS_MAX];
+    int write_fds[FPGA_DMA_CHANNELS_MAX];
+};
+
+/**
+ * Open the read and the write queue of every DMA channel of a slot. The
+ * device number of the slot is looked up once for all of them.
+ *
+ * @param which_driver - specifies which DMA driver to use
+ * @param slot_id      - which FPGA slot to use
+ * @param[out] queues  - the open queues
+ *
+ * @returns 0 on success or an error code less than 0 on failure, in which
+ * case no queue is left open.
+ */
+int fpga_dma_open_all_queues(enum fpga_dma_driver which_driver, int slot_id,
+    struct fpga_dma_queues *queues);
+
+/**
+ * Close the queues opened by fpga_dma_open_all_queues.
+ */
+void fpga_dma_close_all_queues(struct fpga_dma_queues *queues);
+
 /**
  * This returns the path to DMA device file corresponding to the driver, slot,
  * and DMA channel you requested. The function fpga_dma_open_queue uses this
@@ -85,6 +118,11 @@ int fpga_dma_device_id(enum fpga_dma_driver which_driver, int slot_id,
  *                  ensure the buffer is large enough
  * @param address - address of memory in the FPGA
  *
+ * Interrupted calls are restarted. A call which fails with a transient
+ * error (EIO, a driver timeout) or moves nothing is retried up to
+ * FPGA_DMA_RETRIES_DEFAULT times; see fpga_dma_burst_read_ctl for deadlines
+ * and cancellation.
+ *
  * @returns 0 on success, non-zero on failure
  */
 int fpga_dma_burst_read(int fd, uint8_t *buffer, size_t xfer_sz,
@@ -106,10 +144,104 @@ int fpga_dma_burst_read(int fd, uint8_t *buffer, size_t xfer_sz,
 int fpga_dma_burst_write(int fd, uint8_t *buffer, size_t xfer_sz,
     size_t address);
 
+/* retries of a failed DMA call before a burst transfer gives up */
+#define FPGA_DMA_RETRIES_DEFAULT  (3)
+/* smallest piece a failing chunk is split into */
+#define FPGA_DMA_MIN_CHUNK        (4096)
+
+/**
+ * Limits of a burst transfer. The transfer is moved in chunks; between
+ * chunks it stops once the deadline passes or fpga_dma_cancel was called, so
+ * both take effect at most one chunk late (each chunk is bounded by the
+ * driver's own timeout). A chunk which fails with a transient error is
+ * halved, down to min_chunk, and retried.
+ */
+struct fpga_dma_xfer_ctl {
+    /* give up after this long, 0 for no deadline */
+    uint32_t timeout_ms;
+    /* consecutive failed calls retried before giving up */
+    unsigned max_retries;
+    /* largest chunk per call, 0 for the whole remainder */
+    size_t chunk_size;
+    /* smallest chunk a failing chunk is split into */
+    size_t min_chunk;
+    /* set by fpga_dma_cancel */
+    int cancelled;
+    /* out: bytes moved from the start of the buffer, also on failure */
+    size_t done;
+};
+
+/**
+ * Set the limits to the defaults of fpga_dma_burst_read/write: no deadline,
+ * FPGA_DMA_RETRIES_DEFAULT retries, whole transfers per call.
+ */
+void fpga_dma_xfer_ctl_init(struct fpga_dma_xfer_ctl *ctl);
+
+/**
+ * Ask a transfer running with ctl to stop. Does not block and is safe to
+ * call from another thread or a signal handler.
+ */
+void fpga_dma_cancel(struct fpga_dma_xfer_ctl *ctl);
+
+/**
+ * fpga_dma_burst_read/write within the limits of ctl, NULL for the defaults.
+ *
+ * @returns 0 on success, -ETIMEDOUT once the deadline passes, -ECANCELED
+ * after fpga_dma_cancel, or another error code less than 0 on failure
+ */
+int fpga_dma_burst_read_ctl(int fd, uint8_t *buffer, size_t xfer_sz,
+    size_t address, struct fpga_dma_xfer_ctl *ctl);
+int fpga_dma_burst_write_ctl(int fd, uint8_t *buffer, size_t xfer_sz,
+    size_t address, struct fpga_dma_xfer_ctl *ctl);
+
+/**
+ * Copy a range of a file to the FPGA without staging it in a user buffer.
+ * The file pages go from the page cache to the DMA engine through sendfile;
+ * with a driver that does not take spliced pages, the range is mapped and
+ * written from the mapping.
+ *
+ * @param fd          - the file descriptor for the DMA queue to use
+ *                      (obtained with fpga_dma_open_queue). Its file position
+ *                      is changed.
+ * @param file_fd     - the file to read
+ * @param file_offset - offset of the range in the file
+ * @param xfer_sz     - DMA transfer size, the file must hold the whole range
+ * @param address     - address of memory in the FPGA
+ *
+ * @returns 0 on success, non-zero on failure
+ */
+int fpga_dma_burst_write_file(int fd, int file_fd, size_t file_offset,
+    size_t xfer_sz, size_t address);
+
+/**
+ * Gather a list of host buffers into one contiguous range of FPGA memory:
+ * iov[0] goes to address, iov[1] right after it, and so on. The XDMA driver
+ * moves each preadv/pwritev call as a single descriptor chain.
+ *
+ * @param fd      - the file descriptor for the DMA queue to use (obtained with
+ *                  fpga_dma_open_queue)
+ * @param iov     - the host buffers, in FPGA address order
+ * @param iovcnt  - number of buffers
+ * @param address - FPGA address of the first buffer
+ *
+ * @returns 0 on success, non-zero on failure
+ */
+int fpga_dma_burst_writev(int fd, const struct iovec *iov, int iovcnt,
+    size_t address);
+
+/**
+ * Scatter one contiguous range of FPGA memory into a list of host buffers.
+ * It behaves similarly to fpga_dma_burst_writev.
+ */
+int fpga_dma_burst_readv(int fd, const struct iovec *iov, int iovcnt,
+    size_t address);
+
 /**
  * The EDMA and XDMA drivers use a device number which does not map directly
  * onto the slot number. Use this function to map a slot number onto this device
  * number. The device number is the number used in the files found in /dev.
+ * The result is cached per slot until fpga_pci_rescan_slot_app_pfs runs on
+ * the slot or fpga_pci_invalidate_slot_specs runs.
  *
  * @param which_driver     - specifies which DMA driver to use. See
  * @param slot_id          - fpga_dma_driver_e which FPGA slot to use; this uses
@@ -122,6 +254,234 @@ int fpga_dma_burst_write(int fd, uint8_t *buffer, size_t xfer_sz,
 int fpga_pci_get_dma_device_num(enum fpga_dma_driver which_driver,
     int slot_id, int *device_num);
 
+/**
+ * DMA buffers. The XDMA driver pins and maps the pages of every read and
+ * write; a buffer registered on a DMA queue is pinned and mapped once, and
+ * transfers on that queue which fall inside it skip that work. Buffers from
+ * fpga_dma_buffer_alloc are backed by huge pages where possible, so they map
+ * to few DMA descriptors, and live on the NUMA node of the slot.
+ */
+struct fpga_dma_buffer {
+    uint8_t *data;
+    /* requested size */
+    size_t size;
+    /* size of the mapping, rounded up to the page size */
+    size_t map_size;
+    /* 1 GiB, 2 MiB or the base page size */
+    size_t page_size;
+    /* NUMA node of the pages, -1 if any */
+    int numa_node;
+};
+
+/**
+ * Allocate a zeroed, page aligned DMA buffer (see hugepage_alloc).
+ *
+ * @param slot_id  - the slot whose NUMA node the buffer is placed on, -1 for
+ *                   any node
+ * @param size     - size of the buffer in bytes
+ * @param[out] buf - the buffer
+ *
+ * @returns 0 on success, an error code less than 0 on failure
+ */
+int fpga_dma_buffer_alloc(int slot_id, size_t size, struct fpga_dma_buffer *buf);
+
+/**
+ * Free a buffer from fpga_dma_buffer_alloc. Registrations of the buffer must
+ * be removed first.
+ */
+void fpga_dma_buffer_free(struct fpga_dma_buffer *buf);
+
+/**
+ * Pin and map a buffer for the transfers of one DMA queue. The registration
+ * ends with fpga_dma_buffer_unregister or when the queue is closed. The buffer
+ * must stay mapped while it is registered. Its pages count against the
+ * RLIMIT_MEMLOCK of the process until then.
+ *
+ * @param fd          - the DMA queue (obtained with fpga_dma_open_queue)
+ * @param buffer      - start of the buffer
+ * @param size        - size of the buffer in bytes
+ * @param[out] handle - the registration, for fpga_dma_buffer_unregister
+ *
+ * @returns 0 on success, an error code less than 0 on failure; -EINVAL or
+ * -ENOTTY if the driver does not support registration, transfers then work
+ * as usual; -ENOMEM if the buffer would exceed RLIMIT_MEMLOCK
+ */
+int fpga_dma_buffer_register(int fd, const void *buffer, size_t size,
+    uint32_t *handle);
+
+/**
+ * Unpin and unmap a buffer registered with fpga_dma_buffer_register. Fails
+ * with -EBUSY while a transfer uses the buffer.
+ *
+ * @returns 0 on success, an error code less than 0 on failure
+ */
+int fpga_dma_buffer_unregister(int fd, uint32_t handle);
+
+/**
+ * Striped transfers split a buffer into stripes which are moved concurrently
+ * on several DMA channels of a slot, one thread per channel, so a single call
+ * can use the bandwidth of all the DMA engines. The threads and the DMA
+ * queues are kept after the first call; fpga_dma_striped_close closes the
+ * queues of a slot, e.g. before it is rescanned.
+ */
+#define FPGA_DMA_STRIPED_CHANNELS_MAX FPGA_DMA_CHANNELS_MAX
+#define FPGA_DMA_STRIPE_SIZE_DEFAULT  (2 << 20)
+
+struct fpga_dma_striped_opts {
+    /* channels to use, 0 for FPGA_DMA_STRIPED_CHANNELS_MAX */
+    int n_channels;
+    /* bytes per stripe, 0 for FPGA_DMA_STRIPE_SIZE_DEFAULT */
+    size_t stripe_size;
+};
+
+/**
+ * Copy a buffer from the FPGA into host memory over several DMA channels.
+ *
+ * @param slot_id - which FPGA slot to use
+ * @param buffer  - a pointer in host memory to place the DMA'd data into
+ * @param xfer_sz - DMA transfer size
+ * @param address - address of memory in the FPGA
+ * @param opts    - channel count and stripe size, NULL for the defaults
+ *
+ * @returns 0 on success, non-zero on failure
+ */
+int fpga_dma_striped_read(int slot_id, uint8_t *buffer, size_t xfer_sz,
+    size_t address, const struct fpga_dma_striped_opts *opts);
+
+/**
+ * Copy a buffer from host memory to the FPGA over several DMA channels. It
+ * behaves similarly to fpga_dma_striped_read.
+ */
+int fpga_dma_striped_write(int slot_id, uint8_t *buffer, size_t xfer_sz,
+    size_t address, const struct fpga_dma_striped_opts *opts);
+
+/**
+ * Close the DMA queues the striped transfers keep open for a slot.
+ */
+void fpga_dma_striped_close(int slot_id);
+
+/**
+ * Asynchronous DMA. A context holds a submission and a completion queue of
+ * up to depth transfers; a single thread can keep transfers on any number of
+ * DMA queues in flight and reap them as they complete. It is backed by
+ * io_uring; where that is not available, transfers complete synchronously
+ * in fpga_dma_submit and are still reported through fpga_dma_poll.
+ *
+ * A context is not thread safe.
+ */
+struct fpga_dma_async;
+
+struct fpga_dma_event {
+    /* tag passed to fpga_dma_submit */
+    uint64_t tag;
+    /* index of the transfer in the iov of that call */
+    int index;
+    /* 0 on success, a negative errno on failure */
+    int rc;
+};
+
+/**
+ * @param depth   - maximum number of transfers in flight, at most 4096
+ * @param[out] ctx - the new context
+ *
+ * @returns 0 on success, non-zero on failure
+ */
+int fpga_dma_async_init(unsigned depth, struct fpga_dma_async **ctx);
+
+/**
+ * Waits for the transfers in flight and frees the context.
+ */
+void fpga_dma_async_free(struct fpga_dma_async *ctx);
+
+/**
+ * Queue count transfers on one DMA queue: iov[i] from or to address[i] of
+ * the FPGA memory. The buffers must stay valid until the transfer completes.
+ *
+ * @param ctx     - context from fpga_dma_async_init
+ * @param fd      - the DMA queue (obtained with fpga_dma_open_queue)
+ * @param is_read - true for FPGA to host, must match the queue
+ * @param iov     - host buffers
+ * @param address - FPGA address of each buffer
+ * @param count   - number of transfers
+ * @param tag     - reported back with the completion of each transfer
+ *
+ * @returns the number of transfers queued, which is less than count when
+ * the context is full, or an error code less than 0 on failure.
+ */
+int fpga_dma_submit(struct fpga_dma_async *ctx, int fd, bool is_read,
+    const struct iovec iov[], const size_t address[], int count, uint64_t tag);
+
+/**
+ * Reap completed transfers, waiting until at least min_events have
+ * completed or nothing is left in flight.
+ *
+ * @returns the number of events written, or an error code less than 0 on
+ * failure.
+ */
+int fpga_dma_poll(struct fpga_dma_async *ctx, struct fpga_dma_event *events,
+    int max_events, int min_events);
+
+/**
+ * @returns the number of transfers submitted and not reaped yet
+ */
+int fpga_dma_async_pending(struct fpga_dma_async *ctx);
+
+/**
+ * Transfer statistics. Once enabled, with fpga_dma_stats_enable or by setting
+ * the FPGA_DMA_STATS environment variable to anything but 0, every
+ * fpga_dma_burst_* call and asynchronous transfer of the process is counted
+ * per DMA queue in a shared memory file, FPGA_DMA_STATS_DIR/
+ * FPGA_DMA_STATS_PREFIX<pid>, which fpga-dma-top reads. The counters are
+ * updated with relaxed atomics and the file is removed at exit. Disabled, the
+ * cost is one branch per call. Queues are known by fd: the fds closed by
+ * fpga_dma_close_all_queues and fpga_dma_striped_close are forgotten, a queue
+ * fd closed with close() counts as its queue until the fd number is opened as
+ * a queue again.
+ */
+#define FPGA_DMA_STATS_DIR      "/dev/shm"
+#define FPGA_DMA_STATS_PREFIX   "fpga_dma_stats."
+#define FPGA_DMA_STATS_MAGIC    (0x53414d44) /* "DMAS" */
+#define FPGA_DMA_STATS_VERSION  (1)
+
+/*
+ * Bucket 0 counts calls of less than 1 us, bucket i calls of 2^(i-1) to 2^i
+ * us, the last bucket everything longer.
+ */
+#define FPGA_DMA_STATS_LATENCY_BUCKETS (24)
+
+struct fpga_dma_queue_stats {
+    uint64_t calls;
+    uint64_t bytes;
+    uint64_t errors;
+    /* continuations of short transfers */
+    uint64_t retries;
+    /* time spent in the calls */
+    uint64_t busy_ns;
+    uint64_t latency[FPGA_DMA_STATS_LATENCY_BUCKETS];
+};
+
+struct fpga_dma_stats {
+    /* FPGA_DMA_STATS_MAGIC once the rest is valid */
+    uint32_t magic;
+    uint32_t version;
+    int32_t pid;
+    char comm[16];
+    /* CLOCK_MONOTONIC time the stats were enabled */
+    uint64_t start_ns;
+    /* [slot][is_read][channel] of the queues from fpga_dma_open_queue */
+    struct fpga_dma_queue_stats queues[FPGA_SLOT_MAX][2][FPGA_DMA_CHANNELS_MAX];
+    /* transfers on any other fd */
+    struct fpga_dma_queue_stats other;
+};
+
+/**
+ * Start counting the transfers of the process. Queues opened before are
+ * counted too.
+ *
+ * @returns 0 on success, an error code less than 0 on failure
+ */
+int fpga_dma_stats_enable(void);
+
 #ifdef __cplusplus
 }
 #endif
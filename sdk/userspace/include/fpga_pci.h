@@ -15,6 +15,8 @@
 
 #pragma once
 
+#include <assert.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <pthread.h>
 
@@ -141,6 +143,24 @@ int fpga_pci_poke64(pci_bar_handle_t handle, uint64_t offset, uint64_t value);
 int fpga_pci_write_burst(pci_bar_handle_t handle, uint64_t offset,
     uint32_t* datap, uint64_t dword_len);
 
+/**
+ * Read a burst from a burst capable memory bar.
+ *
+ * On a BAR attached with BURST_CAPABLE the data is read with 128-bit loads
+ * where aligned, otherwise one DWORD at a time. Writes through
+ * fpga_pci_write_burst and fpga_pci_memset on such a BAR likewise use 64-byte
+ * (AVX-512) or 32-byte (AVX) non-temporal stores when the CPU has them.
+ *
+ * @param[in]  handle  handle provided by fpga_pci_attach
+ * @param[in]  offset  memory location offset to read
+ * @param[out] datap   pointer to the buffer for the data
+ * @param[in]  dword_len  the length of data to read in burst, in 4-byte DWORDs
+ *
+ * @returns 0 on success, non-zero on error
+ */
+int fpga_pci_read_burst(pci_bar_handle_t handle, uint64_t offset,
+    uint32_t *datap, uint64_t dword_len);
+
 /**
  * Read a value from a register.
  *
@@ -171,6 +191,207 @@ int fpga_pci_peek8(pci_bar_handle_t handle, uint64_t offset, uint8_t *value);
  */
 int fpga_pci_peek64(pci_bar_handle_t handle, uint64_t offset, uint64_t *value);
 
+/**
+ * Directory standing in for / when looking up /sys and /dev files of FPGAs,
+ * from the FPGA_PCI_EMU_ROOT environment variable, see fpga_pci_emu.h. It is
+ * "" unless an emulator is in use.
+ */
+const char *fpga_pci_emu_root(void);
+
+/**
+ * Direct view of an attached BAR for register accesses on hot paths, e.g.
+ * polling a FIFO status register. The fpga_pci_bar_view_peek/poke accessors
+ * below are inline and compile to a single load or store: they take no lock,
+ * look up no handle and check no bounds. Check the registers in use against
+ * the view once, with fpga_pci_bar_view_fits, when the view is obtained.
+ *
+ * The view is valid until the BAR is detached.
+ */
+typedef struct {
+    volatile uint8_t *base;
+    uint64_t size;
+} fpga_pci_bar_view_t;
+
+/**
+ * Get the view of an attached BAR. A BAR served by a device model (see
+ * fpga_pci_emu.h) is not mapped and has no view: use fpga_pci_peek/poke or
+ * fpga_pci_run_program on its handle instead.
+ *
+ * @param[in]  handle  handle provided by fpga_pci_attach
+ * @param[out] view    the view
+ * @returns 0 on success, -ENOTSUP for a BAR served by a device model,
+ * -EINVAL on other errors
+ */
+int fpga_pci_get_bar_view(pci_bar_handle_t handle, fpga_pci_bar_view_t *view);
+
+/**
+ * Check that len bytes at offset are within the view.
+ *
+ * @param[in]  view    view provided by fpga_pci_get_bar_view
+ * @param[in]  offset  offset of the first byte
+ * @param[in]  len     number of bytes
+ * @returns true if the range is within the view
+ */
+static inline bool fpga_pci_bar_view_fits(const fpga_pci_bar_view_t *view,
+    uint64_t offset, uint64_t len)
+{
+    return offset <= view->size && len <= view->size - offset;
+}
+
+/*
+ * Checks of the view accessors. In optimized GCC builds an accessor called
+ * with a constant offset which is not aligned to its width fails the build.
+ * Building with FPGA_PCI_BAR_VIEW_DEBUG also asserts every access is aligned
+ * and within the view.
+ */
+#if defined(__GNUC__) && !defined(__clang__) && defined(__OPTIMIZE__)
+void fpga_pci_bar_view_misaligned(void)
+    __attribute__((error("BAR offset is not aligned to the access width")));
+#define FPGA_PCI_BAR_VIEW_CHECK_CONST(offset, width) do {               \
+        if (__builtin_constant_p(offset) && (offset) % (width) != 0) {  \
+            fpga_pci_bar_view_misaligned();                             \
+        }                                                               \
+    } while (0)
+#else
+#define FPGA_PCI_BAR_VIEW_CHECK_CONST(offset, width) do { } while (0)
+#endif
+
+#if defined(FPGA_PCI_BAR_VIEW_DEBUG)
+#define FPGA_PCI_BAR_VIEW_CHECK(view, offset, width) do {               \
+        FPGA_PCI_BAR_VIEW_CHECK_CONST(offset, width);                   \
+        assert((offset) % (width) == 0 &&                               \
+            fpga_pci_bar_view_fits(view, offset, width));               \
+    } while (0)
+#else
+#define FPGA_PCI_BAR_VIEW_CHECK(view, offset, width)                    \
+    FPGA_PCI_BAR_VIEW_CHECK_CONST(offset, width)
+#endif
+
+/**
+ * Write a 32-bit register through a view.
+ *
+ * @param[in]  view    view provided by fpga_pci_get_bar_view
+ * @param[in]  offset  offset of the register, within the view
+ * @param[in]  value   value to write
+ */
+static inline void fpga_pci_bar_view_poke(const fpga_pci_bar_view_t *view,
+    uint64_t offset, uint32_t value)
+{
+    FPGA_PCI_BAR_VIEW_CHECK(view, offset, sizeof(uint32_t));
+    *(volatile uint32_t *)(view->base + offset) = value;
+}
+
+static inline void fpga_pci_bar_view_poke8(const fpga_pci_bar_view_t *view,
+    uint64_t offset, uint8_t value)
+{
+    FPGA_PCI_BAR_VIEW_CHECK(view, offset, sizeof(uint8_t));
+    *(volatile uint8_t *)(view->base + offset) = value;
+}
+
+static inline void fpga_pci_bar_view_poke64(const fpga_pci_bar_view_t *view,
+    uint64_t offset, uint64_t value)
+{
+    FPGA_PCI_BAR_VIEW_CHECK(view, offset, sizeof(uint64_t));
+    *(volatile uint64_t *)(view->base + offset) = value;
+}
+
+/**
+ * Read a 32-bit register through a view.
+ *
+ * @param[in]  view    view provided by fpga_pci_get_bar_view
+ * @param[in]  offset  offset of the register, within the view
+ * @returns the value of the register
+ */
+static inline uint32_t fpga_pci_bar_view_peek(const fpga_pci_bar_view_t *view,
+    uint64_t offset)
+{
+    FPGA_PCI_BAR_VIEW_CHECK(view, offset, sizeof(uint32_t));
+    return *(volatile uint32_t *)(view->base + offset);
+}
+
+static inline uint8_t fpga_pci_bar_view_peek8(const fpga_pci_bar_view_t *view,
+    uint64_t offset)
+{
+    FPGA_PCI_BAR_VIEW_CHECK(view, offset, sizeof(uint8_t));
+    return *(volatile uint8_t *)(view->base + offset);
+}
+
+static inline uint64_t fpga_pci_bar_view_peek64(
+    const fpga_pci_bar_view_t *view, uint64_t offset)
+{
+    FPGA_PCI_BAR_VIEW_CHECK(view, offset, sizeof(uint64_t));
+    return *(volatile uint64_t *)(view->base + offset);
+}
+
+/**
+ * Register programs: a control sequence of register accesses, built as an
+ * array of operations and run in one call with a single error path. All
+ * offsets are checked before the first access. A program only refers to its
+ * BAR by offset, so the same program can be run against a mock BAR (any
+ * memory described by a fpga_pci_bar_view_t) in tests.
+ */
+enum {
+    /** Write value to the register at offset. */
+    FPGA_PCI_REG_OP_POKE,
+    /** Read the register at offset into *data. */
+    FPGA_PCI_REG_OP_PEEK,
+    /** Write count DWORDs of data to the register (a FIFO port) at offset. */
+    FPGA_PCI_REG_OP_POKE_N,
+    /** Read the register (a FIFO port) at offset count times into data. */
+    FPGA_PCI_REG_OP_PEEK_N,
+    /**
+     * Read the register at offset until (register & mask) == value, for up
+     * to count microseconds. The last value read goes to *data if not NULL.
+     */
+    FPGA_PCI_REG_OP_POLL,
+    /** Wait count microseconds. */
+    FPGA_PCI_REG_OP_DELAY,
+};
+
+struct fpga_pci_reg_op {
+    uint32_t op;
+    uint32_t mask;
+    uint64_t offset;
+    uint32_t value;
+    uint32_t count;
+    uint32_t *data;
+};
+
+/** Initializers of the operations of a register program. */
+#define FPGA_PCI_REG_POKE(offset, value) \
+    { FPGA_PCI_REG_OP_POKE, 0, (offset), (value), 0, NULL }
+#define FPGA_PCI_REG_PEEK(offset, data) \
+    { FPGA_PCI_REG_OP_PEEK, 0, (offset), 0, 0, (data) }
+#define FPGA_PCI_REG_POKE_N(offset, data, count) \
+    { FPGA_PCI_REG_OP_POKE_N, 0, (offset), 0, (count), (uint32_t *)(data) }
+#define FPGA_PCI_REG_PEEK_N(offset, data, count) \
+    { FPGA_PCI_REG_OP_PEEK_N, 0, (offset), 0, (count), (data) }
+#define FPGA_PCI_REG_POLL(offset, mask, value, timeout_us, data) \
+    { FPGA_PCI_REG_OP_POLL, (mask), (offset), (value), (timeout_us), (data) }
+#define FPGA_PCI_REG_DELAY(us) \
+    { FPGA_PCI_REG_OP_DELAY, 0, 0, 0, (us), NULL }
+
+/**
+ * Run a register program on an attached BAR.
+ *
+ * @param[in]  handle     handle provided by fpga_pci_attach
+ * @param[in]  ops        the operations, run in order
+ * @param[in]  n_ops      number of operations
+ * @param[out] failed_op  index of the operation which failed, n_ops on
+ *                        success; may be NULL
+ * @returns 0 on success, -ETIMEDOUT if a poll timed out, -EINVAL for an
+ * invalid program (nothing is accessed then), or the error of a failed
+ * access of a BAR served by a device model
+ */
+int fpga_pci_run_program(pci_bar_handle_t handle,
+    const struct fpga_pci_reg_op *ops, size_t n_ops, size_t *failed_op);
+
+/**
+ * Run a register program through a view, see fpga_pci_run_program.
+ */
+int fpga_pci_bar_view_run_program(const fpga_pci_bar_view_t *view,
+    const struct fpga_pci_reg_op *ops, size_t n_ops, size_t *failed_op);
+
 /**
  * Use a logical slot id to populate a slot spec
  *
@@ -186,11 +407,25 @@ int fpga_pci_get_slot_spec(int slot_id, struct fpga_slot_spec *spec);
  * Populate slot specs for all FPGAs on the system. It is recommended to use
  * FPGA_SLOT_MAX as the size of the spec_array;
  *
+ * The PCI devices are scanned once and the slot specs kept until
+ * fpga_pci_rescan_slot_app_pfs or fpga_pci_invalidate_slot_specs runs, so
+ * fpga_pci_get_slot_spec, fpga_pci_get_resource_map and the attach calls
+ * which follow only copy them.
+ *
  * @param[out]  spec_array  array to populate
  * @param[in]   size        allocated size of the provided array
  */
 int fpga_pci_get_all_slot_specs(struct fpga_slot_spec spec_array[], int size);
 
+/**
+ * Drop the slot specs kept by fpga_pci_get_all_slot_specs and bump the
+ * generation of every slot, see fpga_pci_slot_generation. Call it when the
+ * PCI devices of the slots changed outside of this process, e.g. from a udev
+ * hook or after another process loaded an AFI, which changes the PCI ids of
+ * the application PF.
+ */
+void fpga_pci_invalidate_slot_specs(void);
+
 /**
  * Get resource map information for a single slot and physical function. This
  * information is provided in the slot_spec, but occasionally only the resource
@@ -204,6 +439,16 @@ int fpga_pci_get_all_slot_specs(struct fpga_slot_spec spec_array[], int size);
 int fpga_pci_get_resource_map(int slot_id, int pf_id,
     struct fpga_pci_resource_map *map);
 
+/**
+ * Get the NUMA node of a slot's application PF, i.e. the node local to its
+ * PCIe root, as reported by sysfs.
+ *
+ * @param[in]   slot_id    The logical slot id of the FPGA of interest
+ * @param[out]  numa_node  the node, -1 if the platform does not report one
+ * @returns 0 on success, non-zero on error
+ */
+int fpga_pci_get_numa_node(int slot_id, int *numa_node);
+
 /**
  * Rescan the slot application physical functions.
  * -performs both a pci device remove and a PCI rescan to refresh the device
@@ -215,8 +460,21 @@ int fpga_pci_get_resource_map(int slot_id, int pf_id,
  */
 int fpga_pci_rescan_slot_app_pfs(int slot_id);
 
+/**
+ * Generation of the PCI topology of a slot. It changes each time
+ * fpga_pci_rescan_slot_app_pfs runs on the slot or
+ * fpga_pci_invalidate_slot_specs runs, so anything cached about the
+ * slot (e.g. its DMA device number) is stale once the generation differs.
+ *
+ * @param[in]   slot_id  The logical slot id of the FPGA of interest
+ *
+ * @returns the current generation
+ */
+uint32_t fpga_pci_slot_generation(int slot_id);
+
 /**
  * Get a bounds checked pointer to memory in the mapped region for this handle.
+ * A BAR served by a device model (see fpga_pci_emu.h) has no mapped region.
  *
  * @param[in]   handle    handle provided by fpga_pci_attach
  * @param[in]   offset    offset into the mmap'ed region
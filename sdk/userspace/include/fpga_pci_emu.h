@@ -0,0 +1,59 @@
+/*
+ * Copyright 2015-2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may
+ * not use this file except in compliance with the License. A copy of the
+ * License is located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/**
+ * Protocol between the fpga_pci library and a device model serving an
+ * emulated register BAR, e.g. fpga-emu.
+ *
+ * When FPGA_PCI_EMU_ROOT names a directory, the fpga_pci and fpga_dma
+ * libraries look for /sys and /dev below it instead of at /. A resource file
+ * there which is a regular file is mapped like a memory BAR. A resource file
+ * which is a Unix socket (SOCK_SEQPACKET) is a register BAR served by a
+ * device model: each register access of the BAR is one fpga_pci_emu_req
+ * message, answered by one fpga_pci_emu_rsp message. The size of such a BAR
+ * is read from the resource file of the device, as with sysfs.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/** Environment variable naming the emulator root directory */
+#define FPGA_PCI_EMU_ROOT_ENV	"FPGA_PCI_EMU_ROOT"
+
+/** Request operations */
+enum {
+	FPGA_PCI_EMU_READ = 0,
+	FPGA_PCI_EMU_WRITE = 1,
+};
+
+struct fpga_pci_emu_req {
+	/** FPGA_PCI_EMU_READ or FPGA_PCI_EMU_WRITE */
+	uint32_t op;
+	/** Access width in bytes: 1, 4 or 8 */
+	uint32_t width;
+	/** Offset within the BAR, aligned to width */
+	uint64_t offset;
+	/** Value to write */
+	uint64_t value;
+} __attribute__((packed));
+
+struct fpga_pci_emu_rsp {
+	/** 0 on success, a negative errno otherwise */
+	int32_t status;
+	uint32_t reserved;
+	/** Value read */
+	uint64_t value;
+} __attribute__((packed));
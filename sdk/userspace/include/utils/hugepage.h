@@ -0,0 +1,85 @@
+/*
+ * Copyright 2015-2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may
+ * not use this file except in compliance with the License. A copy of the
+ * License is located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/** @file
+ * Huge page backed buffers, placed on a given NUMA node.
+ *
+ * A DMA transfer needs one descriptor per physically contiguous range of its
+ * buffer, so a buffer of 1 GiB or 2 MiB pages maps to far fewer descriptors
+ * than one of scattered 4 KiB pages. Placing the buffer on the node of the
+ * device keeps the transfers off the socket interconnect.
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HUGEPAGE_SIZE_2M	(2UL << 20)
+#define HUGEPAGE_SIZE_1G	(1UL << 30)
+
+/** A buffer from hugepage_alloc. */
+struct hugepage_buf {
+	/** Start of the buffer, aligned to page_size. */
+	void *data;
+
+	/** Requested size. */
+	size_t size;
+
+	/** Size of the mapping, size rounded up to page_size. */
+	size_t map_size;
+
+	/**
+	 * Page size backing the buffer: HUGEPAGE_SIZE_1G, HUGEPAGE_SIZE_2M or
+	 * the base page size. Base pages may still be merged into transparent
+	 * huge pages.
+	 */
+	size_t page_size;
+
+	/** NUMA node the buffer is placed on, -1 if any node. */
+	int numa_node;
+};
+
+/**
+ * Allocate a zeroed buffer backed by the largest huge pages available: 1 GiB
+ * pages for buffers of at least 1 GiB, then 2 MiB pages, then base pages with
+ * transparent huge pages requested. The pages are faulted in before the
+ * function returns.
+ *
+ * @param[in]	size		Size of the buffer in bytes.
+ * @param[in]	numa_node	Preferred NUMA node of the pages, -1 for any.
+ *				Pages come from other nodes if the node has
+ *				none left.
+ * @param[out]	buf		The buffer.
+ *
+ * @returns
+ *  0 on success,
+ * -1 on failure.
+ */
+int hugepage_alloc(size_t size, int numa_node, struct hugepage_buf *buf);
+
+/**
+ * Free a buffer from hugepage_alloc.
+ *
+ * @param[in]	buf	The buffer, zeroed on return.
+ */
+void hugepage_free(struct hugepage_buf *buf);
+
+#ifdef __cplusplus
+}
+#endif
@@ -66,6 +66,9 @@ fi
 # /usr/bin requires sudo permissions 
 echo "AWS FPGA: Copying Amazon FPGA Image (AFI) Management Tools to $AFI_MGMT_TOOLS_DST_DIR"
 cp -f $AFI_MGMT_TOOLS_SRC_DIR/fpga-* $AFI_MGMT_TOOLS_DST_DIR
+cp -f $SDK_MGMT_DIR/fpga_dma_tools/src/fpga-dma-* $AFI_MGMT_TOOLS_DST_DIR
+cp -f $SDK_MGMT_DIR/fpga_dma_tools/src/fpga-bar-bench $AFI_MGMT_TOOLS_DST_DIR
+cp -f $SDK_MGMT_DIR/fpga_emu/src/fpga-emu $AFI_MGMT_TOOLS_DST_DIR
 cp -f $AFI_MGMT_TOOLS_LIB_DIR/libfpga_mgmt.so.1.0.0 $AFI_MGMT_LIBS_DST_DIR
 ln -sf libfpga_mgmt.so.1 $AFI_MGMT_LIBS_DST_DIR/libfpga_mgmt.so
 
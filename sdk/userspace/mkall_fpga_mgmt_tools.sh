@@ -87,3 +87,9 @@ build_exec
 
 BUILD_DIR="fpga_mgmt_tools/src"
 build_exec
+
+BUILD_DIR="fpga_dma_tools/src"
+build_exec
+
+BUILD_DIR="fpga_emu/src"
+build_exec
@@ -0,0 +1,146 @@
+/*
+ * Copyright 2015-2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may
+ * not use this file except in compliance with the License. A copy of the
+ * License is located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/** @file
+ * Huge page backed buffers, placed on a given NUMA node.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+#include <utils/hugepage.h>
+#include <utils/log.h>
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT	26
+#endif
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB	(21 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB	(30 << MAP_HUGE_SHIFT)
+#endif
+
+/** Highest NUMA node hugepage_alloc can place a buffer on, plus one. */
+#define HUGEPAGE_NUMA_NODES_MAX	1024
+
+#define HUGEPAGE_LONG_BITS	(sizeof(unsigned long) * CHAR_BIT)
+
+/**
+ * Prefer numa_node for the pages of a mapping which are not faulted in yet.
+ * The raw system call is used so the library does not depend on libnuma.
+ */
+static int
+hugepage_bind(void *data, size_t map_size, int numa_node)
+{
+	unsigned long mask[HUGEPAGE_NUMA_NODES_MAX / HUGEPAGE_LONG_BITS];
+
+	if (numa_node < 0 || numa_node >= HUGEPAGE_NUMA_NODES_MAX) {
+		return -1;
+	}
+
+	memset(mask, 0, sizeof(mask));
+	mask[numa_node / HUGEPAGE_LONG_BITS] =
+		1UL << (numa_node % HUGEPAGE_LONG_BITS);
+	/* the kernel reads one bit less than maxnode */
+	return syscall(SYS_mbind, data, map_size, MPOL_PREFERRED, mask,
+		HUGEPAGE_NUMA_NODES_MAX + 1, 0);
+}
+
+/**
+ * Map, place and fault in a buffer of page_size pages.
+ *
+ * @returns
+ *  0 on success,
+ * -1 if the pages are not available.
+ */
+static int
+hugepage_map(struct hugepage_buf *buf, size_t page_size, int flags)
+{
+	size_t map_size = (buf->size + page_size - 1) & ~(page_size - 1);
+	void *data = mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+
+	if (data == MAP_FAILED) {
+		return -1;
+	}
+
+	if (!(flags & MAP_HUGETLB)) {
+		/** Transparent huge pages, if enabled. */
+		madvise(data, map_size, MADV_HUGEPAGE);
+	}
+
+	/**
+	 * The policy only applies to pages faulted in after it is set, so the
+	 * mapping is populated here rather than with MAP_POPULATE.
+	 */
+	if (buf->numa_node >= 0 &&
+		hugepage_bind(data, map_size, buf->numa_node) != 0) {
+		log_warning("Unable to place a buffer on NUMA node %d",
+			buf->numa_node);
+		buf->numa_node = -1;
+	}
+	for (size_t offset = 0; offset < map_size; offset += page_size) {
+		((volatile char *)data)[offset] = 0;
+	}
+
+	buf->data = data;
+	buf->map_size = map_size;
+	buf->page_size = page_size;
+	return 0;
+}
+
+int
+hugepage_alloc(size_t size, int numa_node, struct hugepage_buf *buf)
+{
+	int ret;
+
+	fail_on(ret = (!buf || size == 0) ? -1 : 0, out,
+		"Invalid huge page buffer");
+
+	memset(buf, 0, sizeof(*buf));
+	buf->size = size;
+	buf->numa_node = numa_node;
+
+	if (size >= HUGEPAGE_SIZE_1G &&
+		hugepage_map(buf, HUGEPAGE_SIZE_1G, MAP_HUGETLB | MAP_HUGE_1GB) == 0) {
+		goto out;
+	}
+	if (hugepage_map(buf, HUGEPAGE_SIZE_2M, MAP_HUGETLB | MAP_HUGE_2MB) == 0) {
+		goto out;
+	}
+	ret = hugepage_map(buf, getpagesize(), 0);
+	fail_on(ret, out, "Unable to map a %zu byte buffer", size);
+
+out:
+	/** Failed huge page mappings are expected, do not report their errno. */
+	errno = 0;
+	return ret;
+}
+
+void
+hugepage_free(struct hugepage_buf *buf)
+{
+	if (!buf || !buf->data) {
+		return;
+	}
+	munmap(buf->data, buf->map_size);
+	memset(buf, 0, sizeof(*buf));
+}